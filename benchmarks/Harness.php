@@ -0,0 +1,89 @@
+<?php
+
+declare(strict_types=1);
+
+namespace EventDbx\Benchmarks;
+
+/**
+ * Times one operation at a time: a warm-up, then `iterations` calls each
+ * sampled with hrtime(), so percentiles come from individual calls rather
+ * than batch averages. The transient PHP memory peak of every call is
+ * tracked as well (PHP 8.2+, which can reset the peak between calls).
+ */
+final class Harness
+{
+    public function __construct(
+        private readonly int $iterations = 2000,
+        private readonly int $warmup = 100,
+    ) {
+    }
+
+    /**
+     * @return array{name:string,iterations:int,opsPerSec:float,p50Us:float,p99Us:float,peakBytes:?int}
+     */
+    public function measure(string $name, callable $operation): array
+    {
+        for ($i = 0; $i < $this->warmup; $i++) {
+            $operation();
+        }
+        gc_collect_cycles();
+
+        $trackPeak = function_exists('memory_reset_peak_usage');
+        $samples = [];
+        $peak = 0;
+        for ($i = 0; $i < $this->iterations; $i++) {
+            if ($trackPeak) {
+                memory_reset_peak_usage();
+            }
+            $base = memory_get_usage();
+            $started = hrtime(true);
+            $operation();
+            $samples[] = hrtime(true) - $started;
+            $peak = max($peak, memory_get_peak_usage() - $base);
+        }
+
+        sort($samples);
+        $total = array_sum($samples);
+        return [
+            'name' => $name,
+            'iterations' => $this->iterations,
+            'opsPerSec' => $total > 0 ? $this->iterations / ($total / 1e9) : 0.0,
+            'p50Us' => self::percentile($samples, 50) / 1e3,
+            'p99Us' => self::percentile($samples, 99) / 1e3,
+            'peakBytes' => $trackPeak ? $peak : null,
+        ];
+    }
+
+    /**
+     * Nearest-rank percentile of sorted nanosecond samples.
+     *
+     * @param list<int> $sorted
+     */
+    public static function percentile(array $sorted, float $percent): float
+    {
+        if ($sorted === []) {
+            return 0.0;
+        }
+        $rank = (int) ceil($percent / 100 * count($sorted));
+        return (float) $sorted[max(0, min(count($sorted) - 1, $rank - 1))];
+    }
+
+    /**
+     * @param list<array{name:string,iterations:int,opsPerSec:float,p50Us:float,p99Us:float,peakBytes:?int}> $results
+     */
+    public static function table(array $results): string
+    {
+        $lines = [sprintf('%-24s %12s %10s %10s %12s', 'case', 'ops/sec', 'p50 us', 'p99 us', 'peak B/op')];
+        foreach ($results as $result) {
+            $lines[] = sprintf(
+                '%-24s %12.0f %10.1f %10.1f %12s',
+                $result['name'],
+                $result['opsPerSec'],
+                $result['p50Us'],
+                $result['p99Us'],
+                $result['peakBytes'] ?? 'n/a',
+            );
+        }
+        return implode("\n", $lines) . "\n";
+    }
+}
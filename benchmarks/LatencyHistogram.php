@@ -0,0 +1,90 @@
+<?php
+
+declare(strict_types=1);
+
+namespace EventDbx\Benchmarks;
+
+/**
+ * Log-bucketed latency counts: each bucket spans about 2%, so a worker can
+ * ship millions of samples per interval as a few hundred integers and the
+ * coordinator can merge workers and intervals by adding counts.
+ */
+final class LatencyHistogram
+{
+    /** Buckets per factor of e; 50 gives ~2% wide buckets. */
+    private const SCALE = 50;
+
+    /** @var array<int,int> bucket => samples */
+    private array $counts = [];
+    private int $total = 0;
+    private int $maxNs = 0;
+
+    public function record(int $ns): void
+    {
+        $bucket = (int) round(log(max($ns, 1)) * self::SCALE);
+        $this->counts[$bucket] = ($this->counts[$bucket] ?? 0) + 1;
+        $this->total++;
+        $this->maxNs = max($this->maxNs, $ns);
+    }
+
+    public function count(): int
+    {
+        return $this->total;
+    }
+
+    public function merge(self $other): void
+    {
+        foreach ($other->counts as $bucket => $count) {
+            $this->counts[$bucket] = ($this->counts[$bucket] ?? 0) + $count;
+        }
+        $this->total += $other->total;
+        $this->maxNs = max($this->maxNs, $other->maxNs);
+    }
+
+    /**
+     * Nearest-rank percentile in microseconds, at bucket precision.
+     */
+    public function percentileUs(float $percent): float
+    {
+        if ($this->total === 0) {
+            return 0.0;
+        }
+        ksort($this->counts);
+        $rank = max(1, (int) ceil($percent / 100 * $this->total));
+        $seen = 0;
+        foreach ($this->counts as $bucket => $count) {
+            $seen += $count;
+            if ($seen >= $rank) {
+                return min(exp($bucket / self::SCALE), $this->maxNs) / 1e3;
+            }
+        }
+        return $this->maxNs / 1e3;
+    }
+
+    public function maxUs(): float
+    {
+        return $this->maxNs / 1e3;
+    }
+
+    /**
+     * @return array{counts:array<int,int>,maxNs:int}
+     */
+    public function toArray(): array
+    {
+        return ['counts' => $this->counts, 'maxNs' => $this->maxNs];
+    }
+
+    /**
+     * @param array{counts:array<int|string,int>,maxNs:int} $data
+     */
+    public static function fromArray(array $data): self
+    {
+        $histogram = new self();
+        foreach ($data['counts'] as $bucket => $count) {
+            $histogram->counts[(int) $bucket] = $count;
+            $histogram->total += $count;
+        }
+        $histogram->maxNs = $data['maxNs'];
+        return $histogram;
+    }
+}
@@ -0,0 +1,112 @@
+<?php
+
+declare(strict_types=1);
+
+namespace EventDbx\Benchmarks;
+
+use EventDbx\Client;
+use EventDbx\Exception\EventDbxException;
+
+/**
+ * A weighted traffic mix such as `get:40,apply:20,create:5`, and the SDK
+ * call each operation makes. Against a server every worker seeds its own
+ * aggregates under `$type` first, so reads and writes hit existing streams
+ * and concurrent workers never write the same aggregate.
+ */
+final class LoadMix
+{
+    public const DEFAULT = 'get:40,events:20,list:10,apply:20,create:4,patch:5,createSnapshot:1';
+
+    private const OPERATIONS = ['create', 'apply', 'patch', 'get', 'events', 'list', 'createSnapshot'];
+
+    /** @var list<string> aggregate ids this worker seeded */
+    private array $ids = [];
+    private int $sequence = 0;
+
+    /**
+     * @param array<string,int> $weights operation => relative weight
+     */
+    private function __construct(
+        public readonly array $weights,
+        private readonly string $type,
+        private readonly string $prefix,
+        private readonly string $blob,
+    ) {
+    }
+
+    /**
+     * @param string $prefix unique per worker and run; prefixes aggregate ids
+     */
+    public static function parse(string $spec, string $type, string $prefix, int $payloadBytes = 256): self
+    {
+        $weights = [];
+        foreach (explode(',', $spec) as $entry) {
+            $entry = trim($entry);
+            if ($entry === '') {
+                continue;
+            }
+            [$name, $weight] = array_pad(explode(':', $entry, 2), 2, '1');
+            if (!in_array($name, self::OPERATIONS, true)) {
+                throw new EventDbxException("Unknown operation {$name} in mix; expected one of " . implode(', ', self::OPERATIONS));
+            }
+            if (!ctype_digit($weight)) {
+                throw new EventDbxException("Weight of {$name} must be a non-negative integer");
+            }
+            if ((int) $weight > 0) {
+                $weights[$name] = (int) $weight;
+            }
+        }
+        if ($weights === []) {
+            throw new EventDbxException('The mix needs at least one operation with a positive weight');
+        }
+        return new self($weights, $type, $prefix, str_repeat('x', max(0, $payloadBytes)));
+    }
+
+    /**
+     * Creates the aggregates the other operations target.
+     */
+    public function seed(Client $client, int $count): void
+    {
+        for ($i = 0; $i < max(1, $count); $i++) {
+            $id = "{$this->prefix}-seed-{$i}";
+            $client->create($this->type, $id, 'load_created', ['payload' => ['blob' => $this->blob]]);
+            $this->ids[] = $id;
+        }
+    }
+
+    /**
+     * A weighted random operation name.
+     */
+    public function draw(): string
+    {
+        $pick = random_int(1, array_sum($this->weights));
+        foreach ($this->weights as $name => $weight) {
+            $pick -= $weight;
+            if ($pick <= 0) {
+                return $name;
+            }
+        }
+        return array_key_last($this->weights);
+    }
+
+    public function run(Client $client, string $operation): void
+    {
+        $id = $this->ids === [] ? "{$this->prefix}-seed-0" : $this->ids[array_rand($this->ids)];
+        $seq = ++$this->sequence;
+        match ($operation) {
+            'create' => $client->create($this->type, "{$this->prefix}-{$seq}", 'load_created', [
+                'payload' => ['blob' => $this->blob],
+            ]),
+            'apply' => $client->apply($this->type, $id, 'load_updated', [
+                'payload' => ['seq' => $seq, 'blob' => $this->blob],
+            ]),
+            'patch' => $client->patch($this->type, $id, 'load_created', [
+                ['op' => 'add', 'path' => '/seq', 'value' => $seq],
+            ]),
+            'get' => $client->get($this->type, $id),
+            'events' => $client->events($this->type, $id, ['take' => 20]),
+            'list' => $client->list($this->type, ['take' => 20]),
+            'createSnapshot' => $client->createSnapshot($this->type, $id),
+        };
+    }
+}
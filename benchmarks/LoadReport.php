@@ -0,0 +1,208 @@
+<?php
+
+declare(strict_types=1);
+
+namespace EventDbx\Benchmarks;
+
+/**
+ * Merges the interval reports of every worker into a timeline and a run
+ * summary, and compares a summary against a saved baseline.
+ */
+final class LoadReport
+{
+    /** @var array<int,array{ops:array<string,array{latency:LatencyHistogram,errors:int}>,workers:int,rssKb:?int,threads:?int}> */
+    private array $intervals = [];
+
+    /** @var array<string,array{latency:LatencyHistogram,errors:int,lastError:?string}> */
+    private array $totals = [];
+
+    private int $peakRssKb = 0;
+    private int $peakThreads = 0;
+
+    public function __construct(private readonly float $intervalSeconds)
+    {
+    }
+
+    /**
+     * Adds one worker's report; returns the number of workers that have
+     * reported that interval so far.
+     *
+     * @param array{interval:int,ops:array<string,array{latency:array{counts:array<int|string,int>,maxNs:int},errors:int,lastError:?string}>,rssKb:?int,threads:?int} $report
+     */
+    public function add(array $report): int
+    {
+        $index = $report['interval'];
+        $this->intervals[$index] ??= ['ops' => [], 'workers' => 0, 'rssKb' => null, 'threads' => null];
+        $interval = &$this->intervals[$index];
+        foreach ($report['ops'] as $name => $op) {
+            $latency = LatencyHistogram::fromArray($op['latency']);
+            $interval['ops'][$name] ??= ['latency' => new LatencyHistogram(), 'errors' => 0];
+            $interval['ops'][$name]['latency']->merge($latency);
+            $interval['ops'][$name]['errors'] += $op['errors'];
+
+            $this->totals[$name] ??= ['latency' => new LatencyHistogram(), 'errors' => 0, 'lastError' => null];
+            $this->totals[$name]['latency']->merge($latency);
+            $this->totals[$name]['errors'] += $op['errors'];
+            $this->totals[$name]['lastError'] = $op['lastError'] ?? $this->totals[$name]['lastError'];
+        }
+        if ($report['rssKb'] !== null) {
+            $interval['rssKb'] = ($interval['rssKb'] ?? 0) + $report['rssKb'];
+            $this->peakRssKb = max($this->peakRssKb, $interval['rssKb']);
+        }
+        if ($report['threads'] !== null) {
+            $interval['threads'] = ($interval['threads'] ?? 0) + $report['threads'];
+            $this->peakThreads = max($this->peakThreads, $interval['threads']);
+        }
+        return ++$interval['workers'];
+    }
+
+    public static function timelineHeader(): string
+    {
+        return sprintf('%8s %10s %10s %10s %8s %10s %8s', 't s', 'ops/sec', 'p50 us', 'p99 us', 'err %', 'rss MB', 'threads');
+    }
+
+    /**
+     * One line for an interval across all workers (RSS and threads summed).
+     */
+    public function timelineLine(int $index): string
+    {
+        $interval = $this->intervals[$index];
+        $latency = new LatencyHistogram();
+        $errors = 0;
+        foreach ($interval['ops'] as $op) {
+            $latency->merge($op['latency']);
+            $errors += $op['errors'];
+        }
+        $count = $latency->count();
+        return sprintf(
+            '%8.1f %10.0f %10.1f %10.1f %8.2f %10s %8s',
+            ($index + 1) * $this->intervalSeconds,
+            $count / $this->intervalSeconds,
+            $latency->percentileUs(50),
+            $latency->percentileUs(99),
+            $count > 0 ? 100 * $errors / $count : 0.0,
+            $interval['rssKb'] === null ? 'n/a' : sprintf('%.1f', $interval['rssKb'] / 1024),
+            $interval['threads'] ?? 'n/a',
+        );
+    }
+
+    /**
+     * @param array<string,mixed> $run the options the run was started with
+     * @return array<string,mixed>
+     */
+    public function summary(array $run, float $seconds): array
+    {
+        $all = ['latency' => new LatencyHistogram(), 'errors' => 0, 'lastError' => null];
+        $ops = [];
+        ksort($this->totals);
+        foreach ($this->totals as $name => $op) {
+            $all['latency']->merge($op['latency']);
+            $all['errors'] += $op['errors'];
+            $ops[$name] = self::stats($op, $seconds);
+        }
+        return [
+            'run' => $run,
+            'seconds' => $seconds,
+            'total' => self::stats($all, $seconds),
+            'ops' => $ops,
+            'peakRssKb' => $this->peakRssKb > 0 ? $this->peakRssKb : null,
+            'peakThreads' => $this->peakThreads > 0 ? $this->peakThreads : null,
+        ];
+    }
+
+    /**
+     * @param array{latency:LatencyHistogram,errors:int,lastError:?string} $op
+     * @return array<string,mixed>
+     */
+    private static function stats(array $op, float $seconds): array
+    {
+        $latency = $op['latency'];
+        $count = $latency->count();
+        return [
+            'count' => $count,
+            'opsPerSec' => $seconds > 0 ? $count / $seconds : 0.0,
+            'errorRate' => $count > 0 ? $op['errors'] / $count : 0.0,
+            'p50Us' => $latency->percentileUs(50),
+            'p90Us' => $latency->percentileUs(90),
+            'p99Us' => $latency->percentileUs(99),
+            'p999Us' => $latency->percentileUs(99.9),
+            'maxUs' => $latency->maxUs(),
+            'lastError' => $op['lastError'],
+        ];
+    }
+
+    /**
+     * @param array<string,mixed> $summary
+     */
+    public static function table(array $summary): string
+    {
+        $lines = [sprintf('%-16s %10s %10s %8s %10s %10s %10s %10s', 'operation', 'count', 'ops/sec', 'err %', 'p50 us', 'p99 us', 'p99.9 us', 'max us')];
+        foreach ($summary['ops'] + ['total' => $summary['total']] as $name => $stats) {
+            $lines[] = sprintf(
+                '%-16s %10d %10.0f %8.2f %10.1f %10.1f %10.1f %10.1f',
+                $name,
+                $stats['count'],
+                $stats['opsPerSec'],
+                100 * $stats['errorRate'],
+                $stats['p50Us'],
+                $stats['p99Us'],
+                $stats['p999Us'],
+                $stats['maxUs'],
+            );
+        }
+        foreach ($summary['ops'] as $name => $stats) {
+            if ($stats['lastError'] !== null) {
+                $lines[] = "last {$name} error: {$stats['lastError']}";
+            }
+        }
+        $lines[] = sprintf(
+            'peak rss: %s MB, peak threads: %s',
+            $summary['peakRssKb'] === null ? 'n/a' : sprintf('%.1f', $summary['peakRssKb'] / 1024),
+            $summary['peakThreads'] ?? 'n/a',
+        );
+        return implode("\n", $lines) . "\n";
+    }
+
+    /**
+     * Compares throughput, p99 latency and error rate per operation with
+     * a baseline summary. A regression is throughput or p99 worse by more
+     * than `$tolerance` (a fraction), or an error rate up by more than one
+     * percentage point.
+     *
+     * @param array<string,mixed> $summary
+     * @param array<string,mixed> $baseline
+     * @return array{lines:list<string>,regressions:list<string>}
+     */
+    public static function compare(array $summary, array $baseline, float $tolerance): array
+    {
+        $lines = [sprintf('%-16s %12s %12s %12s', 'vs baseline', 'ops/sec', 'p99', 'err pts')];
+        $regressions = [];
+        $current = $summary['ops'] + ['total' => $summary['total']];
+        $previous = $baseline['ops'] + ['total' => $baseline['total']];
+        foreach ($current as $name => $stats) {
+            if (!isset($previous[$name])) {
+                continue;
+            }
+            $before = $previous[$name];
+            $throughput = self::change($stats['opsPerSec'], $before['opsPerSec']);
+            $p99 = self::change($stats['p99Us'], $before['p99Us']);
+            $errors = 100 * ($stats['errorRate'] - $before['errorRate']);
+            $lines[] = sprintf('%-16s %+11.1f%% %+11.1f%% %+12.2f', $name, 100 * $throughput, 100 * $p99, $errors);
+            if ($throughput < -$tolerance) {
+                $regressions[] = sprintf('%s throughput %.1f%%', $name, 100 * $throughput);
+            }
+            if ($p99 > $tolerance) {
+                $regressions[] = sprintf('%s p99 +%.1f%%', $name, 100 * $p99);
+            }
+            if ($errors > 1.0) {
+                $regressions[] = sprintf('%s error rate +%.2f points', $name, $errors);
+            }
+        }
+        return ['lines' => $lines, 'regressions' => $regressions];
+    }
+
+    private static function change(float $now, float $before): float
+    {
+        return $before > 0 ? ($now - $before) / $before : 0.0;
+    }
+}
@@ -0,0 +1,140 @@
+<?php
+
+declare(strict_types=1);
+
+namespace EventDbx\Benchmarks;
+
+use EventDbx\Client;
+use Throwable;
+
+/**
+ * One load-generating process. It opens its own client, seeds its
+ * aggregates and prints `{"ready":true}`, then waits for `go <epoch>` on
+ * stdin so every worker starts its schedule at the same moment. From then
+ * on it prints one JSON line per interval with a latency histogram and
+ * error count per operation, its RSS and its thread count (which includes
+ * the native runtime's workers), and finally `{"done":true}`.
+ *
+ * With a rate, calls are scheduled at fixed intervals and latency is
+ * measured from the scheduled start, so time spent behind schedule counts
+ * against the SDK instead of vanishing (no coordinated omission). Without
+ * one, the worker calls back to back.
+ */
+final class LoadWorker
+{
+    /**
+     * @param array{target:string,mix:string,type:string,prefix:string,payloadBytes:int,seed:int,rate:float,duration:float,interval:float,config:array<string,mixed>} $spec
+     */
+    public function __construct(private readonly array $spec)
+    {
+    }
+
+    public function run(): int
+    {
+        $target = Target::named($this->spec['target']);
+        $client = $target->client($this->spec['config']);
+        $mix = LoadMix::parse($this->spec['mix'], $this->spec['type'], $this->spec['prefix'], $this->spec['payloadBytes']);
+        if (!$target->isStub()) {
+            $mix->seed($client, $this->spec['seed']);
+        }
+        self::emit(['ready' => true]);
+
+        $line = fgets(STDIN);
+        if ($line === false || !str_starts_with($line, 'go ')) {
+            return 1;
+        }
+        $epoch = (float) substr($line, 3);
+        while (microtime(true) < $epoch) {
+            usleep(1000);
+        }
+
+        $this->loop($client, $mix, $epoch);
+        self::emit(['done' => true]);
+        return 0;
+    }
+
+    private function loop(Client $client, LoadMix $mix, float $epoch): void
+    {
+        $gap = $this->spec['rate'] > 0 ? (int) (1e9 / $this->spec['rate']) : 0;
+        $intervalNs = (int) ($this->spec['interval'] * 1e9);
+        $start = hrtime(true) - (int) ((microtime(true) - $epoch) * 1e9);
+        $end = $start + (int) ($this->spec['duration'] * 1e9);
+
+        $interval = 0;
+        $ops = [];
+        $next = $start;
+        while (true) {
+            $now = hrtime(true);
+            if ($now >= $start + ($interval + 1) * $intervalNs || $now >= $end) {
+                $this->report($interval, $ops);
+                $interval++;
+                $ops = [];
+                if ($now >= $end) {
+                    return;
+                }
+            }
+            if ($gap > 0 && $now < $next) {
+                usleep((int) min(($next - $now) / 1e3, 10000));
+                continue;
+            }
+
+            $operation = $mix->draw();
+            $scheduled = $gap > 0 ? $next : $now;
+            $ops[$operation] ??= ['latency' => new LatencyHistogram(), 'errors' => 0, 'lastError' => null];
+            try {
+                $mix->run($client, $operation);
+            } catch (Throwable $e) {
+                $ops[$operation]['errors']++;
+                $ops[$operation]['lastError'] = $e->getMessage();
+            }
+            $ops[$operation]['latency']->record(hrtime(true) - $scheduled);
+            $next += $gap;
+        }
+    }
+
+    /**
+     * @param array<string,array{latency:LatencyHistogram,errors:int,lastError:?string}> $ops
+     */
+    private function report(int $interval, array $ops): void
+    {
+        $status = self::processStatus();
+        self::emit([
+            'interval' => $interval,
+            'ops' => array_map(static fn (array $op): array => [
+                'latency' => $op['latency']->toArray(),
+                'errors' => $op['errors'],
+                'lastError' => $op['lastError'],
+            ], $ops),
+            'rssKb' => $status['VmRSS'] ?? null,
+            'threads' => $status['Threads'] ?? null,
+        ]);
+    }
+
+    /**
+     * `VmRSS` (kB) and `Threads` from /proc, where available.
+     *
+     * @return array<string,int>
+     */
+    private static function processStatus(): array
+    {
+        $status = @file_get_contents('/proc/self/status');
+        if ($status === false) {
+            return [];
+        }
+        preg_match_all('/^(VmRSS|Threads):\s+(\d+)/m', $status, $matches, PREG_SET_ORDER);
+        $values = [];
+        foreach ($matches as [, $key, $value]) {
+            $values[$key] = (int) $value;
+        }
+        return $values;
+    }
+
+    /**
+     * @param array<string,mixed> $message
+     */
+    private static function emit(array $message): void
+    {
+        fwrite(STDOUT, json_encode($message, JSON_THROW_ON_ERROR | JSON_INVALID_UTF8_SUBSTITUTE) . "\n");
+        fflush(STDOUT);
+    }
+}
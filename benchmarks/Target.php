@@ -0,0 +1,115 @@
+<?php
+
+declare(strict_types=1);
+
+namespace EventDbx\Benchmarks;
+
+use EventDbx\Client;
+use EventDbx\Exception\EventDbxException;
+
+/**
+ * What the suite runs against:
+ *
+ * - `stub`: the C stub from tests/Fixtures, compiled with -O2. Every call
+ *   returns immediately, so timings isolate FFI crossing and JSON
+ *   encode/decode cost.
+ * - `server`: a real EventDBX server. The client config comes from the
+ *   EVENTDBX_BENCH_CONFIG JSON object and the library from
+ *   EVENTDBX_NATIVE_LIB, or native/target when that is unset.
+ */
+final class Target
+{
+    /**
+     * @param array<string,mixed> $config
+     */
+    private function __construct(
+        public readonly string $name,
+        public readonly array $config,
+        public readonly string $libraryPath,
+    ) {
+    }
+
+    public static function named(string $name): self
+    {
+        return match ($name) {
+            'stub' => new self('stub', ['dsn' => 'memory'], self::compileStub()),
+            'server' => new self('server', self::serverConfig(), self::serverLibrary()),
+            default => throw new EventDbxException("Unknown benchmark target {$name}; expected stub or server"),
+        };
+    }
+
+    public function isStub(): bool
+    {
+        return $this->name === 'stub';
+    }
+
+    /**
+     * @param array<string,mixed> $overrides
+     */
+    public function client(array $overrides = []): Client
+    {
+        return new Client($overrides + $this->config, $this->libraryPath);
+    }
+
+    private static function compileStub(): string
+    {
+        $source = dirname(__DIR__) . '/tests/Fixtures/eventdbx_native_stub.c';
+        $buildDir = sys_get_temp_dir() . '/eventdbx-php-bench';
+        if (!is_dir($buildDir) && !mkdir($buildDir, 0777, true) && !is_dir($buildDir)) {
+            throw new EventDbxException("Unable to create {$buildDir}");
+        }
+
+        $darwin = PHP_OS_FAMILY === 'Darwin';
+        $library = $buildDir . '/libeventdbx_php_native_stub.' . ($darwin ? 'dylib' : 'so');
+        if (!is_file($library) || filemtime($library) < filemtime($source)) {
+            $command = sprintf(
+                '%s -O2 %s -o %s %s 2>&1',
+                escapeshellcmd(getenv('CC') ?: 'cc'),
+                $darwin ? '-dynamiclib' : '-shared -fPIC',
+                escapeshellarg($library),
+                escapeshellarg($source),
+            );
+            exec($command, $output, $exitCode);
+            if ($exitCode !== 0) {
+                throw new EventDbxException('Failed to compile stub library: ' . implode("\n", $output));
+            }
+        }
+        return $library;
+    }
+
+    /**
+     * @return array<string,mixed>
+     */
+    private static function serverConfig(): array
+    {
+        $json = getenv('EVENTDBX_BENCH_CONFIG');
+        if ($json === false || $json === '') {
+            throw new EventDbxException('Set EVENTDBX_BENCH_CONFIG to a client config object to benchmark a server');
+        }
+        $config = json_decode($json, true, 512, JSON_THROW_ON_ERROR);
+        if (!is_array($config)) {
+            throw new EventDbxException('EVENTDBX_BENCH_CONFIG must be a JSON object');
+        }
+        return $config;
+    }
+
+    private static function serverLibrary(): string
+    {
+        $library = getenv('EVENTDBX_NATIVE_LIB');
+        if ($library !== false && $library !== '') {
+            return $library;
+        }
+        $file = match (PHP_OS_FAMILY) {
+            'Windows' => 'eventdbx_php_native.dll',
+            'Darwin' => 'libeventdbx_php_native.dylib',
+            default => 'libeventdbx_php_native.so',
+        };
+        foreach (['release', 'debug'] as $profile) {
+            $candidate = dirname(__DIR__) . "/native/target/{$profile}/{$file}";
+            if (is_file($candidate)) {
+                return $candidate;
+            }
+        }
+        throw new EventDbxException('Native library not found; build native/ or set EVENTDBX_NATIVE_LIB');
+    }
+}
@@ -0,0 +1,81 @@
+<?php
+
+/*
+ * Benchmarks the PHP <-> native bridge hot paths.
+ *
+ *     php benchmarks/run.php [--target=stub|server] [--iterations=2000]
+ *         [--warmup=100] [--filter=substring] [--json]
+ *
+ * See Target for how each target is configured. Against a server the suite
+ * seeds its own aggregates under EVENTDBX_BENCH_TYPE (default `bench`).
+ */
+
+declare(strict_types=1);
+
+use EventDbx\Benchmarks\Harness;
+use EventDbx\Benchmarks\Target;
+use EventDbx\Client;
+
+require dirname(__DIR__) . '/vendor/autoload.php';
+
+$options = getopt('', ['target:', 'iterations:', 'warmup:', 'filter:', 'json']);
+$target = Target::named((string) ($options['target'] ?? 'stub'));
+$harness = new Harness((int) ($options['iterations'] ?? 2000), (int) ($options['warmup'] ?? 100));
+$filter = (string) ($options['filter'] ?? '');
+
+$type = getenv('EVENTDBX_BENCH_TYPE') ?: 'bench';
+$run = bin2hex(random_bytes(4));
+$smallId = "small-{$run}";
+$largeId = "large-{$run}";
+$payload1k = ['blob' => str_repeat('x', 1024)];
+$payload100k = ['blob' => str_repeat('x', 100 * 1024)];
+$manyIds = array_map(static fn (int $i): string => "many-{$run}-{$i}", range(1, 50));
+
+$client = $target->client();
+if (!$target->isStub()) {
+    $client->create($type, $smallId, 'bench_created', ['payload' => ['name' => 'small']]);
+    $client->create($type, $largeId, 'bench_created', ['payload' => $payload100k]);
+    for ($i = 0; $i < 100; $i++) {
+        $client->apply($type, $smallId, 'bench_updated', ['payload' => ['seq' => $i]]);
+    }
+    foreach ($manyIds as $id) {
+        $client->create($type, $id, 'bench_created', ['payload' => ['name' => $id]]);
+    }
+}
+
+$cdef = (new ReflectionClassConstant(Client::class, 'CDEF'))->getValue();
+$library = $target->libraryPath;
+
+$cases = [
+    'cdef' => static fn () => FFI::cdef($cdef, $library),
+    'construct' => static fn () => $target->client(),
+    'get small' => static fn () => $client->get($type, $smallId),
+    'get large' => static fn () => $client->get($type, $largeId),
+    'events page 100' => static fn () => $client->events($type, $smallId, ['take' => 100]),
+    'apply 1KB' => static fn () => $client->apply($type, $smallId, 'bench_updated', ['payload' => $payload1k]),
+    'apply 100KB' => static fn () => $client->apply($type, $largeId, 'bench_updated', ['payload' => $payload100k]),
+    'getMany 50' => static fn () => $client->getMany($type, $manyIds),
+    'applyMany 50' => static fn () => $client->applyMany(array_map(
+        static fn (string $id): array => [
+            'aggregateType' => $type,
+            'aggregateId' => $id,
+            'eventType' => 'bench_updated',
+            'payload' => $payload1k,
+        ],
+        $manyIds,
+    )),
+];
+
+$results = [];
+foreach ($cases as $name => $operation) {
+    if ($filter !== '' && !str_contains($name, $filter)) {
+        continue;
+    }
+    $results[] = $harness->measure($name, $operation);
+}
+
+if (isset($options['json'])) {
+    echo json_encode(['target' => $target->name, 'results' => $results], JSON_PRETTY_PRINT), "\n";
+} else {
+    echo "target: {$target->name}\n", Harness::table($results);
+}
@@ -0,0 +1,111 @@
+//! Rust-side costs of one bridge call: parsing the JSON arguments PHP sends
+//! and encoding the reply it reads back.
+//!
+//!     cargo bench --features bench
+
+use std::ffi::CString;
+
+use criterion::{black_box, criterion_group, criterion_main, BatchSize, Criterion, Throughput};
+use eventdbx_php_native::bench;
+use serde_json::{json, Value};
+
+fn options(payload_bytes: usize) -> Value {
+    json!({
+        "payload": { "blob": "x".repeat(payload_bytes), "count": 3, "tags": ["a", "b"] },
+        "metadata": { "source": "bench" },
+        "note": "benchmark",
+        "publishTargets": [{ "plugin": "search", "mode": "async", "priority": "high" }],
+    })
+}
+
+fn page(rows: usize) -> Value {
+    (0..rows)
+        .map(|i| {
+            json!({
+                "aggregateType": "person",
+                "aggregateId": format!("p-{i}"),
+                "version": i,
+                "state": { "name": "Ada Lovelace", "email": "ada@example.com" },
+                "archived": false,
+            })
+        })
+        .collect()
+}
+
+fn parse_json(c: &mut Criterion) {
+    let mut group = c.benchmark_group("parse_json");
+    for size in [1024, 100 * 1024] {
+        let input = CString::new(options(size).to_string()).unwrap();
+        group.throughput(Throughput::Bytes(input.as_bytes().len() as u64));
+        group.bench_function(format!("{size}B"), |b| {
+            b.iter(|| bench::parse_json(black_box(&input)))
+        });
+    }
+    group.finish();
+}
+
+fn parse_payload_options(c: &mut Criterion) {
+    let mut group = c.benchmark_group("parse_payload_options");
+    for size in [1024, 100 * 1024] {
+        let input = options(size);
+        group.bench_function(format!("{size}B"), |b| {
+            b.iter_batched(
+                || input.clone(),
+                bench::parse_payload_options,
+                BatchSize::SmallInput,
+            )
+        });
+    }
+    group.finish();
+}
+
+fn parse_sort(c: &mut Criterion) {
+    let input = json!("created_at:desc, aggregate_type, id:asc, updated_at:descending");
+    c.bench_function("parse_sort", |b| {
+        b.iter(|| bench::parse_sort(black_box(&input)))
+    });
+}
+
+fn encode_reply(c: &mut Criterion) {
+    let mut group = c.benchmark_group("encode_page");
+    for rows in [1, 100] {
+        let items = page(rows);
+        group.bench_function(format!("json/{rows}"), |b| {
+            b.iter_batched(
+                || items.clone(),
+                |items| bench::encode_page(false, items),
+                BatchSize::SmallInput,
+            )
+        });
+        group.bench_function(format!("msgpack/{rows}"), |b| {
+            b.iter_batched(
+                || items.clone(),
+                |items| bench::encode_page(true, items),
+                BatchSize::SmallInput,
+            )
+        });
+        let mut buf = Some(Vec::new());
+        group.bench_function(format!("json_reused_buf/{rows}"), |b| {
+            b.iter_batched(
+                || items.clone(),
+                |items| {
+                    buf = Some(bench::encode_page_buf(
+                        items,
+                        buf.take().unwrap_or_default(),
+                    ))
+                },
+                BatchSize::SmallInput,
+            )
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(
+    benches,
+    parse_json,
+    parse_payload_options,
+    parse_sort,
+    encode_reply
+);
+criterion_main!(benches);
@@ -0,0 +1,63 @@
+//! Entry points for `benches/bridge.rs`, compiled only with the `bench`
+//! feature. They forward to the crate-private input parsers and reply
+//! encoders so those can be benchmarked without widening their visibility.
+
+use std::ffi::CStr;
+
+use eventdbx_client::{AggregateSort, PublishTarget};
+use serde_json::Value;
+
+use crate::reply::{self, Reply, ResponseFormat};
+
+pub type PayloadOptions = (
+    Value,
+    Option<String>,
+    Option<Value>,
+    Option<String>,
+    Vec<PublishTarget>,
+);
+
+pub fn parse_json(input: &CStr) -> Result<Value, String> {
+    crate::parse_json(input.as_ptr())
+}
+
+pub fn parse_payload_options(options: Value) -> PayloadOptions {
+    crate::parse_payload_options(options)
+}
+
+pub fn parse_sort(value: &Value) -> Vec<AggregateSort> {
+    crate::parse_sort(Some(value))
+}
+
+/// Encodes a list page the way `respond` does and frees it again; returns
+/// the encoded length.
+pub fn encode_page(msgpack: bool, items: Value) -> usize {
+    let format = if msgpack {
+        ResponseFormat::Msgpack
+    } else {
+        ResponseFormat::Json
+    };
+    let page = Reply::Page {
+        items,
+        next_cursor: None,
+    };
+    let (ptr, len) = reply::encode(format, &page).expect("page encodes");
+    unsafe {
+        match format {
+            ResponseFormat::Json => drop(std::ffi::CString::from_raw(ptr)),
+            ResponseFormat::Msgpack => reply::free_bytes(ptr),
+        }
+    }
+    len
+}
+
+/// Encodes a list page into `buf` the way `respond_buf` does and hands the
+/// allocation back, as a released `DbxBuf` would be.
+pub fn encode_page_buf(items: Value, buf: Vec<u8>) -> Vec<u8> {
+    let page = Reply::Page {
+        items,
+        next_cursor: None,
+    };
+    let buf = reply::encode_buf(ResponseFormat::Json, &page, buf).expect("page encodes");
+    unsafe { buf.into_vec() }.unwrap_or_default()
+}
@@ -0,0 +1,110 @@
+//! Reusable response buffers for the `_v2` exports.
+//!
+//! A `DbxBuf` handed back with `dbx_buf_release` keeps its allocation in the
+//! handle's pool, and the next reply is serialized into it, so a tight read
+//! loop stops paying a response-sized malloc/free per call. The pool holds
+//! at most `retain` buffers and drops any that grew beyond `maxBytes`, so one
+//! very large page does not pin its memory for the life of the worker.
+
+use std::sync::{Mutex, MutexGuard, PoisonError};
+
+use serde::Deserialize;
+
+const DEFAULT_RETAIN: usize = 4;
+const DEFAULT_MAX_BYTES: usize = 1024 * 1024;
+/// Capacity of a buffer created when the pool is empty.
+const INITIAL_CAPACITY: usize = 256;
+
+/// The `outputBuffers` section of the client config.
+#[derive(Clone, Default, Deserialize, Hash)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct BufferConfig {
+    /// Released buffers kept for reuse; 0 disables pooling.
+    retain: Option<usize>,
+    /// Released buffers with a larger capacity are freed instead.
+    max_bytes: Option<usize>,
+}
+
+pub(crate) struct BufferPool {
+    free: Mutex<Vec<Vec<u8>>>,
+    retain: usize,
+    max_bytes: usize,
+}
+
+impl BufferPool {
+    pub(crate) fn new(config: Option<&BufferConfig>) -> Self {
+        let config = config.cloned().unwrap_or_default();
+        let retain = config.retain.unwrap_or(DEFAULT_RETAIN);
+        BufferPool {
+            free: Mutex::new(Vec::with_capacity(retain)),
+            retain,
+            max_bytes: config.max_bytes.unwrap_or(DEFAULT_MAX_BYTES),
+        }
+    }
+
+    fn lock(&self) -> MutexGuard<'_, Vec<Vec<u8>>> {
+        self.free.lock().unwrap_or_else(PoisonError::into_inner)
+    }
+
+    /// An empty buffer, reusing a released allocation when one is pooled.
+    pub(crate) fn take(&self) -> Vec<u8> {
+        self.lock()
+            .pop()
+            .unwrap_or_else(|| Vec::with_capacity(INITIAL_CAPACITY))
+    }
+
+    /// Keeps `buf` for a later `take`, or frees it when the pool is full or
+    /// the buffer is over the size cap.
+    pub(crate) fn give(&self, mut buf: Vec<u8>) {
+        if buf.capacity() > self.max_bytes {
+            return;
+        }
+        let mut free = self.lock();
+        if free.len() < self.retain {
+            buf.clear();
+            free.push(buf);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn pool(config: serde_json::Value) -> BufferPool {
+        BufferPool::new(Some(&serde_json::from_value(config).unwrap()))
+    }
+
+    #[test]
+    fn released_buffers_are_reused_empty() {
+        let pool = pool(serde_json::json!({}));
+        let mut buf = pool.take();
+        buf.extend_from_slice(&[1; 4096]);
+        let ptr = buf.as_ptr();
+        pool.give(buf);
+
+        let reused = pool.take();
+        assert!(reused.is_empty());
+        assert_eq!(reused.as_ptr(), ptr);
+        assert!(reused.capacity() >= 4096);
+    }
+
+    #[test]
+    fn oversized_and_surplus_buffers_are_freed() {
+        let pool = pool(serde_json::json!({ "retain": 1, "maxBytes": 1024 }));
+        pool.give(Vec::with_capacity(4096));
+        assert_eq!(pool.lock().len(), 0);
+
+        pool.give(Vec::with_capacity(512));
+        pool.give(Vec::with_capacity(512));
+        assert_eq!(pool.lock().len(), 1);
+    }
+
+    #[test]
+    fn zero_retain_disables_pooling() {
+        let pool = pool(serde_json::json!({ "retain": 0 }));
+        pool.give(Vec::with_capacity(64));
+        assert_eq!(pool.lock().len(), 0);
+        assert_eq!(pool.take().capacity(), INITIAL_CAPACITY);
+    }
+}
@@ -0,0 +1,308 @@
+//! Optional read cache for `dbx_get_aggregate` / `dbx_select_aggregate`.
+//!
+//! Entries are bounded by an approximate byte size and evicted least recently
+//! used first; each aggregate type can have its own TTL. Writes issued through
+//! the same handle drop every entry of the aggregate they touch, and bump an
+//! epoch so that a read which raced with the write cannot store its (possibly
+//! stale) result afterwards.
+
+use std::{
+    collections::BTreeMap,
+    ops::Bound,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Mutex, MutexGuard, PoisonError,
+    },
+    time::{Duration, Instant},
+};
+
+use serde::Deserialize;
+use serde_json::Value;
+
+const DEFAULT_MAX_BYTES: usize = 16 * 1024 * 1024;
+const DEFAULT_TTL_MS: u64 = 1_000;
+
+/// The `cache` section of the client config.
+#[derive(Clone, Default, Deserialize, Hash)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct CacheConfig {
+    /// Upper bound on the approximate size of cached values.
+    max_bytes: Option<usize>,
+    /// TTL for types without an entry in `ttl_by_type`.
+    ttl_ms: Option<u64>,
+    /// Per aggregate type TTL; 0 disables caching for that type.
+    ttl_by_type: Option<BTreeMap<String, u64>>,
+}
+
+/// Aggregate type, aggregate id, and the selected fields (`None` for a full
+/// `get`). Ordering by type and id first lets invalidation visit one range.
+type Key = (String, String, Option<Vec<String>>);
+
+struct Entry {
+    found: bool,
+    body: Value,
+    size: usize,
+    expires: Instant,
+    tick: u64,
+}
+
+#[derive(Default)]
+struct Lru {
+    entries: BTreeMap<Key, Entry>,
+    /// Recency order: access tick to key.
+    order: BTreeMap<u64, Key>,
+    tick: u64,
+    bytes: usize,
+}
+
+impl Lru {
+    fn remove(&mut self, key: &Key) {
+        if let Some(entry) = self.entries.remove(key) {
+            self.order.remove(&entry.tick);
+            self.bytes -= entry.size;
+        }
+    }
+}
+
+pub(crate) struct Cache {
+    config: Option<CacheConfig>,
+    lru: Mutex<Lru>,
+    epoch: AtomicU64,
+}
+
+impl Cache {
+    pub(crate) fn new(config: Option<CacheConfig>) -> Self {
+        Cache {
+            config,
+            lru: Mutex::new(Lru::default()),
+            epoch: AtomicU64::new(0),
+        }
+    }
+
+    fn lock(&self) -> MutexGuard<'_, Lru> {
+        self.lru.lock().unwrap_or_else(PoisonError::into_inner)
+    }
+
+    fn ttl(&self, agg_type: &str) -> Option<Duration> {
+        let config = self.config.as_ref()?;
+        let ms = config
+            .ttl_by_type
+            .as_ref()
+            .and_then(|types| types.get(agg_type).copied())
+            .unwrap_or(config.ttl_ms.unwrap_or(DEFAULT_TTL_MS));
+        (ms > 0).then(|| Duration::from_millis(ms))
+    }
+
+    fn max_bytes(&self) -> usize {
+        self.config
+            .as_ref()
+            .and_then(|config| config.max_bytes)
+            .unwrap_or(DEFAULT_MAX_BYTES)
+    }
+
+    /// Whether results for `agg_type` are cached at all.
+    pub(crate) fn enabled(&self, agg_type: &str) -> bool {
+        self.ttl(agg_type).is_some()
+    }
+
+    /// Returns `(found, body)` for a live entry and marks it recently used.
+    pub(crate) fn get(
+        &self,
+        agg_type: &str,
+        agg_id: &str,
+        fields: Option<&[String]>,
+    ) -> Option<(bool, Value)> {
+        if !self.enabled(agg_type) {
+            return None;
+        }
+        let key = (
+            agg_type.to_string(),
+            agg_id.to_string(),
+            fields.map(<[String]>::to_vec),
+        );
+        let mut lru = self.lock();
+        let (expires, old_tick) = {
+            let entry = lru.entries.get(&key)?;
+            (entry.expires, entry.tick)
+        };
+        if expires <= Instant::now() {
+            lru.remove(&key);
+            return None;
+        }
+        lru.tick += 1;
+        let tick = lru.tick;
+        lru.order.remove(&old_tick);
+        let entry = lru.entries.get_mut(&key)?;
+        entry.tick = tick;
+        let hit = (entry.found, entry.body.clone());
+        lru.order.insert(tick, key);
+        Some(hit)
+    }
+
+    /// Token to pass to `put`; a write in between makes the `put` a no-op.
+    pub(crate) fn epoch(&self) -> u64 {
+        self.epoch.load(Ordering::Acquire)
+    }
+
+    pub(crate) fn put(
+        &self,
+        epoch: u64,
+        agg_type: &str,
+        agg_id: &str,
+        fields: Option<&[String]>,
+        found: bool,
+        body: &Value,
+    ) {
+        let Some(ttl) = self.ttl(agg_type) else {
+            return;
+        };
+        let key: Key = (
+            agg_type.to_string(),
+            agg_id.to_string(),
+            fields.map(<[String]>::to_vec),
+        );
+        let size = approx_size(body)
+            + key.0.len()
+            + key.1.len()
+            + key.2.iter().flatten().map(String::len).sum::<usize>();
+        let max_bytes = self.max_bytes();
+        if size > max_bytes {
+            return;
+        }
+
+        let mut lru = self.lock();
+        if self.epoch() != epoch {
+            return;
+        }
+        lru.remove(&key);
+        while lru.bytes + size > max_bytes {
+            let Some((_, oldest)) = lru.order.pop_first() else {
+                break;
+            };
+            if let Some(entry) = lru.entries.remove(&oldest) {
+                lru.bytes -= entry.size;
+            }
+        }
+        lru.tick += 1;
+        let tick = lru.tick;
+        lru.order.insert(tick, key.clone());
+        lru.bytes += size;
+        lru.entries.insert(
+            key,
+            Entry {
+                found,
+                body: body.clone(),
+                size,
+                expires: Instant::now() + ttl,
+                tick,
+            },
+        );
+    }
+
+    /// Drops every cached read of one aggregate.
+    pub(crate) fn invalidate(&self, agg_type: &str, agg_id: &str) {
+        if self.config.is_none() {
+            return;
+        }
+        let mut lru = self.lock();
+        self.epoch.fetch_add(1, Ordering::AcqRel);
+        let start: Key = (agg_type.to_string(), agg_id.to_string(), None);
+        let keys: Vec<Key> = lru
+            .entries
+            .range((Bound::Included(&start), Bound::Unbounded))
+            .map(|(key, _)| key)
+            .take_while(|key| key.0 == agg_type && key.1 == agg_id)
+            .cloned()
+            .collect();
+        for key in &keys {
+            lru.remove(key);
+        }
+    }
+
+    pub(crate) fn clear(&self) {
+        let mut lru = self.lock();
+        self.epoch.fetch_add(1, Ordering::AcqRel);
+        *lru = Lru::default();
+    }
+}
+
+/// Rough in-memory footprint of a JSON value, used for the byte bound.
+fn approx_size(value: &Value) -> usize {
+    match value {
+        Value::Null | Value::Bool(_) => 8,
+        Value::Number(_) => 16,
+        Value::String(s) => 24 + s.len(),
+        Value::Array(items) => 24 + items.iter().map(approx_size).sum::<usize>(),
+        Value::Object(map) => {
+            32 + map
+                .iter()
+                .map(|(k, v)| 24 + k.len() + approx_size(v))
+                .sum::<usize>()
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn cache(config: serde_json::Value) -> Cache {
+        Cache::new(Some(serde_json::from_value(config).unwrap()))
+    }
+
+    #[test]
+    fn disabled_without_config() {
+        let cache = Cache::new(None);
+        cache.put(cache.epoch(), "t", "1", None, true, &Value::Null);
+        assert!(cache.get("t", "1", None).is_none());
+    }
+
+    #[test]
+    fn hits_until_invalidated() {
+        let cache = cache(serde_json::json!({ "ttlMs": 60000 }));
+        let fields = vec!["name".to_string()];
+        cache.put(cache.epoch(), "t", "1", None, true, &serde_json::json!({ "v": 1 }));
+        cache.put(cache.epoch(), "t", "1", Some(&fields), true, &serde_json::json!({ "name": "a" }));
+        cache.put(cache.epoch(), "t", "2", None, false, &Value::Null);
+
+        assert_eq!(cache.get("t", "1", None).unwrap().1["v"], 1);
+        assert!(cache.get("t", "1", Some(&fields)).is_some());
+
+        cache.invalidate("t", "1");
+        assert!(cache.get("t", "1", None).is_none());
+        assert!(cache.get("t", "1", Some(&fields)).is_none());
+        assert_eq!(cache.get("t", "2", None), Some((false, Value::Null)));
+    }
+
+    #[test]
+    fn write_during_read_prevents_stale_put() {
+        let cache = cache(serde_json::json!({}));
+        let epoch = cache.epoch();
+        cache.invalidate("t", "1");
+        cache.put(epoch, "t", "1", None, true, &Value::Null);
+        assert!(cache.get("t", "1", None).is_none());
+    }
+
+    #[test]
+    fn per_type_ttl_and_zero_disables() {
+        let cache = cache(serde_json::json!({ "ttlByType": { "hot": 60000, "cold": 0 } }));
+        cache.put(cache.epoch(), "cold", "1", None, true, &Value::Null);
+        cache.put(cache.epoch(), "hot", "1", None, true, &Value::Null);
+        assert!(cache.get("cold", "1", None).is_none());
+        assert!(cache.get("hot", "1", None).is_some());
+    }
+
+    #[test]
+    fn evicts_least_recently_used_within_byte_bound() {
+        let cache = cache(serde_json::json!({ "maxBytes": 150, "ttlMs": 60000 }));
+        let body = Value::String("x".repeat(40));
+        cache.put(cache.epoch(), "t", "a", None, true, &body);
+        cache.put(cache.epoch(), "t", "b", None, true, &body);
+        assert!(cache.get("t", "a", None).is_some());
+        cache.put(cache.epoch(), "t", "c", None, true, &body);
+
+        assert!(cache.get("t", "a", None).is_some());
+        assert!(cache.get("t", "b", None).is_none());
+        assert!(cache.get("t", "c", None).is_some());
+    }
+}
@@ -0,0 +1,126 @@
+//! Paged listings walked to the end inside the runtime.
+//!
+//! A cursor owns a task that keeps fetching the next page while the caller
+//! consumes earlier ones. Pages travel over a channel of `prefetch` slots, so
+//! at most `prefetch` pages are buffered (plus the one being fetched),
+//! however long the listing is.
+
+use std::future::Future;
+
+use tokio::{runtime::Runtime, sync::mpsc, task::JoinHandle};
+
+use crate::reply::Reply;
+
+/// Pages buffered ahead of the caller when `prefetch` is not given.
+pub(crate) const DEFAULT_PREFETCH: usize = 2;
+
+pub struct Cursor {
+    pages: mpsc::Receiver<Result<Reply, String>>,
+    task: JoinHandle<()>,
+}
+
+impl Cursor {
+    /// Starts fetching immediately. `fetch` receives the cursor of the page to
+    /// load (`None` for the first page) and must resolve to a
+    /// `Reply::Page`; iteration stops after a page without `nextCursor` or
+    /// after the first error.
+    pub(crate) fn open<F, Fut>(runtime: &Runtime, prefetch: usize, mut fetch: F) -> Self
+    where
+        F: FnMut(Option<String>) -> Fut + Send + 'static,
+        Fut: Future<Output = Result<Reply, String>> + Send,
+    {
+        let (tx, pages) = mpsc::channel(prefetch.max(1));
+        let task = runtime.spawn(async move {
+            let mut cursor = None;
+            loop {
+                let page = fetch(cursor.take()).await;
+                let next = match &page {
+                    Ok(Reply::Page { next_cursor, .. }) => {
+                        next_cursor.clone().filter(|c| !c.is_empty())
+                    }
+                    _ => None,
+                };
+                if tx.send(page).await.is_err() || next.is_none() {
+                    return;
+                }
+                cursor = next;
+            }
+        });
+        Cursor { pages, task }
+    }
+
+    /// Blocks for the next page; `None` once the listing is exhausted.
+    pub(crate) fn next(&mut self, runtime: &Runtime) -> Option<Result<Reply, String>> {
+        runtime.block_on(self.pages.recv())
+    }
+}
+
+impl Drop for Cursor {
+    fn drop(&mut self) {
+        self.task.abort();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc,
+    };
+
+    use serde_json::Value;
+
+    use super::*;
+
+    fn page(n: usize, last: usize) -> Reply {
+        Reply::Page {
+            items: Value::from(vec![n]),
+            next_cursor: (n < last).then(|| (n + 1).to_string()),
+        }
+    }
+
+    #[test]
+    fn walks_every_page_in_order() {
+        let runtime = Runtime::new().unwrap();
+        let mut cursor = Cursor::open(&runtime, 2, |cursor: Option<String>| async move {
+            let n = cursor.map_or(0, |c| c.parse().unwrap());
+            Ok(page(n, 3))
+        });
+
+        let mut seen = Vec::new();
+        while let Some(page) = cursor.next(&runtime) {
+            let Ok(Reply::Page { items, .. }) = page else {
+                panic!("unexpected reply");
+            };
+            seen.push(items[0].as_u64().unwrap());
+        }
+        assert_eq!(seen, [0, 1, 2, 3]);
+    }
+
+    #[test]
+    fn read_ahead_is_bounded_by_prefetch() {
+        let runtime = Runtime::new().unwrap();
+        let fetched = Arc::new(AtomicUsize::new(0));
+        let counter = fetched.clone();
+        let mut cursor = Cursor::open(&runtime, 2, move |cursor: Option<String>| {
+            counter.fetch_add(1, Ordering::SeqCst);
+            async move {
+                let n = cursor.map_or(0, |c| c.parse().unwrap());
+                Ok(page(n, 100))
+            }
+        });
+
+        assert!(cursor.next(&runtime).is_some());
+        std::thread::sleep(std::time::Duration::from_millis(50));
+        // Two buffered pages plus one blocked on the full channel.
+        assert!(fetched.load(Ordering::SeqCst) <= 4);
+    }
+
+    #[test]
+    fn stops_after_an_error() {
+        let runtime = Runtime::new().unwrap();
+        let mut cursor = Cursor::open(&runtime, 1, |_| async { Err("boom".to_string()) });
+        assert!(matches!(cursor.next(&runtime), Some(Err(err)) if err == "boom"));
+        assert!(cursor.next(&runtime).is_none());
+    }
+}
@@ -0,0 +1,390 @@
+//! Bulk replay of every event of an aggregate type straight to a file.
+//!
+//! One task walks the aggregate listing and fetches the events of up to
+//! `concurrency` aggregates at a time; pages flow over a bounded channel to
+//! the calling thread, which writes one record per event, optionally through
+//! a zstd encoder (see `compress`). Memory is bounded by the channel depth
+//! and page size, not by the number of events.
+
+use std::{io::Write, sync::Arc};
+
+use eventdbx_client::ListEventsOptions;
+use futures::{stream, StreamExt};
+use serde::{Deserialize, Serialize};
+use serde_json::Value;
+use tokio::sync::mpsc;
+
+use crate::{
+    compress::{Compression, CompressionStats, Output},
+    entry_string, list_aggregates_payload, list_events_payload, msgpack,
+    parse_list_aggregates_options,
+    pool::Pool,
+    reply::Reply,
+    reply::TaggedReply,
+    sizing::{self, Adaptive, AdaptiveTake, PageSizer},
+};
+
+/// Aggregates whose events are fetched at once when `concurrency` is unset.
+const DEFAULT_CONCURRENCY: usize = 4;
+/// Per-aggregate failures listed in the summary; the rest are only counted.
+pub(crate) const MAX_REPORTED_ERRORS: usize = 100;
+
+#[derive(Clone, Copy, Default, Deserialize)]
+#[serde(rename_all = "lowercase")]
+pub(crate) enum ExportFormat {
+    /// One JSON record per line.
+    #[default]
+    Ndjson,
+    /// MessagePack records, each behind a 4-byte big-endian length.
+    Msgpack,
+}
+
+#[derive(Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct ExportOptions {
+    #[serde(default)]
+    format: ExportFormat,
+    concurrency: Option<usize>,
+    /// Page size for each aggregate's events.
+    events_take: Option<u64>,
+    compression: Option<Compression>,
+}
+
+#[derive(Default, Serialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct ExportSummary {
+    aggregates: u64,
+    events: u64,
+    bytes: u64,
+    failed: u64,
+    errors: Vec<TaggedReply>,
+    /// Size of the compressed output, when `compression` was given.
+    #[serde(skip_serializing_if = "Option::is_none")]
+    compressed_bytes: Option<u64>,
+    #[serde(skip)]
+    pub(crate) compression: Option<CompressionStats>,
+}
+
+#[derive(Serialize)]
+#[serde(rename_all = "camelCase")]
+struct Record<'a> {
+    aggregate_type: &'a str,
+    aggregate_id: &'a str,
+    event: &'a Value,
+}
+
+pub(crate) enum Chunk {
+    Events {
+        aggregate_type: String,
+        aggregate_id: String,
+        events: Value,
+    },
+    Done,
+    Failed {
+        aggregate_type: String,
+        aggregate_id: String,
+        error: String,
+    },
+}
+
+/// Exports the events of every aggregate matched by `opts_value` (the
+/// `dbx_list_aggregates` options plus `format`, `concurrency`, `eventsTake`
+/// and `adaptiveTake`) to `out`.
+pub(crate) async fn run<W: Write>(
+    pool: Arc<Pool>,
+    sizer: Arc<PageSizer>,
+    agg_type: Option<String>,
+    opts_value: Value,
+    out: W,
+) -> Result<ExportSummary, String> {
+    let options: ExportOptions = serde_json::from_value(match &opts_value {
+        Value::Object(_) => opts_value.clone(),
+        _ => Value::Object(Default::default()),
+    })
+    .map_err(|e| format!("invalid export options: {e}"))?;
+    let concurrency = options.concurrency.unwrap_or(DEFAULT_CONCURRENCY).max(1);
+    let sizing = AdaptiveTake::from_options(&opts_value)?.map(|config| (sizer, config));
+
+    let (tx, rx) = mpsc::channel(concurrency * 2);
+    let producer = tokio::spawn(produce(
+        pool,
+        agg_type,
+        opts_value,
+        options.events_take,
+        sizing,
+        concurrency,
+        tx,
+    ));
+    let written = consume(rx, options.format, options.compression, out).await;
+    if written.is_err() {
+        producer.abort();
+    }
+    let listed = producer
+        .await
+        .unwrap_or_else(|err| Err(format!("export task failed: {err}")));
+    let summary = written?;
+    listed?;
+    Ok(summary)
+}
+
+pub(crate) async fn produce(
+    pool: Arc<Pool>,
+    agg_type: Option<String>,
+    opts_value: Value,
+    events_take: Option<u64>,
+    sizing: Option<(Arc<PageSizer>, AdaptiveTake)>,
+    concurrency: usize,
+    tx: mpsc::Sender<Chunk>,
+) -> Result<(), String> {
+    let mut cursor = None;
+    loop {
+        let mut opts = parse_list_aggregates_options(agg_type.clone(), &opts_value);
+        if cursor.is_some() {
+            opts.cursor = cursor.take();
+        }
+        let Reply::Page { items, next_cursor } = list_aggregates_payload(pool.clone(), opts, None).await?
+        else {
+            return Err("unexpected aggregate listing reply".to_string());
+        };
+
+        let refs = match items {
+            Value::Array(items) => items,
+            _ => Vec::new(),
+        };
+        stream::iter(refs)
+            .for_each_concurrent(concurrency, |aggregate| {
+                export_aggregate(
+                    pool.clone(),
+                    agg_type.as_deref(),
+                    aggregate,
+                    events_take,
+                    sizing.as_ref(),
+                    tx.clone(),
+                )
+            })
+            .await;
+
+        match next_cursor.filter(|c| !c.is_empty()) {
+            Some(next) => cursor = Some(next),
+            None => return Ok(()),
+        }
+    }
+}
+
+pub(crate) async fn export_aggregate(
+    pool: Arc<Pool>,
+    default_type: Option<&str>,
+    aggregate: Value,
+    events_take: Option<u64>,
+    sizing: Option<&(Arc<PageSizer>, AdaptiveTake)>,
+    tx: mpsc::Sender<Chunk>,
+) {
+    let Value::Object(map) = aggregate else {
+        return;
+    };
+    let aggregate_type = entry_string(&map, "aggregateType", "aggregate_type")
+        .ok()
+        .or_else(|| default_type.map(str::to_string))
+        .unwrap_or_default();
+    let aggregate_id = match entry_string(&map, "aggregateId", "aggregate_id") {
+        Ok(id) => id,
+        Err(error) => {
+            let _ = tx
+                .send(Chunk::Failed {
+                    aggregate_type,
+                    aggregate_id: String::new(),
+                    error,
+                })
+                .await;
+            return;
+        }
+    };
+
+    let adaptive = sizing.map(|(sizer, config)| {
+        Arc::new(Adaptive::new(sizer.clone(), "events", &aggregate_type, *config, events_take))
+    });
+    let mut cursor = None;
+    loop {
+        let mut opts = ListEventsOptions::default();
+        opts.cursor = cursor.take();
+        opts.take = adaptive.as_ref().map(|a| a.take()).or(events_take);
+        let page = sizing::observed(
+            adaptive.clone(),
+            list_events_payload(pool.clone(), aggregate_type.clone(), aggregate_id.clone(), opts, None),
+        )
+        .await;
+        let (events, next) = match page {
+            Ok(Reply::Page { items, next_cursor }) => (items, next_cursor.filter(|c| !c.is_empty())),
+            Ok(_) => (Value::Null, None),
+            Err(error) => {
+                let _ = tx
+                    .send(Chunk::Failed {
+                        aggregate_type,
+                        aggregate_id,
+                        error,
+                    })
+                    .await;
+                return;
+            }
+        };
+        let chunk = Chunk::Events {
+            aggregate_type: aggregate_type.clone(),
+            aggregate_id: aggregate_id.clone(),
+            events,
+        };
+        if tx.send(chunk).await.is_err() {
+            return;
+        }
+        match next {
+            Some(next) => cursor = Some(next),
+            None => break,
+        }
+    }
+    let _ = tx.send(Chunk::Done).await;
+}
+
+async fn consume<W: Write>(
+    mut rx: mpsc::Receiver<Chunk>,
+    format: ExportFormat,
+    compression: Option<Compression>,
+    out: W,
+) -> Result<ExportSummary, String> {
+    let mut out =
+        Output::new(out, compression).map_err(|e| format!("failed to start compression: {e}"))?;
+    let mut summary = ExportSummary::default();
+    let mut record = Vec::with_capacity(512);
+    while let Some(chunk) = rx.recv().await {
+        match chunk {
+            Chunk::Events {
+                aggregate_type,
+                aggregate_id,
+                events,
+            } => {
+                let Value::Array(events) = events else {
+                    continue;
+                };
+                for event in &events {
+                    encode_record(
+                        format,
+                        &Record {
+                            aggregate_type: &aggregate_type,
+                            aggregate_id: &aggregate_id,
+                            event,
+                        },
+                        &mut record,
+                    )?;
+                    out.write_all(&record)
+                        .map_err(|e| format!("failed to write export: {e}"))?;
+                    summary.events += 1;
+                    summary.bytes += record.len() as u64;
+                }
+            }
+            Chunk::Done => summary.aggregates += 1,
+            Chunk::Failed {
+                aggregate_type,
+                aggregate_id,
+                error,
+            } => {
+                summary.failed += 1;
+                if summary.errors.len() < MAX_REPORTED_ERRORS {
+                    summary.errors.push(TaggedReply {
+                        aggregate_type,
+                        aggregate_id,
+                        reply: Reply::Failed { error },
+                    });
+                }
+            }
+        }
+    }
+    summary.compression = out
+        .finish()
+        .map_err(|e| format!("failed to write export: {e}"))?;
+    summary.compressed_bytes = summary.compression.map(|stats| stats.bytes_out);
+    Ok(summary)
+}
+
+fn encode_record(format: ExportFormat, record: &Record<'_>, buf: &mut Vec<u8>) -> Result<(), String> {
+    buf.clear();
+    match format {
+        ExportFormat::Ndjson => {
+            serde_json::to_writer(&mut *buf, record)
+                .map_err(|e| format!("failed to serialize json: {e}"))?;
+            buf.push(b'\n');
+        }
+        ExportFormat::Msgpack => {
+            buf.extend_from_slice(&[0; 4]);
+            msgpack::to_writer(buf, record)
+                .map_err(|e| format!("failed to serialize msgpack: {e}"))?;
+            let len = (buf.len() - 4) as u32;
+            buf[..4].copy_from_slice(&len.to_be_bytes());
+        }
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn ndjson_records_are_tagged_lines() {
+        let event = serde_json::json!({ "eventType": "created" });
+        let record = Record {
+            aggregate_type: "person",
+            aggregate_id: "p-1",
+            event: &event,
+        };
+        let mut buf = Vec::new();
+        encode_record(ExportFormat::Ndjson, &record, &mut buf).unwrap();
+        assert_eq!(
+            String::from_utf8(buf).unwrap(),
+            "{\"aggregateType\":\"person\",\"aggregateId\":\"p-1\",\"event\":{\"eventType\":\"created\"}}\n"
+        );
+    }
+
+    #[test]
+    fn msgpack_records_are_length_prefixed() {
+        let event = Value::Null;
+        let record = Record {
+            aggregate_type: "a",
+            aggregate_id: "b",
+            event: &event,
+        };
+        let mut buf = Vec::new();
+        encode_record(ExportFormat::Msgpack, &record, &mut buf).unwrap();
+        let len = u32::from_be_bytes(buf[..4].try_into().unwrap()) as usize;
+        assert_eq!(len, buf.len() - 4);
+        assert_eq!(buf[4], 0x83);
+    }
+
+    #[test]
+    fn summary_counts_events_and_failures() {
+        let runtime = tokio::runtime::Runtime::new().unwrap();
+        let (tx, rx) = mpsc::channel(8);
+        let mut out = Vec::new();
+        let summary = runtime.block_on(async {
+            tx.send(Chunk::Events {
+                aggregate_type: "person".to_string(),
+                aggregate_id: "p-1".to_string(),
+                events: serde_json::json!([{ "n": 1 }, { "n": 2 }]),
+            })
+            .await
+            .unwrap();
+            tx.send(Chunk::Done).await.unwrap();
+            tx.send(Chunk::Failed {
+                aggregate_type: "person".to_string(),
+                aggregate_id: "p-2".to_string(),
+                error: "boom".to_string(),
+            })
+            .await
+            .unwrap();
+            drop(tx);
+            consume(rx, ExportFormat::Ndjson, None, &mut out).await.unwrap()
+        });
+        assert_eq!(summary.aggregates, 1);
+        assert_eq!(summary.events, 2);
+        assert_eq!(summary.failed, 1);
+        assert_eq!(summary.bytes, out.len() as u64);
+        assert_eq!(out.iter().filter(|b| **b == b'\n').count(), 2);
+    }
+}
@@ -1,25 +1,104 @@
+#[cfg(feature = "bench")]
+#[doc(hidden)]
+pub mod bench;
+mod buffers;
+mod cache;
+mod compress;
+mod cursor;
+mod export;
+mod metrics;
+mod msgpack;
+mod pending;
+mod pool;
+mod projection;
+mod reduce;
+mod registry;
+mod reply;
+mod retry;
+mod routing;
+mod rt;
+mod sizing;
+mod state;
+mod statements;
+mod subscription;
+mod v2;
+mod verify;
+mod view;
+mod writes;
+
 use std::{
+    collections::{hash_map::DefaultHasher, HashMap},
     ffi::{CStr, CString},
-    os::raw::c_char,
-    time::Duration,
+    hash::{Hash, Hasher},
+    os::raw::{c_char, c_int},
+    sync::{atomic::AtomicUsize, Arc, OnceLock},
+    time::{Duration, Instant},
 };
 
+use buffers::{BufferConfig, BufferPool};
+use cache::{Cache, CacheConfig};
+use cursor::Cursor;
 use eventdbx_client::{
     AggregateSort, AggregateSortField, AppendEventRequest, ClientConfig, CreateAggregateRequest,
-    CreateSnapshotRequest, EventDbxClient, GetSnapshotRequest, ListAggregatesOptions,
-    ListEventsOptions, ListSnapshotsOptions, PatchEventRequest, PublishTarget,
-    SelectAggregateRequest, SetAggregateArchiveRequest,
+    CreateSnapshotRequest, GetSnapshotRequest, ListAggregatesOptions, ListEventsOptions,
+    ListSnapshotsOptions, PatchEventRequest, PublishTarget, SelectAggregateRequest,
+    SetAggregateArchiveRequest,
 };
+use futures::future::join_all;
+use metrics::{Call, Metrics, Op};
+use pending::{Pending, TicketState};
+use pool::{read_conn, with_conn, LazyConnect, Pool};
+use projection::{project, Projection};
+use registry::Release;
+use reply::{DbxBuf, Reply, ResponseFormat, TaggedReply};
+use retry::{HedgeConfig, RetryConfig};
+use routing::{Endpoint, HealthConfig};
+use rt::{HandleRuntime, RuntimeConfig};
+use sizing::{Adaptive, AdaptiveTake, PageSizer};
+use state::LoadStateOptions;
+use subscription::{SubscribeOptions, Subscription};
 use serde::Deserialize;
 use serde_json::{Map, Value};
-use tokio::runtime::Runtime;
-
+use statements::{Operation, Statement, Statements};
+use writes::{Enqueued, FlushSummary, WriteQueue, WriteQueueConfig};
+
+/// A client handle. Every export takes it as `&DbxHandle` and all mutable
+/// state sits behind atomics, locks or the pool's per-connection leases, so
+/// one handle may be driven by several threads at once (ZTS builds,
+/// ext-parallel, threaded SAPIs): concurrent calls lease different pooled
+/// connections and queue on `maxInFlight`. Cursors, views and subscriptions
+/// are not shared this way; each must be used by one thread at a time.
 struct DbxHandle {
-    runtime: Runtime,
-    client: EventDbxClient,
+    runtime: HandleRuntime,
+    /// Process that created the handle; see `check_handle`.
+    pid: u32,
+    pool: Arc<Pool>,
+    pending: Arc<Pending>,
+    cache: Arc<Cache>,
+    metrics: Arc<Metrics>,
+    /// Started by the first `dbx_enqueue_append`.
+    writes: OnceLock<WriteQueue>,
+    write_config: Option<WriteQueueConfig>,
+    statements: Statements,
+    /// Allocations reused by the `_v2` replies.
+    buffers: BufferPool,
+    /// Page costs learned by `adaptiveTake` listings.
+    sizer: Arc<PageSizer>,
+    /// Encoding of every response returned by this handle.
+    format: ResponseFormat,
+    /// Registry key when the handle was created with `shared: true`.
+    shared_key: Option<u64>,
+    /// Live references to a shared handle; changed under the registry lock.
+    refs: AtomicUsize,
 }
 
-#[derive(Deserialize)]
+// Handles cross threads as raw pointers; keep that sound as fields change.
+const _: () = {
+    const fn shareable<T: Send + Sync>() {}
+    shareable::<DbxHandle>()
+};
+
+#[derive(Clone, Deserialize, Hash)]
 #[serde(rename_all = "camelCase")]
 struct ConfigInput {
     ip: Option<String>,
@@ -33,6 +112,32 @@ struct ConfigInput {
     connect_timeout_ms: Option<u64>,
     request_timeout_ms: Option<u64>,
     protocol_version: Option<u16>,
+    shared: Option<bool>,
+    /// Connections opened per handle (default 1).
+    pool_size: Option<usize>,
+    /// Requests allowed to queue on or use the pool at once (default `pool_size`).
+    max_in_flight: Option<usize>,
+    /// `json` (default) or `msgpack`; see `dbx_bytes_free`.
+    response_format: Option<ResponseFormat>,
+    /// Read cache for get/select; disabled when absent.
+    cache: Option<CacheConfig>,
+    /// `current_thread` (default), `multi_thread` or `shared`.
+    runtime: Option<RuntimeConfig>,
+    /// Capacity and backpressure policy of `dbx_enqueue_append`.
+    write_queue: Option<WriteQueueConfig>,
+    /// Pooling of `_v2` response buffers.
+    output_buffers: Option<BufferConfig>,
+    /// Backoff retries of reads and of connecting; one attempt when absent.
+    retry: Option<RetryConfig>,
+    /// Hedged reads on a second pooled connection; off when absent.
+    hedge: Option<HedgeConfig>,
+    /// Servers to spread the pool over; `host`/`port` when absent.
+    endpoints: Option<Vec<Endpoint>>,
+    /// Ejection of endpoints that keep failing.
+    health: Option<HealthConfig>,
+    /// Defers connecting to the first call (`true`) or to the background
+    /// (`"background"`); connects while the handle is created when absent.
+    lazy_connect: Option<LazyConnect>,
 }
 
 fn default_host(cfg: &ConfigInput) -> String {
@@ -58,6 +163,146 @@ fn default_tenant(cfg: &ConfigInput) -> String {
         .unwrap_or_else(|| "default".to_string())
 }
 
+/// Hashes the config with every default resolved, so two configs that reach
+/// the same server as the same principal map to the same shared handle.
+fn config_key(cfg: &ConfigInput) -> u64 {
+    let mut normalized = cfg.clone();
+    normalized.host = Some(default_host(cfg));
+    normalized.ip = None;
+    normalized.token = default_token(cfg);
+    normalized.tenant_id = Some(default_tenant(cfg));
+    normalized.tenant = None;
+    normalized.tenant_id_env = None;
+    normalized.shared = None;
+
+    let mut hasher = DefaultHasher::new();
+    normalized.hash(&mut hasher);
+    hasher.finish()
+}
+
+/// The configured endpoints, or the single `host`/`port` one.
+fn endpoints(cfg: &ConfigInput) -> Vec<Endpoint> {
+    match &cfg.endpoints {
+        Some(endpoints) if !endpoints.is_empty() => endpoints.clone(),
+        _ => vec![Endpoint::new(default_host(cfg), cfg.port)],
+    }
+}
+
+fn build_client_config(cfg: &ConfigInput, endpoint: &Endpoint) -> Result<ClientConfig, String> {
+    let token = default_token(cfg).ok_or_else(|| "token is required".to_string())?;
+    let mut client_cfg = ClientConfig::new(endpoint.host.clone(), token);
+    if let Some(port) = endpoint.port.or(cfg.port) {
+        client_cfg = client_cfg.with_port(port);
+    }
+    if let Some(protocol) = cfg.protocol_version {
+        client_cfg = client_cfg.with_protocol_version(protocol);
+    }
+    if let Some(connect) = cfg.connect_timeout_ms {
+        client_cfg = client_cfg.with_connect_timeout(Duration::from_millis(connect));
+    }
+    client_cfg = client_cfg.with_request_timeout(cfg.request_timeout_ms.map(Duration::from_millis));
+    client_cfg = client_cfg.with_tenant(default_tenant(cfg));
+    if let Some(no_noise) = cfg.no_noise {
+        client_cfg = client_cfg.with_noise(!no_noise);
+    }
+    Ok(client_cfg)
+}
+
+/// The first configured feature that only works when the runtime makes
+/// progress between calls; such a config never gets a current-thread
+/// runtime by default.
+fn background_feature(cfg: &ConfigInput) -> Option<&'static str> {
+    if cfg.write_queue.is_some() {
+        return Some("writeQueue");
+    }
+    if cfg.lazy_connect.is_some_and(LazyConnect::in_background) {
+        return Some("lazyConnect \"background\"");
+    }
+    None
+}
+
+fn connect_handle(cfg: &ConfigInput) -> Result<DbxHandle, String> {
+    for endpoint in endpoints(cfg) {
+        build_client_config(cfg, &endpoint)?;
+    }
+    let runtime = HandleRuntime::new(cfg.runtime.as_ref(), background_feature(cfg))?;
+    let metrics = Arc::new(Metrics::new());
+    let pool = runtime.block_on(Pool::connect(cfg.clone(), metrics.clone()))?;
+    Ok(DbxHandle {
+        runtime,
+        pid: std::process::id(),
+        pool: Arc::new(pool),
+        pending: Arc::new(Pending::new()?),
+        cache: Arc::new(Cache::new(cfg.cache.clone())),
+        metrics,
+        writes: OnceLock::new(),
+        write_config: cfg.write_queue.clone(),
+        statements: Statements::new(),
+        buffers: BufferPool::new(cfg.output_buffers.as_ref()),
+        sizer: Arc::new(PageSizer::new()),
+        format: cfg.response_format.unwrap_or_default(),
+        shared_key: None,
+        refs: AtomicUsize::new(1),
+    })
+}
+
+impl DbxHandle {
+    /// True in a child process forked after the handle was created. The
+    /// runtime threads and connections belong to the parent, so such a
+    /// handle must never be driven or torn down here.
+    fn inherited(&self) -> bool {
+        self.pid != std::process::id()
+    }
+
+    /// Gives queued appends up to `writeQueue.closeTimeoutMs` to be sent,
+    /// counting the ones that never will be reported.
+    fn close_writes(&self) {
+        if let Some(queue) = self.writes.get() {
+            let lost = self.runtime.block_on(queue.close());
+            if lost > 0 {
+                metrics::lost_on_close(lost);
+            }
+        }
+    }
+}
+
+/// Frees a handle nobody references any more, first closing its write
+/// queue. Only called from the free/evict exports, which PHP calls outside
+/// any runtime, so the blocking close cannot panic inside one.
+fn free(handle: *mut DbxHandle) {
+    let client = unsafe { Box::from_raw(handle) };
+    client.close_writes();
+    drop(client);
+}
+
+/// Rejects null handles and handles inherited across `fork`.
+fn check_handle(handle: *mut DbxHandle) -> Result<(), String> {
+    if handle.is_null() {
+        return Err("handle is null".to_string());
+    }
+    if unsafe { &*handle }.inherited() {
+        return Err(
+            "handle was created before fork; create a new client in this process".to_string(),
+        );
+    }
+    Ok(())
+}
+
+/// Fails a started call before it reaches the server (bad arguments), still
+/// recording it in the handle's metrics. `handle` must have passed
+/// `check_handle`.
+fn reject(
+    handle: *mut DbxHandle,
+    call: Call,
+    error_out: *mut *mut c_char,
+    msg: impl Into<String>,
+) {
+    unsafe { &*handle }
+        .metrics
+        .finish(call, false, Duration::ZERO, 0);
+    set_error(error_out, msg);
+}
+
 fn set_error(out: *mut *mut c_char, msg: impl Into<String>) {
     if out.is_null() {
         return;
@@ -117,6 +362,20 @@ mod tests {
         assert!(publish_targets.is_empty());
     }
 
+    #[test]
+    fn raw_payload_is_read_by_length_and_replaces_option_payload() {
+        let bytes = b"{\"n\":1}trailing";
+        let payload = parse_json_bytes(bytes_from_ptr(bytes.as_ptr().cast(), 7)).unwrap();
+        let merged = with_payload(serde_json::json!({ "payload": { "n": 0 }, "note": "x" }), payload);
+        let (payload, note, ..) = parse_payload_options(merged);
+        assert_eq!(payload, serde_json::json!({ "n": 1 }));
+        assert_eq!(note.as_deref(), Some("x"));
+
+        assert_eq!(parse_json_bytes(bytes_from_ptr(std::ptr::null(), 4)).unwrap(), Value::Null);
+        assert_eq!(parse_json_bytes(b" \n").unwrap(), Value::Null);
+        assert!(parse_json_bytes(b"{").is_err());
+    }
+
     #[test]
     fn payload_options_reads_fields() {
         let input = serde_json::json!({
@@ -135,6 +394,242 @@ mod tests {
         assert_eq!(publish_targets[0].plugin, "search");
         assert_eq!(publish_targets[0].mode.as_deref(), Some("all"));
     }
+
+    fn config(value: Value) -> ConfigInput {
+        serde_json::from_value(value).unwrap()
+    }
+
+    #[test]
+    fn config_key_ignores_aliases_and_shared_flag() {
+        let a = config(serde_json::json!({ "host": "10.0.0.1", "token": "t", "tenantId": "acme" }));
+        let b = config(
+            serde_json::json!({ "ip": "10.0.0.1", "token": "t", "tenant": "acme", "shared": true }),
+        );
+        assert_eq!(config_key(&a), config_key(&b));
+    }
+
+    #[test]
+    fn config_key_distinguishes_principals() {
+        let a = config(serde_json::json!({ "host": "10.0.0.1", "token": "t1" }));
+        let b = config(serde_json::json!({ "host": "10.0.0.1", "token": "t2" }));
+        let c = config(serde_json::json!({ "host": "10.0.0.1", "token": "t1", "port": 7000 }));
+        assert_ne!(config_key(&a), config_key(&b));
+        assert_ne!(config_key(&a), config_key(&c));
+    }
+
+    #[test]
+    fn refs_accept_bare_ids_and_objects() {
+        let ids = serde_json::json!([
+            "a",
+            { "aggregateId": "b" },
+            { "aggregate_type": "order", "aggregate_id": "c" }
+        ]);
+        let refs = parse_refs("person", ids).unwrap();
+        assert_eq!(refs[0], ("person".to_string(), "a".to_string()));
+        assert_eq!(refs[1], ("person".to_string(), "b".to_string()));
+        assert_eq!(refs[2], ("order".to_string(), "c".to_string()));
+
+        assert!(parse_refs("", serde_json::json!(["a"])).is_err());
+        assert!(parse_refs("", serde_json::json!([{ "aggregateId": "a" }])).is_err());
+    }
+
+    #[test]
+    fn multi_payload_keys_by_id_for_single_type() {
+        let refs = vec![
+            ("person".to_string(), "a".to_string()),
+            ("person".to_string(), "b".to_string()),
+        ];
+        let results = vec![
+            Ok(Reply::Lookup {
+                found: true,
+                aggregate: serde_json::json!({ "id": "a" }),
+            }),
+            Err("boom".to_string()),
+        ];
+        let payload = serde_json::to_value(multi_payload("person", refs, results)).unwrap();
+        assert_eq!(payload["items"]["a"]["found"], Value::Bool(true));
+        assert_eq!(payload["items"]["b"]["error"], Value::String("boom".to_string()));
+
+        let refs = vec![("order".to_string(), "c".to_string())];
+        let results = vec![Ok(Reply::Lookup {
+            found: false,
+            aggregate: Value::Null,
+        })];
+        let payload = serde_json::to_value(multi_payload("", refs, results)).unwrap();
+        assert_eq!(payload["items"][0]["aggregateType"], Value::String("order".to_string()));
+        assert_eq!(payload["items"][0]["found"], Value::Bool(false));
+    }
+
+    #[test]
+    fn append_entry_requires_identifiers() {
+        let entry = serde_json::json!({ "aggregateType": "person" });
+        let err = parse_append_entry(entry, &Map::new()).err().unwrap();
+        assert_eq!(err, "aggregateId is required");
+        assert!(parse_append_entry(Value::String("nope".to_string()), &Map::new()).is_err());
+    }
+
+    #[test]
+    fn append_entry_applies_batch_defaults() {
+        let defaults = serde_json::json!({
+            "token": "batch-token",
+            "publishTargets": [{ "plugin": "search" }]
+        });
+        let entry = serde_json::json!({
+            "aggregate_type": "person",
+            "aggregate_id": "p-1",
+            "eventType": "person_updated",
+            "payload": { "status": "active" }
+        });
+        let request = parse_append_entry(entry, defaults.as_object().unwrap()).unwrap();
+        assert_eq!(request.token.as_deref(), Some("batch-token"));
+        assert_eq!(request.publish_targets.len(), 1);
+
+        let entry = serde_json::json!({
+            "aggregateType": "person",
+            "aggregateId": "p-2",
+            "eventType": "person_updated",
+            "token": "own-token"
+        });
+        let request = parse_append_entry(entry, defaults.as_object().unwrap()).unwrap();
+        assert_eq!(request.token.as_deref(), Some("own-token"));
+    }
+
+    #[test]
+    fn rejected_arguments_are_counted_as_failed_calls() {
+        let config = CString::new(r#"{"token":"t","host":"db.invalid","lazyConnect":true}"#).unwrap();
+        let handle = dbx_client_new(config.as_ptr(), std::ptr::null_mut());
+        assert!(!handle.is_null());
+        let (agg_type, agg_id, options) = (
+            CString::new("person").unwrap(),
+            CString::new("p-1").unwrap(),
+            CString::new("{").unwrap(),
+        );
+        let mut error: *mut c_char = std::ptr::null_mut();
+        let reply = dbx_list_events(handle, agg_type.as_ptr(), agg_id.as_ptr(), options.as_ptr(), &mut error);
+        assert!(reply.is_null());
+        assert!(!error.is_null());
+        dbx_string_free(error);
+
+        let snapshot = serde_json::to_value(unsafe { &*handle }.metrics.snapshot()).unwrap();
+        assert_eq!(snapshot["ops"]["dbx_list_events"]["calls"], 1);
+        assert_eq!(snapshot["ops"]["dbx_list_events"]["errors"], 1);
+        dbx_client_free(handle);
+    }
+
+    #[test]
+    fn execute_requires_an_aggregate_id_and_reports_bad_utf8() {
+        let config = CString::new(r#"{"token":"t","host":"db.invalid","lazyConnect":true}"#).unwrap();
+        let handle = dbx_client_new(config.as_ptr(), std::ptr::null_mut());
+        let (operation, agg_type) = (CString::new("events").unwrap(), CString::new("person").unwrap());
+        let mut error: *mut c_char = std::ptr::null_mut();
+        let statement = dbx_prepare(handle, operation.as_ptr(), agg_type.as_ptr(), std::ptr::null(), &mut error);
+        assert!(error.is_null());
+
+        let execute = |aggregate_id: *const c_char| {
+            let mut error: *mut c_char = std::ptr::null_mut();
+            let reply = dbx_execute(handle, statement, aggregate_id, std::ptr::null(), std::ptr::null(), &mut error);
+            assert!(reply.is_null());
+            let message = unsafe { CStr::from_ptr(error) }.to_string_lossy().into_owned();
+            dbx_string_free(error);
+            message
+        };
+        let empty = CString::new("").unwrap();
+        let invalid = CString::new(vec![0xff, 0xfe]).unwrap();
+        assert_eq!(execute(std::ptr::null()), "aggregate_id is required for this statement");
+        assert_eq!(execute(empty.as_ptr()), "aggregate_id is required for this statement");
+        assert!(execute(invalid.as_ptr()).starts_with("invalid utf-8"));
+        dbx_client_free(handle);
+    }
+
+    #[test]
+    fn one_shared_handle_serves_many_threads() {
+        let config = CString::new(
+            r#"{"token":"t","host":"db.invalid","shared":true,"lazyConnect":true,"poolSize":2,"runtime":"multi_thread"}"#,
+        )
+        .unwrap();
+        let open = || {
+            let handle = dbx_client_new(config.as_ptr(), std::ptr::null_mut());
+            assert!(!handle.is_null());
+            handle as usize
+        };
+        let first = open();
+        let handles: Vec<usize> = std::thread::scope(|scope| {
+            let workers: Vec<_> = (0..8)
+                .map(|_| {
+                    scope.spawn(|| {
+                        let handle = open();
+                        let (agg_type, agg_id) = (CString::new("person").unwrap(), CString::new("p-1").unwrap());
+                        for _ in 0..4 {
+                            let mut error: *mut c_char = std::ptr::null_mut();
+                            let reply = dbx_get_aggregate(handle as *mut DbxHandle, agg_type.as_ptr(), agg_id.as_ptr(), &mut error);
+                            assert!(reply.is_null());
+                            assert!(!error.is_null());
+                            dbx_string_free(error);
+                        }
+                        handle
+                    })
+                })
+                .collect();
+            workers.into_iter().map(|worker| worker.join().unwrap()).collect()
+        });
+        assert!(handles.iter().all(|&handle| handle == first));
+        let handle = first as *mut DbxHandle;
+        assert_eq!(unsafe { &*handle }.refs.load(std::sync::atomic::Ordering::Relaxed), 9);
+        for _ in 0..8 {
+            dbx_client_free(handle);
+        }
+        dbx_client_evict(handle);
+        // the last reference frees it
+        dbx_client_free(handle);
+    }
+
+    #[test]
+    fn idle_shared_handles_drain_while_still_referenced() {
+        let config = CString::new(
+            r#"{"token":"t","host":"db.invalid","shared":true,"lazyConnect":true,"runtime":"multi_thread","writeQueue":{"closeTimeoutMs":20}}"#,
+        )
+        .unwrap();
+        let (agg_type, agg_id, event) = (
+            CString::new("person").unwrap(),
+            CString::new("p-1").unwrap(),
+            CString::new("renamed").unwrap(),
+        );
+        let cycle = || {
+            let handle = dbx_client_new(config.as_ptr(), std::ptr::null_mut());
+            assert!(!handle.is_null());
+            let mut error: *mut c_char = std::ptr::null_mut();
+            dbx_enqueue_append(handle, agg_type.as_ptr(), agg_id.as_ptr(), event.as_ptr(), std::ptr::null(), &mut error);
+            assert!(error.is_null());
+            handle
+        };
+
+        let first = cycle();
+        dbx_client_free(first);
+        // drained but still registered, with no references left
+        assert_eq!(unsafe { &*first }.refs.load(std::sync::atomic::Ordering::Relaxed), 0);
+        let again = cycle();
+        assert_eq!(again, first);
+        dbx_client_free(again);
+
+        // evicting from one thread while others release the last reference
+        std::thread::scope(|scope| {
+            for worker in 0..4 {
+                let cycle = &cycle;
+                scope.spawn(move || {
+                    for round in 0..5 {
+                        let handle = cycle();
+                        if (worker + round) % 3 == 0 {
+                            dbx_client_evict(handle);
+                        }
+                        dbx_client_free(handle);
+                    }
+                });
+            }
+        });
+        let last = cycle();
+        dbx_client_evict(last);
+        dbx_client_free(last);
+    }
 }
 fn clear_error(out: *mut *mut c_char) {
     if out.is_null() {
@@ -159,21 +654,114 @@ fn parse_json(ptr: *const c_char) -> Result<Value, String> {
     if ptr.is_null() {
         return Ok(Value::Null);
     }
-    let text = string_from_ptr(ptr)?;
-    if text.trim().is_empty() {
+    parse_json_bytes(unsafe { CStr::from_ptr(ptr) }.to_bytes())
+}
+
+/// Borrows `len` bytes at `ptr` without a NUL scan or copy; null is empty.
+fn bytes_from_ptr<'a>(ptr: *const c_char, len: usize) -> &'a [u8] {
+    if ptr.is_null() || len == 0 {
+        return &[];
+    }
+    unsafe { std::slice::from_raw_parts(ptr.cast::<u8>(), len) }
+}
+
+/// Parses JSON straight from the caller's bytes; blank input is null.
+fn parse_json_bytes(bytes: &[u8]) -> Result<Value, String> {
+    if bytes.iter().all(u8::is_ascii_whitespace) {
         return Ok(Value::Null);
     }
-    serde_json::from_str(&text).map_err(|e| format!("invalid json: {e}"))
+    serde_json::from_slice(bytes).map_err(|e| format!("invalid json: {e}"))
+}
+
+impl DbxHandle {
+    /// Encodes a reply in the handle's response format, serializing straight
+    /// from the typed reply without an intermediate `Value` tree, and records
+    /// the call in the handle metrics.
+    fn respond(
+        &self,
+        call: Call,
+        result: Result<Reply, String>,
+        error_out: *mut *mut c_char,
+    ) -> *mut c_char {
+        self.finish(call, result, error_out, |reply| reply::encode(self.format, reply))
+            .unwrap_or(std::ptr::null_mut())
+    }
+
+    /// `respond` for the `_v2` exports, which return a `DbxBuf`.
+    fn respond_buf(
+        &self,
+        call: Call,
+        result: Result<Reply, String>,
+        error_out: *mut *mut c_char,
+    ) -> DbxBuf {
+        self.finish(call, result, error_out, |reply| {
+            reply::encode_buf(self.format, reply, self.buffers.take()).map(|buf| {
+                let len = buf.len;
+                (buf, len)
+            })
+        })
+        .unwrap_or(DbxBuf::EMPTY)
+    }
+
+    fn finish<T>(
+        &self,
+        call: Call,
+        result: Result<Reply, String>,
+        error_out: *mut *mut c_char,
+        encode: impl FnOnce(&Reply) -> Result<(T, usize), String>,
+    ) -> Option<T> {
+        let encoding = Instant::now();
+        let encoded = result.and_then(|reply| encode(&reply));
+        let serialize = encoding.elapsed();
+        match encoded {
+            Ok((out, len)) => {
+                self.metrics.finish(call, true, serialize, len);
+                Some(out)
+            }
+            Err(err) => {
+                self.metrics.finish(call, false, serialize, 0);
+                set_error(error_out, err);
+                None
+            }
+        }
+    }
 }
 
-fn to_cstring(json: Value) -> Result<*mut c_char, String> {
-    serde_json::to_string(&json)
-        .map_err(|e| format!("failed to serialize json: {e}"))
-        .and_then(|s| CString::new(s).map_err(|e| format!("failed to build c string: {e}")))
-        .map(|c| c.into_raw())
+/// One parsed `sort` entry. Unlike `AggregateSort` it is `Copy`, so
+/// prepared statements can keep it and build requests from it repeatedly.
+#[derive(Clone, Copy)]
+enum SortField {
+    AggregateType,
+    AggregateId,
+    Archived,
+    CreatedAt,
+    UpdatedAt,
 }
 
-fn parse_sort(value: Option<&Value>) -> Vec<AggregateSort> {
+impl SortField {
+    fn sort(self, descending: bool) -> AggregateSort {
+        let field = match self {
+            SortField::AggregateType => AggregateSortField::AggregateType,
+            SortField::AggregateId => AggregateSortField::AggregateId,
+            SortField::Archived => AggregateSortField::Archived,
+            SortField::CreatedAt => AggregateSortField::CreatedAt,
+            SortField::UpdatedAt => AggregateSortField::UpdatedAt,
+        };
+        AggregateSort { field, descending }
+    }
+
+    fn of(field: &AggregateSortField) -> SortField {
+        match field {
+            AggregateSortField::AggregateType => SortField::AggregateType,
+            AggregateSortField::AggregateId => SortField::AggregateId,
+            AggregateSortField::Archived => SortField::Archived,
+            AggregateSortField::CreatedAt => SortField::CreatedAt,
+            AggregateSortField::UpdatedAt => SortField::UpdatedAt,
+        }
+    }
+}
+
+fn parse_sort_fields(value: Option<&Value>) -> Vec<(SortField, bool)> {
     let mut sorts = Vec::new();
     let Some(Value::String(text)) = value else {
         return sorts;
@@ -183,19 +771,26 @@ fn parse_sort(value: Option<&Value>) -> Vec<AggregateSort> {
         let field_raw = iter.next().unwrap_or_default().trim().to_lowercase();
         let order_raw = iter.next().unwrap_or("asc").trim().to_lowercase();
         let field = match field_raw.as_str() {
-            "aggregate_type" | "type" => AggregateSortField::AggregateType,
-            "aggregate_id" | "id" => AggregateSortField::AggregateId,
-            "archived" => AggregateSortField::Archived,
-            "created_at" => AggregateSortField::CreatedAt,
-            "updated_at" => AggregateSortField::UpdatedAt,
+            "aggregate_type" | "type" => SortField::AggregateType,
+            "aggregate_id" | "id" => SortField::AggregateId,
+            "archived" => SortField::Archived,
+            "created_at" => SortField::CreatedAt,
+            "updated_at" => SortField::UpdatedAt,
             _ => continue,
         };
         let descending = matches!(order_raw.as_str(), "desc" | "descending");
-        sorts.push(AggregateSort { field, descending });
+        sorts.push((field, descending));
     }
     sorts
 }
 
+fn parse_sort(value: Option<&Value>) -> Vec<AggregateSort> {
+    parse_sort_fields(value)
+        .into_iter()
+        .map(|(field, descending)| field.sort(descending))
+        .collect()
+}
+
 fn parse_publish_targets(value: Option<&Value>) -> Vec<PublishTarget> {
     let mut targets = Vec::new();
     if let Some(Value::Array(items)) = value {
@@ -225,6 +820,13 @@ pub extern "C" fn dbx_string_free(ptr: *mut c_char) {
     }
 }
 
+/// Frees a length-prefixed buffer returned by a handle configured with
+/// `responseFormat: "msgpack"`.
+#[no_mangle]
+pub extern "C" fn dbx_bytes_free(ptr: *mut c_char) {
+    unsafe { reply::free_bytes(ptr) }
+}
+
 #[no_mangle]
 pub extern "C" fn dbx_client_new(
     config_json: *const c_char,
@@ -253,56 +855,63 @@ pub extern "C" fn dbx_client_new(
         }
     };
 
-    let host = default_host(&cfg);
-    let token = match default_token(&cfg) {
-        Some(token) => token,
-        None => {
-            set_error(error_out, "token is required");
-            return std::ptr::null_mut();
-        }
-    };
-    let mut client_cfg = ClientConfig::new(host, token);
-    if let Some(port) = cfg.port {
-        client_cfg = client_cfg.with_port(port);
-    }
-    if let Some(protocol) = cfg.protocol_version {
-        client_cfg = client_cfg.with_protocol_version(protocol);
-    }
-    if let Some(connect) = cfg.connect_timeout_ms {
-        client_cfg = client_cfg.with_connect_timeout(Duration::from_millis(connect));
-    }
-    client_cfg = client_cfg.with_request_timeout(cfg.request_timeout_ms.map(Duration::from_millis));
-    client_cfg = client_cfg.with_tenant(default_tenant(&cfg));
-    if let Some(no_noise) = cfg.no_noise {
-        client_cfg = client_cfg.with_noise(!no_noise);
+    if cfg.shared.unwrap_or(false) {
+        return match registry::acquire(config_key(&cfg), || connect_handle(&cfg)) {
+            Ok(handle) => handle,
+            Err(err) => {
+                set_error(error_out, err);
+                std::ptr::null_mut()
+            }
+        };
     }
 
-    let runtime = match Runtime::new() {
-        Ok(rt) => rt,
+    match connect_handle(&cfg) {
+        Ok(handle) => Box::into_raw(Box::new(handle)),
         Err(err) => {
-            set_error(error_out, format!("failed to create runtime: {err}"));
-            return std::ptr::null_mut();
+            set_error(error_out, err);
+            std::ptr::null_mut()
         }
-    };
+    }
+}
 
-    let client = match runtime.block_on(EventDbxClient::connect(client_cfg)) {
-        Ok(client) => client,
-        Err(err) => {
-            set_error(error_out, format!("failed to connect: {err}"));
-            return std::ptr::null_mut();
+/// Releases a handle. Shared handles are only dropped once they have been
+/// evicted and no references remain; otherwise they stay connected for reuse.
+#[no_mangle]
+pub extern "C" fn dbx_client_free(handle: *mut DbxHandle) {
+    if handle.is_null() || unsafe { &*handle }.inherited() {
+        // leaked on purpose after fork: dropping would shut down the parent's
+        // runtime and deregister its sockets
+        return;
+    }
+    match registry::release(handle, false) {
+        Release::Free => free(handle),
+        Release::Idle => {
+            // An idle shared handle may never be freed (it is leaked at
+            // process exit), so let its queue drain while the process is
+            // still here and this reference keeps it alive. The
+            // acknowledgements stay for whoever flushes next.
+            let client = unsafe { &*handle };
+            if let Some(queue) = client.writes.get() {
+                client.runtime.block_on(queue.idle());
+            }
+            if registry::release(handle, true) == Release::Free {
+                free(handle);
+            }
         }
-    };
-
-    Box::into_raw(Box::new(DbxHandle { runtime, client }))
+        Release::Keep => {}
+    }
 }
 
+/// Removes a shared handle from the registry. The handle remains valid for
+/// existing holders and is dropped by the last `dbx_client_free`. No-op for
+/// handles created without `shared: true`.
 #[no_mangle]
-pub extern "C" fn dbx_client_free(handle: *mut DbxHandle) {
-    if handle.is_null() {
+pub extern "C" fn dbx_client_evict(handle: *mut DbxHandle) {
+    if handle.is_null() || unsafe { &*handle }.inherited() {
         return;
     }
-    unsafe {
-        drop(Box::from_raw(handle));
+    if registry::evict(handle) {
+        free(handle);
     }
 }
 
@@ -313,26 +922,50 @@ pub extern "C" fn dbx_list_aggregates(
     options_json: *const c_char,
     error_out: *mut *mut c_char,
 ) -> *mut c_char {
+    let call = Call::start(Op::ListAggregates);
     clear_error(error_out);
-    if handle.is_null() {
-        set_error(error_out, "handle is null");
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
         return std::ptr::null_mut();
     }
     let agg_type = match string_from_ptr(aggregate_type) {
         Ok(s) if s.is_empty() => None,
         Ok(s) => Some(s),
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let opts_value = match parse_json(options_json) {
         Ok(v) => v,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let projection = match Projection::from_options(&opts_value) {
+        Ok(p) => p,
+        Err(err) => {
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
+    let opts = parse_list_aggregates_options(agg_type, &opts_value);
+
+    let client = unsafe { &*handle };
+    client.respond(
+        call,
+        client
+            .runtime
+            .block_on(list_aggregates_payload(client.pool.clone(), opts, projection)),
+        error_out,
+    )
+}
+
+fn parse_list_aggregates_options(
+    agg_type: Option<String>,
+    opts_value: &Value,
+) -> ListAggregatesOptions {
     let mut opts = ListAggregatesOptions::default();
     if let Some(map) = opts_value.as_object() {
         if let Some(cursor) = map.get("cursor").and_then(Value::as_str) {
@@ -360,41 +993,39 @@ pub extern "C" fn dbx_list_aggregates(
             opts.filter = Some(format!("aggregate_type = \"{agg_type}\""));
         }
     }
+    opts
+}
 
-    let client = unsafe { &mut *handle };
-    let response = match client
-        .runtime
-        .block_on(client.client.list_aggregates(opts))
-    {
-        Ok(resp) => resp,
-        Err(err) => {
-            set_error(error_out, err.to_string());
-            return std::ptr::null_mut();
-        }
-    };
-
-    let payload = Value::Object(
-        [
-            ("items".to_string(), response.aggregates),
-            (
-                "nextCursor".to_string(),
-                response
-                    .next_cursor
-                    .map(Value::String)
-                    .unwrap_or(Value::Null),
-            ),
-        ]
-        .into_iter()
-        .collect(),
-    );
+/// A copy of `opts` for each attempt of a retried or hedged listing; the
+/// client option types are not `Clone`.
+fn copy_list_aggregates_options(opts: &ListAggregatesOptions) -> ListAggregatesOptions {
+    let mut copy = ListAggregatesOptions::default();
+    copy.cursor = opts.cursor.clone();
+    copy.take = opts.take;
+    copy.filter = opts.filter.clone();
+    copy.include_archived = opts.include_archived;
+    copy.archived_only = opts.archived_only;
+    copy.token = opts.token.clone();
+    copy.sort = opts
+        .sort
+        .iter()
+        .map(|sort| SortField::of(&sort.field).sort(sort.descending))
+        .collect();
+    copy
+}
 
-    match to_cstring(payload) {
-        Ok(ptr) => ptr,
-        Err(err) => {
-            set_error(error_out, err);
-            std::ptr::null_mut()
-        }
-    }
+async fn list_aggregates_payload(
+    pool: Arc<Pool>,
+    opts: ListAggregatesOptions,
+    projection: Option<Arc<Projection>>,
+) -> Result<Reply, String> {
+    let opts = &opts;
+    let response =
+        read_conn!(pool, |conn| conn.list_aggregates(copy_list_aggregates_options(opts))).await?;
+    Ok(Reply::Page {
+        items: project(projection.as_deref(), response.aggregates),
+        next_cursor: response.next_cursor,
+    })
 }
 
 #[no_mangle]
@@ -405,29 +1036,30 @@ pub extern "C" fn dbx_create_snapshot(
     options_json: *const c_char,
     error_out: *mut *mut c_char,
 ) -> *mut c_char {
+    let call = Call::start(Op::CreateSnapshot);
     clear_error(error_out);
-    if handle.is_null() {
-        set_error(error_out, "handle is null");
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
         return std::ptr::null_mut();
     }
     let agg_type = match string_from_ptr(aggregate_type) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let agg_id = match string_from_ptr(aggregate_id) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let opts_value = match parse_json(options_json) {
         Ok(v) => v,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
@@ -438,31 +1070,14 @@ pub extern "C" fn dbx_create_snapshot(
         request.token = map.get("token").and_then(Value::as_str).map(|s| s.to_string());
     }
 
-    let client = unsafe { &mut *handle };
-    let response = match client
+    let client = unsafe { &*handle };
+    let result = client
         .runtime
-        .block_on(client.client.create_snapshot(request))
-    {
-        Ok(resp) => resp,
-        Err(err) => {
-            set_error(error_out, err.to_string());
-            return std::ptr::null_mut();
-        }
-    };
-
-    let payload = Value::Object(
-        [("snapshot".to_string(), response.snapshot)]
-            .into_iter()
-            .collect(),
-    );
-
-    match to_cstring(payload) {
-        Ok(ptr) => ptr,
-        Err(err) => {
-            set_error(error_out, err);
-            std::ptr::null_mut()
-        }
-    }
+        .block_on(with_conn!(client.pool, |conn| conn.create_snapshot(request)))
+        .map(|response| Reply::Snapshot {
+            snapshot: response.snapshot,
+        });
+    client.respond(call, result, error_out)
 }
 
 #[no_mangle]
@@ -471,16 +1086,17 @@ pub extern "C" fn dbx_list_snapshots(
     options_json: *const c_char,
     error_out: *mut *mut c_char,
 ) -> *mut c_char {
+    let call = Call::start(Op::ListSnapshots);
     clear_error(error_out);
-    if handle.is_null() {
-        set_error(error_out, "handle is null");
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
         return std::ptr::null_mut();
     }
 
     let opts_value = match parse_json(options_json) {
         Ok(v) => v,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
@@ -501,28 +1117,14 @@ pub extern "C" fn dbx_list_snapshots(
         opts.token = map.get("token").and_then(Value::as_str).map(|s| s.to_string());
     }
 
-    let client = unsafe { &mut *handle };
-    let response = match client.runtime.block_on(client.client.list_snapshots(opts)) {
-        Ok(resp) => resp,
-        Err(err) => {
-            set_error(error_out, err.to_string());
-            return std::ptr::null_mut();
-        }
-    };
-
-    let payload = Value::Object(
-        [("items".to_string(), response.snapshots)]
-            .into_iter()
-            .collect(),
-    );
-
-    match to_cstring(payload) {
-        Ok(ptr) => ptr,
-        Err(err) => {
-            set_error(error_out, err);
-            std::ptr::null_mut()
-        }
-    }
+    let client = unsafe { &*handle };
+    let result = client
+        .runtime
+        .block_on(with_conn!(client.pool, |conn| conn.list_snapshots(opts)))
+        .map(|response| Reply::Snapshots {
+            items: response.snapshots,
+        });
+    client.respond(call, result, error_out)
 }
 
 #[no_mangle]
@@ -532,190 +1134,386 @@ pub extern "C" fn dbx_get_snapshot(
     options_json: *const c_char,
     error_out: *mut *mut c_char,
 ) -> *mut c_char {
+    let call = Call::start(Op::GetSnapshot);
     clear_error(error_out);
-    if handle.is_null() {
-        set_error(error_out, "handle is null");
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
         return std::ptr::null_mut();
     }
 
     let opts_value = match parse_json(options_json) {
         Ok(v) => v,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
 
-    let mut request = GetSnapshotRequest::new(snapshot_id);
-    if let Some(map) = opts_value.as_object() {
-        request.token = map.get("token").and_then(Value::as_str).map(|s| s.to_string());
-    }
-
-    let client = unsafe { &mut *handle };
-    let response = match client.runtime.block_on(client.client.get_snapshot(request)) {
-        Ok(resp) => resp,
-        Err(err) => {
-            set_error(error_out, err.to_string());
-            return std::ptr::null_mut();
-        }
+    let token = opts_value
+        .as_object()
+        .and_then(|map| map.get("token"))
+        .and_then(Value::as_str)
+        .map(|s| s.to_string());
+    let token = &token;
+    let request = move || {
+        let mut request = GetSnapshotRequest::new(snapshot_id);
+        request.token = token.clone();
+        request
     };
 
-    let payload = Value::Object(
-        [
-            ("found".to_string(), Value::Bool(response.found)),
-            (
-                "snapshot".to_string(),
-                response.snapshot.unwrap_or(Value::Null),
-            ),
-        ]
-        .into_iter()
-        .collect(),
-    );
-
-    match to_cstring(payload) {
-        Ok(ptr) => ptr,
-        Err(err) => {
-            set_error(error_out, err);
-            std::ptr::null_mut()
-        }
-    }
+    let client = unsafe { &*handle };
+    let result = client
+        .runtime
+        .block_on(read_conn!(client.pool, |conn| conn.get_snapshot(request())))
+        .map(|response| Reply::SnapshotLookup {
+            found: response.found,
+            snapshot: response.snapshot.unwrap_or(Value::Null),
+        });
+    client.respond(call, result, error_out)
 }
 
+/// Latest snapshot of an aggregate plus the events recorded after it, as
+/// `{snapshot, tailEvents}`; see `state.rs` for the `snapshotAfter` policy.
 #[no_mangle]
-pub extern "C" fn dbx_get_aggregate(
+pub extern "C" fn dbx_load_state(
     handle: *mut DbxHandle,
     aggregate_type: *const c_char,
     aggregate_id: *const c_char,
+    options_json: *const c_char,
     error_out: *mut *mut c_char,
 ) -> *mut c_char {
+    let call = Call::start(Op::LoadState);
     clear_error(error_out);
-    if handle.is_null() {
-        set_error(error_out, "handle is null");
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
         return std::ptr::null_mut();
     }
     let agg_type = match string_from_ptr(aggregate_type) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let agg_id = match string_from_ptr(aggregate_id) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
-
-    let client = unsafe { &mut *handle };
-    let response = match client.runtime.block_on(client.client.get_aggregate(&agg_type, &agg_id)) {
-        Ok(resp) => resp,
+    let options = match parse_json(options_json).and_then(LoadStateOptions::parse) {
+        Ok(options) => options,
         Err(err) => {
-            set_error(error_out, err.to_string());
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
 
-    let payload = Value::Object(
-        [
-            ("found".to_string(), Value::Bool(response.found)),
-            (
-                "aggregate".to_string(),
-                response.aggregate.unwrap_or(Value::Null),
-            ),
-        ]
-        .into_iter()
-        .collect(),
-    );
-
-    match to_cstring(payload) {
-        Ok(ptr) => ptr,
-        Err(err) => {
-            set_error(error_out, err);
-            std::ptr::null_mut()
-        }
-    }
+    let client = unsafe { &*handle };
+    client.respond(
+        call,
+        client
+            .runtime
+            .block_on(state::load_state(&client.pool, agg_type, agg_id, options)),
+        error_out,
+    )
 }
 
 #[no_mangle]
-pub extern "C" fn dbx_select_aggregate(
+pub extern "C" fn dbx_get_aggregate(
     handle: *mut DbxHandle,
     aggregate_type: *const c_char,
     aggregate_id: *const c_char,
-    fields_json: *const c_char,
     error_out: *mut *mut c_char,
 ) -> *mut c_char {
+    let call = Call::start(Op::GetAggregate);
     clear_error(error_out);
-    if handle.is_null() {
-        set_error(error_out, "handle is null");
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
         return std::ptr::null_mut();
     }
     let agg_type = match string_from_ptr(aggregate_type) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let agg_id = match string_from_ptr(aggregate_id) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
-    let fields_value = match parse_json(fields_json) {
-        Ok(v) => v,
+
+    let client = unsafe { &*handle };
+    client.respond(
+        call,
+        client
+            .runtime
+            .block_on(get_aggregate_payload(client.pool.clone(), client.cache.clone(), agg_type, agg_id)),
+        error_out,
+    )
+}
+
+async fn get_aggregate_payload(
+    pool: Arc<Pool>,
+    cache: Arc<Cache>,
+    agg_type: String,
+    agg_id: String,
+) -> Result<Reply, String> {
+    if let Some((found, aggregate)) = cache.get(&agg_type, &agg_id, None) {
+        return Ok(Reply::Lookup { found, aggregate });
+    }
+    let epoch = cache.epoch();
+    let (t, id) = (&agg_type, &agg_id);
+    let response = read_conn!(pool, |conn| conn.get_aggregate(t, id)).await?;
+    let aggregate = response.aggregate.unwrap_or(Value::Null);
+    cache.put(epoch, &agg_type, &agg_id, None, response.found, &aggregate);
+    Ok(Reply::Lookup {
+        found: response.found,
+        aggregate,
+    })
+}
+
+/// Aggregates named by a multi-get: bare ids of `default_type`, or
+/// `{aggregateType, aggregateId}` refs when no default type is given.
+fn parse_refs(default_type: &str, ids_value: Value) -> Result<Vec<(String, String)>, String> {
+    let items = match ids_value {
+        Value::Array(items) => items,
+        Value::Null => Vec::new(),
+        _ => return Err("ids must be a JSON array".to_string()),
+    };
+    items
+        .into_iter()
+        .map(|item| match item {
+            Value::String(id) if !default_type.is_empty() => Ok((default_type.to_string(), id)),
+            Value::String(_) => Err("aggregate_type is required for bare ids".to_string()),
+            Value::Object(map) => {
+                let agg_type = entry_string(&map, "aggregateType", "aggregate_type")
+                    .or_else(|err| {
+                        if default_type.is_empty() {
+                            Err(err)
+                        } else {
+                            Ok(default_type.to_string())
+                        }
+                    })?;
+                let agg_id = entry_string(&map, "aggregateId", "aggregate_id")?;
+                Ok((agg_type, agg_id))
+            }
+            _ => Err("ids must be strings or {aggregateType, aggregateId} objects".to_string()),
+        })
+        .collect()
+}
+
+/// Shapes per-aggregate results of a multi-get: keyed by id when every ref
+/// shares `default_type`, otherwise a list tagged with type and id.
+fn multi_payload(
+    default_type: &str,
+    refs: Vec<(String, String)>,
+    results: Vec<Result<Reply, String>>,
+) -> Reply {
+    let entries = refs.into_iter().zip(results.into_iter().map(Reply::item));
+    if default_type.is_empty() {
+        Reply::Refs {
+            items: entries
+                .map(|((aggregate_type, aggregate_id), reply)| TaggedReply {
+                    aggregate_type,
+                    aggregate_id,
+                    reply,
+                })
+                .collect(),
+        }
+    } else {
+        Reply::ById {
+            items: entries.map(|((_, agg_id), reply)| (agg_id, reply)).collect(),
+        }
+    }
+}
+
+/// Looks up many aggregates concurrently across the pool. `ids_json` holds
+/// ids of `aggregate_type`, or `{aggregateType, aggregateId}` refs when
+/// `aggregate_type` is empty. Lookup failures are reported per item.
+#[no_mangle]
+pub extern "C" fn dbx_get_aggregates(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    ids_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    let call = Call::start(Op::GetAggregates);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let agg_type = match string_from_ptr(aggregate_type) {
+        Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
-    let fields: Vec<String> = match fields_value {
-        Value::Array(items) => items
-            .into_iter()
-            .filter_map(|v| v.as_str().map(|s| s.to_string()))
-            .collect(),
-        Value::Null => Vec::new(),
-        _ => {
-            set_error(error_out, "fields must be an array of strings");
+    let refs = match parse_json(ids_json).and_then(|ids| parse_refs(&agg_type, ids)) {
+        Ok(refs) => refs,
+        Err(err) => {
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
 
-    let request = SelectAggregateRequest::new(agg_type, agg_id, fields);
-    let client = unsafe { &mut *handle };
-    let response = match client
-        .runtime
-        .block_on(client.client.select_aggregate(request))
-    {
-        Ok(resp) => resp,
+    let client = unsafe { &*handle };
+    let results = client.runtime.block_on(join_all(refs.iter().map(|(t, id)| {
+        get_aggregate_payload(client.pool.clone(), client.cache.clone(), t.clone(), id.clone())
+    })));
+    client.respond(call, Ok(multi_payload(&agg_type, refs, results)), error_out)
+}
+
+/// Multi-aggregate `dbx_select_aggregate` sharing one `fields_json`; ids
+/// follow `dbx_get_aggregates`.
+#[no_mangle]
+pub extern "C" fn dbx_select_aggregates(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    ids_json: *const c_char,
+    fields_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    let call = Call::start(Op::SelectAggregates);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let agg_type = match string_from_ptr(aggregate_type) {
+        Ok(s) => s,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let refs = match parse_json(ids_json).and_then(|ids| parse_refs(&agg_type, ids)) {
+        Ok(refs) => refs,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let fields = match parse_json(fields_json).and_then(parse_fields) {
+        Ok(fields) => fields,
         Err(err) => {
-            set_error(error_out, err.to_string());
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
 
-    let payload = Value::Object(
-        [
-            ("found".to_string(), Value::Bool(response.found)),
-            (
-                "selection".to_string(),
-                response.selection.unwrap_or(Value::Null),
-            ),
-        ]
-        .into_iter()
-        .collect(),
-    );
+    let client = unsafe { &*handle };
+    let results = client.runtime.block_on(join_all(refs.iter().map(|(t, id)| {
+        select_aggregate_payload(
+            client.pool.clone(),
+            client.cache.clone(),
+            t.clone(),
+            id.clone(),
+            fields.clone(),
+        )
+    })));
+    client.respond(call, Ok(multi_payload(&agg_type, refs, results)), error_out)
+}
 
-    match to_cstring(payload) {
-        Ok(ptr) => ptr,
+#[no_mangle]
+pub extern "C" fn dbx_select_aggregate(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_id: *const c_char,
+    fields_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    let call = Call::start(Op::SelectAggregate);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let agg_type = match string_from_ptr(aggregate_type) {
+        Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
-            std::ptr::null_mut()
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let agg_id = match string_from_ptr(aggregate_id) {
+        Ok(s) => s,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let fields_value = match parse_json(fields_json) {
+        Ok(v) => v,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let fields = match parse_fields(fields_value) {
+        Ok(fields) => fields,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
         }
+    };
+
+    let client = unsafe { &*handle };
+    client.respond(
+        call,
+        client.runtime.block_on(select_aggregate_payload(
+            client.pool.clone(),
+            client.cache.clone(),
+            agg_type,
+            agg_id,
+            fields,
+        )),
+        error_out,
+    )
+}
+
+fn parse_fields(fields_value: Value) -> Result<Vec<String>, String> {
+    match fields_value {
+        Value::Array(items) => Ok(items
+            .into_iter()
+            .filter_map(|v| v.as_str().map(|s| s.to_string()))
+            .collect()),
+        Value::Null => Ok(Vec::new()),
+        _ => Err("fields must be an array of strings".to_string()),
+    }
+}
+
+async fn select_aggregate_payload(
+    pool: Arc<Pool>,
+    cache: Arc<Cache>,
+    agg_type: String,
+    agg_id: String,
+    fields: Vec<String>,
+) -> Result<Reply, String> {
+    if let Some((found, selection)) = cache.get(&agg_type, &agg_id, Some(&fields)) {
+        return Ok(Reply::Selection { found, selection });
     }
+    let epoch = cache.epoch();
+    let (t, id, f) = (&agg_type, &agg_id, &fields);
+    let response = read_conn!(pool, |conn| conn.select_aggregate(SelectAggregateRequest::new(
+        t.clone(),
+        id.clone(),
+        f.clone(),
+    )))
+    .await?;
+    let selection = response.selection.unwrap_or(Value::Null);
+    cache.put(epoch, &agg_type, &agg_id, Some(&fields), response.found, &selection);
+    Ok(Reply::Selection {
+        found: response.found,
+        selection,
+    })
 }
 
 #[no_mangle]
@@ -726,32 +1524,57 @@ pub extern "C" fn dbx_list_events(
     options_json: *const c_char,
     error_out: *mut *mut c_char,
 ) -> *mut c_char {
+    let call = Call::start(Op::ListEvents);
     clear_error(error_out);
-    if handle.is_null() {
-        set_error(error_out, "handle is null");
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
         return std::ptr::null_mut();
     }
     let agg_type = match string_from_ptr(aggregate_type) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let agg_id = match string_from_ptr(aggregate_id) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let opts_value = match parse_json(options_json) {
         Ok(v) => v,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
+    let projection = match Projection::from_options(&opts_value) {
+        Ok(p) => p,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let opts = parse_list_events_options(&opts_value);
+
+    let client = unsafe { &*handle };
+    client.respond(
+        call,
+        client.runtime.block_on(list_events_payload(
+            client.pool.clone(),
+            agg_type,
+            agg_id,
+            opts,
+            projection,
+        )),
+        error_out,
+    )
+}
+
+fn parse_list_events_options(opts_value: &Value) -> ListEventsOptions {
     let mut opts = ListEventsOptions::default();
     if let Some(map) = opts_value.as_object() {
         if let Some(cursor) = map.get("cursor").and_then(Value::as_str) {
@@ -765,44 +1588,37 @@ pub extern "C" fn dbx_list_events(
         }
         opts.token = map.get("token").and_then(Value::as_str).map(|s| s.to_string());
     }
+    opts
+}
 
-    let client = unsafe { &mut *handle };
-    let response = match client
-        .runtime
-        .block_on(client.client.list_events(&agg_type, &agg_id, opts))
-    {
-        Ok(resp) => resp,
-        Err(err) => {
-            set_error(error_out, err.to_string());
-            return std::ptr::null_mut();
-        }
-    };
+/// A copy of `opts` for each attempt of a retried or hedged listing.
+fn copy_list_events_options(opts: &ListEventsOptions) -> ListEventsOptions {
+    let mut copy = ListEventsOptions::default();
+    copy.cursor = opts.cursor.clone();
+    copy.take = opts.take;
+    copy.filter = opts.filter.clone();
+    copy.token = opts.token.clone();
+    copy
+}
 
-    let payload = Value::Object(
-        [
-            ("items".to_string(), response.events),
-            (
-                "nextCursor".to_string(),
-                response
-                    .next_cursor
-                    .map(Value::String)
-                    .unwrap_or(Value::Null),
-            ),
-        ]
-        .into_iter()
-        .collect(),
-    );
-    match to_cstring(payload) {
-        Ok(ptr) => ptr,
-        Err(err) => {
-            set_error(error_out, err);
-            std::ptr::null_mut()
-        }
-    }
+async fn list_events_payload(
+    pool: Arc<Pool>,
+    agg_type: String,
+    agg_id: String,
+    opts: ListEventsOptions,
+    projection: Option<Arc<Projection>>,
+) -> Result<Reply, String> {
+    let (t, id, opts) = (&agg_type, &agg_id, &opts);
+    let response = read_conn!(pool, |conn| conn.list_events(t, id, copy_list_events_options(opts)))
+        .await?;
+    Ok(Reply::Page {
+        items: project(projection.as_deref(), response.events),
+        next_cursor: response.next_cursor,
+    })
 }
 
 fn parse_payload_options(
-    opts_value: Value,
+    mut opts_value: Value,
 ) -> (Value, Option<String>, Option<Value>, Option<String>, Vec<PublishTarget>) {
     let mut payload = Value::Null;
     let mut metadata = None;
@@ -810,11 +1626,12 @@ fn parse_payload_options(
     let mut token = None;
     let mut publish_targets = Vec::new();
 
-    if let Some(map) = opts_value.as_object() {
-        if let Some(p) = map.get("payload") {
-            payload = p.clone();
+    if let Some(map) = opts_value.as_object_mut() {
+        // moved out rather than cloned: payloads can be large
+        if let Some(p) = map.remove("payload") {
+            payload = p;
         }
-        metadata = map.get("metadata").cloned();
+        metadata = map.remove("metadata");
         note = map.get("note").and_then(Value::as_str).map(|s| s.to_string());
         token = map.get("token").and_then(Value::as_str).map(|s| s.to_string());
         publish_targets = parse_publish_targets(map.get("publishTargets"));
@@ -823,6 +1640,17 @@ fn parse_payload_options(
     (payload, note, metadata, token, publish_targets)
 }
 
+/// Stores a payload passed separately from the options (the `*_raw`
+/// exports) where `parse_payload_options` picks it up.
+fn with_payload(opts_value: Value, payload: Value) -> Value {
+    let mut map = match opts_value {
+        Value::Object(map) => map,
+        _ => Map::new(),
+    };
+    map.insert("payload".to_string(), payload);
+    Value::Object(map)
+}
+
 #[no_mangle]
 pub extern "C" fn dbx_append_event(
     handle: *mut DbxHandle,
@@ -832,40 +1660,111 @@ pub extern "C" fn dbx_append_event(
     options_json: *const c_char,
     error_out: *mut *mut c_char,
 ) -> *mut c_char {
+    let call = Call::start(Op::AppendEvent);
     clear_error(error_out);
-    if handle.is_null() {
-        set_error(error_out, "handle is null");
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
         return std::ptr::null_mut();
     }
     let agg_type = match string_from_ptr(aggregate_type) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let agg_id = match string_from_ptr(aggregate_id) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let evt_type = match string_from_ptr(event_type) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let opts_value = match parse_json(options_json) {
         Ok(v) => v,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+
+    let request = build_append_request(agg_type.clone(), agg_id.clone(), evt_type, opts_value);
+    let client = unsafe { &*handle };
+    client.respond(
+        call,
+        client.runtime.block_on(append_event_payload(
+            client.pool.clone(),
+            client.cache.clone(),
+            agg_type,
+            agg_id,
+            request,
+        )),
+        error_out,
+    )
+}
+
+/// `dbx_append_event` with the payload passed as `payload_len` bytes of JSON
+/// at `payload` (not NUL-terminated) instead of inside `options_json`.
+#[no_mangle]
+pub extern "C" fn dbx_append_event_raw(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_id: *const c_char,
+    event_type: *const c_char,
+    payload: *const c_char,
+    payload_len: usize,
+    options_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    let call = Call::start(Op::AppendEventRaw);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let (agg_type, agg_id, evt_type, opts_value) = match raw_write_input(
+        aggregate_type,
+        aggregate_id,
+        event_type,
+        payload,
+        payload_len,
+        options_json,
+    ) {
+        Ok(input) => input,
+        Err(err) => {
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
 
+    let request = build_append_request(agg_type.clone(), agg_id.clone(), evt_type, opts_value);
+    let client = unsafe { &*handle };
+    client.respond(
+        call,
+        client.runtime.block_on(append_event_payload(
+            client.pool.clone(),
+            client.cache.clone(),
+            agg_type,
+            agg_id,
+            request,
+        )),
+        error_out,
+    )
+}
+
+fn build_append_request(
+    agg_type: String,
+    agg_id: String,
+    evt_type: String,
+    opts_value: Value,
+) -> AppendEventRequest {
     let (payload, note, metadata, token, publish_targets) = parse_payload_options(opts_value);
     let payload = match payload {
         Value::Null => Value::Object(Map::new()),
@@ -877,28 +1776,157 @@ pub extern "C" fn dbx_append_event(
     request.metadata = metadata;
     request.token = token;
     request.publish_targets = publish_targets;
+    request
+}
+
+async fn append_event_payload(
+    pool: Arc<Pool>,
+    cache: Arc<Cache>,
+    agg_type: String,
+    agg_id: String,
+    request: AppendEventRequest,
+) -> Result<Reply, String> {
+    let response = with_conn!(pool, |conn| conn.append_event(request)).await;
+    cache.invalidate(&agg_type, &agg_id);
+    Ok(Reply::Event {
+        event: response?.event,
+    })
+}
+
+fn entry_string(map: &Map<String, Value>, camel: &str, snake: &str) -> Result<String, String> {
+    map.get(camel)
+        .or_else(|| map.get(snake))
+        .and_then(Value::as_str)
+        .map(|s| s.to_string())
+        .ok_or_else(|| format!("{camel} is required"))
+}
+
+fn parse_append_entry(entry: Value, defaults: &Map<String, Value>) -> Result<AppendEventRequest, String> {
+    let Value::Object(mut map) = entry else {
+        return Err("event entry must be a JSON object".to_string());
+    };
+    let agg_type = entry_string(&map, "aggregateType", "aggregate_type")?;
+    let agg_id = entry_string(&map, "aggregateId", "aggregate_id")?;
+    let evt_type = entry_string(&map, "eventType", "event_type")?;
+    for key in ["token", "publishTargets"] {
+        if !map.contains_key(key) {
+            if let Some(value) = defaults.get(key) {
+                map.insert(key.to_string(), value.clone());
+            }
+        }
+    }
+
+    Ok(build_append_request(agg_type, agg_id, evt_type, Value::Object(map)))
+}
 
-    let client = unsafe { &mut *handle };
-    let response = match client.runtime.block_on(client.client.append_event(request)) {
-        Ok(resp) => resp,
+/// Runs indexed appends keyed by aggregate: entries for the same aggregate
+/// run in order on one lease at a time, distinct aggregates run concurrently
+/// across the pool. Returns `(index, result)` pairs grouped by aggregate.
+async fn append_grouped(
+    pool: &Pool,
+    cache: &Cache,
+    entries: Vec<(usize, (String, String), Result<AppendEventRequest, String>)>,
+) -> Vec<(usize, Result<Reply, String>)> {
+    let mut groups: Vec<((String, String), Vec<(usize, Result<AppendEventRequest, String>)>)> =
+        Vec::new();
+    let mut group_index: HashMap<(String, String), usize> = HashMap::new();
+    for (index, key, request) in entries {
+        let group = *group_index.entry(key.clone()).or_insert_with(|| {
+            groups.push((key, Vec::new()));
+            groups.len() - 1
+        });
+        groups[group].1.push((index, request));
+    }
+
+    let completed = join_all(groups.into_iter().map(|((agg_type, agg_id), group)| async move {
+        let mut completed = Vec::with_capacity(group.len());
+        for (index, request) in group {
+            let result = match request {
+                Ok(request) => with_conn!(pool, |conn| conn.append_event(request))
+                    .await
+                    .map(|resp| Reply::Event { event: resp.event }),
+                Err(err) => Err(err),
+            };
+            completed.push((index, result));
+        }
+        cache.invalidate(&agg_type, &agg_id);
+        completed
+    }))
+    .await;
+    completed.into_iter().flatten().collect()
+}
+
+/// Appends every entry of `events_json` (a JSON array of
+/// `{aggregateType, aggregateId, eventType, payload?, metadata?, note?, token?, publishTargets?}`)
+/// inside a single FFI call. `token` and `publishTargets` in `options_json`
+/// act as defaults for entries that omit them. Failures are reported per item,
+/// so one bad entry does not abort the rest of the batch.
+#[no_mangle]
+pub extern "C" fn dbx_append_events(
+    handle: *mut DbxHandle,
+    events_json: *const c_char,
+    options_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    let call = Call::start(Op::AppendEvents);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let entries = match parse_json(events_json) {
+        Ok(Value::Array(items)) => items,
+        Ok(Value::Null) => Vec::new(),
+        Ok(_) => {
+            reject(handle, call, error_out, "events must be a JSON array");
+            return std::ptr::null_mut();
+        }
         Err(err) => {
-            set_error(error_out, err.to_string());
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
-
-    let payload = Value::Object(
-        [("event".to_string(), response.event)]
-            .into_iter()
-            .collect(),
-    );
-    match to_cstring(payload) {
-        Ok(ptr) => ptr,
+    let defaults = match parse_json(options_json) {
+        Ok(Value::Object(map)) => map,
+        Ok(_) => Map::new(),
         Err(err) => {
-            set_error(error_out, err);
-            std::ptr::null_mut()
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
         }
+    };
+
+    let mut keyed = Vec::with_capacity(entries.len());
+    for (index, entry) in entries.into_iter().enumerate() {
+        let key = entry
+            .as_object()
+            .and_then(|map| {
+                let agg_type = entry_string(map, "aggregateType", "aggregate_type").ok()?;
+                let agg_id = entry_string(map, "aggregateId", "aggregate_id").ok()?;
+                Some((agg_type, agg_id))
+            })
+            .unwrap_or_else(|| (String::new(), index.to_string()));
+        keyed.push((index, key, parse_append_entry(entry, &defaults)));
     }
+
+    let client = unsafe { &*handle };
+    let mut results: Vec<Result<Reply, String>> =
+        (0..keyed.len()).map(|_| Ok(Reply::Event { event: Value::Null })).collect();
+    let completed = client
+        .runtime
+        .block_on(append_grouped(&client.pool, &client.cache, keyed));
+    for (index, result) in completed {
+        results[index] = result;
+    }
+
+    let failed = results.iter().filter(|r| r.is_err()).count();
+    client.respond(
+        call,
+        Ok(Reply::Batch {
+            items: results.into_iter().map(Reply::item).collect(),
+            failed,
+        }),
+        error_out,
+    )
 }
 
 #[no_mangle]
@@ -910,40 +1938,62 @@ pub extern "C" fn dbx_create_aggregate(
     options_json: *const c_char,
     error_out: *mut *mut c_char,
 ) -> *mut c_char {
+    let call = Call::start(Op::CreateAggregate);
     clear_error(error_out);
-    if handle.is_null() {
-        set_error(error_out, "handle is null");
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
         return std::ptr::null_mut();
     }
     let agg_type = match string_from_ptr(aggregate_type) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let agg_id = match string_from_ptr(aggregate_id) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let evt_type = match string_from_ptr(event_type) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let opts_value = match parse_json(options_json) {
         Ok(v) => v,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
 
+    let request = build_create_request(agg_type.clone(), agg_id.clone(), evt_type, opts_value);
+    let client = unsafe { &*handle };
+    client.respond(
+        call,
+        client.runtime.block_on(create_aggregate_payload(
+            client.pool.clone(),
+            client.cache.clone(),
+            agg_type,
+            agg_id,
+            request,
+        )),
+        error_out,
+    )
+}
+
+fn build_create_request(
+    agg_type: String,
+    agg_id: String,
+    evt_type: String,
+    opts_value: Value,
+) -> CreateAggregateRequest {
     let (payload, note, metadata, token, publish_targets) = parse_payload_options(opts_value);
     let payload = match payload {
         Value::Null => Value::Object(Map::new()),
@@ -955,28 +2005,89 @@ pub extern "C" fn dbx_create_aggregate(
     request.metadata = metadata;
     request.token = token;
     request.publish_targets = publish_targets;
+    request
+}
+
+async fn create_aggregate_payload(
+    pool: Arc<Pool>,
+    cache: Arc<Cache>,
+    agg_type: String,
+    agg_id: String,
+    request: CreateAggregateRequest,
+) -> Result<Reply, String> {
+    let response = with_conn!(pool, |conn| conn.create_aggregate(request)).await;
+    cache.invalidate(&agg_type, &agg_id);
+    Ok(Reply::Aggregate {
+        aggregate: response?.aggregate,
+    })
+}
+
+/// Shared body of `dbx_append_event_raw` / `dbx_create_aggregate_raw`:
+/// reads the identifiers, parses the payload straight from the borrowed
+/// bytes and merges it into the options.
+fn raw_write_input(
+    aggregate_type: *const c_char,
+    aggregate_id: *const c_char,
+    event_type: *const c_char,
+    payload: *const c_char,
+    payload_len: usize,
+    options_json: *const c_char,
+) -> Result<(String, String, String, Value), String> {
+    let agg_type = string_from_ptr(aggregate_type)?;
+    let agg_id = string_from_ptr(aggregate_id)?;
+    let evt_type = string_from_ptr(event_type)?;
+    let payload = parse_json_bytes(bytes_from_ptr(payload, payload_len))?;
+    let opts_value = parse_json(options_json)?;
+    Ok((agg_type, agg_id, evt_type, with_payload(opts_value, payload)))
+}
 
-    let client = unsafe { &mut *handle };
-    let response = match client.runtime.block_on(client.client.create_aggregate(request)) {
-        Ok(resp) => resp,
+/// `dbx_create_aggregate` with the payload passed as `payload_len` bytes of
+/// JSON at `payload` (not NUL-terminated) instead of inside `options_json`.
+#[no_mangle]
+pub extern "C" fn dbx_create_aggregate_raw(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_id: *const c_char,
+    event_type: *const c_char,
+    payload: *const c_char,
+    payload_len: usize,
+    options_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    let call = Call::start(Op::CreateAggregateRaw);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let (agg_type, agg_id, evt_type, opts_value) = match raw_write_input(
+        aggregate_type,
+        aggregate_id,
+        event_type,
+        payload,
+        payload_len,
+        options_json,
+    ) {
+        Ok(input) => input,
         Err(err) => {
-            set_error(error_out, err.to_string());
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
 
-    let payload = Value::Object(
-        [("aggregate".to_string(), response.aggregate)]
-            .into_iter()
-            .collect(),
-    );
-    match to_cstring(payload) {
-        Ok(ptr) => ptr,
-        Err(err) => {
-            set_error(error_out, err);
-            std::ptr::null_mut()
-        }
-    }
+    let request = build_create_request(agg_type.clone(), agg_id.clone(), evt_type, opts_value);
+    let client = unsafe { &*handle };
+    client.respond(
+        call,
+        client.runtime.block_on(create_aggregate_payload(
+            client.pool.clone(),
+            client.cache.clone(),
+            agg_type,
+            agg_id,
+            request,
+        )),
+        error_out,
+    )
 }
 
 #[no_mangle]
@@ -989,29 +2100,30 @@ pub extern "C" fn dbx_patch_event(
     options_json: *const c_char,
     error_out: *mut *mut c_char,
 ) -> *mut c_char {
+    let call = Call::start(Op::PatchEvent);
     clear_error(error_out);
-    if handle.is_null() {
-        set_error(error_out, "handle is null");
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
         return std::ptr::null_mut();
     }
     let agg_type = match string_from_ptr(aggregate_type) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let agg_id = match string_from_ptr(aggregate_id) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let evt_type = match string_from_ptr(event_type) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
@@ -1019,7 +2131,7 @@ pub extern "C" fn dbx_patch_event(
     let patch_value = match parse_json(patch_json) {
         Ok(v) => v,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
@@ -1027,39 +2139,28 @@ pub extern "C" fn dbx_patch_event(
     let opts_value = match parse_json(options_json) {
         Ok(v) => v,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let (_, note, metadata, token, publish_targets) = parse_payload_options(opts_value);
 
-    let mut request = PatchEventRequest::new(agg_type, agg_id, evt_type, patch_value);
+    let mut request =
+        PatchEventRequest::new(agg_type.clone(), agg_id.clone(), evt_type, patch_value);
     request.note = note;
     request.metadata = metadata;
     request.token = token;
     request.publish_targets = publish_targets;
 
-    let client = unsafe { &mut *handle };
-    let response = match client.runtime.block_on(client.client.patch_event(request)) {
-        Ok(resp) => resp,
-        Err(err) => {
-            set_error(error_out, err.to_string());
-            return std::ptr::null_mut();
-        }
-    };
-
-    let payload = Value::Object(
-        [("event".to_string(), response.event)]
-            .into_iter()
-            .collect(),
-    );
-    match to_cstring(payload) {
-        Ok(ptr) => ptr,
-        Err(err) => {
-            set_error(error_out, err);
-            std::ptr::null_mut()
-        }
-    }
+    let client = unsafe { &*handle };
+    let result = client
+        .runtime
+        .block_on(with_conn!(client.pool, |conn| conn.patch_event(request)))
+        .map(|response| Reply::Event {
+            event: response.event,
+        });
+    client.cache.invalidate(&agg_type, &agg_id);
+    client.respond(call, result, error_out)
 }
 
 #[no_mangle]
@@ -1071,22 +2172,23 @@ pub extern "C" fn dbx_set_archive(
     options_json: *const c_char,
     error_out: *mut *mut c_char,
 ) -> *mut c_char {
+    let call = Call::start(Op::SetArchive);
     clear_error(error_out);
-    if handle.is_null() {
-        set_error(error_out, "handle is null");
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
         return std::ptr::null_mut();
     }
     let agg_type = match string_from_ptr(aggregate_type) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
     let agg_id = match string_from_ptr(aggregate_id) {
         Ok(s) => s,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
@@ -1094,92 +2196,1100 @@ pub extern "C" fn dbx_set_archive(
     let opts_value = match parse_json(options_json) {
         Ok(v) => v,
         Err(err) => {
-            set_error(error_out, err);
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
-    let mut request = SetAggregateArchiveRequest::new(agg_type, agg_id, archived);
+    let mut request = SetAggregateArchiveRequest::new(agg_type.clone(), agg_id.clone(), archived);
     if let Some(map) = opts_value.as_object() {
         request.note = map.get("note").and_then(Value::as_str).map(|s| s.to_string());
         request.token = map.get("token").and_then(Value::as_str).map(|s| s.to_string());
     }
 
-    let client = unsafe { &mut *handle };
-    let response = match client
+    let client = unsafe { &*handle };
+    let result = client
         .runtime
-        .block_on(client.client.set_aggregate_archive(request))
-    {
-        Ok(resp) => resp,
-        Err(err) => {
-            set_error(error_out, err.to_string());
-            return std::ptr::null_mut();
+        .block_on(with_conn!(client.pool, |conn| conn.set_aggregate_archive(request)))
+        .map(|response| Reply::Aggregate {
+            aggregate: response.aggregate,
+        });
+    client.cache.invalidate(&agg_type, &agg_id);
+    client.respond(call, result, error_out)
+}
+
+#[no_mangle]
+pub extern "C" fn dbx_verify_aggregate(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_id: *const c_char,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    let call = Call::start(Op::VerifyAggregate);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let agg_type = match string_from_ptr(aggregate_type) {
+        Ok(s) => s,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let agg_id = match string_from_ptr(aggregate_id) {
+        Ok(s) => s,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
         }
     };
 
-    let payload = Value::Object(
-        [("aggregate".to_string(), response.aggregate)]
-            .into_iter()
-            .collect(),
-    );
-    match to_cstring(payload) {
-        Ok(ptr) => ptr,
+    let client = unsafe { &*handle };
+    let result = client
+        .runtime
+        .block_on(with_conn!(client.pool, |conn| conn.verify_aggregate(&agg_type, &agg_id)))
+        .map(|response| Reply::Verified {
+            merkle_root: response.merkle_root,
+        });
+    client.respond(call, result, error_out)
+}
+
+/// Verifies every aggregate in `ids_json` (a JSON array of ids), or every
+/// aggregate of the type matched by the list options in `options_json` when
+/// it is null, `concurrency` at a time. Results are returned in the summary,
+/// or written to `path`/`fd` as NDJSON when either is given.
+#[no_mangle]
+pub extern "C" fn dbx_verify_aggregates(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    ids_json: *const c_char,
+    options_json: *const c_char,
+    path: *const c_char,
+    fd: c_int,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    let call = Call::start(Op::VerifyAggregates);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let agg_type = match string_from_ptr(aggregate_type) {
+        Ok(s) => s,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let ids = match parse_json(ids_json).and_then(verify::parse_ids) {
+        Ok(ids) => ids,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let opts_value = match parse_json(options_json) {
+        Ok(v) => v,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let file = if path.is_null() && fd < 0 {
+        None
+    } else {
+        match open_export_target(path, fd) {
+            Ok(file) => Some(file),
+            Err(err) => {
+                reject(handle, call, error_out, err);
+                return std::ptr::null_mut();
+            }
+        }
+    };
+
+    let client = unsafe { &*handle };
+    let result = client
+        .runtime
+        .block_on(verify::run(
+            client.pool.clone(),
+            agg_type,
+            ids,
+            opts_value,
+            file.as_ref().map(|file| &**file),
+        ))
+        .map(Reply::Verifications);
+    if !path.is_null() {
+        drop(file.map(std::mem::ManuallyDrop::into_inner));
+    }
+    client.respond(call, result, error_out)
+}
+
+/// Starts `dbx_get_aggregate` on the runtime and returns a ticket for
+/// `dbx_poll`/`dbx_wait_any`, or 0 with `error_out` set.
+#[no_mangle]
+pub extern "C" fn dbx_submit_get_aggregate(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_id: *const c_char,
+    error_out: *mut *mut c_char,
+) -> u64 {
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return 0;
+    }
+    let agg_type = match string_from_ptr(aggregate_type) {
+        Ok(s) => s,
         Err(err) => {
             set_error(error_out, err);
-            std::ptr::null_mut()
+            return 0;
+        }
+    };
+    let agg_id = match string_from_ptr(aggregate_id) {
+        Ok(s) => s,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
         }
+    };
+
+    let client = unsafe { &*handle };
+    client.pending.submit(
+        &client.runtime,
+        get_aggregate_payload(client.pool.clone(), client.cache.clone(), agg_type, agg_id),
+    )
+}
+
+/// Non-blocking `dbx_select_aggregate`; see `dbx_submit_get_aggregate`.
+#[no_mangle]
+pub extern "C" fn dbx_submit_select_aggregate(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_id: *const c_char,
+    fields_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> u64 {
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return 0;
     }
+    let agg_type = match string_from_ptr(aggregate_type) {
+        Ok(s) => s,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+    let agg_id = match string_from_ptr(aggregate_id) {
+        Ok(s) => s,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+    let fields = match parse_json(fields_json).and_then(parse_fields) {
+        Ok(fields) => fields,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+
+    let client = unsafe { &*handle };
+    client.pending.submit(
+        &client.runtime,
+        select_aggregate_payload(
+            client.pool.clone(),
+            client.cache.clone(),
+            agg_type,
+            agg_id,
+            fields,
+        ),
+    )
 }
 
+/// Non-blocking `dbx_list_events`; see `dbx_submit_get_aggregate`.
 #[no_mangle]
-pub extern "C" fn dbx_verify_aggregate(
+pub extern "C" fn dbx_submit_list_events(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_id: *const c_char,
+    options_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> u64 {
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return 0;
+    }
+    let agg_type = match string_from_ptr(aggregate_type) {
+        Ok(s) => s,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+    let agg_id = match string_from_ptr(aggregate_id) {
+        Ok(s) => s,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+    let opts_value = match parse_json(options_json) {
+        Ok(v) => v,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+
+    let projection = match Projection::from_options(&opts_value) {
+        Ok(p) => p,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+    let opts = parse_list_events_options(&opts_value);
+    let client = unsafe { &*handle };
+    client.pending.submit(
+        &client.runtime,
+        list_events_payload(client.pool.clone(), agg_type, agg_id, opts, projection),
+    )
+}
+
+/// Non-blocking `dbx_append_event`; see `dbx_submit_get_aggregate`.
+#[no_mangle]
+pub extern "C" fn dbx_submit_append_event(
     handle: *mut DbxHandle,
     aggregate_type: *const c_char,
     aggregate_id: *const c_char,
+    event_type: *const c_char,
+    options_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> u64 {
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return 0;
+    }
+    let agg_type = match string_from_ptr(aggregate_type) {
+        Ok(s) => s,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+    let agg_id = match string_from_ptr(aggregate_id) {
+        Ok(s) => s,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+    let evt_type = match string_from_ptr(event_type) {
+        Ok(s) => s,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+    let opts_value = match parse_json(options_json) {
+        Ok(v) => v,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+
+    let request = build_append_request(agg_type.clone(), agg_id.clone(), evt_type, opts_value);
+    let client = unsafe { &*handle };
+    client.pending.submit(
+        &client.runtime,
+        append_event_payload(
+            client.pool.clone(),
+            client.cache.clone(),
+            agg_type,
+            agg_id,
+            request,
+        ),
+    )
+}
+
+/// Parses `options_json` once for repeated calls of `operation` (`list`,
+/// `events` or `apply`, the latter with `eventType` in the options) on
+/// `aggregate_type`, returning a statement id for `dbx_execute` (0 on error).
+#[no_mangle]
+pub extern "C" fn dbx_prepare(
+    handle: *mut DbxHandle,
+    operation: *const c_char,
+    aggregate_type: *const c_char,
+    options_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> u64 {
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return 0;
+    }
+    let operation = match string_from_ptr(operation) {
+        Ok(s) => s,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+    let agg_type = if aggregate_type.is_null() {
+        String::new()
+    } else {
+        match string_from_ptr(aggregate_type) {
+            Ok(s) => s,
+            Err(err) => {
+                set_error(error_out, err);
+                return 0;
+            }
+        }
+    };
+    let opts_value = match parse_json(options_json) {
+        Ok(v) => v,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+
+    let client = unsafe { &*handle };
+    match Statement::prepare(&operation, agg_type, opts_value) {
+        Ok(statement) => client.statements.insert(statement),
+        Err(err) => {
+            set_error(error_out, err);
+            0
+        }
+    }
+}
+
+/// Runs a prepared statement. `aggregate_id` is required for `events` and
+/// `apply`, `cursor` (nullable) pages `list`/`events`, and `payload_json`
+/// (nullable) replaces the prepared payload of `apply`. Responses have the
+/// same shape as the matching one-shot export.
+#[no_mangle]
+pub extern "C" fn dbx_execute(
+    handle: *mut DbxHandle,
+    statement: u64,
+    aggregate_id: *const c_char,
+    cursor: *const c_char,
+    payload_json: *const c_char,
     error_out: *mut *mut c_char,
 ) -> *mut c_char {
+    let call = Call::start(Op::Execute);
     clear_error(error_out);
-    if handle.is_null() {
-        set_error(error_out, "handle is null");
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
         return std::ptr::null_mut();
     }
+    let client = unsafe { &*handle };
+    let statement = match client.statements.get(statement) {
+        Ok(statement) => statement,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let cursor = if cursor.is_null() {
+        None
+    } else {
+        match string_from_ptr(cursor) {
+            Ok(s) => Some(s).filter(|c| !c.is_empty()),
+            Err(err) => {
+                reject(handle, call, error_out, err);
+                return std::ptr::null_mut();
+            }
+        }
+    };
+    let agg_id = if statement.operation == Operation::List {
+        String::new()
+    } else {
+        match string_from_ptr(aggregate_id) {
+            Ok(s) if s.is_empty() => {
+                reject(handle, call, error_out, "aggregate_id is required for this statement");
+                return std::ptr::null_mut();
+            }
+            Ok(s) => s,
+            Err(err) => {
+                reject(handle, call, error_out, err);
+                return std::ptr::null_mut();
+            }
+        }
+    };
+
+    let result = match statement.operation {
+        Operation::List => client.runtime.block_on(list_aggregates_payload(
+            client.pool.clone(),
+            statement.list_options(cursor),
+            statement.projection.clone(),
+        )),
+        Operation::Events => client.runtime.block_on(list_events_payload(
+            client.pool.clone(),
+            statement.aggregate_type.clone(),
+            agg_id,
+            statement.events_options(cursor),
+            statement.projection.clone(),
+        )),
+        Operation::Apply => {
+            let payload = match parse_json(payload_json) {
+                Ok(v) => v,
+                Err(err) => {
+                    reject(handle, call, error_out, err);
+                    return std::ptr::null_mut();
+                }
+            };
+            let request = statement.append_request(agg_id.clone(), payload);
+            client.runtime.block_on(append_event_payload(
+                client.pool.clone(),
+                client.cache.clone(),
+                statement.aggregate_type.clone(),
+                agg_id,
+                request,
+            ))
+        }
+    };
+    client.respond(call, result, error_out)
+}
+
+/// Forgets a prepared statement; unknown ids are ignored.
+#[no_mangle]
+pub extern "C" fn dbx_statement_free(handle: *mut DbxHandle, statement: u64) {
+    if check_handle(handle).is_err() {
+        return;
+    }
+    let client = unsafe { &*handle };
+    client.statements.remove(statement);
+}
+
+/// Queues an append on the handle's write queue and returns its sequence
+/// number without waiting for the server. When the queue is full the
+/// `writeQueue.policy` applies: `block` waits for room, `drop` returns 0 with
+/// no error, `fail` returns 0 with `error_out` set. Results are collected by
+/// `dbx_flush`.
+#[no_mangle]
+pub extern "C" fn dbx_enqueue_append(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_id: *const c_char,
+    event_type: *const c_char,
+    options_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> u64 {
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return 0;
+    }
     let agg_type = match string_from_ptr(aggregate_type) {
         Ok(s) => s,
         Err(err) => {
             set_error(error_out, err);
-            return std::ptr::null_mut();
+            return 0;
         }
     };
     let agg_id = match string_from_ptr(aggregate_id) {
         Ok(s) => s,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+    let evt_type = match string_from_ptr(event_type) {
+        Ok(s) => s,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+    let opts_value = match parse_json(options_json) {
+        Ok(v) => v,
+        Err(err) => {
+            set_error(error_out, err);
+            return 0;
+        }
+    };
+
+    let request = build_append_request(agg_type.clone(), agg_id.clone(), evt_type, opts_value);
+    let client = unsafe { &*handle };
+    if let Err(err) = client.runtime.require_threaded("the write queue") {
+        set_error(error_out, err);
+        return 0;
+    }
+    let queue = client.writes.get_or_init(|| {
+        WriteQueue::start(
+            &client.runtime,
+            client.write_config.as_ref(),
+            client.pool.clone(),
+            client.cache.clone(),
+            client.metrics.clone(),
+        )
+    });
+    match queue.enqueue(&client.runtime, agg_type, agg_id, request) {
+        Ok(Enqueued::Queued(seq)) => seq,
+        Ok(Enqueued::Dropped) => 0,
+        Err(err) => {
+            set_error(error_out, err);
+            0
+        }
+    }
+}
+
+/// Waits up to `timeout_ms` (negative waits indefinitely, 0 only collects)
+/// for queued appends to be acknowledged and returns
+/// `{items: [{seq, aggregateType, aggregateId, event | error}], failed, pending}`
+/// for every entry acknowledged since the previous flush.
+#[no_mangle]
+pub extern "C" fn dbx_flush(
+    handle: *mut DbxHandle,
+    timeout_ms: i64,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    let call = Call::start(Op::Flush);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let timeout = u64::try_from(timeout_ms).ok().map(Duration::from_millis);
+    let client = unsafe { &*handle };
+    let summary = match client.writes.get() {
+        Some(queue) => client.runtime.block_on(queue.flush(timeout)),
+        None => FlushSummary::default(),
+    };
+    client.respond(call, Ok(Reply::Flushed(summary)), error_out)
+}
+
+/// Returns the response JSON of a completed ticket and forgets the ticket.
+/// Returns null with no error while the operation is still running, and null
+/// with `error_out` set when it failed or the ticket is unknown.
+#[no_mangle]
+pub extern "C" fn dbx_poll(
+    handle: *mut DbxHandle,
+    ticket: u64,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    let call = Call::start(Op::Poll);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let client = unsafe { &*handle };
+    client.runtime.turn();
+    match client.pending.poll(ticket) {
+        TicketState::Pending => std::ptr::null_mut(),
+        TicketState::Ready(result) => client.respond(call, result, error_out),
+        TicketState::Unknown => {
+            reject(handle, call, error_out, format!("unknown ticket {ticket}"));
+            std::ptr::null_mut()
+        }
+    }
+}
+
+/// Blocks until one of `tickets` can be polled and returns it, or returns 0
+/// after `timeout_ms` (negative waits indefinitely, 0 only checks).
+#[no_mangle]
+pub extern "C" fn dbx_wait_any(
+    handle: *mut DbxHandle,
+    tickets: *const u64,
+    count: usize,
+    timeout_ms: i64,
+) -> u64 {
+    if check_handle(handle).is_err() || tickets.is_null() || count == 0 {
+        return 0;
+    }
+    let tickets = unsafe { std::slice::from_raw_parts(tickets, count) };
+    let timeout = u64::try_from(timeout_ms).ok().map(Duration::from_millis);
+    let client = unsafe { &*handle };
+    client
+        .runtime
+        .block_on(client.pending.wait_any(tickets, timeout))
+        .unwrap_or(0)
+}
+
+/// Forgets a ticket without waiting for it.
+#[no_mangle]
+pub extern "C" fn dbx_cancel(handle: *mut DbxHandle, ticket: u64) {
+    if check_handle(handle).is_err() {
+        return;
+    }
+    let client = unsafe { &*handle };
+    client.pending.cancel(ticket);
+}
+
+/// Descriptor that becomes readable whenever a submitted operation
+/// completes, for `stream_select` or an event loop; -1 where unsupported
+/// and on a current-thread runtime.
+/// Call `dbx_notify_drain` once it fires, before polling tickets.
+#[no_mangle]
+pub extern "C" fn dbx_notify_fd(handle: *mut DbxHandle) -> c_int {
+    if check_handle(handle).is_err() {
+        return -1;
+    }
+    let client = unsafe { &*handle };
+    if client.runtime.require_threaded("dbx_notify_fd").is_err() {
+        // nothing would complete while the caller waits on the descriptor
+        return -1;
+    }
+    client.pending.notify_fd()
+}
+
+#[no_mangle]
+pub extern "C" fn dbx_notify_drain(handle: *mut DbxHandle) {
+    if check_handle(handle).is_err() {
+        return;
+    }
+    let client = unsafe { &*handle };
+    client.pending.drain_notifications();
+}
+
+/// Opens a cursor over every page of a listing: the events of
+/// `aggregate_id`, or when `aggregate_id` is null the aggregates of
+/// `aggregate_type` (as `dbx_list_aggregates`). `options_json` takes the
+/// listing options plus `prefetch`, the number of pages fetched ahead of the
+/// caller (default 2; setting it needs a threaded runtime). Release with
+/// `dbx_cursor_close` before the handle.
+#[no_mangle]
+pub extern "C" fn dbx_cursor_open(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_id: *const c_char,
+    options_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> *mut Cursor {
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let agg_type = match string_from_ptr(aggregate_type) {
+        Ok(s) => s,
+        Err(err) => {
+            set_error(error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let agg_id = if aggregate_id.is_null() {
+        None
+    } else {
+        match string_from_ptr(aggregate_id) {
+            Ok(s) => Some(s),
+            Err(err) => {
+                set_error(error_out, err);
+                return std::ptr::null_mut();
+            }
+        }
+    };
+    let opts_value = match parse_json(options_json) {
+        Ok(v) => v,
         Err(err) => {
             set_error(error_out, err);
             return std::ptr::null_mut();
         }
     };
+    if opts_value.get("prefetch").is_some() {
+        // read-ahead only overlaps PHP work when the runtime has threads
+        if let Err(err) = unsafe { &*handle }.runtime.require_threaded("cursor prefetch") {
+            set_error(error_out, err);
+            return std::ptr::null_mut();
+        }
+    }
+    let prefetch = opts_value
+        .get("prefetch")
+        .and_then(Value::as_u64)
+        .map_or(cursor::DEFAULT_PREFETCH, |n| n as usize);
 
-    let client = unsafe { &mut *handle };
-    let response = match client
+    let projection = match Projection::from_options(&opts_value) {
+        Ok(p) => p,
+        Err(err) => {
+            set_error(error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let adaptive_take = match AdaptiveTake::from_options(&opts_value) {
+        Ok(a) => a,
+        Err(err) => {
+            set_error(error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+
+    let client = unsafe { &*handle };
+    let pool = client.pool.clone();
+    let kind = if agg_id.is_some() { "events" } else { "aggregates" };
+    let adaptive = adaptive_take.map(|config| {
+        let initial = opts_value.get("take").and_then(Value::as_u64);
+        Arc::new(Adaptive::new(client.sizer.clone(), kind, &agg_type, config, initial))
+    });
+    let cursor = match agg_id {
+        Some(agg_id) => Cursor::open(&client.runtime, prefetch, move |cursor| {
+            let mut opts = parse_list_events_options(&opts_value);
+            if cursor.is_some() {
+                opts.cursor = cursor;
+            }
+            if let Some(adaptive) = &adaptive {
+                opts.take = Some(adaptive.take());
+            }
+            sizing::observed(
+                adaptive.clone(),
+                list_events_payload(
+                    pool.clone(),
+                    agg_type.clone(),
+                    agg_id.clone(),
+                    opts,
+                    projection.clone(),
+                ),
+            )
+        }),
+        None => {
+            let agg_type = Some(agg_type).filter(|t| !t.is_empty());
+            Cursor::open(&client.runtime, prefetch, move |cursor| {
+                let mut opts = parse_list_aggregates_options(agg_type.clone(), &opts_value);
+                if cursor.is_some() {
+                    opts.cursor = cursor;
+                }
+                if let Some(adaptive) = &adaptive {
+                    opts.take = Some(adaptive.take());
+                }
+                sizing::observed(
+                    adaptive.clone(),
+                    list_aggregates_payload(pool.clone(), opts, projection.clone()),
+                )
+            })
+        }
+    };
+    Box::into_raw(Box::new(cursor))
+}
+
+/// Returns the next page (`{items, nextCursor}`), blocking only if it has
+/// not been prefetched yet. Returns null without an error once exhausted.
+#[no_mangle]
+pub extern "C" fn dbx_cursor_next(
+    handle: *mut DbxHandle,
+    cursor: *mut Cursor,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    let call = Call::start(Op::CursorNext);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    if cursor.is_null() {
+        reject(handle, call, error_out, "cursor is null");
+        return std::ptr::null_mut();
+    }
+    let client = unsafe { &*handle };
+    let cursor = unsafe { &mut *cursor };
+    match cursor.next(&client.runtime) {
+        Some(page) => client.respond(call, page, error_out),
+        None => std::ptr::null_mut(),
+    }
+}
+
+/// Stops the cursor's read-ahead and frees it.
+#[no_mangle]
+pub extern "C" fn dbx_cursor_close(cursor: *mut Cursor) {
+    if cursor.is_null() {
+        return;
+    }
+    unsafe {
+        drop(Box::from_raw(cursor));
+    }
+}
+
+/// Starts a change feed over the aggregates in `filter_json`
+/// (`{aggregates: [{aggregateType, aggregateId, fromVersion?}], intervalMs,
+/// buffer, eventsTake, token}`); see `subscription.rs`.
+#[no_mangle]
+pub extern "C" fn dbx_subscribe(
+    handle: *mut DbxHandle,
+    filter_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> *mut Subscription {
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let options = match parse_json(filter_json).and_then(SubscribeOptions::parse) {
+        Ok(options) => options,
+        Err(err) => {
+            set_error(error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let client = unsafe { &*handle };
+    if let Err(err) = client.runtime.require_threaded("a change feed") {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    match Subscription::start(&client.runtime, client.pool.clone(), options) {
+        Ok(subscription) => Box::into_raw(Box::new(subscription)),
+        Err(err) => {
+            set_error(error_out, err);
+            std::ptr::null_mut()
+        }
+    }
+}
+
+/// Up to `max` changes as `{items: [{aggregateType, aggregateId, event} |
+/// {aggregateType, aggregateId, error}]}`, waiting up to `timeout_ms` for
+/// the first (negative waits indefinitely, 0 only collects). Fails once the
+/// feed has ended and its buffer is drained.
+#[no_mangle]
+pub extern "C" fn dbx_subscription_next_batch(
+    handle: *mut DbxHandle,
+    subscription: *mut Subscription,
+    max: usize,
+    timeout_ms: i64,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    let call = Call::start(Op::SubscriptionNext);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    if subscription.is_null() {
+        reject(handle, call, error_out, "subscription is null");
+        return std::ptr::null_mut();
+    }
+    let client = unsafe { &*handle };
+    let subscription = unsafe { &mut *subscription };
+    let timeout = u64::try_from(timeout_ms).ok().map(Duration::from_millis);
+    let batch = subscription.next_batch(&client.runtime, max, timeout);
+    client.respond(call, batch, error_out)
+}
+
+/// Descriptor that becomes readable when changes are buffered; drained by
+/// `dbx_subscription_next_batch`. -1 where unsupported.
+#[no_mangle]
+pub extern "C" fn dbx_subscription_fd(subscription: *mut Subscription) -> c_int {
+    if subscription.is_null() {
+        return -1;
+    }
+    unsafe { &*subscription }.fd()
+}
+
+/// Stops the feed and frees it.
+#[no_mangle]
+pub extern "C" fn dbx_subscription_close(subscription: *mut Subscription) {
+    if subscription.is_null() {
+        return;
+    }
+    unsafe {
+        drop(Box::from_raw(subscription));
+    }
+}
+
+/// Writes every event of every aggregate matched by `options_json` (the
+/// `dbx_list_aggregates` options plus `format` = `ndjson`|`msgpack`,
+/// `concurrency` and `eventsTake`) to the file at `path`, or to `fd` when
+/// `path` is null (the descriptor is left open). Returns a summary
+/// `{aggregates, events, bytes, failed, errors}`; aggregates that fail to
+/// load are listed in `errors` without aborting the export.
+#[no_mangle]
+pub extern "C" fn dbx_export_events(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    options_json: *const c_char,
+    path: *const c_char,
+    fd: c_int,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    let call = Call::start(Op::ExportEvents);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let agg_type = match string_from_ptr(aggregate_type) {
+        Ok(s) if s.is_empty() => None,
+        Ok(s) => Some(s),
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let opts_value = match parse_json(options_json) {
+        Ok(v) => v,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let file = match open_export_target(path, fd) {
+        Ok(file) => file,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+
+    let client = unsafe { &*handle };
+    let result = client
         .runtime
-        .block_on(client.client.verify_aggregate(&agg_type, &agg_id))
-    {
-        Ok(resp) => resp,
+        .block_on(export::run(
+            client.pool.clone(),
+            client.sizer.clone(),
+            agg_type,
+            opts_value,
+            &*file,
+        ))
+        .map(|summary| {
+            if let Some(stats) = summary.compression {
+                client.metrics.compression.record(stats);
+            }
+            Reply::Exported(summary)
+        });
+    if !path.is_null() {
+        drop(std::mem::ManuallyDrop::into_inner(file));
+    }
+    client.respond(call, result, error_out)
+}
+
+/// Folds the events of `aggregate_id`, or of every aggregate of
+/// `aggregate_type` matched by the listing options in `spec_json` when
+/// `aggregate_id` is null, into the metrics of the spec (see `reduce`).
+/// Returns `{aggregates, events, matched, failed, errors}` plus `values`, or
+/// `groups` keyed by the `groupBy` value.
+#[no_mangle]
+pub extern "C" fn dbx_reduce_events(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_id: *const c_char,
+    spec_json: *const c_char,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    let call = Call::start(Op::ReduceEvents);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let agg_type = match string_from_ptr(aggregate_type) {
+        Ok(s) if s.is_empty() => None,
+        Ok(s) => Some(s),
         Err(err) => {
-            set_error(error_out, err.to_string());
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let agg_id = if aggregate_id.is_null() {
+        None
+    } else {
+        match string_from_ptr(aggregate_id) {
+            Ok(s) => Some(s),
+            Err(err) => {
+                reject(handle, call, error_out, err);
+                return std::ptr::null_mut();
+            }
+        }
+    };
+    if agg_id.is_some() && agg_type.is_none() {
+        reject(handle, call, error_out, "aggregate_type is required with aggregate_id");
+        return std::ptr::null_mut();
+    }
+    let spec_value = match parse_json(spec_json) {
+        Ok(v) => v,
+        Err(err) => {
+            reject(handle, call, error_out, err);
             return std::ptr::null_mut();
         }
     };
 
-    let payload = Value::Object(
-        [("merkleRoot".to_string(), Value::String(response.merkle_root))]
-            .into_iter()
-            .collect(),
-    );
+    let client = unsafe { &*handle };
+    let result = client
+        .runtime
+        .block_on(reduce::run(
+            client.pool.clone(),
+            client.sizer.clone(),
+            agg_type,
+            agg_id,
+            spec_value,
+        ))
+        .map(Reply::Reduced);
+    client.respond(call, result, error_out)
+}
+
+/// The export destination, wrapped so that a caller-owned descriptor is not
+/// closed on drop; files opened from `path` are closed explicitly.
+fn open_export_target(
+    path: *const c_char,
+    fd: c_int,
+) -> Result<std::mem::ManuallyDrop<std::fs::File>, String> {
+    if !path.is_null() {
+        let path = string_from_ptr(path)?;
+        return std::fs::File::create(&path)
+            .map(std::mem::ManuallyDrop::new)
+            .map_err(|e| format!("failed to open {path}: {e}"));
+    }
+    #[cfg(unix)]
+    {
+        use std::os::unix::io::FromRawFd;
+        if fd < 0 {
+            return Err("path or fd is required".to_string());
+        }
+        Ok(std::mem::ManuallyDrop::new(unsafe { std::fs::File::from_raw_fd(fd) }))
+    }
+    #[cfg(not(unix))]
+    {
+        let _ = fd;
+        Err("exporting to a file descriptor is only supported on unix".to_string())
+    }
+}
+
+/// Drops every entry of the handle's read cache.
+#[no_mangle]
+pub extern "C" fn dbx_cache_clear(handle: *mut DbxHandle) {
+    if check_handle(handle).is_err() {
+        return;
+    }
+    let client = unsafe { &*handle };
+    client.cache.clear();
+}
 
-    match to_cstring(payload) {
-        Ok(ptr) => ptr,
+/// Per-operation call counts, error counts, response bytes and latency
+/// percentiles, plus pool queue wait and server time, as
+/// `{ops: {<export>: {...}}, queueWait, server}`.
+#[no_mangle]
+pub extern "C" fn dbx_metrics_snapshot(
+    handle: *mut DbxHandle,
+    error_out: *mut *mut c_char,
+) -> *mut c_char {
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let client = unsafe { &*handle };
+    match reply::encode(client.format, &client.metrics.snapshot()) {
+        Ok((ptr, _)) => ptr,
         Err(err) => {
             set_error(error_out, err);
             std::ptr::null_mut()
         }
     }
 }
+
+/// The same metrics in Prometheus text format; always plain text, freed with
+/// `dbx_string_free`.
+#[no_mangle]
+pub extern "C" fn dbx_metrics_prometheus(handle: *mut DbxHandle) -> *mut c_char {
+    if check_handle(handle).is_err() {
+        return std::ptr::null_mut();
+    }
+    let client = unsafe { &*handle };
+    CString::new(client.metrics.prometheus())
+        .map(CString::into_raw)
+        .unwrap_or(std::ptr::null_mut())
+}
@@ -0,0 +1,587 @@
+//! Per-handle call counters and latency histograms.
+//!
+//! Everything is a relaxed atomic in a fixed array, so recording a call
+//! costs a few uncontended increments and no allocation. Latencies go into
+//! power-of-two microsecond buckets (HDR-style, ~2x resolution), from which
+//! snapshots derive percentiles and the Prometheus rendering its `le` series.
+
+use std::{
+    fmt::Write as _,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc, OnceLock,
+    },
+    time::{Duration, Instant},
+};
+
+use serde::Serialize;
+
+use crate::{
+    compress::CompressionStats,
+    retry::{RetryGauge, RetrySnapshot},
+    routing::{self, EndpointSnapshot, Node},
+};
+
+/// Bucket `i` counts samples below `2^i` µs; the last one is unbounded.
+const BUCKETS: usize = 32;
+
+macro_rules! ops {
+    ($($op:ident => $name:literal,)*) => {
+        /// Exports that record per-call metrics.
+        #[derive(Clone, Copy)]
+        pub(crate) enum Op {
+            $($op,)*
+        }
+
+        const OP_NAMES: &[&str] = &[$($name,)*];
+    };
+}
+
+ops! {
+    ListAggregates => "dbx_list_aggregates",
+    GetAggregate => "dbx_get_aggregate",
+    GetAggregates => "dbx_get_aggregates",
+    SelectAggregate => "dbx_select_aggregate",
+    SelectAggregates => "dbx_select_aggregates",
+    ListEvents => "dbx_list_events",
+    AppendEvent => "dbx_append_event",
+    AppendEventRaw => "dbx_append_event_raw",
+    AppendEvents => "dbx_append_events",
+    CreateAggregate => "dbx_create_aggregate",
+    CreateAggregateRaw => "dbx_create_aggregate_raw",
+    PatchEvent => "dbx_patch_event",
+    SetArchive => "dbx_set_archive",
+    VerifyAggregate => "dbx_verify_aggregate",
+    VerifyAggregates => "dbx_verify_aggregates",
+    CreateSnapshot => "dbx_create_snapshot",
+    ListSnapshots => "dbx_list_snapshots",
+    GetSnapshot => "dbx_get_snapshot",
+    LoadState => "dbx_load_state",
+    Poll => "dbx_poll",
+    CursorNext => "dbx_cursor_next",
+    SubscriptionNext => "dbx_subscription_next_batch",
+    ExportEvents => "dbx_export_events",
+    ReduceEvents => "dbx_reduce_events",
+    Flush => "dbx_flush",
+    Execute => "dbx_execute",
+}
+
+pub(crate) struct Histogram {
+    buckets: [AtomicU64; BUCKETS],
+    count: AtomicU64,
+    sum_us: AtomicU64,
+    max_us: AtomicU64,
+}
+
+impl Histogram {
+    pub(crate) fn new() -> Self {
+        Histogram {
+            buckets: std::array::from_fn(|_| AtomicU64::new(0)),
+            count: AtomicU64::new(0),
+            sum_us: AtomicU64::new(0),
+            max_us: AtomicU64::new(0),
+        }
+    }
+
+    pub(crate) fn record(&self, elapsed: Duration) {
+        let us = u64::try_from(elapsed.as_micros()).unwrap_or(u64::MAX);
+        // bucket i holds (2^(i-1), 2^i], matching Prometheus' inclusive `le`
+        let bucket = ((u64::BITS - us.saturating_sub(1).leading_zeros()) as usize).min(BUCKETS - 1);
+        self.buckets[bucket].fetch_add(1, Ordering::Relaxed);
+        self.count.fetch_add(1, Ordering::Relaxed);
+        self.sum_us.fetch_add(us, Ordering::Relaxed);
+        self.max_us.fetch_max(us, Ordering::Relaxed);
+    }
+
+    fn counts(&self) -> [u64; BUCKETS] {
+        std::array::from_fn(|i| self.buckets[i].load(Ordering::Relaxed))
+    }
+
+    pub(crate) fn count(&self) -> u64 {
+        self.count.load(Ordering::Relaxed)
+    }
+
+    /// Upper bound of the bucket holding quantile `q`, capped at the
+    /// largest sample.
+    pub(crate) fn quantile_us(&self, q: f64) -> u64 {
+        quantile_us(&self.counts(), self.max_us.load(Ordering::Relaxed), q)
+    }
+
+    fn snapshot(&self) -> HistogramSnapshot {
+        let counts = self.counts();
+        let count = counts.iter().sum();
+        let max_us = self.max_us.load(Ordering::Relaxed);
+        let quantile = |q: f64| quantile_us(&counts, max_us, q);
+        HistogramSnapshot {
+            count,
+            sum_us: self.sum_us.load(Ordering::Relaxed),
+            max_us,
+            p50_us: quantile(0.5),
+            p90_us: quantile(0.9),
+            p99_us: quantile(0.99),
+        }
+    }
+}
+
+fn quantile_us(counts: &[u64; BUCKETS], max_us: u64, q: f64) -> u64 {
+    let count: u64 = counts.iter().sum();
+    let target = ((count as f64) * q).ceil().max(1.0) as u64;
+    let mut seen = 0;
+    for (i, n) in counts.iter().enumerate() {
+        seen += n;
+        if seen >= target {
+            return bucket_upper_us(i).min(max_us);
+        }
+    }
+    max_us
+}
+
+fn bucket_upper_us(bucket: usize) -> u64 {
+    if bucket + 1 >= BUCKETS {
+        u64::MAX
+    } else {
+        1u64 << bucket
+    }
+}
+
+/// Depth and outcomes of the write queue (see `writes`).
+#[derive(Default)]
+pub(crate) struct QueueGauge {
+    depth: AtomicU64,
+    high_water: AtomicU64,
+    enqueued: AtomicU64,
+    dropped: AtomicU64,
+    rejected: AtomicU64,
+}
+
+impl QueueGauge {
+    /// Counts an entry about to be sent; returns the depth including it.
+    pub(crate) fn push(&self) -> u64 {
+        self.depth.fetch_add(1, Ordering::Relaxed) + 1
+    }
+
+    /// Confirms a `push` once the entry is in the queue.
+    pub(crate) fn accepted(&self, depth: u64) {
+        self.high_water.fetch_max(depth, Ordering::Relaxed);
+        self.enqueued.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Reverts a `push` whose entry was not queued after all.
+    pub(crate) fn unpush(&self) {
+        self.depth.fetch_sub(1, Ordering::Relaxed);
+    }
+
+    pub(crate) fn pop(&self, count: usize) {
+        self.depth.fetch_sub(count as u64, Ordering::Relaxed);
+    }
+
+    pub(crate) fn dropped(&self) {
+        self.dropped.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub(crate) fn rejected(&self) {
+        self.rejected.fetch_add(1, Ordering::Relaxed);
+    }
+
+    fn snapshot(&self) -> QueueSnapshot {
+        QueueSnapshot {
+            depth: self.depth.load(Ordering::Relaxed),
+            high_water: self.high_water.load(Ordering::Relaxed),
+            enqueued: self.enqueued.load(Ordering::Relaxed),
+            dropped: self.dropped.load(Ordering::Relaxed),
+            rejected: self.rejected.load(Ordering::Relaxed),
+            lost_on_close: LOST_ON_CLOSE.load(Ordering::Relaxed),
+        }
+    }
+}
+
+/// Appends that handles freed in this process never got to report: still
+/// unacknowledged when the close flush timed out, or failed without a
+/// later `dbx_flush` collecting the failure. Process-wide, because the
+/// handle (and its metrics) are gone by then.
+static LOST_ON_CLOSE: AtomicU64 = AtomicU64::new(0);
+
+pub(crate) fn lost_on_close(count: u64) {
+    LOST_ON_CLOSE.fetch_add(count, Ordering::Relaxed);
+}
+
+/// Bytes through and time spent in the encoder of compressed exports.
+pub(crate) struct CompressionGauge {
+    bytes_in: AtomicU64,
+    bytes_out: AtomicU64,
+    busy: Histogram,
+}
+
+impl CompressionGauge {
+    fn new() -> Self {
+        CompressionGauge {
+            bytes_in: AtomicU64::new(0),
+            bytes_out: AtomicU64::new(0),
+            busy: Histogram::new(),
+        }
+    }
+
+    pub(crate) fn record(&self, stats: CompressionStats) {
+        self.bytes_in.fetch_add(stats.bytes_in, Ordering::Relaxed);
+        self.bytes_out.fetch_add(stats.bytes_out, Ordering::Relaxed);
+        self.busy.record(stats.busy);
+    }
+
+    fn snapshot(&self) -> CompressionSnapshot {
+        let bytes_in = self.bytes_in.load(Ordering::Relaxed);
+        let bytes_out = self.bytes_out.load(Ordering::Relaxed);
+        CompressionSnapshot {
+            bytes_in,
+            bytes_out,
+            ratio: if bytes_out > 0 {
+                bytes_in as f64 / bytes_out as f64
+            } else {
+                0.0
+            },
+            busy: self.busy.snapshot(),
+        }
+    }
+}
+
+struct OpMetrics {
+    calls: AtomicU64,
+    errors: AtomicU64,
+    bytes_out: AtomicU64,
+    latency: Histogram,
+    serialize: Histogram,
+}
+
+pub(crate) struct Metrics {
+    ops: Vec<OpMetrics>,
+    /// Time spent waiting for an in-flight permit and a pooled connection.
+    pub(crate) queue_wait: Histogram,
+    /// Time from leasing a connection to the server's reply.
+    pub(crate) server: Histogram,
+    pub(crate) write_queue: QueueGauge,
+    pub(crate) compression: CompressionGauge,
+    pub(crate) retry: RetryGauge,
+    /// Health of the pool's endpoints, set once the pool is connected.
+    pub(crate) endpoints: OnceLock<Vec<Arc<Node>>>,
+}
+
+/// Started by an export on entry and passed to `DbxHandle::respond`.
+#[derive(Clone, Copy)]
+pub(crate) struct Call {
+    op: Op,
+    started: Instant,
+}
+
+impl Call {
+    pub(crate) fn start(op: Op) -> Self {
+        Call {
+            op,
+            started: Instant::now(),
+        }
+    }
+}
+
+impl Metrics {
+    pub(crate) fn new() -> Self {
+        Metrics {
+            ops: OP_NAMES
+                .iter()
+                .map(|_| OpMetrics {
+                    calls: AtomicU64::new(0),
+                    errors: AtomicU64::new(0),
+                    bytes_out: AtomicU64::new(0),
+                    latency: Histogram::new(),
+                    serialize: Histogram::new(),
+                })
+                .collect(),
+            queue_wait: Histogram::new(),
+            server: Histogram::new(),
+            write_queue: QueueGauge::default(),
+            compression: CompressionGauge::new(),
+            retry: RetryGauge::new(),
+            endpoints: OnceLock::new(),
+        }
+    }
+
+    /// Records a finished call; `serialize` covers encoding the reply and
+    /// `bytes_out` is the size handed back (0 on error).
+    pub(crate) fn finish(&self, call: Call, ok: bool, serialize: Duration, bytes_out: usize) {
+        let op = &self.ops[call.op as usize];
+        op.calls.fetch_add(1, Ordering::Relaxed);
+        if !ok {
+            op.errors.fetch_add(1, Ordering::Relaxed);
+        }
+        op.bytes_out.fetch_add(bytes_out as u64, Ordering::Relaxed);
+        op.serialize.record(serialize);
+        op.latency.record(call.started.elapsed());
+    }
+
+    pub(crate) fn snapshot(&self) -> MetricsSnapshot {
+        MetricsSnapshot {
+            ops: OP_NAMES
+                .iter()
+                .zip(&self.ops)
+                .filter(|(_, op)| op.calls.load(Ordering::Relaxed) > 0)
+                .map(|(name, op)| {
+                    (
+                        name.to_string(),
+                        OpSnapshot {
+                            calls: op.calls.load(Ordering::Relaxed),
+                            errors: op.errors.load(Ordering::Relaxed),
+                            bytes_out: op.bytes_out.load(Ordering::Relaxed),
+                            latency: op.latency.snapshot(),
+                            serialize: op.serialize.snapshot(),
+                        },
+                    )
+                })
+                .collect(),
+            queue_wait: self.queue_wait.snapshot(),
+            server: self.server.snapshot(),
+            write_queue: self.write_queue.snapshot(),
+            compression: self.compression.snapshot(),
+            retry: self.retry.snapshot(),
+            endpoints: routing::snapshot(self.endpoints.get().map_or(&[], Vec::as_slice)),
+        }
+    }
+
+    /// Prometheus text exposition format (also valid OpenMetrics without the
+    /// trailing `# EOF`).
+    pub(crate) fn prometheus(&self) -> String {
+        let mut out = String::with_capacity(4096);
+        // each family is one contiguous group, as the format requires
+        let counters: [(&str, fn(&OpMetrics) -> &AtomicU64); 3] = [
+            ("eventdbx_calls_total", |op| &op.calls),
+            ("eventdbx_errors_total", |op| &op.errors),
+            ("eventdbx_response_bytes_total", |op| &op.bytes_out),
+        ];
+        for (metric, counter) in counters {
+            let _ = writeln!(out, "# TYPE {metric} counter");
+            for (name, op) in OP_NAMES.iter().zip(&self.ops) {
+                if op.calls.load(Ordering::Relaxed) > 0 {
+                    let value = counter(op).load(Ordering::Relaxed);
+                    let _ = writeln!(out, "{metric}{{op=\"{name}\"}} {value}");
+                }
+            }
+        }
+        render_histogram(&mut out, "eventdbx_call_seconds", &self.ops, |op| &op.latency);
+        render_histogram(&mut out, "eventdbx_serialize_seconds", &self.ops, |op| &op.serialize);
+        render_single(&mut out, "eventdbx_queue_wait_seconds", &self.queue_wait);
+        render_single(&mut out, "eventdbx_server_seconds", &self.server);
+
+        let queue = self.write_queue.snapshot();
+        for (metric, kind, value) in [
+            ("eventdbx_write_queue_depth", "gauge", queue.depth),
+            ("eventdbx_write_queue_high_water", "gauge", queue.high_water),
+            ("eventdbx_write_queue_enqueued_total", "counter", queue.enqueued),
+            ("eventdbx_write_queue_dropped_total", "counter", queue.dropped),
+            ("eventdbx_write_queue_rejected_total", "counter", queue.rejected),
+            ("eventdbx_write_queue_lost_on_close_total", "counter", queue.lost_on_close),
+        ] {
+            let _ = writeln!(out, "# TYPE {metric} {kind}\n{metric} {value}");
+        }
+
+        let compression = self.compression.snapshot();
+        for (metric, value) in [
+            ("eventdbx_compression_input_bytes_total", compression.bytes_in),
+            ("eventdbx_compression_output_bytes_total", compression.bytes_out),
+        ] {
+            let _ = writeln!(out, "# TYPE {metric} counter\n{metric} {value}");
+        }
+        render_single(&mut out, "eventdbx_compression_seconds", &self.compression.busy);
+
+        let retry = self.retry.snapshot();
+        for (metric, value) in [
+            ("eventdbx_retries_total", retry.retries),
+            ("eventdbx_hedges_total", retry.hedges),
+            ("eventdbx_hedge_wins_total", retry.hedge_wins),
+        ] {
+            let _ = writeln!(out, "# TYPE {metric} counter\n{metric} {value}");
+        }
+        routing::prometheus(&mut out, self.endpoints.get().map_or(&[], Vec::as_slice));
+        out
+    }
+}
+
+fn render_histogram(
+    out: &mut String,
+    metric: &str,
+    ops: &[OpMetrics],
+    histogram: impl Fn(&OpMetrics) -> &Histogram,
+) {
+    let _ = writeln!(out, "# TYPE {metric} histogram");
+    for (name, op) in OP_NAMES.iter().zip(ops) {
+        if op.calls.load(Ordering::Relaxed) > 0 {
+            render_series(out, metric, &format!("op=\"{name}\","), histogram(op));
+        }
+    }
+}
+
+fn render_single(out: &mut String, metric: &str, histogram: &Histogram) {
+    let _ = writeln!(out, "# TYPE {metric} histogram");
+    render_series(out, metric, "", histogram);
+}
+
+fn render_series(out: &mut String, metric: &str, labels: &str, histogram: &Histogram) {
+    let counts = histogram.counts();
+    let mut cumulative = 0;
+    for (i, n) in counts.iter().enumerate().take(BUCKETS - 1) {
+        cumulative += n;
+        let le = bucket_upper_us(i) as f64 / 1e6;
+        let _ = writeln!(out, "{metric}_bucket{{{labels}le=\"{le}\"}} {cumulative}");
+    }
+    cumulative += counts[BUCKETS - 1];
+    let _ = writeln!(out, "{metric}_bucket{{{labels}le=\"+Inf\"}} {cumulative}");
+    let sum = histogram.sum_us.load(Ordering::Relaxed) as f64 / 1e6;
+    let labels = labels.trim_end_matches(',');
+    let braces = if labels.is_empty() {
+        String::new()
+    } else {
+        format!("{{{labels}}}")
+    };
+    let _ = writeln!(out, "{metric}_sum{braces} {sum}");
+    let _ = writeln!(out, "{metric}_count{braces} {cumulative}");
+}
+
+#[derive(Serialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct HistogramSnapshot {
+    count: u64,
+    sum_us: u64,
+    max_us: u64,
+    p50_us: u64,
+    p90_us: u64,
+    p99_us: u64,
+}
+
+#[derive(Serialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct OpSnapshot {
+    calls: u64,
+    errors: u64,
+    bytes_out: u64,
+    latency: HistogramSnapshot,
+    serialize: HistogramSnapshot,
+}
+
+#[derive(Serialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct QueueSnapshot {
+    depth: u64,
+    high_water: u64,
+    enqueued: u64,
+    dropped: u64,
+    rejected: u64,
+    lost_on_close: u64,
+}
+
+#[derive(Serialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct CompressionSnapshot {
+    bytes_in: u64,
+    bytes_out: u64,
+    /// `bytesIn / bytesOut`; 0 before anything was compressed.
+    ratio: f64,
+    busy: HistogramSnapshot,
+}
+
+#[derive(Serialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct MetricsSnapshot {
+    ops: std::collections::BTreeMap<String, OpSnapshot>,
+    queue_wait: HistogramSnapshot,
+    server: HistogramSnapshot,
+    write_queue: QueueSnapshot,
+    compression: CompressionSnapshot,
+    retry: RetrySnapshot,
+    endpoints: Vec<EndpointSnapshot>,
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn histogram_buckets_and_quantiles() {
+        let histogram = Histogram::new();
+        for us in [0, 1, 3, 100, 1000] {
+            histogram.record(Duration::from_micros(us));
+        }
+        let counts = histogram.counts();
+        assert_eq!(counts[0], 2);
+        assert_eq!(counts[1], 0);
+        assert_eq!(counts[2], 1);
+        assert_eq!(counts[7], 1);
+        assert_eq!(counts[10], 1);
+
+        // upper bounds are inclusive: 4 us counts towards le=4 us
+        let edge = Histogram::new();
+        edge.record(Duration::from_micros(4));
+        edge.record(Duration::from_micros(5));
+        assert_eq!(edge.counts()[2], 1);
+        assert_eq!(edge.counts()[3], 1);
+
+        let snapshot = histogram.snapshot();
+        assert_eq!(snapshot.count, 5);
+        assert_eq!(snapshot.max_us, 1000);
+        assert_eq!(snapshot.p50_us, 4);
+        assert_eq!(snapshot.p99_us, 1000);
+    }
+
+    #[test]
+    fn snapshot_lists_only_called_ops() {
+        let metrics = Metrics::new();
+        metrics.finish(Call::start(Op::GetAggregate), true, Duration::from_micros(5), 42);
+        metrics.finish(Call::start(Op::GetAggregate), false, Duration::ZERO, 0);
+
+        let snapshot = serde_json::to_value(metrics.snapshot()).unwrap();
+        let get = &snapshot["ops"]["dbx_get_aggregate"];
+        assert_eq!(get["calls"], 2);
+        assert_eq!(get["errors"], 1);
+        assert_eq!(get["bytesOut"], 42);
+        assert!(snapshot["ops"].get("dbx_list_events").is_none());
+    }
+
+    #[test]
+    fn prometheus_renders_cumulative_buckets() {
+        let metrics = Metrics::new();
+        metrics.finish(Call::start(Op::ListEvents), true, Duration::ZERO, 10);
+        metrics.server.record(Duration::from_millis(2));
+
+        let text = metrics.prometheus();
+        assert!(text.contains("eventdbx_calls_total{op=\"dbx_list_events\"} 1\n"));
+        assert!(text.contains("eventdbx_call_seconds_count{op=\"dbx_list_events\"} 1\n"));
+        assert!(text.contains("eventdbx_server_seconds_bucket{le=\"+Inf\"} 1\n"));
+        assert!(text.contains("eventdbx_server_seconds_count 1\n"));
+        assert!(text.contains("# TYPE eventdbx_write_queue_high_water gauge\neventdbx_write_queue_high_water 0\n"));
+        // 2 ms is in the le=0.002048 bucket, not above it
+        assert!(text.contains("eventdbx_server_seconds_bucket{le=\"0.001024\"} 0\n"));
+        assert!(text.contains("eventdbx_server_seconds_bucket{le=\"0.002048\"} 1\n"));
+    }
+
+    #[test]
+    fn prometheus_keeps_each_family_contiguous() {
+        let metrics = Metrics::new();
+        metrics.finish(Call::start(Op::GetAggregate), true, Duration::ZERO, 10);
+        metrics.finish(Call::start(Op::ListEvents), false, Duration::ZERO, 0);
+
+        let text = metrics.prometheus();
+        let mut families: Vec<&str> = text
+            .lines()
+            .filter(|line| !line.starts_with('#'))
+            .map(|line| line.split(['{', ' ']).next().unwrap())
+            .map(|name| {
+                ["_bucket", "_sum", "_count"]
+                    .iter()
+                    .find_map(|suffix| name.strip_suffix(suffix))
+                    .unwrap_or(name)
+            })
+            .collect();
+        families.dedup();
+        let mut unique = families.clone();
+        unique.sort_unstable();
+        unique.dedup();
+        assert_eq!(families.len(), unique.len(), "{families:?}");
+        assert!(text.contains(
+            "# TYPE eventdbx_errors_total counter\neventdbx_errors_total{op=\"dbx_get_aggregate\"} 0\neventdbx_errors_total{op=\"dbx_list_events\"} 1\n"
+        ));
+    }
+}
@@ -0,0 +1,76 @@
+//! MessagePack encoding for responses (`responseFormat: msgpack`) and
+//! msgpack exports, via `rmp-serde`.
+//!
+//! Structs are written as maps keyed by field name, so PHP's
+//! `msgpack_unpack()` yields the same associative arrays as the JSON
+//! replies. Maps of unknown length (e.g. from `#[serde(flatten)]`) are
+//! buffered by the encoder and get an exact header.
+
+use serde::Serialize;
+
+pub(crate) fn to_writer<T: Serialize + ?Sized>(
+    out: &mut Vec<u8>,
+    value: &T,
+) -> Result<(), rmp_serde::encode::Error> {
+    rmp_serde::encode::write_named(out, value)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn encode<T: Serialize>(value: &T) -> Vec<u8> {
+        let mut out = Vec::new();
+        to_writer(&mut out, value).unwrap();
+        out
+    }
+
+    #[test]
+    fn encodes_scalars_compactly() {
+        assert_eq!(encode(&serde_json::json!(null)), [0xc0]);
+        assert_eq!(encode(&serde_json::json!(true)), [0xc3]);
+        assert_eq!(encode(&serde_json::json!(5)), [0x05]);
+        assert_eq!(encode(&serde_json::json!(-1)), [0xff]);
+        assert_eq!(encode(&serde_json::json!(300)), [0xcd, 0x01, 0x2c]);
+        assert_eq!(encode(&serde_json::json!(-200)), [0xd1, 0xff, 0x38]);
+        assert_eq!(encode(&serde_json::json!("ab")), [0xa2, b'a', b'b']);
+    }
+
+    #[test]
+    fn encodes_structs_as_named_maps() {
+        #[derive(Serialize)]
+        struct Event<'a> {
+            version: u64,
+            kind: &'a str,
+        }
+        let bytes = encode(&Event { version: 3, kind: "x" });
+        let mut expected = vec![0x82, 0xa7];
+        expected.extend_from_slice(b"version");
+        expected.extend_from_slice(&[0x03, 0xa4]);
+        expected.extend_from_slice(b"kind");
+        expected.extend_from_slice(&[0xa1, b'x']);
+        assert_eq!(bytes, expected);
+    }
+
+    #[test]
+    fn encodes_nested_containers() {
+        let value = serde_json::json!({ "a": [1, 2] });
+        assert_eq!(encode(&value), [0x81, 0xa1, b'a', 0x92, 0x01, 0x02]);
+    }
+
+    #[test]
+    fn sizes_unknown_length_maps() {
+        #[derive(Serialize)]
+        struct Inner {
+            b: u8,
+        }
+        #[derive(Serialize)]
+        struct Outer {
+            a: u8,
+            #[serde(flatten)]
+            inner: Inner,
+        }
+        let bytes = encode(&Outer { a: 1, inner: Inner { b: 2 } });
+        assert_eq!(bytes, [0x82, 0xa1, b'a', 0x01, 0xa1, b'b', 0x02]);
+    }
+}
@@ -0,0 +1,261 @@
+//! Tickets for operations submitted without blocking the caller.
+//!
+//! `dbx_submit_*` spawns the operation on the handle runtime and returns a
+//! ticket straight away. Completion is signalled three ways: `dbx_poll`
+//! checks a single ticket, `dbx_wait_any` blocks (bounded) until one of a set
+//! completes, and on Unix a pipe descriptor from `dbx_notify_fd` becomes
+//! readable so event loops can multiplex it with their other streams.
+
+use std::{
+    collections::HashMap,
+    future::Future,
+    pin::pin,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc, Mutex, MutexGuard, PoisonError,
+    },
+    time::Duration,
+};
+
+use tokio::{runtime::Runtime, sync::Notify};
+
+use crate::reply::Reply;
+
+pub(crate) enum TicketState {
+    Unknown,
+    Pending,
+    Ready(Result<Reply, String>),
+}
+
+pub(crate) struct Pending {
+    next: AtomicU64,
+    /// `None` while the operation is in flight.
+    results: Mutex<HashMap<u64, Option<Result<Reply, String>>>>,
+    changed: Notify,
+    notifier: Notifier,
+}
+
+impl Pending {
+    pub(crate) fn new() -> Result<Pending, String> {
+        Ok(Pending {
+            next: AtomicU64::new(1),
+            results: Mutex::new(HashMap::new()),
+            changed: Notify::new(),
+            notifier: Notifier::new()?,
+        })
+    }
+
+    fn lock(&self) -> MutexGuard<'_, HashMap<u64, Option<Result<Reply, String>>>> {
+        self.results.lock().unwrap_or_else(PoisonError::into_inner)
+    }
+
+    /// Spawns `operation` and returns its ticket (never 0).
+    pub(crate) fn submit<F>(self: &Arc<Self>, runtime: &Runtime, operation: F) -> u64
+    where
+        F: Future<Output = Result<Reply, String>> + Send + 'static,
+    {
+        let ticket = self.next.fetch_add(1, Ordering::Relaxed);
+        self.lock().insert(ticket, None);
+        let pending = self.clone();
+        runtime.spawn(async move {
+            let result = operation.await;
+            pending.complete(ticket, result);
+        });
+        ticket
+    }
+
+    fn complete(&self, ticket: u64, result: Result<Reply, String>) {
+        if let Some(slot) = self.lock().get_mut(&ticket) {
+            *slot = Some(result);
+        } else {
+            // cancelled while in flight
+            return;
+        }
+        self.changed.notify_waiters();
+        self.notifier.signal();
+    }
+
+    /// Takes the result of a completed ticket; pending tickets stay queued.
+    pub(crate) fn poll(&self, ticket: u64) -> TicketState {
+        let mut results = self.lock();
+        match results.get(&ticket) {
+            None => TicketState::Unknown,
+            Some(None) => TicketState::Pending,
+            Some(Some(_)) => match results.remove(&ticket) {
+                Some(Some(result)) => TicketState::Ready(result),
+                _ => TicketState::Unknown,
+            },
+        }
+    }
+
+    /// Forgets a ticket. An in-flight operation still runs to completion but
+    /// its result is discarded.
+    pub(crate) fn cancel(&self, ticket: u64) {
+        self.lock().remove(&ticket);
+    }
+
+    fn first_ready(&self, tickets: &[u64]) -> Option<u64> {
+        let results = self.lock();
+        tickets
+            .iter()
+            .copied()
+            .find(|ticket| !matches!(results.get(ticket), Some(None)))
+    }
+
+    /// Returns the first ticket in `tickets` that has completed (or is
+    /// unknown, so callers never wait on it forever), or `None` on timeout.
+    /// `timeout` of `None` waits indefinitely.
+    pub(crate) async fn wait_any(&self, tickets: &[u64], timeout: Option<Duration>) -> Option<u64> {
+        let wait = async {
+            loop {
+                let mut changed = pin!(self.changed.notified());
+                changed.as_mut().enable();
+                if let Some(ticket) = self.first_ready(tickets) {
+                    return ticket;
+                }
+                changed.await;
+            }
+        };
+        match timeout {
+            Some(timeout) => tokio::time::timeout(timeout, wait).await.ok(),
+            None => Some(wait.await),
+        }
+    }
+
+    pub(crate) fn notify_fd(&self) -> i32 {
+        self.notifier.fd()
+    }
+
+    pub(crate) fn drain_notifications(&self) {
+        self.notifier.drain();
+    }
+}
+
+/// Self-pipe that event loops can watch for readiness.
+#[cfg(unix)]
+pub(crate) struct Notifier {
+    read_fd: i32,
+    write_fd: i32,
+}
+
+#[cfg(unix)]
+impl Notifier {
+    pub(crate) fn new() -> Result<Notifier, String> {
+        let mut fds = [0; 2];
+        if unsafe { libc::pipe(fds.as_mut_ptr()) } != 0 {
+            return Err(format!(
+                "failed to create notify pipe: {}",
+                std::io::Error::last_os_error()
+            ));
+        }
+        for fd in fds {
+            unsafe {
+                let flags = libc::fcntl(fd, libc::F_GETFL);
+                libc::fcntl(fd, libc::F_SETFL, flags | libc::O_NONBLOCK);
+                libc::fcntl(fd, libc::F_SETFD, libc::FD_CLOEXEC);
+            }
+        }
+        Ok(Notifier {
+            read_fd: fds[0],
+            write_fd: fds[1],
+        })
+    }
+
+    pub(crate) fn fd(&self) -> i32 {
+        self.read_fd
+    }
+
+    pub(crate) fn signal(&self) {
+        // a full pipe already wakes readers, so EAGAIN is fine to ignore
+        let byte = 1u8;
+        unsafe {
+            libc::write(self.write_fd, (&byte as *const u8).cast(), 1);
+        }
+    }
+
+    pub(crate) fn drain(&self) {
+        let mut buf = [0u8; 256];
+        while unsafe { libc::read(self.read_fd, buf.as_mut_ptr().cast(), buf.len()) } > 0 {}
+    }
+}
+
+#[cfg(unix)]
+impl Drop for Notifier {
+    fn drop(&mut self) {
+        unsafe {
+            libc::close(self.read_fd);
+            libc::close(self.write_fd);
+        }
+    }
+}
+
+#[cfg(not(unix))]
+pub(crate) struct Notifier;
+
+#[cfg(not(unix))]
+impl Notifier {
+    pub(crate) fn new() -> Result<Notifier, String> {
+        Ok(Notifier)
+    }
+
+    pub(crate) fn fd(&self) -> i32 {
+        -1
+    }
+
+    pub(crate) fn signal(&self) {}
+
+    pub(crate) fn drain(&self) {}
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn submitted_ticket_completes_and_is_consumed() {
+        let runtime = Runtime::new().unwrap();
+        let pending = Arc::new(Pending::new().unwrap());
+        let ticket = pending.submit(&runtime, async {
+            Ok(Reply::Failed {
+                error: "seven".to_string(),
+            })
+        });
+
+        let ready = runtime.block_on(pending.wait_any(&[ticket], Some(Duration::from_secs(5))));
+        assert_eq!(ready, Some(ticket));
+        assert!(matches!(
+            pending.poll(ticket),
+            TicketState::Ready(Ok(Reply::Failed { error })) if error == "seven"
+        ));
+        assert!(matches!(pending.poll(ticket), TicketState::Unknown));
+    }
+
+    #[test]
+    fn wait_any_times_out_on_pending_tickets() {
+        let runtime = Runtime::new().unwrap();
+        let pending = Arc::new(Pending::new().unwrap());
+        let ticket = pending.submit(&runtime, futures::future::pending());
+
+        let ready = runtime.block_on(pending.wait_any(&[ticket], Some(Duration::from_millis(10))));
+        assert_eq!(ready, None);
+        assert!(matches!(pending.poll(ticket), TicketState::Pending));
+        pending.cancel(ticket);
+        assert!(matches!(pending.poll(ticket), TicketState::Unknown));
+    }
+
+    #[cfg(unix)]
+    #[test]
+    fn completion_makes_notify_fd_readable() {
+        let runtime = Runtime::new().unwrap();
+        let pending = Arc::new(Pending::new().unwrap());
+        let ticket = pending.submit(&runtime, async { Err("boom".to_string()) });
+        runtime.block_on(pending.wait_any(&[ticket], None));
+
+        let mut byte = 0u8;
+        let read = unsafe { libc::read(pending.notify_fd(), (&mut byte as *mut u8).cast(), 1) };
+        assert_eq!(read, 1);
+        pending.drain_notifications();
+        let read = unsafe { libc::read(pending.notify_fd(), (&mut byte as *mut u8).cast(), 1) };
+        assert_eq!(read, -1);
+    }
+}
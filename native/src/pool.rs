@@ -0,0 +1,622 @@
+//! Fixed-size pool of control-socket connections owned by a handle.
+//!
+//! Every request leases one connection for its duration. The pool holds
+//! `poolSize` connections per endpoint; leases go to the connection
+//! `routing::pick` scores best (least loaded on a single endpoint, ties
+//! rotating round-robin), the number of requests queued or running against
+//! the pool is capped by `maxInFlight`, and a connection that fails with a
+//! transport error (or whose request was cancelled mid-flight) is dropped and
+//! re-established in the background so the next lease does not pay for the
+//! handshake. Reads go through `Pool::read`, which applies the handle's retry
+//! and hedge policy. With `lazyConnect` the pool starts out with every
+//! connection closed, so creating a handle does no network I/O; the first
+//! lease of each connection opens it inline, or a background task started at
+//! creation (`lazyConnect: "background"`) already has.
+
+use std::{
+    error::Error,
+    future::Future,
+    ops::{Deref, DerefMut},
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc,
+    },
+    time::Instant,
+};
+
+use eventdbx_client::EventDbxClient;
+use serde::Deserialize;
+use tokio::sync::{Mutex, OwnedMutexGuard, OwnedSemaphorePermit, Semaphore};
+
+use crate::{
+    build_client_config, endpoints,
+    metrics::Metrics,
+    retry::RetryPolicy,
+    routing::{self, Endpoint, Node, Route},
+    ConfigInput,
+};
+
+/// When a handle connects its pool.
+#[derive(Clone, Copy, Debug, Default, Deserialize, Hash, PartialEq)]
+#[serde(rename_all = "snake_case")]
+pub(crate) enum ConnectMode {
+    /// While the handle is created, failing it when no endpoint answers.
+    #[default]
+    Eager,
+    /// On the first lease of each connection.
+    Lazy,
+    /// In background tasks spawned when the handle is created; a lease
+    /// that arrives first waits for (or retries) its connection.
+    Background,
+}
+
+/// `lazyConnect` accepts `true`/`false` or a mode name.
+#[derive(Clone, Copy, Debug, Deserialize, Hash, PartialEq)]
+#[serde(untagged)]
+pub(crate) enum LazyConnect {
+    Enabled(bool),
+    Mode(ConnectMode),
+}
+
+impl LazyConnect {
+    pub(crate) fn in_background(self) -> bool {
+        self.mode() == ConnectMode::Background
+    }
+
+    fn mode(self) -> ConnectMode {
+        match self {
+            LazyConnect::Enabled(true) => ConnectMode::Lazy,
+            LazyConnect::Enabled(false) => ConnectMode::Eager,
+            LazyConnect::Mode(mode) => mode,
+        }
+    }
+}
+
+struct Slot {
+    client: Arc<Mutex<Option<EventDbxClient>>>,
+    /// Requests waiting on or using this connection.
+    load: AtomicUsize,
+    /// The endpoint this connection goes to.
+    node: Arc<Node>,
+}
+
+pub(crate) struct Pool {
+    cfg: Arc<ConfigInput>,
+    slots: Vec<Arc<Slot>>,
+    permits: Arc<Semaphore>,
+    next: AtomicUsize,
+    metrics: Arc<Metrics>,
+    policy: RetryPolicy,
+}
+
+async fn connect(cfg: &ConfigInput, endpoint: &Endpoint) -> Result<EventDbxClient, String> {
+    let client_cfg = build_client_config(cfg, endpoint)?;
+    EventDbxClient::connect(client_cfg)
+        .await
+        .map_err(|err| format!("failed to connect: {err}"))
+}
+
+/// A failed call on a leased connection, classified by `Lease::settle_read`
+/// while the client's typed error was still at hand.
+pub(crate) struct Failure {
+    message: String,
+    transport: bool,
+}
+
+impl Failure {
+    fn is_transport(&self) -> bool {
+        self.transport
+    }
+}
+
+/// Errors from opening a connection, which `RetryPolicy::connect` already
+/// retried; `Pool::read` does not retry them again.
+impl From<String> for Failure {
+    fn from(message: String) -> Self {
+        Failure {
+            message,
+            transport: false,
+        }
+    }
+}
+
+/// Errors after which the connection state is unknown (dropped socket,
+/// broken Noise session, or a timeout that may leave a late reply in the
+/// stream). Any I/O error or elapsed timer in the source chain is one;
+/// errors carrying neither only count when their text names a transport
+/// failure outright, so a server-side rejection that merely mentions
+/// "closed" or "timeout" keeps the connection and is never resent.
+pub(crate) fn is_transport_error(err: &(dyn Error + 'static)) -> bool {
+    let mut source = Some(err);
+    while let Some(err) = source {
+        if err.is::<std::io::Error>() || err.is::<tokio::time::error::Elapsed>() {
+            return true;
+        }
+        source = err.source();
+    }
+    let message = err.to_string().to_ascii_lowercase();
+    [
+        "connection reset",
+        "connection refused",
+        "connection aborted",
+        "connection closed",
+        "broken pipe",
+        "unexpected eof",
+        "request timed out",
+        "noise handshake",
+    ]
+    .iter()
+    .any(|needle| message.contains(needle))
+}
+
+impl Pool {
+    /// Opens `poolSize` connections (default 1) to every endpoint
+    /// concurrently. Fails only when no endpoint could be reached; one that
+    /// could not starts out ejected and probed. With `lazyConnect` nothing is
+    /// opened here (see the module docs).
+    pub(crate) async fn connect(cfg: ConfigInput, metrics: Arc<Metrics>) -> Result<Pool, String> {
+        let size = cfg.pool_size.unwrap_or(1).max(1);
+        let max_in_flight = cfg.max_in_flight.unwrap_or(size).max(1);
+        let health = cfg.health.unwrap_or_default();
+        let nodes: Vec<Arc<Node>> = endpoints(&cfg)
+            .into_iter()
+            .map(|endpoint| Arc::new(Node::new(endpoint, health)))
+            .collect();
+        let mode = cfg.lazy_connect.map(LazyConnect::mode).unwrap_or_default();
+        let cfg = Arc::new(cfg);
+        if mode != ConnectMode::Eager {
+            let slots: Vec<Arc<Slot>> = nodes
+                .iter()
+                .flat_map(|node| (0..size).map(move |_| node.clone()))
+                .map(|node| {
+                    Arc::new(Slot {
+                        client: Arc::new(Mutex::new(None)),
+                        load: AtomicUsize::new(0),
+                        node,
+                    })
+                })
+                .collect();
+            if mode == ConnectMode::Background {
+                for slot in &slots {
+                    warm(slot, &cfg);
+                }
+            }
+            let _ = metrics.endpoints.set(nodes);
+            return Ok(Pool::new(cfg, slots, max_in_flight, metrics));
+        }
+        let clients = futures::future::join_all(nodes.iter().flat_map(|node| {
+            let cfg = &cfg;
+            (0..size).map(move |_| connect(cfg, &node.endpoint))
+        }))
+        .await;
+        if clients.iter().all(Result::is_err) {
+            return Err(clients
+                .into_iter()
+                .find_map(Result::err)
+                .unwrap_or_default());
+        }
+        let unreachable: Vec<usize> = clients
+            .chunks(size)
+            .enumerate()
+            .filter(|(_, clients)| clients.iter().all(Result::is_err))
+            .map(|(index, _)| index * size)
+            .collect();
+        let slots: Vec<Arc<Slot>> = nodes
+            .iter()
+            .flat_map(|node| (0..size).map(move |_| node.clone()))
+            .zip(clients)
+            .map(|(node, client)| {
+                Arc::new(Slot {
+                    client: Arc::new(Mutex::new(client.ok())),
+                    load: AtomicUsize::new(0),
+                    node,
+                })
+            })
+            .collect();
+        for index in unreachable {
+            slots[index].node.eject();
+            probe(&slots[index], &cfg);
+        }
+        let _ = metrics.endpoints.set(nodes);
+        Ok(Pool::new(cfg, slots, max_in_flight, metrics))
+    }
+
+    fn new(
+        cfg: Arc<ConfigInput>,
+        slots: Vec<Arc<Slot>>,
+        max_in_flight: usize,
+        metrics: Arc<Metrics>,
+    ) -> Pool {
+        Pool {
+            policy: RetryPolicy::new(cfg.retry, cfg.hedge),
+            cfg,
+            slots,
+            permits: Arc::new(Semaphore::new(max_in_flight)),
+            next: AtomicUsize::new(0),
+            metrics,
+        }
+    }
+
+    /// Runs an idempotent read built by `read` (once per attempt), retrying
+    /// transport errors and hedging slow replies as configured. Only for
+    /// calls that are safe to send twice.
+    pub(crate) async fn read<T, F, Fut>(&self, read: F) -> Result<T, String>
+    where
+        F: Fn() -> Fut,
+        Fut: Future<Output = Result<T, Failure>>,
+    {
+        let hedgeable = self.slots.len() > 1;
+        self.policy
+            .read(&self.metrics.retry, hedgeable, Failure::is_transport, read)
+            .await
+            .map_err(|failure| failure.message)
+    }
+
+    fn pick(&self, route: Route) -> Arc<Slot> {
+        let start = self.next.fetch_add(1, Ordering::Relaxed);
+        let candidates = self
+            .slots
+            .iter()
+            .map(|slot| (&*slot.node, slot.load.load(Ordering::Relaxed)));
+        self.slots[routing::pick(candidates, start, route)].clone()
+    }
+
+    /// Waits for an in-flight permit and exclusive use of one connection,
+    /// reconnecting it first if an earlier failure left it closed. Leases
+    /// for writes (and any call not known to be a read) stay on primary
+    /// endpoints when some are configured.
+    pub(crate) async fn acquire(&self) -> Result<Lease, String> {
+        self.lease(Route::Write).await
+    }
+
+    /// `acquire` for reads, which may go to any healthy endpoint.
+    pub(crate) async fn acquire_read(&self) -> Result<Lease, String> {
+        self.lease(Route::Read).await
+    }
+
+    async fn lease(&self, route: Route) -> Result<Lease, String> {
+        let queued = Instant::now();
+        let permit = self
+            .permits
+            .clone()
+            .acquire_owned()
+            .await
+            .map_err(|_| "connection pool is closed".to_string())?;
+        let slot = self.pick(route);
+        slot.load.fetch_add(1, Ordering::Relaxed);
+        let guard = slot.client.clone().lock_owned().await;
+        let mut lease = Lease {
+            slot,
+            guard,
+            cfg: self.cfg.clone(),
+            broken: false,
+            settled: false,
+            metrics: self.metrics.clone(),
+            acquired: queued,
+            _permit: permit,
+        };
+        if lease.guard.is_none() {
+            let (cfg, endpoint) = (&self.cfg, &lease.slot.node.endpoint);
+            let client = self
+                .policy
+                .connect(&self.metrics.retry, || connect(cfg, endpoint))
+                .await;
+            match client {
+                Ok(client) => *lease.guard = Some(client),
+                Err(err) => {
+                    failed(&lease.slot, &self.cfg);
+                    return Err(err);
+                }
+            }
+        }
+        self.metrics.queue_wait.record(queued.elapsed());
+        lease.acquired = Instant::now();
+        Ok(lease)
+    }
+}
+
+/// Counts a transport failure against the slot's endpoint, probing it in
+/// the background when that ejected it.
+fn failed(slot: &Arc<Slot>, cfg: &Arc<ConfigInput>) {
+    if slot.node.failed() {
+        probe(slot, cfg);
+    }
+}
+
+/// The active health check of an ejected endpoint: reconnects `slot` every
+/// `ejectMs` until that succeeds, keeping the endpoint ejected meanwhile.
+fn probe(slot: &Arc<Slot>, cfg: &Arc<ConfigInput>) {
+    if !slot.node.claim_probe() {
+        return;
+    }
+    let Ok(runtime) = tokio::runtime::Handle::try_current() else {
+        slot.node.end_probe();
+        return;
+    };
+    let (slot, cfg) = (slot.clone(), cfg.clone());
+    runtime.spawn(async move {
+        let node = &slot.node;
+        loop {
+            tokio::time::sleep(node.eject_duration()).await;
+            if node.reinstated() {
+                // another connection to it succeeded in the meantime
+                break;
+            }
+            match connect(&cfg, &node.endpoint).await {
+                Ok(client) => {
+                    let mut guard = slot.client.lock().await;
+                    if guard.is_none() {
+                        *guard = Some(client);
+                    }
+                    node.recovered();
+                    break;
+                }
+                Err(_) => node.eject(),
+            }
+        }
+        node.end_probe();
+    });
+}
+
+/// Opens `slot` in the background unless a lease got to it first. A failed
+/// attempt leaves it closed for the next lease to retry inline, and counts
+/// against the endpoint like any transport failure.
+fn warm(slot: &Arc<Slot>, cfg: &Arc<ConfigInput>) {
+    let Ok(runtime) = tokio::runtime::Handle::try_current() else {
+        return;
+    };
+    let (slot, cfg) = (slot.clone(), cfg.clone());
+    runtime.spawn(async move {
+        let mut guard = slot.client.clone().lock_owned().await;
+        if guard.is_some() {
+            return;
+        }
+        match connect(&cfg, &slot.node.endpoint).await {
+            Ok(client) => *guard = Some(client),
+            Err(_) => {
+                drop(guard);
+                failed(&slot, &cfg);
+            }
+        }
+    });
+}
+
+/// Exclusive use of one pooled connection; dereferences to the client.
+pub(crate) struct Lease {
+    slot: Arc<Slot>,
+    guard: OwnedMutexGuard<Option<EventDbxClient>>,
+    cfg: Arc<ConfigInput>,
+    broken: bool,
+    /// Set by `settle`; a lease dropped before it was settled had its
+    /// request cancelled, and a late reply may still be on the socket.
+    settled: bool,
+    metrics: Arc<Metrics>,
+    acquired: Instant,
+    _permit: OwnedSemaphorePermit,
+}
+
+impl Lease {
+    /// Converts a client result to the FFI error form, retiring the
+    /// connection when the failure was at the transport level.
+    pub(crate) fn settle<T, E: Error + 'static>(
+        &mut self,
+        result: Result<T, E>,
+    ) -> Result<T, String> {
+        self.settle_read(result).map_err(|failure| failure.message)
+    }
+
+    /// `settle` that keeps the classification for `Pool::read`'s retries.
+    pub(crate) fn settle_read<T, E: Error + 'static>(
+        &mut self,
+        result: Result<T, E>,
+    ) -> Result<T, Failure> {
+        let elapsed = self.acquired.elapsed();
+        self.metrics.server.record(elapsed);
+        self.settled = true;
+        let result = result.map_err(|err| {
+            let transport = is_transport_error(&err);
+            if transport {
+                self.broken = true;
+            }
+            Failure {
+                message: err.to_string(),
+                transport,
+            }
+        });
+        if self.broken {
+            failed(&self.slot, &self.cfg);
+        } else {
+            self.slot.node.succeeded(elapsed);
+        }
+        result
+    }
+}
+
+impl Deref for Lease {
+    type Target = EventDbxClient;
+
+    fn deref(&self) -> &EventDbxClient {
+        self.guard.as_ref().expect("leased connection is connected")
+    }
+}
+
+impl DerefMut for Lease {
+    fn deref_mut(&mut self) -> &mut EventDbxClient {
+        self.guard.as_mut().expect("leased connection is connected")
+    }
+}
+
+impl Drop for Lease {
+    fn drop(&mut self) {
+        self.slot.load.fetch_sub(1, Ordering::Relaxed);
+        if self.settled && !self.broken {
+            return;
+        }
+        *self.guard = None;
+        if let Ok(runtime) = tokio::runtime::Handle::try_current() {
+            let slot = self.slot.clone();
+            let cfg = self.cfg.clone();
+            runtime.spawn(async move {
+                let mut guard = slot.client.lock().await;
+                if guard.is_none() {
+                    // leave it closed on failure; the next lease retries inline
+                    *guard = connect(&cfg, &slot.node.endpoint).await.ok();
+                }
+            });
+        }
+    }
+}
+
+/// Runs one client call on a leased connection, yielding `Result<T, String>`.
+macro_rules! with_conn {
+    ($pool:expr, |$conn:ident| $call:expr) => {
+        async move {
+            let mut $conn = $pool.acquire().await?;
+            let result = $call.await;
+            $conn.settle(result)
+        }
+    };
+}
+pub(crate) use with_conn;
+
+/// `with_conn!` for idempotent reads, run through `Pool::read` on a read
+/// lease. `$call` is evaluated once per attempt, so it must build its
+/// request from borrowed values rather than move owned ones.
+macro_rules! read_conn {
+    ($pool:expr, |$conn:ident| $call:expr) => {{
+        let pool: &$crate::pool::Pool = &$pool;
+        pool.read(move || async move {
+            let mut $conn = pool.acquire_read().await?;
+            let result = $call.await;
+            $conn.settle_read(result)
+        })
+    }};
+}
+pub(crate) use read_conn;
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// A client error with an optional cause, like the client's variants.
+    #[derive(Debug)]
+    struct ClientError(&'static str, Option<std::io::Error>);
+
+    impl std::fmt::Display for ClientError {
+        fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+            f.write_str(self.0)
+        }
+    }
+
+    impl Error for ClientError {
+        fn source(&self) -> Option<&(dyn Error + 'static)> {
+            self.1.as_ref().map(|err| err as &(dyn Error + 'static))
+        }
+    }
+
+    fn transport(message: &'static str) -> bool {
+        is_transport_error(&ClientError(message, None))
+    }
+
+    #[test]
+    fn transport_errors_are_detected() {
+        assert!(transport("Connection reset by peer"));
+        assert!(transport("request timed out after 5000ms"));
+        assert!(transport("noise handshake failed"));
+        let io = std::io::Error::new(std::io::ErrorKind::InvalidData, "bad frame");
+        assert!(is_transport_error(&ClientError("read failed", Some(io))));
+        assert!(is_transport_error(&std::io::Error::from(
+            std::io::ErrorKind::BrokenPipe
+        )));
+    }
+
+    #[test]
+    fn server_rejections_are_not_transport_errors() {
+        for message in [
+            "aggregate person/p-1 not found",
+            "invalid token",
+            "aggregate person/p-1 is closed for writes",
+            "connection limit for tenant acme reached",
+            "timeout must be a positive number",
+            "schema check timed out on the server: retry later",
+            "i/o quota exceeded",
+            "noise: unknown key",
+        ] {
+            assert!(!transport(message), "{message}");
+        }
+    }
+
+    #[test]
+    fn reads_retry_transport_failures_only() {
+        let runtime = tokio::runtime::Builder::new_current_thread()
+            .enable_all()
+            .build()
+            .unwrap();
+        let cfg = config(serde_json::json!({
+            "host": "db.invalid",
+            "token": "t",
+            "lazyConnect": true,
+            "retry": { "maxAttempts": 3, "baseDelayMs": 1, "maxDelayMs": 1 },
+        }));
+        let pool = runtime
+            .block_on(Pool::connect(cfg, Arc::new(Metrics::new())))
+            .unwrap();
+        let attempts = AtomicUsize::new(0);
+        let read = |transport| {
+            let attempts = &attempts;
+            move || async move {
+                attempts.fetch_add(1, Ordering::Relaxed);
+                Err::<(), _>(Failure {
+                    message: "rejected".to_string(),
+                    transport,
+                })
+            }
+        };
+        assert_eq!(
+            runtime.block_on(pool.read(read(false))),
+            Err("rejected".to_string())
+        );
+        assert_eq!(attempts.swap(0, Ordering::Relaxed), 1);
+        assert!(runtime.block_on(pool.read(read(true))).is_err());
+        assert_eq!(attempts.load(Ordering::Relaxed), 3);
+    }
+
+    fn config(value: serde_json::Value) -> ConfigInput {
+        serde_json::from_value(value).unwrap()
+    }
+
+    #[test]
+    fn lazy_connect_accepts_flags_and_modes() {
+        let mode = |value| config(value).lazy_connect.map(LazyConnect::mode);
+        assert_eq!(mode(serde_json::json!({})), None);
+        let lazy = serde_json::json!({ "lazyConnect": true });
+        assert_eq!(mode(lazy), Some(ConnectMode::Lazy));
+        let eager = serde_json::json!({ "lazyConnect": false });
+        assert_eq!(mode(eager), Some(ConnectMode::Eager));
+        let background = serde_json::json!({ "lazyConnect": "background" });
+        assert_eq!(mode(background), Some(ConnectMode::Background));
+    }
+
+    #[test]
+    fn lazy_pools_connect_on_first_lease() {
+        let runtime = tokio::runtime::Builder::new_current_thread()
+            .enable_all()
+            .build()
+            .unwrap();
+        let metrics = Arc::new(Metrics::new());
+        let eager = config(serde_json::json!({ "host": "db.invalid", "token": "t" }));
+        assert!(runtime
+            .block_on(Pool::connect(eager, metrics.clone()))
+            .is_err());
+
+        let lazy = config(serde_json::json!({
+            "host": "db.invalid",
+            "token": "t",
+            "lazyConnect": true,
+        }));
+        let pool = runtime.block_on(Pool::connect(lazy, metrics)).unwrap();
+        // the unreachable server only shows up once a call needs it
+        let lease = runtime.block_on(pool.acquire());
+        assert!(lease.err().unwrap().starts_with("failed to connect"));
+    }
+}
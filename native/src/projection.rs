@@ -0,0 +1,139 @@
+//! The `fields` option of list and event pages.
+//!
+//! The list calls of the control protocol have no projection, so rows are
+//! trimmed here, after the response arrives and before it is serialized:
+//! PHP only ever decodes the requested fields. Each field is a dotted path
+//! (`aggregateId`, `state.address.city`); paths sharing a prefix merge into
+//! one nested object, and rows missing a path simply omit it. Selected
+//! values are moved out of the row, never copied.
+
+use std::collections::BTreeMap;
+use std::sync::Arc;
+
+use serde_json::{Map, Value};
+
+use crate::parse_fields;
+
+#[derive(Debug, Default, PartialEq)]
+struct Node {
+    /// The whole value at this path was requested.
+    whole: bool,
+    children: BTreeMap<String, Node>,
+}
+
+#[derive(Debug, PartialEq)]
+pub(crate) struct Projection {
+    root: Node,
+}
+
+impl Projection {
+    /// Reads `fields` from list options; `None` when absent or empty.
+    pub(crate) fn from_options(options: &Value) -> Result<Option<Arc<Projection>>, String> {
+        let fields = parse_fields(options.get("fields").cloned().unwrap_or(Value::Null))?;
+        Ok(Projection::new(&fields).map(Arc::new))
+    }
+
+    fn new(fields: &[String]) -> Option<Projection> {
+        let mut root = Node::default();
+        for field in fields {
+            let mut parts = field.split('.').filter(|part| !part.is_empty()).peekable();
+            if parts.peek().is_none() {
+                continue;
+            }
+            let mut node = &mut root;
+            for part in parts {
+                node = node.children.entry(part.to_string()).or_default();
+            }
+            node.whole = true;
+        }
+        (!root.children.is_empty()).then_some(Projection { root })
+    }
+
+    /// Projects every row of a page's `items` array.
+    pub(crate) fn apply(&self, items: Value) -> Value {
+        match items {
+            Value::Array(rows) => Value::Array(rows.into_iter().map(|row| self.row(row)).collect()),
+            other => other,
+        }
+    }
+
+    fn row(&self, row: Value) -> Value {
+        match row {
+            Value::Object(map) => Value::Object(pick(map, &self.root)),
+            other => other,
+        }
+    }
+}
+
+/// `items` trimmed by `projection`, or unchanged without one.
+pub(crate) fn project(projection: Option<&Projection>, items: Value) -> Value {
+    match projection {
+        Some(projection) => projection.apply(items),
+        None => items,
+    }
+}
+
+fn pick(mut map: Map<String, Value>, node: &Node) -> Map<String, Value> {
+    let mut out = Map::new();
+    for (key, child) in &node.children {
+        let Some(value) = map.remove(key) else {
+            continue;
+        };
+        if child.whole {
+            out.insert(key.clone(), value);
+        } else if let Value::Object(inner) = value {
+            out.insert(key.clone(), Value::Object(pick(inner, child)));
+        }
+    }
+    out
+}
+
+#[cfg(test)]
+mod tests {
+    use serde_json::json;
+
+    use super::*;
+
+    fn projection(fields: Value) -> Option<Arc<Projection>> {
+        Projection::from_options(&json!({ "fields": fields })).unwrap()
+    }
+
+    #[test]
+    fn keeps_only_requested_paths() {
+        let projection =
+            projection(json!(["aggregateId", "state.name", "state.address.city"])).unwrap();
+        let items = json!([
+            {
+                "aggregateId": "p-1",
+                "version": 3,
+                "state": { "name": "Ada", "email": "a@x", "address": { "city": "London", "zip": "N1" } },
+            },
+            { "aggregateId": "p-2", "state": "not an object" },
+        ]);
+        assert_eq!(
+            projection.apply(items),
+            json!([
+                { "aggregateId": "p-1", "state": { "name": "Ada", "address": { "city": "London" } } },
+                { "aggregateId": "p-2" },
+            ])
+        );
+    }
+
+    #[test]
+    fn whole_value_wins_over_nested_paths() {
+        let projection = projection(json!(["state.name", "state"])).unwrap();
+        let items = json!([{ "state": { "name": "Ada", "email": "a@x" }, "version": 1 }]);
+        assert_eq!(
+            projection.apply(items),
+            json!([{ "state": { "name": "Ada", "email": "a@x" } }])
+        );
+    }
+
+    #[test]
+    fn absent_or_empty_fields_disable_projection() {
+        assert!(Projection::from_options(&Value::Null).unwrap().is_none());
+        assert!(projection(json!([])).is_none());
+        assert!(projection(json!(["."])).is_none());
+        assert!(Projection::from_options(&json!({ "fields": "id" })).is_err());
+    }
+}
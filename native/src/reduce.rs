@@ -0,0 +1,558 @@
+//! Filtering and aggregation of event streams behind `dbx_reduce_events`.
+//!
+//! The events are fetched the way `export` fetches them (the aggregate
+//! listing walked by one task, the events of up to `concurrency` aggregates
+//! at a time), but instead of being written out each page is folded into a
+//! handful of accumulators as it arrives and then dropped. Only the reduced
+//! values cross the FFI boundary.
+//!
+//! A spec keeps the events whose `eventType` is in `eventTypes` and for
+//! which every `where` condition holds, optionally splits them by the value
+//! at `groupBy`, and computes the named `metrics` (`count`, `sum`, `avg`,
+//! `min`, `max`, `latest`) per group. Paths are dotted and relative to the
+//! event (`payload.amount`, `metadata.region`); `aggregateId` and
+//! `aggregateType` also resolve when the event does not carry them, so
+//! `groupBy: "aggregateId"` with `latest` gives the latest value per
+//! aggregate.
+
+use std::{cmp::Ordering, collections::BTreeMap, sync::Arc};
+
+use serde::{Deserialize, Serialize};
+use serde_json::{Map, Value};
+use tokio::sync::mpsc;
+
+use crate::{
+    export::{self, Chunk, MAX_REPORTED_ERRORS},
+    pool::Pool,
+    reply::{Reply, TaggedReply},
+    sizing::{AdaptiveTake, PageSizer},
+    view::lookup,
+};
+
+/// Aggregates whose events are fetched at once when `concurrency` is unset.
+const DEFAULT_CONCURRENCY: usize = 4;
+
+#[derive(Deserialize)]
+#[serde(untagged)]
+enum OneOrMany {
+    One(String),
+    Many(Vec<String>),
+}
+
+#[derive(Deserialize)]
+#[serde(rename_all = "camelCase")]
+struct ReduceSpec {
+    event_types: Option<OneOrMany>,
+    #[serde(default, rename = "where")]
+    conditions: Vec<Condition>,
+    group_by: Option<String>,
+    /// Result name to metric; a single `count` when empty.
+    #[serde(default)]
+    metrics: BTreeMap<String, Metric>,
+    concurrency: Option<usize>,
+    /// Page size for each aggregate's events.
+    events_take: Option<u64>,
+}
+
+#[derive(Deserialize)]
+struct Condition {
+    path: String,
+    op: ConditionOp,
+    #[serde(default)]
+    value: Value,
+}
+
+#[derive(Clone, Copy, Deserialize)]
+#[serde(rename_all = "lowercase")]
+enum ConditionOp {
+    Eq,
+    Ne,
+    Gt,
+    Gte,
+    Lt,
+    Lte,
+    In,
+    /// `value: false` matches events lacking the path.
+    Exists,
+}
+
+#[derive(Deserialize)]
+#[serde(tag = "op", rename_all = "lowercase")]
+enum Metric {
+    Count,
+    Sum {
+        path: String,
+    },
+    Avg {
+        path: String,
+    },
+    Min {
+        path: String,
+    },
+    Max {
+        path: String,
+    },
+    /// The value at `path` of the last event, or of the event with the
+    /// greatest value at `by` when given.
+    Latest {
+        path: String,
+        by: Option<String>,
+    },
+}
+
+enum Acc {
+    Count(u64),
+    Sum(f64),
+    Avg { sum: f64, n: u64 },
+    Min(Option<Value>),
+    Max(Option<Value>),
+    Latest { order: Option<Value>, value: Value },
+}
+
+#[derive(Default, Serialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct ReduceSummary {
+    aggregates: u64,
+    /// Events scanned, matched or not.
+    events: u64,
+    matched: u64,
+    failed: u64,
+    errors: Vec<TaggedReply>,
+    /// The metrics, when there is no `groupBy`.
+    #[serde(skip_serializing_if = "Option::is_none")]
+    values: Option<Map<String, Value>>,
+    /// The metrics per group key, with `groupBy`.
+    #[serde(skip_serializing_if = "Option::is_none")]
+    groups: Option<Map<String, Value>>,
+}
+
+/// The value at `path` of an event of `aggregate_type`/`aggregate_id`.
+fn field<'a>(event: &'a Value, path: &str, aggregate: &'a (Value, Value)) -> Option<&'a Value> {
+    lookup(event, path).or(match path {
+        "aggregateType" => Some(&aggregate.0),
+        "aggregateId" => Some(&aggregate.1),
+        _ => None,
+    })
+}
+
+/// Numbers by value, strings and booleans by their natural order; other
+/// pairs do not compare.
+fn compare(a: &Value, b: &Value) -> Option<Ordering> {
+    match (a, b) {
+        (Value::Number(a), Value::Number(b)) => a.as_f64()?.partial_cmp(&b.as_f64()?),
+        (Value::String(a), Value::String(b)) => Some(a.cmp(b)),
+        (Value::Bool(a), Value::Bool(b)) => Some(a.cmp(b)),
+        _ => None,
+    }
+}
+
+fn equal(a: &Value, b: &Value) -> bool {
+    compare(a, b).map_or(a == b, Ordering::is_eq)
+}
+
+/// A sum as an integer when it is one, so counts of units stay integral.
+fn number(n: f64) -> Value {
+    if n.fract() == 0.0 && n.abs() < 9_007_199_254_740_992.0 {
+        Value::from(n as i64)
+    } else {
+        Value::from(n)
+    }
+}
+
+impl Condition {
+    fn holds(&self, value: Option<&Value>) -> bool {
+        let ordered = |accept: fn(Ordering) -> bool| {
+            value
+                .and_then(|value| compare(value, &self.value))
+                .is_some_and(accept)
+        };
+        match self.op {
+            ConditionOp::Eq => value.is_some_and(|value| equal(value, &self.value)),
+            ConditionOp::Ne => !value.is_some_and(|value| equal(value, &self.value)),
+            ConditionOp::Gt => ordered(Ordering::is_gt),
+            ConditionOp::Gte => ordered(Ordering::is_ge),
+            ConditionOp::Lt => ordered(Ordering::is_lt),
+            ConditionOp::Lte => ordered(Ordering::is_le),
+            ConditionOp::In => match (&self.value, value) {
+                (Value::Array(options), Some(value)) => {
+                    options.iter().any(|option| equal(value, option))
+                }
+                _ => false,
+            },
+            ConditionOp::Exists => {
+                value.is_some_and(|value| !value.is_null()) == self.value.as_bool().unwrap_or(true)
+            }
+        }
+    }
+}
+
+impl Acc {
+    fn new(metric: &Metric) -> Acc {
+        match metric {
+            Metric::Count => Acc::Count(0),
+            Metric::Sum { .. } => Acc::Sum(0.0),
+            Metric::Avg { .. } => Acc::Avg { sum: 0.0, n: 0 },
+            Metric::Min { .. } => Acc::Min(None),
+            Metric::Max { .. } => Acc::Max(None),
+            Metric::Latest { .. } => Acc::Latest {
+                order: None,
+                value: Value::Null,
+            },
+        }
+    }
+
+    fn add<'a>(&mut self, metric: &Metric, at: impl Fn(&str) -> Option<&'a Value>) {
+        let extreme = |current: &mut Option<Value>, path: &str, keep: Ordering| {
+            if let Some(value) = at(path) {
+                let replace = match current {
+                    None => compare(value, value).is_some(),
+                    Some(current) => compare(value, current) == Some(keep),
+                };
+                if replace {
+                    *current = Some(value.clone());
+                }
+            }
+        };
+        match (self, metric) {
+            (Acc::Count(n), _) => *n += 1,
+            (Acc::Sum(sum), Metric::Sum { path }) => {
+                *sum += at(path).and_then(Value::as_f64).unwrap_or(0.0);
+            }
+            (Acc::Avg { sum, n }, Metric::Avg { path }) => {
+                if let Some(value) = at(path).and_then(Value::as_f64) {
+                    *sum += value;
+                    *n += 1;
+                }
+            }
+            (Acc::Min(current), Metric::Min { path }) => extreme(current, path, Ordering::Less),
+            (Acc::Max(current), Metric::Max { path }) => extreme(current, path, Ordering::Greater),
+            (Acc::Latest { order, value }, Metric::Latest { path, by }) => {
+                let next = by.as_deref().and_then(&at);
+                // later events win ties, so without `by` the last one does
+                let newer = match (next, order.as_ref()) {
+                    (_, None) => true,
+                    (None, Some(_)) => false,
+                    (Some(next), Some(order)) => compare(next, order).is_some_and(Ordering::is_ge),
+                };
+                if newer {
+                    *order = next.cloned();
+                    *value = at(path).cloned().unwrap_or(Value::Null);
+                }
+            }
+            _ => {}
+        }
+    }
+
+    fn finish(self) -> Value {
+        match self {
+            Acc::Count(n) => Value::from(n),
+            Acc::Sum(sum) => number(sum),
+            Acc::Avg { n: 0, .. } => Value::Null,
+            Acc::Avg { sum, n } => Value::from(sum / n as f64),
+            Acc::Min(value) | Acc::Max(value) => value.unwrap_or(Value::Null),
+            Acc::Latest { value, .. } => value,
+        }
+    }
+}
+
+struct Reducer {
+    spec: ReduceSpec,
+    groups: BTreeMap<String, Vec<Acc>>,
+    summary: ReduceSummary,
+}
+
+impl Reducer {
+    fn new(mut spec: ReduceSpec) -> Self {
+        if spec.metrics.is_empty() {
+            spec.metrics.insert("count".to_string(), Metric::Count);
+        }
+        Reducer {
+            spec,
+            groups: BTreeMap::new(),
+            summary: ReduceSummary::default(),
+        }
+    }
+
+    fn matches(&self, event: &Value, aggregate: &(Value, Value)) -> bool {
+        let type_matches = match &self.spec.event_types {
+            None => true,
+            Some(types) => {
+                let event_type = event
+                    .get("eventType")
+                    .or_else(|| event.get("event_type"))
+                    .and_then(Value::as_str);
+                match types {
+                    OneOrMany::One(wanted) => event_type == Some(wanted.as_str()),
+                    OneOrMany::Many(wanted) => {
+                        event_type.is_some_and(|t| wanted.iter().any(|w| w == t))
+                    }
+                }
+            }
+        };
+        type_matches
+            && self
+                .spec
+                .conditions
+                .iter()
+                .all(|condition| condition.holds(field(event, &condition.path, aggregate)))
+    }
+
+    fn add(&mut self, event: &Value, aggregate: &(Value, Value)) {
+        self.summary.events += 1;
+        if !self.matches(event, aggregate) {
+            return;
+        }
+        self.summary.matched += 1;
+        let key = match &self.spec.group_by {
+            None => String::new(),
+            Some(path) => match field(event, path, aggregate) {
+                Some(Value::String(key)) => key.clone(),
+                Some(value) => value.to_string(),
+                None => "null".to_string(),
+            },
+        };
+        let metrics = &self.spec.metrics;
+        let accs = self
+            .groups
+            .entry(key)
+            .or_insert_with(|| metrics.values().map(Acc::new).collect());
+        for (metric, acc) in metrics.values().zip(accs) {
+            acc.add(metric, |path| field(event, path, aggregate));
+        }
+    }
+
+    fn finish(mut self) -> ReduceSummary {
+        let names: Vec<&String> = self.spec.metrics.keys().collect();
+        let mut groups: Map<String, Value> = std::mem::take(&mut self.groups)
+            .into_iter()
+            .map(|(key, accs)| {
+                let values = names
+                    .iter()
+                    .map(|name| name.to_string())
+                    .zip(accs.into_iter().map(Acc::finish))
+                    .collect();
+                (key, Value::Object(values))
+            })
+            .collect();
+        if self.spec.group_by.is_some() {
+            self.summary.groups = Some(groups);
+        } else {
+            // without matches the metrics still report their empty values
+            let values = groups.remove("").unwrap_or_else(|| {
+                let accs = self.spec.metrics.values().map(Acc::new);
+                Value::Object(
+                    names
+                        .iter()
+                        .map(|name| name.to_string())
+                        .zip(accs.map(Acc::finish))
+                        .collect(),
+                )
+            });
+            if let Value::Object(values) = values {
+                self.summary.values = Some(values);
+            }
+        }
+        self.summary
+    }
+}
+
+/// Reduces the events of `agg_id`, or of every aggregate matched by the
+/// `dbx_list_aggregates` options in `spec_value` when `agg_id` is `None`.
+pub(crate) async fn run(
+    pool: Arc<Pool>,
+    sizer: Arc<PageSizer>,
+    agg_type: Option<String>,
+    agg_id: Option<String>,
+    spec_value: Value,
+) -> Result<ReduceSummary, String> {
+    let spec: ReduceSpec = serde_json::from_value(match &spec_value {
+        Value::Object(_) => spec_value.clone(),
+        _ => Value::Object(Default::default()),
+    })
+    .map_err(|e| format!("invalid reduce spec: {e}"))?;
+    let concurrency = spec.concurrency.unwrap_or(DEFAULT_CONCURRENCY).max(1);
+    let events_take = spec.events_take;
+    let sizing = AdaptiveTake::from_options(&spec_value)?.map(|config| (sizer, config));
+
+    let (tx, rx) = mpsc::channel(concurrency * 2);
+    let producer = match agg_id {
+        None => tokio::spawn(export::produce(
+            pool,
+            agg_type,
+            spec_value,
+            events_take,
+            sizing,
+            concurrency,
+            tx,
+        )),
+        Some(agg_id) => {
+            let aggregate = serde_json::json!({ "aggregateType": agg_type, "aggregateId": agg_id });
+            tokio::spawn(async move {
+                export::export_aggregate(pool, None, aggregate, events_take, sizing.as_ref(), tx)
+                    .await;
+                Ok(())
+            })
+        }
+    };
+    let summary = consume(rx, Reducer::new(spec)).await;
+    producer
+        .await
+        .unwrap_or_else(|err| Err(format!("reduce task failed: {err}")))?;
+    Ok(summary)
+}
+
+async fn consume(mut rx: mpsc::Receiver<Chunk>, mut reducer: Reducer) -> ReduceSummary {
+    while let Some(chunk) = rx.recv().await {
+        match chunk {
+            Chunk::Events {
+                aggregate_type,
+                aggregate_id,
+                events,
+            } => {
+                let Value::Array(events) = events else {
+                    continue;
+                };
+                let aggregate = (Value::String(aggregate_type), Value::String(aggregate_id));
+                for event in &events {
+                    reducer.add(event, &aggregate);
+                }
+            }
+            Chunk::Done => reducer.summary.aggregates += 1,
+            Chunk::Failed {
+                aggregate_type,
+                aggregate_id,
+                error,
+            } => {
+                let summary = &mut reducer.summary;
+                summary.failed += 1;
+                if summary.errors.len() < MAX_REPORTED_ERRORS {
+                    summary.errors.push(TaggedReply {
+                        aggregate_type,
+                        aggregate_id,
+                        reply: Reply::Failed { error },
+                    });
+                }
+            }
+        }
+    }
+    reducer.finish()
+}
+
+#[cfg(test)]
+mod tests {
+    use serde_json::json;
+
+    use super::*;
+
+    fn reduce(spec: Value, aggregates: &[(&str, Value)]) -> Value {
+        let spec = serde_json::from_value(spec).unwrap();
+        let runtime = tokio::runtime::Builder::new_current_thread()
+            .build()
+            .unwrap();
+        let (tx, rx) = mpsc::channel(aggregates.len() * 2 + 1);
+        for (id, events) in aggregates {
+            tx.try_send(Chunk::Events {
+                aggregate_type: "order".to_string(),
+                aggregate_id: id.to_string(),
+                events: events.clone(),
+            })
+            .ok()
+            .unwrap();
+            tx.try_send(Chunk::Done).ok().unwrap();
+        }
+        drop(tx);
+        serde_json::to_value(runtime.block_on(consume(rx, Reducer::new(spec)))).unwrap()
+    }
+
+    fn orders() -> Vec<(&'static str, Value)> {
+        vec![
+            (
+                "o-1",
+                json!([
+                    { "eventType": "placed", "payload": { "amount": 30, "currency": "USD" } },
+                    { "eventType": "paid", "payload": { "amount": 30, "currency": "USD", "status": "paid" } },
+                ]),
+            ),
+            (
+                "o-2",
+                json!([
+                    { "eventType": "placed", "payload": { "amount": 12.5, "currency": "EUR" } },
+                    { "eventType": "paid", "payload": { "amount": 12.5, "currency": "EUR", "status": "paid" } },
+                    { "eventType": "refunded", "payload": { "status": "refunded" } },
+                ]),
+            ),
+        ]
+    }
+
+    #[test]
+    fn counts_everything_by_default() {
+        let result = reduce(json!({}), &orders());
+        assert_eq!(result["values"], json!({ "count": 5 }));
+        assert_eq!(
+            (&result["aggregates"], &result["events"], &result["matched"]),
+            (&json!(2), &json!(5), &json!(5))
+        );
+        assert!(result.get("groups").is_none());
+    }
+
+    #[test]
+    fn filters_then_groups_and_aggregates() {
+        let spec = json!({
+            "eventTypes": ["paid"],
+            "where": [{ "path": "payload.amount", "op": "gte", "value": 10 }],
+            "groupBy": "payload.currency",
+            "metrics": {
+                "orders": { "op": "count" },
+                "revenue": { "op": "sum", "path": "payload.amount" },
+                "largest": { "op": "max", "path": "payload.amount" },
+                "mean": { "op": "avg", "path": "payload.amount" },
+            },
+        });
+        let result = reduce(spec, &orders());
+        assert_eq!(result["matched"], json!(2));
+        assert_eq!(
+            result["groups"],
+            json!({
+                "EUR": { "orders": 1, "revenue": 12.5, "largest": 12.5, "mean": 12.5 },
+                "USD": { "orders": 1, "revenue": 30, "largest": 30, "mean": 30.0 },
+            })
+        );
+    }
+
+    #[test]
+    fn latest_per_aggregate() {
+        let spec = json!({
+            "where": [{ "path": "payload.status", "op": "exists" }],
+            "groupBy": "aggregateId",
+            "metrics": { "status": { "op": "latest", "path": "payload.status" } },
+        });
+        let result = reduce(spec, &orders());
+        assert_eq!(
+            result["groups"],
+            json!({ "o-1": { "status": "paid" }, "o-2": { "status": "refunded" } })
+        );
+    }
+
+    #[test]
+    fn conditions_compare_by_type() {
+        let holds = |op: &str, value: Value, actual: Option<Value>| {
+            let condition: Condition =
+                serde_json::from_value(json!({ "path": "x", "op": op, "value": value })).unwrap();
+            condition.holds(actual.as_ref())
+        };
+        assert!(holds("eq", json!(1), Some(json!(1.0))));
+        assert!(holds("ne", json!("a"), None));
+        assert!(holds("lt", json!("2024-02"), Some(json!("2024-01-31"))));
+        assert!(!holds("gt", json!(1), Some(json!("2"))));
+        assert!(holds("in", json!(["a", "b"]), Some(json!("b"))));
+        assert!(holds("exists", json!(false), Some(Value::Null)));
+        assert!(serde_json::from_value::<Condition>(json!({ "path": "x", "op": "like" })).is_err());
+    }
+
+    #[test]
+    fn empty_streams_report_empty_metrics() {
+        let spec =
+            json!({ "metrics": { "n": { "op": "count" }, "top": { "op": "max", "path": "a" } } });
+        assert_eq!(reduce(spec, &[])["values"], json!({ "n": 0, "top": null }));
+    }
+}
@@ -0,0 +1,101 @@
+//! Process-wide registry of shared handles.
+//!
+//! Handles created with `shared: true` are keyed by a hash of their normalized
+//! config and outlive the PHP objects that use them: `dbx_client_free` only
+//! drops a reference, and an idle handle stays connected until it is evicted.
+//! Under PHP-FPM this lets every request after the first skip runtime
+//! creation and the Noise handshake. The registry is process-wide, so in a
+//! threaded SAPI every thread asking for the same config shares one handle
+//! (and its pool) instead of connecting its own.
+
+use std::{
+    collections::HashMap,
+    sync::{atomic::Ordering, Mutex, MutexGuard, OnceLock, PoisonError},
+};
+
+use crate::DbxHandle;
+
+fn lock() -> MutexGuard<'static, HashMap<u64, usize>> {
+    static REGISTRY: OnceLock<Mutex<HashMap<u64, usize>>> = OnceLock::new();
+    REGISTRY
+        .get_or_init(|| Mutex::new(HashMap::new()))
+        .lock()
+        .unwrap_or_else(PoisonError::into_inner)
+}
+
+/// Returns the registered handle for `key`, taking a reference on it, or
+/// registers a new one built by `connect`. The lock is held while connecting
+/// so concurrent callers with the same config never open two handles.
+pub(crate) fn acquire(
+    key: u64,
+    connect: impl FnOnce() -> Result<DbxHandle, String>,
+) -> Result<*mut DbxHandle, String> {
+    let mut handles = lock();
+    if let Some(&addr) = handles.get(&key) {
+        let handle = addr as *mut DbxHandle;
+        // A handle registered before fork belongs to the parent; replace it.
+        if !unsafe { &*handle }.inherited() {
+            unsafe { &*handle }.refs.fetch_add(1, Ordering::Relaxed);
+            return Ok(handle);
+        }
+    }
+
+    let mut handle = connect()?;
+    handle.shared_key = Some(key);
+    handle.refs = 1.into();
+    let ptr = Box::into_raw(Box::new(handle));
+    handles.insert(key, ptr as usize);
+    Ok(ptr)
+}
+
+/// What `dbx_client_free` must do after `release`.
+#[derive(Debug, PartialEq)]
+pub(crate) enum Release {
+    /// No references remain and the handle is not registered: free it.
+    Free,
+    /// The last reference to a registered handle with a write queue. The
+    /// reference is still held, so the caller can drain the queue and then
+    /// call `release` again with `settled` set.
+    Idle,
+    /// Other references remain, or the handle stays registered for reuse.
+    Keep,
+}
+
+/// Drops one reference and decides, under the registry lock, whether the
+/// caller frees the handle: always for unshared handles, and for shared ones
+/// only once they have been evicted and the last reference is gone.
+pub(crate) fn release(handle: *mut DbxHandle, settled: bool) -> Release {
+    let handles = lock();
+    let entry = unsafe { &*handle };
+    let Some(key) = entry.shared_key else {
+        return Release::Free;
+    };
+    let registered = handles.get(&key) == Some(&(handle as usize));
+    // only changed under the lock, so the load and store cannot race
+    let refs = entry.refs.load(Ordering::Relaxed);
+    if refs == 1 && registered && !settled && entry.writes.get().is_some() {
+        return Release::Idle;
+    }
+    let refs = refs.saturating_sub(1);
+    entry.refs.store(refs, Ordering::Relaxed);
+    if refs == 0 && !registered {
+        Release::Free
+    } else {
+        Release::Keep
+    }
+}
+
+/// Removes a shared handle from the registry so the next `dbx_client_new`
+/// connects afresh. Returns true when no references remain and the caller
+/// must free it now; otherwise the last `dbx_client_free` does.
+pub(crate) fn evict(handle: *mut DbxHandle) -> bool {
+    let mut handles = lock();
+    let entry = unsafe { &*handle };
+    let Some(key) = entry.shared_key else {
+        return false;
+    };
+    if handles.get(&key) == Some(&(handle as usize)) {
+        handles.remove(&key);
+    }
+    entry.refs.load(Ordering::Relaxed) == 0
+}
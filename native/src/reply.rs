@@ -0,0 +1,319 @@
+//! Typed response bodies and their wire encodings.
+//!
+//! Exports build a `Reply` directly from the client response (moving the
+//! server-provided values, never copying them into an intermediate map) and
+//! serialize it once into the buffer handed back to PHP.
+
+use std::{collections::BTreeMap, ffi::CString, os::raw::c_char};
+
+use serde::{Deserialize, Serialize};
+use serde_json::Value;
+
+use crate::{
+    export::ExportSummary, msgpack, reduce::ReduceSummary, verify::VerifySummary,
+    writes::FlushSummary,
+};
+
+/// Encoding of response buffers, selected by the `responseFormat` config key.
+#[derive(Clone, Copy, Debug, Default, Deserialize, Hash, PartialEq, Eq)]
+#[serde(rename_all = "lowercase")]
+pub(crate) enum ResponseFormat {
+    /// NUL-terminated JSON text, freed with `dbx_string_free`.
+    #[default]
+    Json,
+    /// MessagePack behind an 8-byte little-endian length prefix, freed with
+    /// `dbx_bytes_free`.
+    #[serde(alias = "messagepack")]
+    Msgpack,
+}
+
+const LEN_PREFIX: usize = std::mem::size_of::<u64>();
+
+#[derive(Serialize)]
+#[serde(untagged)]
+pub(crate) enum Reply {
+    Page {
+        items: Value,
+        #[serde(rename = "nextCursor")]
+        next_cursor: Option<String>,
+    },
+    Lookup {
+        found: bool,
+        aggregate: Value,
+    },
+    Selection {
+        found: bool,
+        selection: Value,
+    },
+    SnapshotLookup {
+        found: bool,
+        snapshot: Value,
+    },
+    Event {
+        event: Value,
+    },
+    Aggregate {
+        aggregate: Value,
+    },
+    Snapshot {
+        snapshot: Value,
+    },
+    Snapshots {
+        items: Value,
+    },
+    Verified {
+        #[serde(rename = "merkleRoot")]
+        merkle_root: String,
+    },
+    Failed {
+        error: String,
+    },
+    Batch {
+        items: Vec<Reply>,
+        failed: usize,
+    },
+    ById {
+        items: BTreeMap<String, Reply>,
+    },
+    Refs {
+        items: Vec<TaggedReply>,
+    },
+    State {
+        snapshot: Value,
+        #[serde(rename = "tailEvents")]
+        tail_events: Value,
+        #[serde(rename = "createdSnapshot", skip_serializing_if = "Option::is_none")]
+        created_snapshot: Option<Value>,
+        #[serde(rename = "snapshotError", skip_serializing_if = "Option::is_none")]
+        snapshot_error: Option<String>,
+    },
+    Exported(ExportSummary),
+    Verifications(VerifySummary),
+    Reduced(ReduceSummary),
+    Flushed(FlushSummary),
+}
+
+impl Reply {
+    /// Per-item form of a result inside a batch or multi-get response.
+    pub(crate) fn item(result: Result<Reply, String>) -> Reply {
+        result.unwrap_or_else(|error| Reply::Failed { error })
+    }
+
+    /// The reply as the `Value` tree it serializes to, moving the values of
+    /// the page and lookup shapes rather than copying them.
+    pub(crate) fn into_value(self) -> Result<Value, String> {
+        let object = |entries: [(&str, Value); 2]| {
+            Value::Object(
+                entries
+                    .into_iter()
+                    .map(|(key, value)| (key.to_string(), value))
+                    .collect(),
+            )
+        };
+        Ok(match self {
+            Reply::Page { items, next_cursor } => object([
+                ("items", items),
+                ("nextCursor", next_cursor.map_or(Value::Null, Value::String)),
+            ]),
+            Reply::Lookup { found, aggregate } => {
+                object([("found", Value::Bool(found)), ("aggregate", aggregate)])
+            }
+            Reply::Selection { found, selection } => {
+                object([("found", Value::Bool(found)), ("selection", selection)])
+            }
+            reply => serde_json::to_value(&reply)
+                .map_err(|e| format!("failed to serialize json: {e}"))?,
+        })
+    }
+}
+
+#[derive(Serialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct TaggedReply {
+    pub(crate) aggregate_type: String,
+    pub(crate) aggregate_id: String,
+    #[serde(flatten)]
+    pub(crate) reply: Reply,
+}
+
+/// Serializes `reply` into a buffer owned by the caller, returning the buffer
+/// and its encoded length.
+pub(crate) fn encode<T: Serialize>(
+    format: ResponseFormat,
+    reply: &T,
+) -> Result<(*mut c_char, usize), String> {
+    match format {
+        ResponseFormat::Json => {
+            let mut buf = Vec::with_capacity(256);
+            serde_json::to_writer(&mut buf, reply)
+                .map_err(|e| format!("failed to serialize json: {e}"))?;
+            let len = buf.len();
+            // serde_json escapes U+0000 inside strings, so the text has no interior NUL
+            Ok((unsafe { CString::from_vec_unchecked(buf) }.into_raw(), len))
+        }
+        ResponseFormat::Msgpack => {
+            let mut buf = Vec::with_capacity(256);
+            buf.extend_from_slice(&[0; LEN_PREFIX]);
+            msgpack::to_writer(&mut buf, reply)
+                .map_err(|e| format!("failed to serialize msgpack: {e}"))?;
+            let len = buf.len() - LEN_PREFIX;
+            buf[..LEN_PREFIX].copy_from_slice(&(len as u64).to_le_bytes());
+            Ok((Box::into_raw(buf.into_boxed_slice()) as *mut c_char, len))
+        }
+    }
+}
+
+/// Response buffer of the `_v2` exports: `len` bytes of JSON or MessagePack
+/// at `ptr`, without NUL terminator or length prefix, inside an allocation of
+/// `cap` bytes. A null `ptr` means no response (see `error_out`). Freed with
+/// `dbx_buf_free`.
+#[repr(C)]
+pub struct DbxBuf {
+    pub ptr: *mut u8,
+    pub len: usize,
+    pub cap: usize,
+}
+
+impl DbxBuf {
+    pub(crate) const EMPTY: DbxBuf = DbxBuf {
+        ptr: std::ptr::null_mut(),
+        len: 0,
+        cap: 0,
+    };
+
+    fn from_vec(buf: Vec<u8>) -> DbxBuf {
+        let mut buf = std::mem::ManuallyDrop::new(buf);
+        DbxBuf {
+            ptr: buf.as_mut_ptr(),
+            len: buf.len(),
+            cap: buf.capacity(),
+        }
+    }
+
+    /// Takes back the allocation; `None` for an empty buffer.
+    ///
+    /// # Safety
+    /// `self` must come from `encode_buf` and not have been freed.
+    pub(crate) unsafe fn into_vec(self) -> Option<Vec<u8>> {
+        (!self.ptr.is_null()).then(|| Vec::from_raw_parts(self.ptr, self.len, self.cap))
+    }
+}
+
+/// Serializes `reply` into `buf` (normally empty, possibly reused) and hands
+/// it out as a `DbxBuf`; the length travels in the struct, so neither
+/// format needs a terminator or prefix.
+pub(crate) fn encode_buf<T: Serialize>(
+    format: ResponseFormat,
+    reply: &T,
+    mut buf: Vec<u8>,
+) -> Result<DbxBuf, String> {
+    buf.clear();
+    match format {
+        ResponseFormat::Json => serde_json::to_writer(&mut buf, reply)
+            .map_err(|e| format!("failed to serialize json: {e}"))?,
+        ResponseFormat::Msgpack => msgpack::to_writer(&mut buf, reply)
+            .map_err(|e| format!("failed to serialize msgpack: {e}"))?,
+    }
+    Ok(DbxBuf::from_vec(buf))
+}
+
+/// Frees a buffer produced by `encode` with `ResponseFormat::Msgpack`.
+///
+/// # Safety
+/// `ptr` must come from `encode` in msgpack mode and not have been freed.
+pub(crate) unsafe fn free_bytes(ptr: *mut c_char) {
+    let mut prefix = [0u8; LEN_PREFIX];
+    std::ptr::copy_nonoverlapping(ptr as *const u8, prefix.as_mut_ptr(), LEN_PREFIX);
+    let len = u64::from_le_bytes(prefix) as usize + LEN_PREFIX;
+    drop(Box::from_raw(std::ptr::slice_from_raw_parts_mut(ptr as *mut u8, len)));
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn replies_serialize_to_the_documented_shapes() {
+        let page = Reply::Page {
+            items: serde_json::json!([{ "id": 1 }]),
+            next_cursor: None,
+        };
+        assert_eq!(
+            serde_json::to_value(&page).unwrap(),
+            serde_json::json!({ "items": [{ "id": 1 }], "nextCursor": null })
+        );
+
+        let refs = Reply::Refs {
+            items: vec![TaggedReply {
+                aggregate_type: "order".to_string(),
+                aggregate_id: "1".to_string(),
+                reply: Reply::item(Err("boom".to_string())),
+            }],
+        };
+        assert_eq!(
+            serde_json::to_value(&refs).unwrap(),
+            serde_json::json!({ "items": [{ "aggregateType": "order", "aggregateId": "1", "error": "boom" }] })
+        );
+    }
+
+    #[test]
+    fn values_match_the_serialized_shapes() {
+        let replies = || {
+            [
+                Reply::Page {
+                    items: serde_json::json!([{ "id": 1 }]),
+                    next_cursor: Some("c".to_string()),
+                },
+                Reply::Lookup {
+                    found: false,
+                    aggregate: Value::Null,
+                },
+                Reply::Verified {
+                    merkle_root: "ab".to_string(),
+                },
+            ]
+        };
+        for (reply, expected) in replies().into_iter().zip(replies()) {
+            assert_eq!(
+                reply.into_value().unwrap(),
+                serde_json::to_value(&expected).unwrap()
+            );
+        }
+    }
+
+    #[test]
+    fn json_encoding_round_trips_through_c_string() {
+        let reply = Reply::Verified {
+            merkle_root: "ab\u{0}cd".to_string(),
+        };
+        let (ptr, _) = encode(ResponseFormat::Json, &reply).unwrap();
+        let text = unsafe { CString::from_raw(ptr) }.into_string().unwrap();
+        assert_eq!(text, r#"{"merkleRoot":"ab\u0000cd"}"#);
+    }
+
+    #[test]
+    fn msgpack_encoding_is_length_prefixed() {
+        let reply = Reply::Event { event: Value::Null };
+        let (ptr, _) = encode(ResponseFormat::Msgpack, &reply).unwrap();
+        let bytes = unsafe { std::slice::from_raw_parts(ptr as *const u8, LEN_PREFIX + 8) };
+        assert_eq!(&bytes[..LEN_PREFIX], &8u64.to_le_bytes());
+        assert_eq!(&bytes[LEN_PREFIX..], [0x81, 0xa5, b'e', b'v', b'e', b'n', b't', 0xc0]);
+        unsafe { free_bytes(ptr) };
+    }
+
+    #[test]
+    fn buffers_carry_length_without_terminator() {
+        let reply = Reply::Event { event: Value::Null };
+        let buf = encode_buf(ResponseFormat::Json, &reply, b"stale".to_vec()).unwrap();
+        let bytes = unsafe { std::slice::from_raw_parts(buf.ptr, buf.len) };
+        assert_eq!(bytes, br#"{"event":null}"#);
+        assert!(buf.cap >= buf.len);
+        let reused = unsafe { buf.into_vec() }.unwrap();
+
+        let buf = encode_buf(ResponseFormat::Msgpack, &reply, reused).unwrap();
+        assert_eq!(buf.len, 8);
+        assert_eq!(unsafe { *buf.ptr }, 0x81);
+        drop(unsafe { buf.into_vec() });
+        assert!(unsafe { DbxBuf::EMPTY.into_vec() }.is_none());
+    }
+}
@@ -0,0 +1,360 @@
+//! Retries and hedged requests (`retry` and `hedge` config keys).
+//!
+//! Reads (`get`, `select`, `events`, `list`, `getSnapshot`) run through
+//! `Pool::read`. A transport error is retried up to `maxAttempts` times
+//! with exponential backoff and full jitter. With `hedge`, a read still
+//! unanswered after the `percentile` latency of earlier reads on this
+//! handle is sent again on another pooled connection, and the first
+//! successful reply wins. The losing request is cancelled, which retires
+//! its connection (see `Lease`), so hedging costs a reconnect per hedge.
+//!
+//! Writes are never resent once they may have reached the server: the
+//! protocol has no idempotency key, so a second append could apply twice.
+//! They, like reads, are only retried while opening a connection, before
+//! anything was sent.
+
+use std::{
+    collections::hash_map::RandomState,
+    future::Future,
+    hash::{BuildHasher, Hasher},
+    pin::pin,
+    sync::atomic::{AtomicU64, Ordering},
+    time::{Duration, Instant},
+};
+
+use futures::future::{select, Either};
+use serde::Deserialize;
+
+use crate::metrics::Histogram;
+
+/// Reads observed before the hedge delay is derived from their latency.
+const MIN_HEDGE_SAMPLES: u64 = 20;
+
+#[derive(Clone, Copy, Debug, Deserialize, Hash, PartialEq)]
+#[serde(rename_all = "camelCase", default)]
+pub(crate) struct RetryConfig {
+    /// Attempts per call, the first one included.
+    max_attempts: u32,
+    base_delay_ms: u64,
+    max_delay_ms: u64,
+}
+
+impl Default for RetryConfig {
+    fn default() -> Self {
+        RetryConfig {
+            max_attempts: 3,
+            base_delay_ms: 10,
+            max_delay_ms: 500,
+        }
+    }
+}
+
+#[derive(Clone, Copy, Debug, Deserialize, Hash, PartialEq)]
+#[serde(rename_all = "camelCase", default)]
+pub(crate) struct HedgeConfig {
+    /// Read latency percentile (1-99) after which a hedge is sent.
+    percentile: u32,
+    /// Fixed hedge delay instead of the percentile.
+    delay_ms: Option<u64>,
+    min_delay_ms: u64,
+    max_delay_ms: u64,
+}
+
+impl Default for HedgeConfig {
+    fn default() -> Self {
+        HedgeConfig {
+            percentile: 95,
+            delay_ms: None,
+            min_delay_ms: 2,
+            max_delay_ms: 1000,
+        }
+    }
+}
+
+/// Retry and hedge counters plus the read latencies hedging is derived from.
+pub(crate) struct RetryGauge {
+    retries: AtomicU64,
+    hedges: AtomicU64,
+    hedge_wins: AtomicU64,
+    pub(crate) reads: Histogram,
+}
+
+#[derive(serde::Serialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct RetrySnapshot {
+    pub(crate) retries: u64,
+    pub(crate) hedges: u64,
+    pub(crate) hedge_wins: u64,
+}
+
+impl RetryGauge {
+    pub(crate) fn new() -> Self {
+        RetryGauge {
+            retries: AtomicU64::new(0),
+            hedges: AtomicU64::new(0),
+            hedge_wins: AtomicU64::new(0),
+            reads: Histogram::new(),
+        }
+    }
+
+    pub(crate) fn snapshot(&self) -> RetrySnapshot {
+        RetrySnapshot {
+            retries: self.retries.load(Ordering::Relaxed),
+            hedges: self.hedges.load(Ordering::Relaxed),
+            hedge_wins: self.hedge_wins.load(Ordering::Relaxed),
+        }
+    }
+}
+
+/// The policy of one handle; the default makes a single attempt.
+#[derive(Clone, Copy, Default)]
+pub(crate) struct RetryPolicy {
+    retry: Option<RetryConfig>,
+    hedge: Option<HedgeConfig>,
+}
+
+impl RetryPolicy {
+    pub(crate) fn new(retry: Option<RetryConfig>, hedge: Option<HedgeConfig>) -> Self {
+        RetryPolicy { retry, hedge }
+    }
+
+    fn max_attempts(&self) -> u32 {
+        self.retry.map_or(1, |retry| retry.max_attempts.max(1))
+    }
+
+    /// Full-jitter exponential backoff before retry number `retry` (1-based).
+    fn backoff(&self, retry: u32) -> Duration {
+        let Some(config) = self.retry else {
+            return Duration::ZERO;
+        };
+        let ceiling = config
+            .base_delay_ms
+            .saturating_mul(1 << (retry - 1).min(20))
+            .min(config.max_delay_ms);
+        Duration::from_millis(jitter(ceiling))
+    }
+
+    fn hedge_delay(&self, gauge: &RetryGauge) -> Option<Duration> {
+        let hedge = self.hedge?;
+        let delay_ms = match hedge.delay_ms {
+            Some(delay) => delay,
+            None => {
+                if gauge.reads.count() < MIN_HEDGE_SAMPLES {
+                    return None;
+                }
+                let q = f64::from(hedge.percentile.clamp(1, 99)) / 100.0;
+                gauge.reads.quantile_us(q) / 1000
+            }
+        };
+        Some(Duration::from_millis(delay_ms.clamp(
+            hedge.min_delay_ms,
+            hedge.max_delay_ms.max(hedge.min_delay_ms),
+        )))
+    }
+
+    /// Runs `connect` until it succeeds or the attempts are used up. Nothing
+    /// was sent yet, so this is safe for writes too.
+    pub(crate) async fn connect<T, F, Fut>(
+        &self,
+        gauge: &RetryGauge,
+        connect: F,
+    ) -> Result<T, String>
+    where
+        F: Fn() -> Fut,
+        Fut: Future<Output = Result<T, String>>,
+    {
+        let mut attempt = 1;
+        loop {
+            match connect().await {
+                Err(_) if attempt < self.max_attempts() => {
+                    gauge.retries.fetch_add(1, Ordering::Relaxed);
+                    tokio::time::sleep(self.backoff(attempt)).await;
+                    attempt += 1;
+                }
+                result => return result,
+            }
+        }
+    }
+
+    /// Runs an idempotent read, hedging it when `hedgeable` (the pool has
+    /// another connection) and retrying errors `retryable` accepts.
+    pub(crate) async fn read<T, E, F, Fut>(
+        &self,
+        gauge: &RetryGauge,
+        hedgeable: bool,
+        retryable: fn(&E) -> bool,
+        read: F,
+    ) -> Result<T, E>
+    where
+        F: Fn() -> Fut,
+        Fut: Future<Output = Result<T, E>>,
+    {
+        let mut attempt = 1;
+        loop {
+            let started = Instant::now();
+            let delay = hedgeable.then(|| self.hedge_delay(gauge)).flatten();
+            let result = match delay {
+                Some(delay) => hedged(gauge, delay, &read).await,
+                None => read().await,
+            };
+            if result.is_ok() {
+                gauge.reads.record(started.elapsed());
+            }
+            match result {
+                Err(err) if attempt < self.max_attempts() && retryable(&err) => {
+                    gauge.retries.fetch_add(1, Ordering::Relaxed);
+                    tokio::time::sleep(self.backoff(attempt)).await;
+                    attempt += 1;
+                }
+                result => return result,
+            }
+        }
+    }
+}
+
+/// First success of the read and, once `delay` passed without a reply, a
+/// second copy of it; an error only wins when both fail.
+async fn hedged<T, E, F, Fut>(gauge: &RetryGauge, delay: Duration, read: &F) -> Result<T, E>
+where
+    F: Fn() -> Fut,
+    Fut: Future<Output = Result<T, E>>,
+{
+    let first = pin!(read());
+    let sleep = pin!(tokio::time::sleep(delay));
+    let first = match select(first, sleep).await {
+        Either::Left((result, _)) => return result,
+        Either::Right(((), first)) => first,
+    };
+    gauge.hedges.fetch_add(1, Ordering::Relaxed);
+    let second = pin!(read());
+    match select(first, second).await {
+        Either::Left((Ok(value), _)) => Ok(value),
+        Either::Left((Err(_), second)) => second.await.inspect(|_| {
+            gauge.hedge_wins.fetch_add(1, Ordering::Relaxed);
+        }),
+        Either::Right((Ok(value), _)) => {
+            gauge.hedge_wins.fetch_add(1, Ordering::Relaxed);
+            Ok(value)
+        }
+        Either::Right((Err(_), first)) => first.await,
+    }
+}
+
+/// Uniform in `0..=ceiling`, seeded per call.
+fn jitter(ceiling: u64) -> u64 {
+    if ceiling == 0 {
+        return 0;
+    }
+    let mut hasher = RandomState::new().build_hasher();
+    hasher.write_u64(ceiling);
+    hasher.finish() % (ceiling + 1)
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::atomic::AtomicU32;
+
+    use tokio::runtime::Runtime;
+
+    use super::*;
+
+    fn policy(max_attempts: u32, hedge: Option<HedgeConfig>) -> RetryPolicy {
+        RetryPolicy::new(
+            Some(RetryConfig {
+                max_attempts,
+                base_delay_ms: 1,
+                max_delay_ms: 2,
+            }),
+            hedge,
+        )
+    }
+
+    #[test]
+    fn retries_only_retryable_errors() {
+        let runtime = Runtime::new().unwrap();
+        let gauge = RetryGauge::new();
+        let calls = AtomicU32::new(0);
+        let read = || async {
+            let n = calls.fetch_add(1, Ordering::SeqCst);
+            if n < 2 {
+                Err("connection reset".to_string())
+            } else {
+                Ok(n)
+            }
+        };
+        let result = runtime.block_on(policy(3, None).read(&gauge, false, |_| true, read));
+        assert_eq!(result, Ok(2));
+        assert_eq!(gauge.snapshot().retries, 2);
+
+        calls.store(0, Ordering::SeqCst);
+        let result = runtime.block_on(policy(3, None).read(&gauge, false, |_| false, read));
+        assert!(result.is_err());
+        assert_eq!(calls.load(Ordering::SeqCst), 1);
+
+        // without a retry config there is a single attempt
+        calls.store(0, Ordering::SeqCst);
+        let single = RetryPolicy::default();
+        assert!(runtime
+            .block_on(single.read(&gauge, false, |_| true, read))
+            .is_err());
+        assert_eq!(calls.load(Ordering::SeqCst), 1);
+    }
+
+    #[test]
+    fn slow_reads_are_hedged() {
+        let runtime = Runtime::new().unwrap();
+        let gauge = RetryGauge::new();
+        let hedge = HedgeConfig {
+            delay_ms: Some(5),
+            ..HedgeConfig::default()
+        };
+        let calls = AtomicU32::new(0);
+        let read = || async {
+            let n = calls.fetch_add(1, Ordering::SeqCst);
+            // the first copy stalls, the hedge answers at once
+            if n == 0 {
+                tokio::time::sleep(Duration::from_secs(5)).await;
+            }
+            Ok::<_, String>(n)
+        };
+        let started = Instant::now();
+        let result = runtime.block_on(policy(1, Some(hedge)).read(&gauge, true, |_| true, read));
+        assert_eq!(result, Ok(1));
+        assert!(started.elapsed() < Duration::from_secs(1));
+        let snapshot = gauge.snapshot();
+        assert_eq!((snapshot.hedges, snapshot.hedge_wins), (1, 1));
+
+        // a single-connection pool never hedges
+        calls.store(0, Ordering::SeqCst);
+        let result = runtime.block_on(policy(1, Some(hedge)).read(
+            &gauge,
+            false,
+            |_| true,
+            || async { Ok::<_, String>(calls.fetch_add(1, Ordering::SeqCst)) },
+        ));
+        assert_eq!(result, Ok(0));
+        assert_eq!(gauge.snapshot().hedges, 1);
+    }
+
+    #[test]
+    fn hedge_delay_follows_the_read_percentile() {
+        let gauge = RetryGauge::new();
+        let policy = policy(1, Some(HedgeConfig::default()));
+        assert_eq!(policy.hedge_delay(&gauge), None);
+        for _ in 0..MIN_HEDGE_SAMPLES {
+            gauge.reads.record(Duration::from_millis(10));
+        }
+        // 10 ms falls in the bucket below 16.384 ms, capped at the max seen
+        assert_eq!(policy.hedge_delay(&gauge), Some(Duration::from_millis(10)));
+    }
+
+    #[test]
+    fn backoff_is_capped_and_jittered() {
+        let policy = RetryPolicy::new(Some(RetryConfig::default()), None);
+        for retry in 1..10 {
+            assert!(policy.backoff(retry) <= Duration::from_millis(500));
+        }
+        assert_eq!(jitter(0), 0);
+        assert!((0..100).map(|_| jitter(1000)).any(|ms| ms != jitter(1000)));
+    }
+}
@@ -0,0 +1,360 @@
+//! Endpoint selection for the connection pool (`endpoints` and `health`
+//! config keys).
+//!
+//! A handle opens `poolSize` connections to every endpoint. Each endpoint
+//! tracks a moving average of its reply latency and its consecutive
+//! transport failures; `ejectAfter` failures in a row eject it for
+//! `ejectMs`, during which a background probe keeps reconnecting until the
+//! node answers again. Leases prefer healthy endpoints with the lowest
+//! `(load + 1) * latency / weight`, so reads drift to the fastest node
+//! without starving the others. Writes go to endpoints marked `primary`
+//! when there are any, since the protocol does not announce a leader.
+
+use std::{
+    fmt::Write as _,
+    sync::atomic::{AtomicBool, AtomicU32, AtomicU64, Ordering},
+    time::{Duration, Instant},
+};
+
+use serde::{Deserialize, Serialize};
+
+/// Weight of the newest reply in the latency average.
+const ALPHA: f64 = 0.2;
+
+#[derive(Clone, Debug, Deserialize, Hash, PartialEq)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct Endpoint {
+    pub(crate) host: String,
+    pub(crate) port: Option<u16>,
+    /// Relative share of traffic at equal latency (default 1).
+    #[serde(default = "default_weight")]
+    weight: u32,
+    /// Receives the writes; when no endpoint is marked, every one does.
+    #[serde(default)]
+    primary: bool,
+}
+
+fn default_weight() -> u32 {
+    1
+}
+
+impl Endpoint {
+    pub(crate) fn new(host: String, port: Option<u16>) -> Self {
+        Endpoint {
+            host,
+            port,
+            weight: 1,
+            primary: false,
+        }
+    }
+}
+
+#[derive(Clone, Copy, Debug, Deserialize, Hash, PartialEq)]
+#[serde(rename_all = "camelCase", default)]
+pub(crate) struct HealthConfig {
+    /// Consecutive transport failures that eject an endpoint.
+    eject_after: u32,
+    /// How long an endpoint stays ejected between probes.
+    eject_ms: u64,
+}
+
+impl Default for HealthConfig {
+    fn default() -> Self {
+        HealthConfig {
+            eject_after: 3,
+            eject_ms: 5000,
+        }
+    }
+}
+
+/// Whether a lease is for a read or a write.
+#[derive(Clone, Copy, PartialEq)]
+pub(crate) enum Route {
+    Read,
+    Write,
+}
+
+/// Health and latency of one endpoint, shared by its connections.
+pub(crate) struct Node {
+    pub(crate) endpoint: Endpoint,
+    health: HealthConfig,
+    epoch: Instant,
+    /// Moving average reply latency; 0 until the first reply.
+    latency_us: AtomicU64,
+    failures: AtomicU32,
+    /// Milliseconds after `epoch` until which the node is ejected.
+    ejected_until_ms: AtomicU64,
+    /// Whether a probe task is running for it.
+    probing: AtomicBool,
+}
+
+impl Node {
+    pub(crate) fn new(endpoint: Endpoint, health: HealthConfig) -> Self {
+        Node {
+            endpoint,
+            health,
+            epoch: Instant::now(),
+            latency_us: AtomicU64::new(0),
+            failures: AtomicU32::new(0),
+            ejected_until_ms: AtomicU64::new(0),
+            probing: AtomicBool::new(false),
+        }
+    }
+
+    fn now_ms(&self) -> u64 {
+        self.epoch.elapsed().as_millis() as u64
+    }
+
+    pub(crate) fn healthy(&self) -> bool {
+        self.now_ms() >= self.ejected_until_ms.load(Ordering::Relaxed)
+    }
+
+    /// Records a reply (including server-side rejections: the node answered).
+    pub(crate) fn succeeded(&self, elapsed: Duration) {
+        self.failures.store(0, Ordering::Relaxed);
+        self.ejected_until_ms.store(0, Ordering::Relaxed);
+        let sample = elapsed.as_micros() as f64;
+        let previous = self.latency_us.load(Ordering::Relaxed);
+        let latency = if previous == 0 {
+            sample
+        } else {
+            previous as f64 + ALPHA * (sample - previous as f64)
+        };
+        self.latency_us
+            .store(latency.max(1.0) as u64, Ordering::Relaxed);
+    }
+
+    /// Records a transport failure; true when it ejected the node, in which
+    /// case the caller starts a probe.
+    pub(crate) fn failed(&self) -> bool {
+        let failures = self.failures.fetch_add(1, Ordering::Relaxed) + 1;
+        if failures < self.health.eject_after.max(1) || !self.healthy() {
+            return false;
+        }
+        self.eject();
+        true
+    }
+
+    /// Ejects (or keeps ejected) the node for another `ejectMs`.
+    pub(crate) fn eject(&self) {
+        self.ejected_until_ms.store(
+            self.now_ms() + self.health.eject_ms.max(1),
+            Ordering::Relaxed,
+        );
+    }
+
+    /// Clears the failures once a probe reconnected.
+    pub(crate) fn recovered(&self) {
+        self.failures.store(0, Ordering::Relaxed);
+        self.ejected_until_ms.store(0, Ordering::Relaxed);
+    }
+
+    /// Whether a reply or probe cleared the last ejection.
+    pub(crate) fn reinstated(&self) -> bool {
+        self.ejected_until_ms.load(Ordering::Relaxed) == 0
+    }
+
+    pub(crate) fn eject_duration(&self) -> Duration {
+        Duration::from_millis(self.health.eject_ms.max(1))
+    }
+
+    /// True for the caller that gets to start the probe.
+    pub(crate) fn claim_probe(&self) -> bool {
+        !self.probing.swap(true, Ordering::AcqRel)
+    }
+
+    pub(crate) fn end_probe(&self) {
+        self.probing.store(false, Ordering::Release);
+    }
+
+    /// Lower is better: expected wait for a lease on a connection with
+    /// `load` requests ahead of it.
+    fn score(&self, load: usize) -> f64 {
+        let latency = self.latency_us.load(Ordering::Relaxed).max(1) as f64;
+        (load + 1) as f64 * latency / f64::from(self.endpoint.weight.max(1))
+    }
+
+    pub(crate) fn name(&self) -> String {
+        match self.endpoint.port {
+            Some(port) => format!("{}:{port}", self.endpoint.host),
+            None => self.endpoint.host.clone(),
+        }
+    }
+
+    fn snapshot(&self) -> EndpointSnapshot {
+        EndpointSnapshot {
+            endpoint: self.name(),
+            weight: self.endpoint.weight,
+            primary: self.endpoint.primary,
+            healthy: self.healthy(),
+            latency_us: self.latency_us.load(Ordering::Relaxed),
+            failures: self.failures.load(Ordering::Relaxed),
+        }
+    }
+}
+
+/// The index among `candidates` (node and load per connection) to lease,
+/// scanning from `start` so ties rotate. Ejected endpoints are only used
+/// when nothing else is left, and writes stay on primaries when any exist.
+pub(crate) fn pick<'a>(
+    candidates: impl ExactSizeIterator<Item = (&'a Node, usize)> + Clone,
+    start: usize,
+    route: Route,
+) -> usize {
+    let count = candidates.len();
+    let primaries =
+        route == Route::Write && candidates.clone().any(|(node, _)| node.endpoint.primary);
+    let eligible: Vec<(usize, &Node, usize)> = candidates
+        .enumerate()
+        .map(|(index, (node, load))| (index, node, load))
+        .filter(|(_, node, _)| !primaries || node.endpoint.primary)
+        .collect();
+    let any_healthy = eligible.iter().any(|(_, node, _)| node.healthy());
+
+    let mut best = start % count;
+    let mut best_score = f64::INFINITY;
+    for offset in 0..count {
+        let index = (start + offset) % count;
+        let Some((_, node, load)) = eligible.iter().find(|(i, _, _)| *i == index) else {
+            continue;
+        };
+        if any_healthy && !node.healthy() {
+            continue;
+        }
+        let score = node.score(*load);
+        if score < best_score {
+            best = index;
+            best_score = score;
+        }
+    }
+    best
+}
+
+#[derive(Serialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct EndpointSnapshot {
+    endpoint: String,
+    weight: u32,
+    primary: bool,
+    healthy: bool,
+    latency_us: u64,
+    failures: u32,
+}
+
+pub(crate) fn snapshot(nodes: &[std::sync::Arc<Node>]) -> Vec<EndpointSnapshot> {
+    nodes.iter().map(|node| node.snapshot()).collect()
+}
+
+/// One contiguous group per metric family, as the exposition format
+/// requires.
+pub(crate) fn prometheus(out: &mut String, nodes: &[std::sync::Arc<Node>]) {
+    out.push_str("# TYPE eventdbx_endpoint_healthy gauge\n");
+    for node in nodes {
+        let _ = writeln!(
+            out,
+            "eventdbx_endpoint_healthy{{endpoint=\"{}\"}} {}",
+            node.name(),
+            u8::from(node.healthy())
+        );
+    }
+    out.push_str("# TYPE eventdbx_endpoint_latency_seconds gauge\n");
+    for node in nodes {
+        let _ = writeln!(
+            out,
+            "eventdbx_endpoint_latency_seconds{{endpoint=\"{}\"}} {}",
+            node.name(),
+            node.latency_us.load(Ordering::Relaxed) as f64 / 1e6
+        );
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn node(host: &str, weight: u32, primary: bool) -> Node {
+        let mut endpoint = Endpoint::new(host.to_string(), None);
+        endpoint.weight = weight;
+        endpoint.primary = primary;
+        Node::new(endpoint, HealthConfig::default())
+    }
+
+    #[test]
+    fn reads_prefer_the_fastest_node_until_it_is_busy() {
+        let (fast, slow) = (node("a", 1, false), node("b", 1, false));
+        fast.succeeded(Duration::from_millis(1));
+        slow.succeeded(Duration::from_millis(4));
+        let pick_with = |fast_load, slow_load| {
+            pick(
+                [(&fast, fast_load), (&slow, slow_load)].into_iter(),
+                0,
+                Route::Read,
+            )
+        };
+        assert_eq!(pick_with(0, 0), 0);
+        assert_eq!(pick_with(3, 0), 0);
+        assert_eq!(pick_with(4, 0), 1);
+    }
+
+    #[test]
+    fn equal_nodes_rotate_with_start() {
+        let (a, b) = (node("a", 1, false), node("b", 1, false));
+        let candidates = [(&a, 0), (&b, 0)];
+        assert_eq!(pick(candidates.into_iter(), 0, Route::Read), 0);
+        assert_eq!(pick(candidates.into_iter(), 1, Route::Read), 1);
+    }
+
+    #[test]
+    fn ejected_nodes_are_skipped_while_others_are_healthy() {
+        let (a, b) = (node("a", 1, false), node("b", 1, false));
+        assert!(!a.failed());
+        assert!(!a.failed());
+        assert!(a.failed());
+        assert!(!a.healthy());
+        assert_eq!(pick([(&a, 0), (&b, 5)].into_iter(), 0, Route::Read), 1);
+
+        b.eject();
+        // nothing healthy: fall back to the best of all
+        assert_eq!(pick([(&a, 0), (&b, 5)].into_iter(), 0, Route::Read), 0);
+
+        a.succeeded(Duration::from_millis(1));
+        assert!(a.healthy());
+    }
+
+    #[test]
+    fn writes_stay_on_primaries() {
+        let (replica, primary) = (node("r", 10, false), node("p", 1, true));
+        let candidates = [(&replica, 0), (&primary, 8)];
+        assert_eq!(pick(candidates.into_iter(), 0, Route::Write), 1);
+        assert_eq!(pick(candidates.into_iter(), 0, Route::Read), 0);
+    }
+
+    #[test]
+    fn prometheus_groups_each_family() {
+        let nodes = [
+            std::sync::Arc::new(node("a", 1, false)),
+            std::sync::Arc::new(node("b", 1, false)),
+        ];
+        nodes[1].succeeded(Duration::from_millis(2));
+        let mut out = String::new();
+        prometheus(&mut out, &nodes);
+        let families: Vec<&str> = out
+            .lines()
+            .filter(|line| !line.starts_with('#'))
+            .map(|line| line.split('{').next().unwrap())
+            .collect();
+        assert_eq!(
+            families,
+            [
+                "eventdbx_endpoint_healthy",
+                "eventdbx_endpoint_healthy",
+                "eventdbx_endpoint_latency_seconds",
+                "eventdbx_endpoint_latency_seconds",
+            ]
+        );
+        assert!(out.starts_with(
+            "# TYPE eventdbx_endpoint_healthy gauge\neventdbx_endpoint_healthy{endpoint=\"a\"} 1\n"
+        ));
+        assert!(out.contains("# TYPE eventdbx_endpoint_latency_seconds gauge\neventdbx_endpoint_latency_seconds{endpoint=\"a\"}"));
+    }
+}
@@ -0,0 +1,235 @@
+//! Runtime selection for handles (the `runtime` config key).
+//!
+//! * `current_thread`: no worker threads. Work spawned by a handle
+//!   (submitted tickets, cursor read-ahead, reconnects) advances while a call
+//!   on that handle is blocked in the runtime, and on `dbx_poll`. Features
+//!   whose point is progress while PHP runs (the write queue, change feeds,
+//!   `dbx_notify_fd`, explicit cursor `prefetch`, background connecting) are
+//!   refused on it; see `require_threaded`.
+//! * `multi_thread`: a private pool of `workerThreads` (default: one per core)
+//!   so spawned work also advances between calls.
+//! * `shared`: one multi-threaded runtime per process, reused by every handle
+//!   that asks for it; the first handle's thread counts apply.
+//!
+//! Without a flavor a handle gets `current_thread`, unless its config already
+//! asks for background work (`writeQueue`, `lazyConnect: "background"`), in
+//! which case it gets `shared`, or only sets thread counts, in which case it
+//! gets `multi_thread` so those counts are not ignored.
+//!
+//! A forked child inherits runtime memory but none of its threads, so every
+//! runtime remembers the pid that built it and is never reused, driven or
+//! shut down from another process.
+
+use std::{
+    ops::Deref,
+    sync::{Mutex, PoisonError},
+};
+
+use serde::Deserialize;
+use tokio::runtime::{Builder, Runtime, RuntimeFlavor};
+
+#[derive(Clone, Copy, Debug, Deserialize, Hash, PartialEq)]
+#[serde(rename_all = "snake_case")]
+pub(crate) enum Flavor {
+    CurrentThread,
+    MultiThread,
+    Shared,
+}
+
+#[derive(Clone, Default, Deserialize, Hash)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct RuntimeOptions {
+    /// Chosen from the rest of the config when absent.
+    flavor: Option<Flavor>,
+    worker_threads: Option<usize>,
+    max_blocking_threads: Option<usize>,
+}
+
+/// `runtime` accepts a bare flavor name or the full options object.
+#[derive(Clone, Deserialize, Hash)]
+#[serde(untagged)]
+pub(crate) enum RuntimeConfig {
+    Flavor(Flavor),
+    Options(RuntimeOptions),
+}
+
+impl RuntimeConfig {
+    fn options(&self) -> RuntimeOptions {
+        match self {
+            RuntimeConfig::Flavor(flavor) => RuntimeOptions {
+                flavor: Some(*flavor),
+                ..RuntimeOptions::default()
+            },
+            RuntimeConfig::Options(options) => options.clone(),
+        }
+    }
+}
+
+pub(crate) enum HandleRuntime {
+    Owned(Runtime),
+    Shared(&'static Runtime),
+}
+
+impl Deref for HandleRuntime {
+    type Target = Runtime;
+
+    fn deref(&self) -> &Runtime {
+        match self {
+            HandleRuntime::Owned(runtime) => runtime,
+            HandleRuntime::Shared(runtime) => runtime,
+        }
+    }
+}
+
+fn build(options: &RuntimeOptions, multi_thread: bool) -> Result<Runtime, String> {
+    let mut builder = if multi_thread {
+        let mut builder = Builder::new_multi_thread();
+        if let Some(workers) = options.worker_threads {
+            builder.worker_threads(workers.max(1));
+        }
+        builder
+    } else {
+        Builder::new_current_thread()
+    };
+    if let Some(blocking) = options.max_blocking_threads {
+        builder.max_blocking_threads(blocking.max(1));
+    }
+    builder
+        .thread_name("eventdbx")
+        .enable_all()
+        .build()
+        .map_err(|err| format!("failed to create runtime: {err}"))
+}
+
+fn shared(options: &RuntimeOptions) -> Result<&'static Runtime, String> {
+    static SHARED: Mutex<Option<(u32, &'static Runtime)>> = Mutex::new(None);
+    let mut shared = SHARED.lock().unwrap_or_else(PoisonError::into_inner);
+    let pid = std::process::id();
+    if let Some((owner, runtime)) = *shared {
+        if owner == pid {
+            return Ok(runtime);
+        }
+    }
+    // Any runtime left from before a fork is leaked, not shut down: its
+    // worker threads do not exist in this process.
+    let runtime: &'static Runtime = Box::leak(Box::new(build(options, true)?));
+    *shared = Some((pid, runtime));
+    Ok(runtime)
+}
+
+fn needs_threads(feature: &str) -> String {
+    format!("{feature} needs a threaded runtime; set runtime to multi_thread or shared")
+}
+
+impl HandleRuntime {
+    /// `background` names the first configured feature that needs work to
+    /// progress between calls, if any.
+    pub(crate) fn new(
+        config: Option<&RuntimeConfig>,
+        background: Option<&str>,
+    ) -> Result<Self, String> {
+        let options = config.map(RuntimeConfig::options).unwrap_or_default();
+        let flavor = match (options.flavor, background) {
+            (Some(Flavor::CurrentThread), Some(feature)) => return Err(needs_threads(feature)),
+            (Some(flavor), _) => flavor,
+            (None, Some(_)) => Flavor::Shared,
+            (None, None) if options.worker_threads.is_some() || options.max_blocking_threads.is_some() => {
+                Flavor::MultiThread
+            }
+            (None, None) => Flavor::CurrentThread,
+        };
+        match flavor {
+            Flavor::CurrentThread => build(&options, false).map(HandleRuntime::Owned),
+            Flavor::MultiThread => build(&options, true).map(HandleRuntime::Owned),
+            Flavor::Shared => shared(&options).map(HandleRuntime::Shared),
+        }
+    }
+
+    /// Refuses `feature` on a current-thread runtime, where it would only
+    /// progress while PHP is inside a native call.
+    pub(crate) fn require_threaded(&self, feature: &str) -> Result<(), String> {
+        if self.handle().runtime_flavor() == RuntimeFlavor::CurrentThread {
+            return Err(needs_threads(feature));
+        }
+        Ok(())
+    }
+
+    /// Gives spawned tasks a chance to run on a current-thread runtime,
+    /// which otherwise only drives them inside `block_on`.
+    pub(crate) fn turn(&self) {
+        if self.handle().runtime_flavor() == RuntimeFlavor::CurrentThread {
+            self.block_on(tokio::task::yield_now());
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn defaults_to_current_thread() {
+        let runtime = HandleRuntime::new(None, None).unwrap();
+        assert_eq!(runtime.handle().runtime_flavor(), RuntimeFlavor::CurrentThread);
+        assert!(runtime.require_threaded("the write queue").is_err());
+    }
+
+    #[test]
+    fn background_features_get_a_threaded_runtime() {
+        let runtime = HandleRuntime::new(None, Some("writeQueue")).unwrap();
+        assert_eq!(runtime.handle().runtime_flavor(), RuntimeFlavor::MultiThread);
+        assert!(runtime.require_threaded("the write queue").is_ok());
+
+        let options: RuntimeConfig =
+            serde_json::from_value(serde_json::json!({ "workerThreads": 2 })).unwrap();
+        let runtime = HandleRuntime::new(Some(&options), Some("writeQueue")).unwrap();
+        assert_eq!(runtime.handle().runtime_flavor(), RuntimeFlavor::MultiThread);
+
+        let explicit: RuntimeConfig =
+            serde_json::from_value(serde_json::json!("current_thread")).unwrap();
+        let err = HandleRuntime::new(Some(&explicit), Some("writeQueue")).err().unwrap();
+        assert_eq!(
+            err,
+            "writeQueue needs a threaded runtime; set runtime to multi_thread or shared"
+        );
+    }
+
+    #[test]
+    fn thread_counts_without_a_flavor_get_a_private_pool() {
+        for counts in [
+            serde_json::json!({ "workerThreads": 2 }),
+            serde_json::json!({ "maxBlockingThreads": 4 }),
+        ] {
+            let config: RuntimeConfig = serde_json::from_value(counts).unwrap();
+            let first = HandleRuntime::new(Some(&config), None).unwrap();
+            let second = HandleRuntime::new(Some(&config), None).unwrap();
+            assert_eq!(first.handle().runtime_flavor(), RuntimeFlavor::MultiThread);
+            assert!(!std::ptr::eq(&*first, &*second));
+        }
+    }
+
+    #[test]
+    fn accepts_flavor_shorthand_and_options() {
+        let config: RuntimeConfig = serde_json::from_value(serde_json::json!("multi_thread")).unwrap();
+        let runtime = HandleRuntime::new(Some(&config), None).unwrap();
+        assert_eq!(runtime.handle().runtime_flavor(), RuntimeFlavor::MultiThread);
+
+        let config: RuntimeConfig =
+            serde_json::from_value(serde_json::json!({ "flavor": "shared", "workerThreads": 2 }))
+                .unwrap();
+        let first = HandleRuntime::new(Some(&config), None).unwrap();
+        let second = HandleRuntime::new(Some(&config), None).unwrap();
+        assert!(std::ptr::eq(&*first, &*second));
+    }
+
+    #[test]
+    fn turn_runs_spawned_tasks_on_current_thread() {
+        let runtime = HandleRuntime::new(None, None).unwrap();
+        let (tx, mut rx) = tokio::sync::oneshot::channel();
+        runtime.spawn(async move {
+            let _ = tx.send(7);
+        });
+        runtime.turn();
+        assert_eq!(rx.try_recv().ok(), Some(7));
+    }
+}
@@ -0,0 +1,320 @@
+//! The `adaptiveTake` option of streaming listings and exports.
+//!
+//! Instead of a fixed `take`, each page is sized from what earlier pages of
+//! the same aggregate type cost on this handle: the average encoded row size
+//! bounds a page to `targetBytes`, and the per-row share of the page latency
+//! (above the fastest page seen, which approximates the round trip) bounds it
+//! to `targetMs`. Both estimates are moving averages, so a type whose events
+//! grow is followed within a few pages. Takes stay within
+//! `minTake..=maxTake`, the latter standing in for the server's page limit.
+
+use std::{
+    collections::HashMap,
+    future::Future,
+    io::Write,
+    sync::{Arc, Mutex, PoisonError},
+    time::{Duration, Instant},
+};
+
+use serde::Deserialize;
+use serde_json::Value;
+
+use crate::reply::Reply;
+
+/// Take of the first page of a type when the call has no `take` of its own.
+const DEFAULT_INITIAL_TAKE: u64 = 100;
+/// Weight of the newest page in the moving averages.
+const ALPHA: f64 = 0.3;
+/// Rows serialized to estimate the row size of a page.
+const SAMPLED_ROWS: usize = 8;
+
+#[derive(Clone, Copy, Debug, Deserialize, PartialEq)]
+#[serde(rename_all = "camelCase", default)]
+pub(crate) struct AdaptiveTake {
+    target_bytes: u64,
+    target_ms: u64,
+    min_take: u64,
+    max_take: u64,
+}
+
+impl Default for AdaptiveTake {
+    fn default() -> Self {
+        AdaptiveTake {
+            target_bytes: 1024 * 1024,
+            target_ms: 20,
+            min_take: 10,
+            max_take: 1000,
+        }
+    }
+}
+
+impl AdaptiveTake {
+    /// Reads `adaptiveTake` (`true` or an object of targets) from call
+    /// options; `None` when absent or `false`.
+    pub(crate) fn from_options(options: &Value) -> Result<Option<AdaptiveTake>, String> {
+        match options.get("adaptiveTake") {
+            None | Some(Value::Null) | Some(Value::Bool(false)) => Ok(None),
+            Some(Value::Bool(true)) => Ok(Some(AdaptiveTake::default())),
+            Some(value) => serde_json::from_value(value.clone())
+                .map(Some)
+                .map_err(|e| format!("invalid adaptiveTake: {e}")),
+        }
+    }
+}
+
+#[derive(Clone, Copy, Debug)]
+struct RowStats {
+    row_bytes: f64,
+    /// Per-row latency above the floor; `None` until a page had a
+    /// measurable one, which then seeds the average.
+    row_us: Option<f64>,
+    /// Fastest page seen; the part of every page's latency not due to rows.
+    floor_us: f64,
+}
+
+/// What this handle has learned about page costs, per listing kind and
+/// aggregate type.
+#[derive(Default)]
+pub(crate) struct PageSizer {
+    stats: Mutex<HashMap<String, RowStats>>,
+}
+
+impl PageSizer {
+    pub(crate) fn new() -> Self {
+        PageSizer::default()
+    }
+
+    fn take(&self, key: &str, config: &AdaptiveTake, initial: u64) -> u64 {
+        let stats = self
+            .stats
+            .lock()
+            .unwrap_or_else(PoisonError::into_inner)
+            .get(key)
+            .copied();
+        let take = match stats {
+            None => initial,
+            Some(stats) => {
+                let by_bytes = config.target_bytes as f64 / stats.row_bytes.max(1.0);
+                let budget_us = config.target_ms as f64 * 1000.0 - stats.floor_us;
+                let by_latency = match stats.row_us {
+                    Some(row_us) if row_us > 0.0 && budget_us > 0.0 => budget_us / row_us,
+                    // no measurable per-row cost, or the round trip alone
+                    // exceeds the target: only the byte budget applies
+                    _ => f64::INFINITY,
+                };
+                by_bytes.min(by_latency) as u64
+            }
+        };
+        take.clamp(
+            config.min_take.max(1),
+            config.max_take.max(config.min_take.max(1)),
+        )
+    }
+
+    fn observe(&self, key: &str, rows: usize, row_bytes: f64, elapsed: Duration) {
+        if rows == 0 {
+            return;
+        }
+        let elapsed_us = elapsed.as_secs_f64() * 1_000_000.0;
+        let mut stats = self.stats.lock().unwrap_or_else(PoisonError::into_inner);
+        match stats.get_mut(key) {
+            None => {
+                stats.insert(
+                    key.to_string(),
+                    RowStats {
+                        row_bytes,
+                        row_us: None,
+                        floor_us: elapsed_us,
+                    },
+                );
+            }
+            Some(stats) => {
+                stats.floor_us = stats.floor_us.min(elapsed_us);
+                let row_us = (elapsed_us - stats.floor_us) / rows as f64;
+                stats.row_bytes += ALPHA * (row_bytes - stats.row_bytes);
+                stats.row_us = match stats.row_us {
+                    Some(average) => Some(average + ALPHA * (row_us - average)),
+                    None if row_us > 0.0 => Some(row_us),
+                    None => None,
+                };
+            }
+        }
+    }
+}
+
+/// Adaptive sizing of one listing: the pages of `kind` (`events` or
+/// `aggregates`) for one aggregate type.
+pub(crate) struct Adaptive {
+    sizer: Arc<PageSizer>,
+    key: String,
+    config: AdaptiveTake,
+    initial: u64,
+}
+
+impl Adaptive {
+    /// `initial` is the caller's own `take`, used until a page was observed.
+    pub(crate) fn new(
+        sizer: Arc<PageSizer>,
+        kind: &str,
+        agg_type: &str,
+        config: AdaptiveTake,
+        initial: Option<u64>,
+    ) -> Self {
+        Adaptive {
+            sizer,
+            key: format!("{kind}:{agg_type}"),
+            config,
+            initial: initial.unwrap_or(DEFAULT_INITIAL_TAKE),
+        }
+    }
+
+    /// Take of the next page.
+    pub(crate) fn take(&self) -> u64 {
+        self.sizer.take(&self.key, &self.config, self.initial)
+    }
+
+    /// Learns from a fetched page and the time it took.
+    pub(crate) fn observe(&self, page: &Result<Reply, String>, elapsed: Duration) {
+        if let Ok(Reply::Page {
+            items: Value::Array(rows),
+            ..
+        }) = page
+        {
+            if let Some(row_bytes) = sample_row_bytes(rows) {
+                self.sizer
+                    .observe(&self.key, rows.len(), row_bytes, elapsed);
+            }
+        }
+    }
+}
+
+/// Awaits `page`, learning from it when the listing is sized adaptively.
+pub(crate) async fn observed<F>(adaptive: Option<Arc<Adaptive>>, page: F) -> Result<Reply, String>
+where
+    F: Future<Output = Result<Reply, String>>,
+{
+    let started = Instant::now();
+    let page = page.await;
+    if let Some(adaptive) = adaptive {
+        adaptive.observe(&page, started.elapsed());
+    }
+    page
+}
+
+/// Average encoded size of up to `SAMPLED_ROWS` evenly spaced rows, so that
+/// sizing does not serialize whole pages twice.
+fn sample_row_bytes(rows: &[Value]) -> Option<f64> {
+    if rows.is_empty() {
+        return None;
+    }
+    let step = rows.len().div_ceil(SAMPLED_ROWS);
+    let mut counter = Counter(0);
+    let mut sampled = 0;
+    for row in rows.iter().step_by(step) {
+        serde_json::to_writer(&mut counter, row).ok()?;
+        sampled += 1;
+    }
+    Some(counter.0 as f64 / sampled as f64)
+}
+
+struct Counter(usize);
+
+impl Write for Counter {
+    fn write(&mut self, buf: &[u8]) -> std::io::Result<usize> {
+        self.0 += buf.len();
+        Ok(buf.len())
+    }
+
+    fn flush(&mut self) -> std::io::Result<()> {
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use serde_json::json;
+
+    use super::*;
+
+    fn page(rows: usize, bytes: usize) -> Result<Reply, String> {
+        Ok(Reply::Page {
+            // each row encodes to `bytes`: {"b":"…"} is 8 bytes of framing
+            items: Value::Array(vec![json!({ "b": "x".repeat(bytes - 8) }); rows]),
+            next_cursor: None,
+        })
+    }
+
+    fn adaptive(config: AdaptiveTake) -> Adaptive {
+        Adaptive::new(Arc::new(PageSizer::new()), "events", "person", config, None)
+    }
+
+    #[test]
+    fn options_accept_true_or_targets() {
+        assert_eq!(AdaptiveTake::from_options(&json!({})).unwrap(), None);
+        assert_eq!(
+            AdaptiveTake::from_options(&json!({ "adaptiveTake": false })).unwrap(),
+            None
+        );
+        assert_eq!(
+            AdaptiveTake::from_options(&json!({ "adaptiveTake": true })).unwrap(),
+            Some(AdaptiveTake::default())
+        );
+        let config =
+            AdaptiveTake::from_options(&json!({ "adaptiveTake": { "targetBytes": 4096 } }))
+                .unwrap()
+                .unwrap();
+        assert_eq!(config.target_bytes, 4096);
+        assert_eq!(config.max_take, 1000);
+        assert!(AdaptiveTake::from_options(&json!({ "adaptiveTake": "big" })).is_err());
+    }
+
+    #[test]
+    fn pages_fill_the_byte_budget() {
+        let sizing = adaptive(AdaptiveTake {
+            target_bytes: 100 * 1000,
+            ..AdaptiveTake::default()
+        });
+        assert_eq!(sizing.take(), DEFAULT_INITIAL_TAKE);
+
+        sizing.observe(&page(50, 1000), Duration::from_millis(5));
+        assert_eq!(sizing.take(), 100);
+
+        // huge events shrink pages, clamped at minTake
+        let sizing = adaptive(AdaptiveTake::default());
+        sizing.observe(&page(10, 1024 * 1024), Duration::from_millis(5));
+        assert_eq!(sizing.take(), 10);
+
+        // tiny events grow them, clamped at maxTake
+        let tiny = adaptive(AdaptiveTake::default());
+        tiny.observe(&page(100, 16), Duration::from_millis(5));
+        assert_eq!(tiny.take(), 1000);
+    }
+
+    #[test]
+    fn latency_above_the_round_trip_bounds_pages() {
+        let sizing = adaptive(AdaptiveTake {
+            target_ms: 20,
+            ..AdaptiveTake::default()
+        });
+        // 5 ms round trip, then 100 rows costing 0.1 ms each
+        sizing.observe(&page(1, 100), Duration::from_millis(5));
+        sizing.observe(&page(100, 100), Duration::from_millis(15));
+        // the first measurable cost seeds the average: (20 - 5) ms / 100 us
+        assert_eq!(sizing.take(), 150);
+
+        // later pages move it by ALPHA: 100 + 0.3 * (200 - 100) = 130 us
+        sizing.observe(&page(100, 100), Duration::from_millis(25));
+        assert_eq!(sizing.take(), (15_000.0 / 130.0) as u64);
+    }
+
+    #[test]
+    fn types_are_learned_separately() {
+        let sizer = Arc::new(PageSizer::new());
+        let config = AdaptiveTake::default();
+        let people = Adaptive::new(sizer.clone(), "events", "person", config, Some(50));
+        let orders = Adaptive::new(sizer, "events", "order", config, Some(50));
+        people.observe(&page(10, 100 * 1024), Duration::from_millis(5));
+        assert_eq!(people.take(), 10);
+        assert_eq!(orders.take(), 50);
+    }
+}
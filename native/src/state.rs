@@ -0,0 +1,153 @@
+//! Aggregate reconstruction from the latest snapshot plus the events after it.
+//!
+//! `dbx_load_state` lists the aggregate's snapshots, keeps the one with the
+//! highest version and reads only the events recorded after that version,
+//! so loading a long-lived aggregate costs O(tail) rather than O(history).
+//! With `snapshotAfter: N`, a tail of N or more events also snapshots the
+//! aggregate, so the next load starts from the new snapshot.
+
+use eventdbx_client::{CreateSnapshotRequest, ListEventsOptions, ListSnapshotsOptions};
+use serde::Deserialize;
+use serde_json::Value;
+
+use crate::{
+    pool::{with_conn, Pool},
+    reply::Reply,
+};
+
+#[derive(Default, Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct LoadStateOptions {
+    token: Option<String>,
+    /// Page size used while reading the tail.
+    events_take: Option<u64>,
+    /// Snapshot the aggregate once the tail reaches this many events.
+    snapshot_after: Option<u64>,
+    /// Comment stored with snapshots taken through `snapshot_after`.
+    snapshot_comment: Option<String>,
+}
+
+impl LoadStateOptions {
+    pub(crate) fn parse(value: Value) -> Result<Self, String> {
+        match value {
+            Value::Null => Ok(LoadStateOptions::default()),
+            value => serde_json::from_value(value)
+                .map_err(|e| format!("invalid load state options: {e}")),
+        }
+    }
+}
+
+/// Aggregate version recorded on a snapshot or event row.
+pub(crate) fn version_of(row: &Value) -> Option<u64> {
+    ["version", "aggregateVersion", "aggregate_version"]
+        .iter()
+        .find_map(|key| row.get(key).and_then(Value::as_u64))
+}
+
+/// The snapshot with the highest version; the last row when none carries
+/// a version.
+fn latest(snapshots: Value) -> Option<Value> {
+    let Value::Array(rows) = snapshots else {
+        return None;
+    };
+    if rows.iter().any(|row| version_of(row).is_some()) {
+        rows.into_iter()
+            .max_by_key(|row| version_of(row).unwrap_or(0))
+    } else {
+        rows.into_iter().last()
+    }
+}
+
+pub(crate) async fn load_state(
+    pool: &Pool,
+    agg_type: String,
+    agg_id: String,
+    options: LoadStateOptions,
+) -> Result<Reply, String> {
+    let mut listing = ListSnapshotsOptions::default();
+    listing.aggregate_type = Some(agg_type.clone());
+    listing.aggregate_id = Some(agg_id.clone());
+    listing.token = options.token.clone();
+    let snapshots = with_conn!(pool, |conn| conn.list_snapshots(listing)).await?;
+    let snapshot = latest(snapshots.snapshots);
+    let after = snapshot.as_ref().and_then(version_of);
+
+    let (events_type, events_id) = (agg_type.as_str(), agg_id.as_str());
+    let mut tail = Vec::new();
+    let mut cursor = None;
+    loop {
+        let mut opts = ListEventsOptions::default();
+        opts.cursor = cursor.take();
+        opts.take = options.events_take;
+        opts.token = options.token.clone();
+        opts.filter = after.map(|version| format!("version > {version}"));
+        let page = with_conn!(pool, |conn| conn.list_events(events_type, events_id, opts)).await?;
+        if let Value::Array(events) = page.events {
+            // the version check also keeps the tail exact if the filter is ignored
+            tail.extend(
+                events
+                    .into_iter()
+                    .filter(|event| match (after, version_of(event)) {
+                        (Some(after), Some(version)) => version > after,
+                        _ => true,
+                    }),
+            );
+        }
+        match page.next_cursor.filter(|c| !c.is_empty()) {
+            Some(next) => cursor = Some(next),
+            None => break,
+        }
+    }
+
+    // The load itself succeeded, so a failed snapshot is reported, not raised.
+    let (created_snapshot, snapshot_error) = match options.snapshot_after {
+        Some(limit) if limit > 0 && tail.len() as u64 >= limit => {
+            let mut request = CreateSnapshotRequest::new(agg_type, agg_id);
+            request.comment = options.snapshot_comment;
+            request.token = options.token;
+            match with_conn!(pool, |conn| conn.create_snapshot(request)).await {
+                Ok(response) => (Some(response.snapshot), None),
+                Err(err) => (None, Some(err)),
+            }
+        }
+        _ => (None, None),
+    };
+
+    Ok(Reply::State {
+        snapshot: snapshot.unwrap_or(Value::Null),
+        tail_events: Value::Array(tail),
+        created_snapshot,
+        snapshot_error,
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use serde_json::json;
+
+    use super::*;
+
+    #[test]
+    fn latest_snapshot_is_the_highest_version() {
+        let rows = json!([
+            { "id": 1, "version": 10 },
+            { "id": 3, "aggregateVersion": 40 },
+            { "id": 2, "version": 25 },
+        ]);
+        assert_eq!(latest(rows).unwrap()["id"], 3);
+        assert_eq!(latest(json!([{ "id": 1 }, { "id": 2 }])).unwrap()["id"], 2);
+        assert!(latest(json!([])).is_none());
+        assert!(latest(Value::Null).is_none());
+    }
+
+    #[test]
+    fn options_default_from_null_and_reject_bad_types() {
+        let options = LoadStateOptions::parse(Value::Null).unwrap();
+        assert!(options.snapshot_after.is_none());
+        let options =
+            LoadStateOptions::parse(json!({ "snapshotAfter": 500, "eventsTake": 200 })).unwrap();
+        assert_eq!(options.snapshot_after, Some(500));
+        assert_eq!(options.events_take, Some(200));
+        assert!(LoadStateOptions::parse(json!({ "snapshotAfter": "often" })).is_err());
+    }
+}
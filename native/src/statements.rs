@@ -0,0 +1,300 @@
+//! Prepared calls behind `dbx_prepare` / `dbx_execute`.
+//!
+//! A statement keeps the parsed form of one options object (filter, sort,
+//! fields, page size, token, publish targets and payload defaults), so repeated
+//! calls only pass what varies: the aggregate id, a cursor and the payload.
+//! Client request types cannot be cloned, so each execution assembles a
+//! fresh one from the cached parts; that costs a few string copies instead
+//! of a JSON parse and a round of key lookups.
+
+use std::{
+    collections::HashMap,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc, Mutex, MutexGuard, PoisonError,
+    },
+};
+
+use eventdbx_client::{
+    AppendEventRequest, ListAggregatesOptions, ListEventsOptions, PublishTarget,
+};
+use serde_json::{Map, Value};
+
+use crate::{
+    parse_list_aggregates_options, parse_list_events_options, parse_payload_options,
+    parse_sort_fields, projection::Projection, SortField,
+};
+
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub(crate) enum Operation {
+    /// `dbx_list_aggregates`; executions take a cursor.
+    List,
+    /// `dbx_list_events`; executions take an aggregate id and a cursor.
+    Events,
+    /// `dbx_append_event`; executions take an aggregate id and a payload.
+    Apply,
+}
+
+impl Operation {
+    fn parse(name: &str) -> Result<Operation, String> {
+        match name {
+            "list" => Ok(Operation::List),
+            "events" => Ok(Operation::Events),
+            "apply" => Ok(Operation::Apply),
+            other => Err(format!(
+                "unsupported operation '{other}' (expected list, events or apply)"
+            )),
+        }
+    }
+}
+
+struct Target {
+    plugin: String,
+    mode: Option<String>,
+    priority: Option<String>,
+}
+
+pub(crate) struct Statement {
+    pub(crate) operation: Operation,
+    pub(crate) aggregate_type: String,
+    event_type: String,
+    take: Option<u64>,
+    filter: Option<String>,
+    include_archived: bool,
+    archived_only: bool,
+    token: Option<String>,
+    sort: Vec<(SortField, bool)>,
+    pub(crate) projection: Option<Arc<Projection>>,
+    payload: Value,
+    note: Option<String>,
+    metadata: Option<Value>,
+    publish_targets: Vec<Target>,
+}
+
+impl Statement {
+    /// Parses `options` the same way the matching one-shot export does.
+    /// `apply` statements also need `eventType` in `options`.
+    pub(crate) fn prepare(
+        operation: &str,
+        aggregate_type: String,
+        options: Value,
+    ) -> Result<Statement, String> {
+        let operation = Operation::parse(operation)?;
+        let mut statement = Statement {
+            operation,
+            aggregate_type,
+            event_type: String::new(),
+            take: None,
+            filter: None,
+            include_archived: false,
+            archived_only: false,
+            token: None,
+            sort: Vec::new(),
+            projection: None,
+            payload: Value::Object(Map::new()),
+            note: None,
+            metadata: None,
+            publish_targets: Vec::new(),
+        };
+        match operation {
+            Operation::List => {
+                let agg_type = Some(statement.aggregate_type.clone()).filter(|t| !t.is_empty());
+                let opts = parse_list_aggregates_options(agg_type, &options);
+                statement.take = opts.take;
+                statement.filter = opts.filter;
+                statement.include_archived = opts.include_archived;
+                statement.archived_only = opts.archived_only;
+                statement.token = opts.token;
+                statement.sort = parse_sort_fields(options.get("sort"));
+                statement.projection = Projection::from_options(&options)?;
+            }
+            Operation::Events => {
+                let opts = parse_list_events_options(&options);
+                statement.take = opts.take;
+                statement.filter = opts.filter;
+                statement.token = opts.token;
+                statement.projection = Projection::from_options(&options)?;
+            }
+            Operation::Apply => {
+                statement.event_type = options
+                    .get("eventType")
+                    .and_then(Value::as_str)
+                    .map(str::to_string)
+                    .ok_or_else(|| "eventType is required for apply statements".to_string())?;
+                let (payload, note, metadata, token, targets) = parse_payload_options(options);
+                if !payload.is_null() {
+                    statement.payload = payload;
+                }
+                statement.note = note;
+                statement.metadata = metadata;
+                statement.token = token;
+                statement.publish_targets = targets
+                    .into_iter()
+                    .map(|target| Target {
+                        plugin: target.plugin,
+                        mode: target.mode,
+                        priority: target.priority,
+                    })
+                    .collect();
+            }
+        }
+        Ok(statement)
+    }
+
+    pub(crate) fn list_options(&self, cursor: Option<String>) -> ListAggregatesOptions {
+        let mut opts = ListAggregatesOptions::default();
+        opts.cursor = cursor;
+        opts.take = self.take;
+        opts.filter = self.filter.clone();
+        opts.include_archived = self.include_archived;
+        opts.archived_only = self.archived_only;
+        opts.token = self.token.clone();
+        opts.sort = self
+            .sort
+            .iter()
+            .map(|(field, descending)| field.sort(*descending))
+            .collect();
+        opts
+    }
+
+    pub(crate) fn events_options(&self, cursor: Option<String>) -> ListEventsOptions {
+        let mut opts = ListEventsOptions::default();
+        opts.cursor = cursor;
+        opts.take = self.take;
+        opts.filter = self.filter.clone();
+        opts.token = self.token.clone();
+        opts
+    }
+
+    /// Append request for `aggregate_id`; a null `payload` uses the one
+    /// given at prepare time (or `{}`).
+    pub(crate) fn append_request(
+        &self,
+        aggregate_id: String,
+        payload: Value,
+    ) -> AppendEventRequest {
+        let payload = match payload {
+            Value::Null => self.payload.clone(),
+            other => other,
+        };
+        let mut request = AppendEventRequest::new(
+            self.aggregate_type.clone(),
+            aggregate_id,
+            self.event_type.clone(),
+            payload,
+        );
+        request.note = self.note.clone();
+        request.metadata = self.metadata.clone();
+        request.token = self.token.clone();
+        request.publish_targets = self
+            .publish_targets
+            .iter()
+            .map(|target| {
+                let mut built = PublishTarget::new(target.plugin.clone());
+                built.mode = target.mode.clone();
+                built.priority = target.priority.clone();
+                built
+            })
+            .collect();
+        request
+    }
+}
+
+/// Statements prepared on one handle, by id.
+pub(crate) struct Statements {
+    next: AtomicU64,
+    prepared: Mutex<HashMap<u64, Arc<Statement>>>,
+}
+
+impl Statements {
+    pub(crate) fn new() -> Self {
+        Statements {
+            next: AtomicU64::new(1),
+            prepared: Mutex::new(HashMap::new()),
+        }
+    }
+
+    fn lock(&self) -> MutexGuard<'_, HashMap<u64, Arc<Statement>>> {
+        self.prepared.lock().unwrap_or_else(PoisonError::into_inner)
+    }
+
+    /// Stores `statement` and returns its id (never 0).
+    pub(crate) fn insert(&self, statement: Statement) -> u64 {
+        let id = self.next.fetch_add(1, Ordering::Relaxed);
+        self.lock().insert(id, Arc::new(statement));
+        id
+    }
+
+    pub(crate) fn get(&self, id: u64) -> Result<Arc<Statement>, String> {
+        self.lock()
+            .get(&id)
+            .cloned()
+            .ok_or_else(|| format!("unknown statement {id}"))
+    }
+
+    pub(crate) fn remove(&self, id: u64) {
+        self.lock().remove(&id);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn list_statement_bakes_type_filter_and_sort() {
+        let statement = Statement::prepare(
+            "list",
+            "person".to_string(),
+            serde_json::json!({ "take": 25, "sort": "created_at:desc, id", "archivedOnly": true }),
+        )
+        .unwrap();
+        let opts = statement.list_options(Some("c-2".to_string()));
+        assert_eq!(opts.cursor.as_deref(), Some("c-2"));
+        assert_eq!(opts.take, Some(25));
+        assert_eq!(opts.filter.as_deref(), Some("aggregate_type = \"person\""));
+        assert!(opts.archived_only);
+        assert_eq!(opts.sort.len(), 2);
+        assert!(opts.sort[0].descending);
+        assert!(!opts.sort[1].descending);
+    }
+
+    #[test]
+    fn apply_statement_requires_event_type_and_reuses_payload() {
+        let err = Statement::prepare("apply", "person".to_string(), serde_json::json!({}));
+        assert_eq!(
+            err.err().as_deref(),
+            Some("eventType is required for apply statements")
+        );
+
+        let statement = Statement::prepare(
+            "apply",
+            "person".to_string(),
+            serde_json::json!({
+                "eventType": "renamed",
+                "note": "bulk",
+                "publishTargets": [{ "plugin": "search", "mode": "async" }],
+            }),
+        )
+        .unwrap();
+        let request = statement.append_request("p-1".to_string(), Value::Null);
+        assert_eq!(request.note.as_deref(), Some("bulk"));
+        assert_eq!(request.publish_targets.len(), 1);
+        assert_eq!(request.publish_targets[0].mode.as_deref(), Some("async"));
+    }
+
+    #[test]
+    fn unknown_operations_and_ids_are_rejected() {
+        assert!(Statement::prepare("delete", String::new(), Value::Null).is_err());
+
+        let statements = Statements::new();
+        let id = statements
+            .insert(Statement::prepare("events", "person".to_string(), Value::Null).unwrap());
+        assert_eq!(statements.get(id).unwrap().operation, Operation::Events);
+        statements.remove(id);
+        assert_eq!(
+            statements.get(id).err(),
+            Some(format!("unknown statement {id}"))
+        );
+    }
+}
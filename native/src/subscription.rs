@@ -0,0 +1,387 @@
+//! Change feeds behind `dbx_subscribe`.
+//!
+//! The control protocol has no push subscription, so the feed is driven from
+//! inside the runtime instead of from PHP: one task per subscription polls
+//! every watched aggregate for events after the last version it delivered,
+//! all aggregates concurrently over the handle's pool, and queues new events
+//! in a bounded buffer. PHP drains it in batches with
+//! `dbx_subscription_next_batch` and can wait on `dbx_subscription_fd`,
+//! which turns readable when events arrive. A full buffer pauses polling
+//! until the caller catches up, so memory stays bounded.
+//!
+//! A feed without `fromVersion` is not polled until its aggregate's current
+//! version has been read; a failure there is reported like a failed poll
+//! and retried every round, so an outage at subscribe time never replays
+//! the whole history. Once the task has ended, `next_batch` fails instead of
+//! returning empty batches.
+
+use std::{sync::Arc, time::Duration};
+
+use eventdbx_client::ListEventsOptions;
+use futures::future::join_all;
+use serde::Deserialize;
+use serde_json::Value;
+use tokio::{
+    runtime::Runtime,
+    sync::mpsc::{self, error::TrySendError},
+    task::JoinHandle,
+};
+
+use crate::{
+    pending::Notifier,
+    pool::{with_conn, Pool},
+    reply::{Reply, TaggedReply},
+    state::version_of,
+};
+
+const DEFAULT_INTERVAL_MS: u64 = 250;
+const DEFAULT_BUFFER: usize = 1024;
+
+#[derive(Deserialize)]
+#[serde(rename_all = "camelCase")]
+struct Watch {
+    aggregate_type: String,
+    aggregate_id: String,
+    /// Deliver events after this version; defaults to the current version.
+    from_version: Option<u64>,
+}
+
+#[derive(Deserialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct SubscribeOptions {
+    aggregates: Vec<Watch>,
+    /// Pause between polling rounds (default 250).
+    interval_ms: Option<u64>,
+    /// Events buffered before polling pauses (default 1024).
+    buffer: Option<usize>,
+    /// Page size of each poll.
+    events_take: Option<u64>,
+    token: Option<String>,
+}
+
+impl SubscribeOptions {
+    pub(crate) fn parse(value: Value) -> Result<Self, String> {
+        let options: SubscribeOptions = serde_json::from_value(value)
+            .map_err(|e| format!("invalid subscription filter: {e}"))?;
+        if options.aggregates.is_empty() {
+            return Err("subscription filter needs at least one aggregate".to_string());
+        }
+        Ok(options)
+    }
+}
+
+struct Feed {
+    aggregate_type: String,
+    aggregate_id: String,
+    after: Option<u64>,
+    /// False until the start version is known (given or read).
+    started: bool,
+    /// Set after a failed poll, so an outage is reported once, not per round.
+    failing: bool,
+}
+
+impl Feed {
+    fn tag(&self, reply: Reply) -> TaggedReply {
+        TaggedReply {
+            aggregate_type: self.aggregate_type.clone(),
+            aggregate_id: self.aggregate_id.clone(),
+            reply,
+        }
+    }
+
+    /// The error as a change the first time in a row it happens.
+    fn failed(&mut self, error: String) -> Vec<TaggedReply> {
+        let report = !self.failing;
+        self.failing = true;
+        if report {
+            vec![self.tag(Reply::Failed { error })]
+        } else {
+            Vec::new()
+        }
+    }
+}
+
+pub struct Subscription {
+    changes: mpsc::Receiver<TaggedReply>,
+    notifier: Arc<Notifier>,
+    task: JoinHandle<()>,
+}
+
+impl Subscription {
+    pub(crate) fn start(
+        runtime: &Runtime,
+        pool: Arc<Pool>,
+        options: SubscribeOptions,
+    ) -> Result<Self, String> {
+        let notifier = Arc::new(Notifier::new()?);
+        let (tx, changes) = mpsc::channel(options.buffer.unwrap_or(DEFAULT_BUFFER).max(1));
+        let task = runtime.spawn(run(pool, options, tx, notifier.clone()));
+        Ok(Subscription {
+            changes,
+            notifier,
+            task,
+        })
+    }
+
+    pub(crate) fn fd(&self) -> i32 {
+        self.notifier.fd()
+    }
+
+    /// Up to `max` buffered changes, waiting up to `timeout` (forever when
+    /// `None`) for the first one. An empty batch means nothing arrived; an
+    /// error means the feed has ended and nothing is left to drain.
+    pub(crate) fn next_batch(
+        &mut self,
+        runtime: &Runtime,
+        max: usize,
+        timeout: Option<Duration>,
+    ) -> Result<Reply, String> {
+        self.notifier.drain();
+        let changes = &mut self.changes;
+        let first = runtime.block_on(async {
+            match timeout {
+                Some(timeout) => tokio::time::timeout(timeout, changes.recv()).await,
+                None => Ok(changes.recv().await),
+            }
+        });
+        let mut items: Vec<TaggedReply> = match first {
+            Ok(Some(change)) => vec![change],
+            Ok(None) => return Err("subscription has ended".to_string()),
+            Err(_) => Vec::new(),
+        };
+        while items.len() < max.max(1) {
+            match self.changes.try_recv() {
+                Ok(change) => items.push(change),
+                Err(_) => break,
+            }
+        }
+        if !self.changes.is_empty() {
+            // more than `max` were buffered: stay readable for the rest
+            self.notifier.signal();
+        }
+        Ok(Reply::Refs { items })
+    }
+}
+
+impl Drop for Subscription {
+    fn drop(&mut self) {
+        self.task.abort();
+    }
+}
+
+async fn run(
+    pool: Arc<Pool>,
+    options: SubscribeOptions,
+    tx: mpsc::Sender<TaggedReply>,
+    notifier: Arc<Notifier>,
+) {
+    let interval = Duration::from_millis(options.interval_ms.unwrap_or(DEFAULT_INTERVAL_MS));
+    let token = options.token;
+    let mut feeds: Vec<Feed> = options
+        .aggregates
+        .into_iter()
+        .map(|watch| Feed {
+            aggregate_type: watch.aggregate_type,
+            aggregate_id: watch.aggregate_id,
+            after: watch.from_version,
+            started: watch.from_version.is_some(),
+            failing: false,
+        })
+        .collect();
+
+    loop {
+        let rounds = join_all(
+            feeds
+                .iter_mut()
+                .map(|feed| advance(&pool, feed, options.events_take, token.clone())),
+        )
+        .await;
+        let mut delivered = false;
+        for change in rounds.into_iter().flatten() {
+            match tx.try_send(change) {
+                Ok(()) => {}
+                Err(TrySendError::Full(change)) => {
+                    // wake the reader before waiting for room
+                    notifier.signal();
+                    if tx.send(change).await.is_err() {
+                        return;
+                    }
+                }
+                Err(TrySendError::Closed(_)) => return,
+            }
+            delivered = true;
+        }
+        if delivered {
+            notifier.signal();
+        }
+        tokio::time::sleep(interval).await;
+    }
+}
+
+/// One round of `feed`: reads its start version while it has none, then
+/// polls it.
+async fn advance(
+    pool: &Pool,
+    feed: &mut Feed,
+    take: Option<u64>,
+    token: Option<String>,
+) -> Vec<TaggedReply> {
+    if !feed.started {
+        if let Err(error) = start_version(pool, feed).await {
+            return feed.failed(error);
+        }
+    }
+    poll(pool, feed, take, token).await
+}
+
+/// Starts a feed at the aggregate's current version, so only new events
+/// are delivered; an aggregate without one is followed from the start.
+async fn start_version(pool: &Pool, feed: &mut Feed) -> Result<(), String> {
+    let (t, id) = (feed.aggregate_type.as_str(), feed.aggregate_id.as_str());
+    let response = with_conn!(pool, |conn| conn.get_aggregate(t, id)).await?;
+    feed.after = response.aggregate.as_ref().and_then(version_of);
+    feed.started = true;
+    Ok(())
+}
+
+/// Events of `feed` after its last delivered version, advancing it.
+async fn poll(
+    pool: &Pool,
+    feed: &mut Feed,
+    take: Option<u64>,
+    token: Option<String>,
+) -> Vec<TaggedReply> {
+    let (agg_type, agg_id) = (feed.aggregate_type.clone(), feed.aggregate_id.clone());
+    let (t, id) = (agg_type.as_str(), agg_id.as_str());
+    let mut opts = ListEventsOptions::default();
+    opts.take = take;
+    opts.token = token;
+    opts.filter = feed.after.map(|version| format!("version > {version}"));
+    let events = match with_conn!(pool, |conn| conn.list_events(t, id, opts)).await {
+        Ok(page) => page.events,
+        Err(error) => return feed.failed(error),
+    };
+    feed.failing = false;
+    let Value::Array(events) = events else {
+        return Vec::new();
+    };
+
+    let mut changes = Vec::with_capacity(events.len());
+    let mut after = feed.after;
+    for event in events {
+        let version = version_of(&event);
+        if let (Some(version), Some(seen)) = (version, after) {
+            if version <= seen {
+                continue;
+            }
+        }
+        after = Some(version.unwrap_or_else(|| after.map_or(1, |seen| seen + 1)));
+        changes.push(feed.tag(Reply::Event { event }));
+    }
+    feed.after = after;
+    changes
+}
+
+#[cfg(test)]
+mod tests {
+    use serde_json::json;
+
+    use super::*;
+
+    #[test]
+    fn filter_needs_aggregates() {
+        let options = SubscribeOptions::parse(json!({
+            "aggregates": [{ "aggregateType": "person", "aggregateId": "p-1", "fromVersion": 3 }],
+            "intervalMs": 50,
+        }))
+        .unwrap();
+        assert_eq!(options.aggregates[0].from_version, Some(3));
+        assert_eq!(options.interval_ms, Some(50));
+
+        let err = SubscribeOptions::parse(json!({ "aggregates": [] })).err();
+        assert_eq!(
+            err.as_deref(),
+            Some("subscription filter needs at least one aggregate")
+        );
+        assert!(SubscribeOptions::parse(Value::Null).is_err());
+    }
+
+    #[test]
+    fn next_batch_collects_up_to_max_and_times_out_empty() {
+        let runtime = Runtime::new().unwrap();
+        let (tx, changes) = mpsc::channel(8);
+        let mut subscription = Subscription {
+            changes,
+            notifier: Arc::new(Notifier::new().unwrap()),
+            task: runtime.spawn(async {}),
+        };
+        for n in 0..3 {
+            tx.try_send(TaggedReply {
+                aggregate_type: "person".to_string(),
+                aggregate_id: format!("p-{n}"),
+                reply: Reply::Event {
+                    event: json!({ "version": n }),
+                },
+            })
+            .unwrap();
+        }
+
+        let Ok(Reply::Refs { items }) = subscription.next_batch(&runtime, 2, Some(Duration::ZERO))
+        else {
+            panic!("expected a batch");
+        };
+        assert_eq!(items.len(), 2);
+        let Ok(Reply::Refs { items }) = subscription.next_batch(&runtime, 10, Some(Duration::ZERO))
+        else {
+            panic!("expected a batch");
+        };
+        assert_eq!(items[0].aggregate_id, "p-2");
+        let Ok(Reply::Refs { items }) =
+            subscription.next_batch(&runtime, 10, Some(Duration::from_millis(5)))
+        else {
+            panic!("expected a batch");
+        };
+        assert!(items.is_empty());
+
+        // the feed task has gone: report it instead of empty batches
+        drop(tx);
+        let err = subscription.next_batch(&runtime, 10, None).err();
+        assert_eq!(err.as_deref(), Some("subscription has ended"));
+    }
+
+    #[test]
+    fn unknown_start_versions_are_retried_not_replayed() {
+        let runtime = Runtime::new().unwrap();
+        let cfg = serde_json::from_value(json!({
+            "host": "db.invalid",
+            "token": "t",
+            "lazyConnect": true,
+        }))
+        .unwrap();
+        let pool = runtime
+            .block_on(Pool::connect(cfg, Arc::new(crate::metrics::Metrics::new())))
+            .unwrap();
+        let mut feed = Feed {
+            aggregate_type: "person".to_string(),
+            aggregate_id: "p-1".to_string(),
+            after: None,
+            started: false,
+            failing: false,
+        };
+
+        let first = runtime.block_on(advance(&pool, &mut feed, None, None));
+        assert!(matches!(
+            first[..],
+            [TaggedReply {
+                reply: Reply::Failed { .. },
+                ..
+            }]
+        ));
+        // still waiting for its start version, and the outage is reported once
+        assert!(!feed.started);
+        assert!(runtime
+            .block_on(advance(&pool, &mut feed, None, None))
+            .is_empty());
+        assert!(!feed.started);
+    }
+}
@@ -0,0 +1,342 @@
+//! Length-aware variants of the data-path exports (the `_v2` ABI).
+//!
+//! Every string argument is a `(ptr, len)` pair borrowed for the duration of
+//! the call: no `strlen` scan, and embedded NULs are allowed. Responses come
+//! back as a `DbxBuf` carrying their own length, so PHP reads them with
+//! `FFI::string($buf->ptr, $buf->len)` instead of scanning for a terminator,
+//! and MessagePack replies need no length prefix. Buffers released with
+//! `dbx_buf_release` are reused for later replies on the same handle. Calls
+//! record metrics under the name of the matching v1 export.
+
+use std::os::raw::c_char;
+
+use serde_json::Value;
+
+use crate::{
+    append_event_payload, build_append_request, bytes_from_ptr, check_handle, clear_error,
+    cursor::Cursor,
+    get_aggregate_payload, list_aggregates_payload, list_events_payload,
+    metrics::{Call, Op},
+    parse_fields, parse_json_bytes, parse_list_aggregates_options, parse_list_events_options,
+    projection::Projection,
+    reject,
+    reply::DbxBuf,
+    select_aggregate_payload, set_error, DbxHandle,
+};
+
+/// `len` bytes at `ptr` as UTF-8 text; null reads as empty.
+pub(crate) fn text(ptr: *const c_char, len: usize) -> Result<String, String> {
+    std::str::from_utf8(bytes_from_ptr(ptr, len))
+        .map(str::to_string)
+        .map_err(|e| format!("invalid utf-8: {e}"))
+}
+
+pub(crate) fn json(ptr: *const c_char, len: usize) -> Result<Value, String> {
+    parse_json_bytes(bytes_from_ptr(ptr, len))
+}
+
+/// Frees a buffer returned by a `_v2` export; an empty buffer is ignored.
+#[no_mangle]
+pub extern "C" fn dbx_buf_free(buf: DbxBuf) {
+    drop(unsafe { buf.into_vec() });
+}
+
+/// Returns a buffer to the pool of the handle that produced it, so a later
+/// reply can reuse the allocation (see `outputBuffers`). Equivalent to
+/// `dbx_buf_free` when the handle is unusable.
+#[no_mangle]
+pub extern "C" fn dbx_buf_release(handle: *mut DbxHandle, buf: DbxBuf) {
+    let Some(buf) = (unsafe { buf.into_vec() }) else {
+        return;
+    };
+    if check_handle(handle).is_ok() {
+        unsafe { &*handle }.buffers.give(buf);
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn dbx_list_aggregates_v2(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_type_len: usize,
+    options_json: *const c_char,
+    options_json_len: usize,
+    error_out: *mut *mut c_char,
+) -> DbxBuf {
+    let call = Call::start(Op::ListAggregates);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return DbxBuf::EMPTY;
+    }
+    let agg_type = match text(aggregate_type, aggregate_type_len) {
+        Ok(s) if s.is_empty() => None,
+        Ok(s) => Some(s),
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return DbxBuf::EMPTY;
+        }
+    };
+    let opts_value = match json(options_json, options_json_len) {
+        Ok(v) => v,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return DbxBuf::EMPTY;
+        }
+    };
+    let projection = match Projection::from_options(&opts_value) {
+        Ok(p) => p,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return DbxBuf::EMPTY;
+        }
+    };
+    let opts = parse_list_aggregates_options(agg_type, &opts_value);
+
+    let client = unsafe { &*handle };
+    client.respond_buf(
+        call,
+        client.runtime.block_on(list_aggregates_payload(
+            client.pool.clone(),
+            opts,
+            projection,
+        )),
+        error_out,
+    )
+}
+
+#[no_mangle]
+pub extern "C" fn dbx_get_aggregate_v2(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_type_len: usize,
+    aggregate_id: *const c_char,
+    aggregate_id_len: usize,
+    error_out: *mut *mut c_char,
+) -> DbxBuf {
+    let call = Call::start(Op::GetAggregate);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return DbxBuf::EMPTY;
+    }
+    let ids = text(aggregate_type, aggregate_type_len)
+        .and_then(|agg_type| Ok((agg_type, text(aggregate_id, aggregate_id_len)?)));
+    let (agg_type, agg_id) = match ids {
+        Ok(ids) => ids,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return DbxBuf::EMPTY;
+        }
+    };
+
+    let client = unsafe { &*handle };
+    client.respond_buf(
+        call,
+        client.runtime.block_on(get_aggregate_payload(
+            client.pool.clone(),
+            client.cache.clone(),
+            agg_type,
+            agg_id,
+        )),
+        error_out,
+    )
+}
+
+#[no_mangle]
+pub extern "C" fn dbx_select_aggregate_v2(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_type_len: usize,
+    aggregate_id: *const c_char,
+    aggregate_id_len: usize,
+    fields_json: *const c_char,
+    fields_json_len: usize,
+    error_out: *mut *mut c_char,
+) -> DbxBuf {
+    let call = Call::start(Op::SelectAggregate);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return DbxBuf::EMPTY;
+    }
+    let input = text(aggregate_type, aggregate_type_len).and_then(|agg_type| {
+        let agg_id = text(aggregate_id, aggregate_id_len)?;
+        let fields = parse_fields(json(fields_json, fields_json_len)?)?;
+        Ok((agg_type, agg_id, fields))
+    });
+    let (agg_type, agg_id, fields) = match input {
+        Ok(input) => input,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return DbxBuf::EMPTY;
+        }
+    };
+
+    let client = unsafe { &*handle };
+    client.respond_buf(
+        call,
+        client.runtime.block_on(select_aggregate_payload(
+            client.pool.clone(),
+            client.cache.clone(),
+            agg_type,
+            agg_id,
+            fields,
+        )),
+        error_out,
+    )
+}
+
+#[no_mangle]
+pub extern "C" fn dbx_list_events_v2(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_type_len: usize,
+    aggregate_id: *const c_char,
+    aggregate_id_len: usize,
+    options_json: *const c_char,
+    options_json_len: usize,
+    error_out: *mut *mut c_char,
+) -> DbxBuf {
+    let call = Call::start(Op::ListEvents);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return DbxBuf::EMPTY;
+    }
+    let input = text(aggregate_type, aggregate_type_len).and_then(|agg_type| {
+        let agg_id = text(aggregate_id, aggregate_id_len)?;
+        let opts_value = json(options_json, options_json_len)?;
+        let projection = Projection::from_options(&opts_value)?;
+        Ok((agg_type, agg_id, opts_value, projection))
+    });
+    let (agg_type, agg_id, opts_value, projection) = match input {
+        Ok(input) => input,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return DbxBuf::EMPTY;
+        }
+    };
+    let opts = parse_list_events_options(&opts_value);
+
+    let client = unsafe { &*handle };
+    client.respond_buf(
+        call,
+        client.runtime.block_on(list_events_payload(
+            client.pool.clone(),
+            agg_type,
+            agg_id,
+            opts,
+            projection,
+        )),
+        error_out,
+    )
+}
+
+#[no_mangle]
+pub extern "C" fn dbx_append_event_v2(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_type_len: usize,
+    aggregate_id: *const c_char,
+    aggregate_id_len: usize,
+    event_type: *const c_char,
+    event_type_len: usize,
+    options_json: *const c_char,
+    options_json_len: usize,
+    error_out: *mut *mut c_char,
+) -> DbxBuf {
+    let call = Call::start(Op::AppendEvent);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return DbxBuf::EMPTY;
+    }
+    let input = text(aggregate_type, aggregate_type_len).and_then(|agg_type| {
+        let agg_id = text(aggregate_id, aggregate_id_len)?;
+        let evt_type = text(event_type, event_type_len)?;
+        let opts_value = json(options_json, options_json_len)?;
+        Ok((agg_type, agg_id, evt_type, opts_value))
+    });
+    let (agg_type, agg_id, evt_type, opts_value) = match input {
+        Ok(input) => input,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return DbxBuf::EMPTY;
+        }
+    };
+
+    let request = build_append_request(agg_type.clone(), agg_id.clone(), evt_type, opts_value);
+    let client = unsafe { &*handle };
+    client.respond_buf(
+        call,
+        client.runtime.block_on(append_event_payload(
+            client.pool.clone(),
+            client.cache.clone(),
+            agg_type,
+            agg_id,
+            request,
+        )),
+        error_out,
+    )
+}
+
+/// Next page of a cursor; an empty buffer with no error means the cursor is
+/// exhausted.
+#[no_mangle]
+pub extern "C" fn dbx_cursor_next_v2(
+    handle: *mut DbxHandle,
+    cursor: *mut Cursor,
+    error_out: *mut *mut c_char,
+) -> DbxBuf {
+    let call = Call::start(Op::CursorNext);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return DbxBuf::EMPTY;
+    }
+    if cursor.is_null() {
+        reject(handle, call, error_out, "cursor is null");
+        return DbxBuf::EMPTY;
+    }
+    let client = unsafe { &*handle };
+    let cursor = unsafe { &mut *cursor };
+    match cursor.next(&client.runtime) {
+        Some(page) => client.respond_buf(call, page, error_out),
+        None => DbxBuf::EMPTY,
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn text_honours_length_and_embedded_nul() {
+        let bytes = b"a\0bc";
+        assert_eq!(text(bytes.as_ptr().cast(), 3).unwrap(), "a\0b");
+        assert_eq!(text(std::ptr::null(), 5).unwrap(), "");
+        assert!(text([0xffu8].as_ptr().cast(), 1).is_err());
+        assert_eq!(
+            json(b"[1]x".as_ptr().cast(), 3).unwrap(),
+            serde_json::json!([1])
+        );
+    }
+
+    #[test]
+    fn null_handle_returns_empty_buffer_with_error() {
+        let mut error: *mut c_char = std::ptr::null_mut();
+        let buf = dbx_get_aggregate_v2(
+            std::ptr::null_mut(),
+            b"t".as_ptr().cast(),
+            1,
+            b"1".as_ptr().cast(),
+            1,
+            &mut error,
+        );
+        assert!(buf.ptr.is_null());
+        let message = unsafe { std::ffi::CString::from_raw(error) };
+        assert_eq!(message.to_str().unwrap(), "handle is null");
+        dbx_buf_free(buf);
+    }
+}
@@ -0,0 +1,320 @@
+//! Merkle verification of many aggregates behind `dbx_verify_aggregates`.
+//!
+//! Ids come from the caller or from paging the aggregate listing; up to
+//! `concurrency` verifications run at a time over the pool. Each result is
+//! either collected into the reply or written to a file as one NDJSON line,
+//! so verifying a whole type does not hold every root in memory. With an
+//! `expected` map of id to root, matching aggregates are only counted and
+//! just mismatches and failures are reported.
+
+use std::{collections::HashMap, io::Write, sync::Arc};
+
+use futures::{stream, StreamExt};
+use serde::{Deserialize, Serialize};
+use serde_json::Value;
+
+use crate::{
+    entry_string, list_aggregates_payload, parse_list_aggregates_options,
+    pool::{with_conn, Pool},
+    reply::Reply,
+};
+
+/// Verifications in flight when `concurrency` is unset.
+const DEFAULT_CONCURRENCY: usize = 8;
+
+#[derive(Deserialize)]
+#[serde(rename_all = "camelCase")]
+struct VerifyOptions {
+    concurrency: Option<usize>,
+    /// Known roots by aggregate id; matches are counted, not reported.
+    expected: Option<HashMap<String, String>>,
+}
+
+#[derive(Serialize)]
+#[serde(untagged)]
+enum Outcome {
+    Verified {
+        #[serde(rename = "merkleRoot")]
+        merkle_root: String,
+    },
+    Mismatch {
+        #[serde(rename = "merkleRoot")]
+        merkle_root: String,
+        expected: Option<String>,
+    },
+    Failed {
+        error: String,
+    },
+}
+
+#[derive(Serialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct Verification {
+    aggregate_id: String,
+    #[serde(flatten)]
+    outcome: Outcome,
+}
+
+#[derive(Default, Serialize)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct VerifySummary {
+    verified: u64,
+    mismatched: u64,
+    failed: u64,
+    /// Reported results; absent when they were written to a file instead.
+    #[serde(skip_serializing_if = "Option::is_none")]
+    items: Option<Vec<Verification>>,
+}
+
+/// The ids passed to `dbx_verify_aggregates`; `None` lists the type instead.
+pub(crate) fn parse_ids(value: Value) -> Result<Option<Vec<String>>, String> {
+    match value {
+        Value::Null => Ok(None),
+        value => serde_json::from_value(value)
+            .map(Some)
+            .map_err(|_| "ids must be a JSON array of strings".to_string()),
+    }
+}
+
+/// Where reported results go.
+struct Sink<W: Write> {
+    out: Option<std::io::BufWriter<W>>,
+    line: Vec<u8>,
+    summary: VerifySummary,
+}
+
+impl<W: Write> Sink<W> {
+    fn new(out: Option<W>) -> Self {
+        Sink {
+            summary: VerifySummary {
+                items: out.is_none().then(Vec::new),
+                ..VerifySummary::default()
+            },
+            out: out.map(std::io::BufWriter::new),
+            line: Vec::with_capacity(128),
+        }
+    }
+
+    fn record(&mut self, verification: Verification, report: bool) -> Result<(), String> {
+        match verification.outcome {
+            Outcome::Verified { .. } => self.summary.verified += 1,
+            Outcome::Mismatch { .. } => self.summary.mismatched += 1,
+            Outcome::Failed { .. } => self.summary.failed += 1,
+        }
+        if !report {
+            return Ok(());
+        }
+        match (&mut self.out, &mut self.summary.items) {
+            (Some(out), _) => {
+                self.line.clear();
+                serde_json::to_writer(&mut self.line, &verification)
+                    .map_err(|e| format!("failed to serialize json: {e}"))?;
+                self.line.push(b'\n');
+                out.write_all(&self.line)
+                    .map_err(|e| format!("failed to write verification: {e}"))
+            }
+            (None, Some(items)) => {
+                items.push(verification);
+                Ok(())
+            }
+            (None, None) => Ok(()),
+        }
+    }
+
+    fn finish(mut self) -> Result<VerifySummary, String> {
+        if let Some(out) = &mut self.out {
+            out.flush()
+                .map_err(|e| format!("failed to write verification: {e}"))?;
+        }
+        Ok(self.summary)
+    }
+}
+
+/// Verifies `ids`, or every aggregate of `agg_type` matched by the
+/// `dbx_list_aggregates` options in `opts_value` when `ids` is `None`, and
+/// writes reported results to `out` when given.
+pub(crate) async fn run<W: Write>(
+    pool: Arc<Pool>,
+    agg_type: String,
+    ids: Option<Vec<String>>,
+    opts_value: Value,
+    out: Option<W>,
+) -> Result<VerifySummary, String> {
+    let options: VerifyOptions = serde_json::from_value(match &opts_value {
+        Value::Object(_) => opts_value.clone(),
+        _ => Value::Object(Default::default()),
+    })
+    .map_err(|e| format!("invalid verify options: {e}"))?;
+    let concurrency = options.concurrency.unwrap_or(DEFAULT_CONCURRENCY).max(1);
+    let expected = options.expected.as_ref();
+    let mut sink = Sink::new(out);
+
+    if let Some(ids) = ids {
+        verify_ids(&pool, &agg_type, ids, concurrency, expected, &mut sink).await?;
+        return sink.finish();
+    }
+
+    let mut cursor = None;
+    loop {
+        let mut opts = parse_list_aggregates_options(Some(agg_type.clone()), &opts_value);
+        if cursor.is_some() {
+            opts.cursor = cursor.take();
+        }
+        let Reply::Page { items, next_cursor } =
+            list_aggregates_payload(pool.clone(), opts, None).await?
+        else {
+            return Err("unexpected aggregate listing reply".to_string());
+        };
+        let ids = match items {
+            Value::Array(items) => items
+                .iter()
+                .filter_map(Value::as_object)
+                .filter_map(|map| entry_string(map, "aggregateId", "aggregate_id").ok())
+                .collect(),
+            _ => Vec::new(),
+        };
+        verify_ids(&pool, &agg_type, ids, concurrency, expected, &mut sink).await?;
+
+        match next_cursor.filter(|c| !c.is_empty()) {
+            Some(next) => cursor = Some(next),
+            None => return sink.finish(),
+        }
+    }
+}
+
+async fn verify_ids<W: Write>(
+    pool: &Pool,
+    agg_type: &str,
+    ids: Vec<String>,
+    concurrency: usize,
+    expected: Option<&HashMap<String, String>>,
+    sink: &mut Sink<W>,
+) -> Result<(), String> {
+    let mut results = stream::iter(ids)
+        .map(|id| async move {
+            let root = {
+                let id = id.as_str();
+                with_conn!(pool, |conn| conn.verify_aggregate(agg_type, id)).await
+            };
+            (id, root.map(|response| response.merkle_root))
+        })
+        .buffer_unordered(concurrency);
+    while let Some((aggregate_id, root)) = results.next().await {
+        let (outcome, report) = judge(root, expected.map(|roots| roots.get(&aggregate_id)));
+        sink.record(
+            Verification {
+                aggregate_id,
+                outcome,
+            },
+            report,
+        )?;
+    }
+    Ok(())
+}
+
+/// The outcome of one verification and whether it is reported: everything
+/// is without `expected`, only mismatches and failures with it.
+fn judge(root: Result<String, String>, expected: Option<Option<&String>>) -> (Outcome, bool) {
+    match (root, expected) {
+        (Err(error), _) => (Outcome::Failed { error }, true),
+        (Ok(merkle_root), None) => (Outcome::Verified { merkle_root }, true),
+        (Ok(merkle_root), Some(Some(root))) if *root == merkle_root => {
+            (Outcome::Verified { merkle_root }, false)
+        }
+        (Ok(merkle_root), Some(expected)) => (
+            Outcome::Mismatch {
+                merkle_root,
+                expected: expected.cloned(),
+            },
+            true,
+        ),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use serde_json::json;
+
+    use super::*;
+
+    fn verification(
+        id: &str,
+        root: Result<&str, &str>,
+        expected: Option<Option<&str>>,
+    ) -> Verification {
+        let expected = expected.map(|e| e.map(str::to_string));
+        let (outcome, _) = judge(
+            root.map(str::to_string).map_err(str::to_string),
+            expected.as_ref().map(Option::as_ref),
+        );
+        Verification {
+            aggregate_id: id.to_string(),
+            outcome,
+        }
+    }
+
+    #[test]
+    fn expected_roots_report_only_mismatches() {
+        let root = Ok("abc".to_string());
+        let matching = "abc".to_string();
+        assert!(matches!(
+            judge(root.clone(), None),
+            (Outcome::Verified { .. }, true)
+        ));
+        assert!(matches!(
+            judge(root.clone(), Some(Some(&matching))),
+            (Outcome::Verified { .. }, false)
+        ));
+        assert!(matches!(
+            judge(root.clone(), Some(None)),
+            (Outcome::Mismatch { expected: None, .. }, true)
+        ));
+        assert!(matches!(
+            judge(Err("boom".to_string()), Some(Some(&matching))),
+            (Outcome::Failed { .. }, true)
+        ));
+    }
+
+    #[test]
+    fn results_serialize_flat() {
+        assert_eq!(
+            serde_json::to_value(verification("p-1", Ok("abc"), None)).unwrap(),
+            json!({ "aggregateId": "p-1", "merkleRoot": "abc" })
+        );
+        assert_eq!(
+            serde_json::to_value(verification("p-2", Ok("abc"), Some(Some("def")))).unwrap(),
+            json!({ "aggregateId": "p-2", "merkleRoot": "abc", "expected": "def" })
+        );
+        assert_eq!(
+            serde_json::to_value(verification("p-3", Err("boom"), None)).unwrap(),
+            json!({ "aggregateId": "p-3", "error": "boom" })
+        );
+    }
+
+    #[test]
+    fn sink_writes_ndjson_and_counts() {
+        let mut out = Vec::new();
+        let mut sink = Sink::new(Some(&mut out));
+        sink.record(verification("p-1", Ok("abc"), None), true)
+            .unwrap();
+        sink.record(verification("p-2", Ok("abc"), Some(Some("abc"))), false)
+            .unwrap();
+        sink.record(verification("p-3", Err("boom"), None), true)
+            .unwrap();
+        let summary = sink.finish().unwrap();
+        assert_eq!(
+            (summary.verified, summary.mismatched, summary.failed),
+            (2, 0, 1)
+        );
+        assert!(summary.items.is_none());
+        assert_eq!(
+            String::from_utf8(out).unwrap(),
+            "{\"aggregateId\":\"p-1\",\"merkleRoot\":\"abc\"}\n{\"aggregateId\":\"p-3\",\"error\":\"boom\"}\n"
+        );
+
+        let mut sink = Sink::<Vec<u8>>::new(None);
+        sink.record(verification("p-1", Ok("abc"), None), true)
+            .unwrap();
+        assert_eq!(sink.finish().unwrap().items.unwrap().len(), 1);
+    }
+}
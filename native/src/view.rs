@@ -0,0 +1,311 @@
+//! Lazily decoded results (`Client::getLazy()` / `eventsLazy()`).
+//!
+//! A view keeps the reply as the `Value` tree the client already parsed, in
+//! native memory, instead of serializing it for PHP to decode in full. PHP
+//! then asks for parts of it by dotted path (`items.3.payload.status`), and
+//! only the subtree at the path is encoded, in the handle's response format.
+//! Counting and listing keys need no encoding of the values at all. The tree
+//! lives until `dbx_view_free`, which `ResultView` calls when destroyed.
+
+use std::{os::raw::c_char, time::Instant};
+
+use serde_json::Value;
+
+use crate::{
+    check_handle, clear_error, get_aggregate_payload, list_events_payload,
+    metrics::{Call, Op},
+    parse_list_events_options,
+    projection::Projection,
+    reject,
+    reply::{self, DbxBuf, Reply},
+    set_error,
+    v2::{json, text},
+    DbxHandle,
+};
+
+/// `dbx_view_len` of a path that does not resolve.
+const MISSING: i64 = -2;
+/// `dbx_view_len` of a scalar.
+const SCALAR: i64 = -1;
+
+pub struct DbxView {
+    root: Value,
+}
+
+/// The value at a dotted `path`; segments index objects by key and arrays
+/// by position, and the empty path is the whole reply.
+pub(crate) fn lookup<'a>(root: &'a Value, path: &str) -> Option<&'a Value> {
+    if path.is_empty() {
+        return Some(root);
+    }
+    path.split('.')
+        .try_fold(root, |value, segment| match value {
+            Value::Object(map) => map.get(segment),
+            Value::Array(items) => items.get(segment.parse::<usize>().ok()?),
+            _ => None,
+        })
+}
+
+fn len(value: Option<&Value>) -> i64 {
+    match value {
+        None => MISSING,
+        Some(Value::Array(items)) => items.len() as i64,
+        Some(Value::Object(map)) => map.len() as i64,
+        Some(_) => SCALAR,
+    }
+}
+
+/// Keys of an object, or the positions of an array; empty for a scalar.
+fn keys(value: &Value) -> Value {
+    match value {
+        Value::Object(map) => map.keys().cloned().map(Value::String).collect(),
+        Value::Array(items) => (0..items.len()).map(Value::from).collect(),
+        _ => Value::Array(Vec::new()),
+    }
+}
+
+/// Finishes a view export: keeps the reply and records the call (with no
+/// response bytes, since nothing was encoded yet).
+fn respond_view(
+    client: &DbxHandle,
+    call: Call,
+    result: Result<Reply, String>,
+    error_out: *mut *mut c_char,
+) -> *mut DbxView {
+    let started = Instant::now();
+    let root = result.and_then(Reply::into_value);
+    let elapsed = started.elapsed();
+    match root {
+        Ok(root) => {
+            client.metrics.finish(call, true, elapsed, 0);
+            Box::into_raw(Box::new(DbxView { root }))
+        }
+        Err(err) => {
+            client.metrics.finish(call, false, elapsed, 0);
+            set_error(error_out, err);
+            std::ptr::null_mut()
+        }
+    }
+}
+
+/// `dbx_get_aggregate_v2` returning a view of the reply.
+#[no_mangle]
+pub extern "C" fn dbx_get_aggregate_view(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_type_len: usize,
+    aggregate_id: *const c_char,
+    aggregate_id_len: usize,
+    error_out: *mut *mut c_char,
+) -> *mut DbxView {
+    let call = Call::start(Op::GetAggregate);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let ids = text(aggregate_type, aggregate_type_len)
+        .and_then(|agg_type| Ok((agg_type, text(aggregate_id, aggregate_id_len)?)));
+    let (agg_type, agg_id) = match ids {
+        Ok(ids) => ids,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+
+    let client = unsafe { &*handle };
+    respond_view(
+        client,
+        call,
+        client.runtime.block_on(get_aggregate_payload(
+            client.pool.clone(),
+            client.cache.clone(),
+            agg_type,
+            agg_id,
+        )),
+        error_out,
+    )
+}
+
+/// `dbx_list_events_v2` returning a view of the reply.
+#[no_mangle]
+pub extern "C" fn dbx_list_events_view(
+    handle: *mut DbxHandle,
+    aggregate_type: *const c_char,
+    aggregate_type_len: usize,
+    aggregate_id: *const c_char,
+    aggregate_id_len: usize,
+    options_json: *const c_char,
+    options_json_len: usize,
+    error_out: *mut *mut c_char,
+) -> *mut DbxView {
+    let call = Call::start(Op::ListEvents);
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return std::ptr::null_mut();
+    }
+    let input = text(aggregate_type, aggregate_type_len).and_then(|agg_type| {
+        let agg_id = text(aggregate_id, aggregate_id_len)?;
+        let opts_value = json(options_json, options_json_len)?;
+        let projection = Projection::from_options(&opts_value)?;
+        Ok((agg_type, agg_id, opts_value, projection))
+    });
+    let (agg_type, agg_id, opts_value, projection) = match input {
+        Ok(input) => input,
+        Err(err) => {
+            reject(handle, call, error_out, err);
+            return std::ptr::null_mut();
+        }
+    };
+    let opts = parse_list_events_options(&opts_value);
+
+    let client = unsafe { &*handle };
+    respond_view(
+        client,
+        call,
+        client.runtime.block_on(list_events_payload(
+            client.pool.clone(),
+            agg_type,
+            agg_id,
+            opts,
+            projection,
+        )),
+        error_out,
+    )
+}
+
+/// Encodes the value at `path` like a `_v2` reply (release it with
+/// `dbx_buf_release`). An empty buffer without error means the path does
+/// not resolve.
+#[no_mangle]
+pub extern "C" fn dbx_view_get(
+    handle: *mut DbxHandle,
+    view: *const DbxView,
+    path: *const c_char,
+    path_len: usize,
+    error_out: *mut *mut c_char,
+) -> DbxBuf {
+    view_buf(handle, view, path, path_len, error_out, |value| {
+        encode(handle, value)
+    })
+}
+
+/// The keys of the object at `path`, or the positions of the array there,
+/// encoded as a list.
+#[no_mangle]
+pub extern "C" fn dbx_view_keys(
+    handle: *mut DbxHandle,
+    view: *const DbxView,
+    path: *const c_char,
+    path_len: usize,
+    error_out: *mut *mut c_char,
+) -> DbxBuf {
+    view_buf(handle, view, path, path_len, error_out, |value| {
+        encode(handle, &keys(value))
+    })
+}
+
+/// Elements of the array or entries of the object at `path`; -1 for a
+/// scalar and -2 when the path does not resolve.
+#[no_mangle]
+pub extern "C" fn dbx_view_len(view: *const DbxView, path: *const c_char, path_len: usize) -> i64 {
+    if view.is_null() {
+        return MISSING;
+    }
+    match text(path, path_len) {
+        Ok(path) => len(lookup(&unsafe { &*view }.root, &path)),
+        Err(_) => MISSING,
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn dbx_view_free(view: *mut DbxView) {
+    if !view.is_null() {
+        drop(unsafe { Box::from_raw(view) });
+    }
+}
+
+fn view_buf(
+    handle: *mut DbxHandle,
+    view: *const DbxView,
+    path: *const c_char,
+    path_len: usize,
+    error_out: *mut *mut c_char,
+    encode: impl FnOnce(&Value) -> Result<DbxBuf, String>,
+) -> DbxBuf {
+    clear_error(error_out);
+    if let Err(err) = check_handle(handle) {
+        set_error(error_out, err);
+        return DbxBuf::EMPTY;
+    }
+    if view.is_null() {
+        set_error(error_out, "view is null");
+        return DbxBuf::EMPTY;
+    }
+    let path = match text(path, path_len) {
+        Ok(path) => path,
+        Err(err) => {
+            set_error(error_out, err);
+            return DbxBuf::EMPTY;
+        }
+    };
+    let Some(value) = lookup(&unsafe { &*view }.root, &path) else {
+        return DbxBuf::EMPTY;
+    };
+    encode(value).unwrap_or_else(|err| {
+        set_error(error_out, err);
+        DbxBuf::EMPTY
+    })
+}
+
+fn encode(handle: *mut DbxHandle, value: &Value) -> Result<DbxBuf, String> {
+    let client = unsafe { &*handle };
+    reply::encode_buf(client.format, value, client.buffers.take())
+}
+
+#[cfg(test)]
+mod tests {
+    use serde_json::json;
+
+    use super::*;
+
+    fn page() -> Value {
+        Reply::Page {
+            items: json!([
+                { "version": 1, "payload": { "status": "open" } },
+                { "version": 2, "payload": { "status": "paid", "lines": [1, 2, 3] } },
+            ]),
+            next_cursor: Some("c-2".to_string()),
+        }
+        .into_value()
+        .unwrap()
+    }
+
+    #[test]
+    fn paths_walk_objects_and_arrays() {
+        let root = page();
+        assert_eq!(
+            lookup(&root, "items.1.payload.status"),
+            Some(&json!("paid"))
+        );
+        assert_eq!(lookup(&root, "nextCursor"), Some(&json!("c-2")));
+        assert_eq!(lookup(&root, ""), Some(&root));
+        assert_eq!(lookup(&root, "items.2"), None);
+        assert_eq!(lookup(&root, "items.first"), None);
+        assert_eq!(lookup(&root, "nextCursor.length"), None);
+    }
+
+    #[test]
+    fn lengths_and_keys_need_no_encoding() {
+        let root = page();
+        assert_eq!(len(lookup(&root, "items")), 2);
+        assert_eq!(len(lookup(&root, "items.1.payload")), 2);
+        assert_eq!(len(lookup(&root, "items.0.version")), SCALAR);
+        assert_eq!(len(lookup(&root, "items.5")), MISSING);
+        assert_eq!(keys(&root), json!(["items", "nextCursor"]));
+        assert_eq!(keys(&root["items"]), json!([0, 1]));
+        assert_eq!(keys(&json!(7)), json!([]));
+    }
+}
@@ -0,0 +1,449 @@
+//! Client-side write queue behind `dbx_enqueue_append` / `dbx_flush`.
+//!
+//! Appends are pushed onto a bounded channel and acknowledged later. A single
+//! drain task takes whatever is queued (up to `batch` entries per round),
+//! groups it by aggregate the same way `dbx_append_events` does and runs the
+//! groups concurrently across the pool. Entries of one aggregate are sent in
+//! enqueue order, and a round completes before the next one starts, so that
+//! order also holds across rounds. Acknowledgements collect until
+//! `dbx_flush` takes them. Freeing the handle flushes for up to
+//! `closeTimeoutMs` first; entries that are still unacknowledged then, or
+//! that failed without being flushed, are lost and counted in
+//! `writeQueue.lostOnClose`.
+
+use std::{
+    pin::pin,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc, Mutex, MutexGuard, PoisonError,
+    },
+    time::Duration,
+};
+
+use eventdbx_client::AppendEventRequest;
+use serde::{Deserialize, Serialize};
+use tokio::{
+    runtime::Runtime,
+    sync::{
+        mpsc::{self, error::TrySendError},
+        Notify,
+    },
+};
+
+use crate::{
+    append_grouped,
+    cache::Cache,
+    metrics::Metrics,
+    pool::Pool,
+    reply::{Reply, TaggedReply},
+};
+
+const DEFAULT_CAPACITY: usize = 1024;
+const DEFAULT_BATCH: usize = 64;
+const DEFAULT_CLOSE_TIMEOUT: Duration = Duration::from_secs(5);
+
+/// What `dbx_enqueue_append` does when the queue is full.
+#[derive(Clone, Copy, Default, Deserialize, Hash, PartialEq)]
+#[serde(rename_all = "lowercase")]
+pub(crate) enum Backpressure {
+    /// Wait for the drain task to make room.
+    #[default]
+    Block,
+    /// Discard the entry and report it as dropped.
+    Drop,
+    /// Reject the entry with an error.
+    Fail,
+}
+
+/// The `writeQueue` section of the client config.
+#[derive(Clone, Default, Deserialize, Hash)]
+#[serde(rename_all = "camelCase")]
+pub(crate) struct WriteQueueConfig {
+    /// Entries queued but not yet picked up by the drain task.
+    capacity: Option<usize>,
+    #[serde(default)]
+    policy: Backpressure,
+    /// Entries sent per drain round.
+    batch: Option<usize>,
+    /// How long freeing the handle waits for queued entries (default 5000).
+    close_timeout_ms: Option<u64>,
+}
+
+struct Queued {
+    seq: u64,
+    aggregate_type: String,
+    aggregate_id: String,
+    request: AppendEventRequest,
+}
+
+#[derive(Serialize)]
+pub(crate) struct Ack {
+    seq: u64,
+    #[serde(flatten)]
+    entry: TaggedReply,
+}
+
+#[derive(Default, Serialize)]
+pub(crate) struct FlushSummary {
+    items: Vec<Ack>,
+    failed: usize,
+    /// Entries still queued or in flight when the flush returned.
+    pending: u64,
+}
+
+pub(crate) enum Enqueued {
+    Queued(u64),
+    Dropped,
+}
+
+/// State shared between the handle and its drain task.
+#[derive(Default)]
+struct Ledger {
+    /// Accepted entries not yet acknowledged.
+    outstanding: AtomicU64,
+    acks: Mutex<Vec<Ack>>,
+    settled: Notify,
+}
+
+impl Ledger {
+    fn lock(&self) -> MutexGuard<'_, Vec<Ack>> {
+        self.acks.lock().unwrap_or_else(PoisonError::into_inner)
+    }
+
+    fn settle(&self, acks: Vec<Ack>) {
+        let count = acks.len() as u64;
+        self.lock().extend(acks);
+        self.outstanding.fetch_sub(count, Ordering::AcqRel);
+        self.settled.notify_waiters();
+    }
+}
+
+pub(crate) struct WriteQueue {
+    policy: Backpressure,
+    capacity: usize,
+    close_timeout: Duration,
+    tx: mpsc::Sender<Queued>,
+    next: AtomicU64,
+    ledger: Arc<Ledger>,
+    metrics: Arc<Metrics>,
+}
+
+impl WriteQueue {
+    /// Creates the queue and spawns its drain task. The task ends once the
+    /// queue is dropped and every entry already queued has been sent.
+    pub(crate) fn start(
+        runtime: &Runtime,
+        config: Option<&WriteQueueConfig>,
+        pool: Arc<Pool>,
+        cache: Arc<Cache>,
+        metrics: Arc<Metrics>,
+    ) -> WriteQueue {
+        let config = config.cloned().unwrap_or_default();
+        let capacity = config.capacity.unwrap_or(DEFAULT_CAPACITY).max(1);
+        let batch = config.batch.unwrap_or(DEFAULT_BATCH).max(1);
+        let (tx, rx) = mpsc::channel(capacity);
+        let ledger = Arc::new(Ledger::default());
+        runtime.spawn(drain(rx, batch, ledger.clone(), pool, cache, metrics.clone()));
+        WriteQueue {
+            policy: config.policy,
+            capacity,
+            close_timeout: config
+                .close_timeout_ms
+                .map_or(DEFAULT_CLOSE_TIMEOUT, Duration::from_millis),
+            tx,
+            next: AtomicU64::new(1),
+            ledger,
+            metrics,
+        }
+    }
+
+    /// Queues one append, returning its sequence number (increasing, never
+    /// 0, with gaps where entries were dropped or rejected).
+    pub(crate) fn enqueue(
+        &self,
+        runtime: &Runtime,
+        aggregate_type: String,
+        aggregate_id: String,
+        request: AppendEventRequest,
+    ) -> Result<Enqueued, String> {
+        let seq = self.next.fetch_add(1, Ordering::Relaxed);
+        let entry = Queued {
+            seq,
+            aggregate_type,
+            aggregate_id,
+            request,
+        };
+        // counted before sending so the drain task never sees a negative depth
+        self.ledger.outstanding.fetch_add(1, Ordering::AcqRel);
+        let depth = self.metrics.write_queue.push();
+        let full = match self.tx.try_send(entry) {
+            Ok(()) => {
+                self.metrics.write_queue.accepted(depth);
+                return Ok(Enqueued::Queued(seq));
+            }
+            Err(TrySendError::Full(entry)) if self.policy == Backpressure::Block => {
+                match runtime.block_on(self.tx.send(entry)) {
+                    Ok(()) => {
+                        self.metrics.write_queue.accepted(depth);
+                        return Ok(Enqueued::Queued(seq));
+                    }
+                    Err(_) => false,
+                }
+            }
+            Err(TrySendError::Full(_)) => true,
+            Err(TrySendError::Closed(_)) => false,
+        };
+        self.ledger.outstanding.fetch_sub(1, Ordering::AcqRel);
+        self.metrics.write_queue.unpush();
+        if !full {
+            return Err("write queue is closed".to_string());
+        }
+        if self.policy == Backpressure::Drop {
+            self.metrics.write_queue.dropped();
+            return Ok(Enqueued::Dropped);
+        }
+        self.metrics.write_queue.rejected();
+        Err(format!("write queue is full ({} entries)", self.capacity))
+    }
+
+    /// Waits until every accepted entry is acknowledged or `timeout` passes
+    /// (`None` waits indefinitely), then takes the acknowledgements collected
+    /// so far, ordered by sequence number.
+    pub(crate) async fn flush(&self, timeout: Option<Duration>) -> FlushSummary {
+        let ledger = &self.ledger;
+        self.settle(timeout).await;
+
+        let mut items = std::mem::take(&mut *ledger.lock());
+        items.sort_unstable_by_key(|ack| ack.seq);
+        FlushSummary {
+            failed: items
+                .iter()
+                .filter(|ack| matches!(ack.entry.reply, Reply::Failed { .. }))
+                .count(),
+            items,
+            pending: ledger.outstanding.load(Ordering::Acquire),
+        }
+    }
+
+    /// Waits until every accepted entry is acknowledged or `timeout`
+    /// passes, leaving the acknowledgements for the next flush.
+    async fn settle(&self, timeout: Option<Duration>) {
+        let ledger = &self.ledger;
+        let settled = async {
+            loop {
+                let mut changed = pin!(ledger.settled.notified());
+                changed.as_mut().enable();
+                if ledger.outstanding.load(Ordering::Acquire) == 0 {
+                    return;
+                }
+                changed.await;
+            }
+        };
+        match timeout {
+            Some(timeout) => {
+                let _ = tokio::time::timeout(timeout, settled).await;
+            }
+            None => settled.await,
+        }
+    }
+
+    /// `settle` for up to `closeTimeoutMs`, for a shared handle that goes
+    /// idle without being dropped.
+    pub(crate) async fn idle(&self) {
+        self.settle(Some(self.close_timeout)).await;
+    }
+
+    /// The flush run when the handle is freed: waits up to `closeTimeoutMs`
+    /// and returns how many entries will never be reported (see the module
+    /// docs).
+    pub(crate) async fn close(&self) -> u64 {
+        let summary = self.flush(Some(self.close_timeout)).await;
+        summary.pending + summary.failed as u64
+    }
+}
+
+async fn drain(
+    mut rx: mpsc::Receiver<Queued>,
+    batch: usize,
+    ledger: Arc<Ledger>,
+    pool: Arc<Pool>,
+    cache: Arc<Cache>,
+    metrics: Arc<Metrics>,
+) {
+    let mut round = Vec::with_capacity(batch);
+    while rx.recv_many(&mut round, batch).await > 0 {
+        metrics.write_queue.pop(round.len());
+        let mut tags = Vec::with_capacity(round.len());
+        let entries = round
+            .drain(..)
+            .enumerate()
+            .map(|(index, entry)| {
+                let key = (entry.aggregate_type.clone(), entry.aggregate_id.clone());
+                tags.push((entry.seq, entry.aggregate_type, entry.aggregate_id));
+                (index, key, Ok(entry.request))
+            })
+            .collect::<Vec<_>>();
+        let completed = append_grouped(&pool, &cache, entries).await;
+        let acks = completed
+            .into_iter()
+            .map(|(index, result)| {
+                let (seq, aggregate_type, aggregate_id) = std::mem::take(&mut tags[index]);
+                Ack {
+                    seq,
+                    entry: TaggedReply {
+                        aggregate_type,
+                        aggregate_id,
+                        reply: Reply::item(result),
+                    },
+                }
+            })
+            .collect();
+        ledger.settle(acks);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn queue(policy: Backpressure, capacity: usize) -> (WriteQueue, mpsc::Receiver<Queued>) {
+        let (tx, rx) = mpsc::channel(capacity);
+        let queue = WriteQueue {
+            policy,
+            capacity,
+            close_timeout: Duration::from_millis(50),
+            tx,
+            next: AtomicU64::new(1),
+            ledger: Arc::new(Ledger::default()),
+            metrics: Arc::new(Metrics::new()),
+        };
+        (queue, rx)
+    }
+
+    fn request(id: &str) -> AppendEventRequest {
+        AppendEventRequest::new(
+            "person".to_string(),
+            id.to_string(),
+            "renamed".to_string(),
+            serde_json::json!({}),
+        )
+    }
+
+    fn ack(seq: u64, reply: Reply) -> Ack {
+        Ack {
+            seq,
+            entry: TaggedReply {
+                aggregate_type: "person".to_string(),
+                aggregate_id: format!("p-{seq}"),
+                reply,
+            },
+        }
+    }
+
+    #[test]
+    fn config_parses_policy_names() {
+        let config: WriteQueueConfig =
+            serde_json::from_value(serde_json::json!({ "capacity": 8, "policy": "drop" })).unwrap();
+        assert!(config.policy == Backpressure::Drop);
+        assert_eq!(config.capacity, Some(8));
+        let config: WriteQueueConfig = serde_json::from_value(serde_json::json!({})).unwrap();
+        assert!(config.policy == Backpressure::Block);
+        assert!(
+            serde_json::from_value::<WriteQueueConfig>(serde_json::json!({ "policy": "spin" })).is_err()
+        );
+    }
+
+    #[test]
+    fn full_queue_drops_or_fails() {
+        let runtime = Runtime::new().unwrap();
+        let (dropping, _rx) = queue(Backpressure::Drop, 1);
+        let enqueue = |queue: &WriteQueue, id: &str| {
+            queue.enqueue(&runtime, "person".to_string(), id.to_string(), request(id))
+        };
+        assert!(matches!(enqueue(&dropping, "p-1"), Ok(Enqueued::Queued(1))));
+        assert!(matches!(enqueue(&dropping, "p-2"), Ok(Enqueued::Dropped)));
+        assert_eq!(dropping.ledger.outstanding.load(Ordering::Acquire), 1);
+
+        let (failing, _rx) = queue(Backpressure::Fail, 1);
+        assert!(matches!(enqueue(&failing, "p-1"), Ok(Enqueued::Queued(1))));
+        assert_eq!(
+            enqueue(&failing, "p-2").err().as_deref(),
+            Some("write queue is full (1 entries)")
+        );
+
+        let snapshot = serde_json::to_value(dropping.metrics.snapshot()).unwrap();
+        assert_eq!(snapshot["writeQueue"]["depth"], 1);
+        assert_eq!(snapshot["writeQueue"]["highWater"], 1);
+        assert_eq!(snapshot["writeQueue"]["dropped"], 1);
+    }
+
+    #[test]
+    fn flush_waits_for_outstanding_and_orders_acks() {
+        let runtime = Runtime::new().unwrap();
+        let (queue, _rx) = queue(Backpressure::Block, 1);
+        queue.ledger.outstanding.store(2, Ordering::Release);
+
+        let ledger = queue.ledger.clone();
+        runtime.spawn(async move {
+            tokio::time::sleep(Duration::from_millis(5)).await;
+            ledger.settle(vec![
+                ack(
+                    2,
+                    Reply::Failed {
+                        error: "conflict".to_string(),
+                    },
+                ),
+                ack(
+                    1,
+                    Reply::Event {
+                        event: serde_json::Value::Null,
+                    },
+                ),
+            ]);
+        });
+
+        let summary = runtime.block_on(queue.flush(Some(Duration::from_secs(5))));
+        assert_eq!(summary.pending, 0);
+        assert_eq!(summary.failed, 1);
+        let seqs: Vec<u64> = summary.items.iter().map(|ack| ack.seq).collect();
+        assert_eq!(seqs, [1, 2]);
+
+        let json = serde_json::to_value(summary.items.last().unwrap()).unwrap();
+        assert_eq!(json["seq"], 2);
+        assert_eq!(json["aggregateId"], "p-2");
+        assert_eq!(json["error"], "conflict");
+    }
+
+    #[test]
+    fn flush_times_out_with_pending_count() {
+        let runtime = Runtime::new().unwrap();
+        let (queue, _rx) = queue(Backpressure::Fail, 1);
+        queue.ledger.outstanding.store(3, Ordering::Release);
+        let summary = runtime.block_on(queue.flush(Some(Duration::from_millis(5))));
+        assert_eq!(summary.pending, 3);
+        assert!(summary.items.is_empty());
+    }
+
+    #[test]
+    fn close_counts_unacknowledged_and_unflushed_failures() {
+        let runtime = Runtime::new().unwrap();
+        let (queue, _rx) = queue(Backpressure::Block, 4);
+        queue.ledger.outstanding.store(3, Ordering::Release);
+        queue.ledger.settle(vec![
+            ack(
+                1,
+                Reply::Failed {
+                    error: "conflict".to_string(),
+                },
+            ),
+            ack(
+                2,
+                Reply::Event {
+                    event: serde_json::Value::Null,
+                },
+            ),
+        ]);
+        // one entry never acknowledged, one failure nobody flushed
+        assert_eq!(runtime.block_on(queue.close()), 2);
+    }
+}
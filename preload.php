@@ -0,0 +1,20 @@
+<?php
+
+/*
+ * opcache.preload entry point: binds the native library into the EVENTDBX
+ * FFI scope once per server start.
+ *
+ *     opcache.preload=/path/to/vendor/eventdbx/eventdbx-php/preload.php
+ *     opcache.preload_user=www-data
+ *     ffi.enable=preload
+ *
+ * Set EVENTDBX_NATIVE_LIB to load a library outside native/target.
+ */
+
+declare(strict_types=1);
+
+require_once __DIR__ . '/src/Exception/EventDbxException.php';
+require_once __DIR__ . '/src/Client.php';
+
+$library = getenv('EVENTDBX_NATIVE_LIB');
+\EventDbx\Client::preload($library === false || $library === '' ? null : $library);
@@ -7,46 +7,127 @@ namespace EventDbx;
 use EventDbx\Exception\EventDbxException;
 use FFI;
 use FFI\CData;
+use Generator;
 
 final class Client
 {
     private const CDEF = <<<CDEF
     typedef struct DbxHandle DbxHandle;
+    typedef struct DbxCursor DbxCursor;
+    typedef struct DbxSubscription DbxSubscription;
+    typedef struct DbxView DbxView;
     typedef unsigned long long uint64_t;
+    typedef struct DbxBuf { char* ptr; size_t len; size_t cap; } DbxBuf;
 
     void dbx_string_free(char* ptr);
+    void dbx_bytes_free(char* ptr);
 
     DbxHandle* dbx_client_new(const char* config_json, char** error_out);
     void dbx_client_free(DbxHandle* handle);
+    void dbx_client_evict(DbxHandle* handle);
 
     char* dbx_list_aggregates(DbxHandle* handle, const char* aggregate_type, const char* options_json, char** error_out);
     char* dbx_get_aggregate(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, char** error_out);
+    char* dbx_get_aggregates(DbxHandle* handle, const char* aggregate_type, const char* ids_json, char** error_out);
     char* dbx_select_aggregate(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* fields_json, char** error_out);
+    char* dbx_select_aggregates(DbxHandle* handle, const char* aggregate_type, const char* ids_json, const char* fields_json, char** error_out);
     char* dbx_list_events(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* options_json, char** error_out);
     char* dbx_append_event(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* event_type, const char* options_json, char** error_out);
+    char* dbx_append_event_raw(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* event_type, const char* payload, size_t payload_len, const char* options_json, char** error_out);
+    char* dbx_append_events(DbxHandle* handle, const char* events_json, const char* options_json, char** error_out);
     char* dbx_create_aggregate(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* event_type, const char* options_json, char** error_out);
+    char* dbx_create_aggregate_raw(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* event_type, const char* payload, size_t payload_len, const char* options_json, char** error_out);
     char* dbx_patch_event(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* event_type, const char* patch_json, const char* options_json, char** error_out);
     char* dbx_set_archive(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, bool archived, const char* options_json, char** error_out);
     char* dbx_verify_aggregate(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, char** error_out);
+    char* dbx_verify_aggregates(DbxHandle* handle, const char* aggregate_type, const char* ids_json, const char* options_json, const char* path, int fd, char** error_out);
     char* dbx_create_snapshot(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* options_json, char** error_out);
     char* dbx_list_snapshots(DbxHandle* handle, const char* options_json, char** error_out);
     char* dbx_get_snapshot(DbxHandle* handle, uint64_t snapshot_id, const char* options_json, char** error_out);
+    char* dbx_load_state(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* options_json, char** error_out);
+
+    uint64_t dbx_submit_get_aggregate(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, char** error_out);
+    uint64_t dbx_submit_select_aggregate(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* fields_json, char** error_out);
+    uint64_t dbx_submit_list_events(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* options_json, char** error_out);
+    uint64_t dbx_submit_append_event(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* event_type, const char* options_json, char** error_out);
+    char* dbx_poll(DbxHandle* handle, uint64_t ticket, char** error_out);
+    uint64_t dbx_wait_any(DbxHandle* handle, const uint64_t* tickets, size_t count, int64_t timeout_ms);
+    void dbx_cancel(DbxHandle* handle, uint64_t ticket);
+    int dbx_notify_fd(DbxHandle* handle);
+    void dbx_notify_drain(DbxHandle* handle);
+
+    uint64_t dbx_prepare(DbxHandle* handle, const char* operation, const char* aggregate_type, const char* options_json, char** error_out);
+    char* dbx_execute(DbxHandle* handle, uint64_t statement, const char* aggregate_id, const char* cursor, const char* payload_json, char** error_out);
+    void dbx_statement_free(DbxHandle* handle, uint64_t statement);
+
+    uint64_t dbx_enqueue_append(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* event_type, const char* options_json, char** error_out);
+    char* dbx_flush(DbxHandle* handle, int64_t timeout_ms, char** error_out);
+
+    void dbx_buf_free(DbxBuf buf);
+    void dbx_buf_release(DbxHandle* handle, DbxBuf buf);
+    DbxBuf dbx_list_aggregates_v2(DbxHandle* handle, const char* aggregate_type, size_t aggregate_type_len, const char* options_json, size_t options_json_len, char** error_out);
+    DbxBuf dbx_get_aggregate_v2(DbxHandle* handle, const char* aggregate_type, size_t aggregate_type_len, const char* aggregate_id, size_t aggregate_id_len, char** error_out);
+    DbxBuf dbx_select_aggregate_v2(DbxHandle* handle, const char* aggregate_type, size_t aggregate_type_len, const char* aggregate_id, size_t aggregate_id_len, const char* fields_json, size_t fields_json_len, char** error_out);
+    DbxBuf dbx_list_events_v2(DbxHandle* handle, const char* aggregate_type, size_t aggregate_type_len, const char* aggregate_id, size_t aggregate_id_len, const char* options_json, size_t options_json_len, char** error_out);
+    DbxBuf dbx_append_event_v2(DbxHandle* handle, const char* aggregate_type, size_t aggregate_type_len, const char* aggregate_id, size_t aggregate_id_len, const char* event_type, size_t event_type_len, const char* options_json, size_t options_json_len, char** error_out);
+    DbxBuf dbx_cursor_next_v2(DbxHandle* handle, DbxCursor* cursor, char** error_out);
+
+    DbxView* dbx_get_aggregate_view(DbxHandle* handle, const char* aggregate_type, size_t aggregate_type_len, const char* aggregate_id, size_t aggregate_id_len, char** error_out);
+    DbxView* dbx_list_events_view(DbxHandle* handle, const char* aggregate_type, size_t aggregate_type_len, const char* aggregate_id, size_t aggregate_id_len, const char* options_json, size_t options_json_len, char** error_out);
+    DbxBuf dbx_view_get(DbxHandle* handle, DbxView* view, const char* path, size_t path_len, char** error_out);
+    DbxBuf dbx_view_keys(DbxHandle* handle, DbxView* view, const char* path, size_t path_len, char** error_out);
+    int64_t dbx_view_len(DbxView* view, const char* path, size_t path_len);
+    void dbx_view_free(DbxView* view);
+
+    DbxCursor* dbx_cursor_open(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* options_json, char** error_out);
+    char* dbx_cursor_next(DbxHandle* handle, DbxCursor* cursor, char** error_out);
+    void dbx_cursor_close(DbxCursor* cursor);
+    DbxSubscription* dbx_subscribe(DbxHandle* handle, const char* filter_json, char** error_out);
+    char* dbx_subscription_next_batch(DbxHandle* handle, DbxSubscription* subscription, size_t max, int64_t timeout_ms, char** error_out);
+    int dbx_subscription_fd(DbxSubscription* subscription);
+    void dbx_subscription_close(DbxSubscription* subscription);
+
+    void dbx_cache_clear(DbxHandle* handle);
+    char* dbx_metrics_snapshot(DbxHandle* handle, char** error_out);
+    char* dbx_metrics_prometheus(DbxHandle* handle);
+
+    char* dbx_export_events(DbxHandle* handle, const char* aggregate_type, const char* options_json, const char* path, int fd, char** error_out);
+    char* dbx_reduce_events(DbxHandle* handle, const char* aggregate_type, const char* aggregate_id, const char* spec_json, char** error_out);
     CDEF;
 
+    private const FFI_SCOPE = 'EVENTDBX';
+
+    /** @var array<string,FFI> */
+    private static array $ffiCache = [];
+
+    /** @var array<string,self> */
+    private static array $sharedClients = [];
+
+    /** Process that populated `$sharedClients`; a forked child starts over. */
+    private static int $sharedPid = 0;
+
     private FFI $ffi;
     private CData $handle;
+    private bool $msgpack = false;
+
+    /** @var array{encodeNs:int,decodeNs:int,bytesIn:int,bytesOut:int} */
+    private array $phpMetrics = ['encodeNs' => 0, 'decodeNs' => 0, 'bytesIn' => 0, 'bytesOut' => 0];
 
     /**
      * @param array<string,mixed> $config
      */
     public function __construct(array $config, ?string $libraryPath = null)
     {
-        $lib = $libraryPath ?? self::defaultLibraryPath();
-        if (!is_file($lib)) {
-            throw new EventDbxException("Native library not found at {$lib}. Build it with `cargo build --release` inside native/.");
+        $format = $config['responseFormat'] ?? 'json';
+        if (!in_array($format, ['json', 'msgpack'], true)) {
+            throw new EventDbxException("Unsupported responseFormat {$format}; expected json or msgpack");
         }
+        if ($format === 'msgpack' && !function_exists('msgpack_unpack')) {
+            throw new EventDbxException('responseFormat msgpack requires the msgpack extension');
+        }
+        $this->msgpack = $format === 'msgpack';
 
-        $this->ffi = FFI::cdef(self::CDEF, $lib);
+        $this->ffi = self::loadFfi($libraryPath);
         $configJson = $this->encode($config);
 
         $error = $this->ffi->new('char*');
@@ -65,64 +146,435 @@ final class Client
         }
     }
 
+    /**
+     * Returns a client backed by the process-wide native handle for `$config`.
+     * The connection (runtime, socket and Noise session) is reused by every
+     * later call with an equivalent config until `evict()` is called, which
+     * under PHP-FPM means across requests served by the same worker.
+     *
+     * @param array<string,mixed> $config
+     */
+    public static function shared(array $config, ?string $libraryPath = null): self
+    {
+        $config['shared'] = true;
+        $key = md5(($libraryPath ?? '') . "\0" . serialize($config));
+
+        if (self::$sharedPid !== getmypid()) {
+            // Handles inherited across pcntl_fork() belong to the parent; the
+            // native side refuses them and leaks them on free.
+            self::$sharedClients = [];
+            self::$sharedPid = getmypid();
+        }
+
+        return self::$sharedClients[$key] ??= new self($config, $libraryPath);
+    }
+
+    /**
+     * Drops the shared native handle behind this client so the next
+     * `shared()` call reconnects. The handle itself is released once the last
+     * client using it is destroyed.
+     */
+    public function evict(): void
+    {
+        $this->ffi->dbx_client_evict($this->handle);
+        foreach (self::$sharedClients as $key => $client) {
+            if ($client === $this) {
+                unset(self::$sharedClients[$key]);
+            }
+        }
+    }
+
+    /**
+     * Loads the native library into a named FFI scope. Call this from an
+     * `opcache.preload` script (see `preload.php`) so every request can bind
+     * the definitions through `FFI::scope()` instead of re-parsing them.
+     */
+    public static function preload(?string $libraryPath = null): void
+    {
+        $lib = $libraryPath ?? self::defaultLibraryPath();
+        if (!is_file($lib)) {
+            throw new EventDbxException("Native library not found at {$lib}. Build it with `cargo build --release` inside native/.");
+        }
+
+        $header = sys_get_temp_dir() . '/eventdbx-php-' . md5($lib . self::CDEF) . '.h';
+        $contents = sprintf("#define FFI_SCOPE \"%s\"\n#define FFI_LIB \"%s\"\n%s", self::FFI_SCOPE, $lib, self::CDEF);
+        if (@file_put_contents($header, $contents) === false) {
+            throw new EventDbxException("Unable to write FFI header to {$header}");
+        }
+
+        if (FFI::load($header) === null) {
+            throw new EventDbxException("Failed to preload native library from {$header}");
+        }
+    }
+
+    private static function loadFfi(?string $libraryPath): FFI
+    {
+        if ($libraryPath === null) {
+            if (isset(self::$ffiCache[self::FFI_SCOPE])) {
+                return self::$ffiCache[self::FFI_SCOPE];
+            }
+            try {
+                return self::$ffiCache[self::FFI_SCOPE] = FFI::scope(self::FFI_SCOPE);
+            } catch (FFI\Exception) {
+                // not preloaded; fall back to parsing the definitions
+            }
+        }
+
+        $lib = $libraryPath ?? self::defaultLibraryPath();
+        if (isset(self::$ffiCache[$lib])) {
+            return self::$ffiCache[$lib];
+        }
+        if (!is_file($lib)) {
+            throw new EventDbxException("Native library not found at {$lib}. Build it with `cargo build --release` inside native/.");
+        }
+
+        return self::$ffiCache[$lib] = FFI::cdef(self::CDEF, $lib);
+    }
+
     /**
      * @param array<string,mixed> $options
      */
     public function list(string $aggregateType = '', array $options = []): array
     {
-        return $this->callJson(
-            'dbx_list_aggregates',
+        return $this->callBuf(
+            'dbx_list_aggregates_v2',
             $aggregateType,
             $this->encode($options),
         );
     }
 
+    /**
+     * Yields every aggregate matching `list()` options across all pages. The
+     * native side fetches up to `prefetch` pages (default 2) ahead while
+     * earlier ones are consumed, so memory stays bounded by page size.
+     * `adaptiveTake` (`true` or `{targetBytes, targetMs, minTake, maxTake}`)
+     * sizes each page from the pages already fetched for the type.
+     *
+     * @param array<string,mixed> $options
+     * @return Generator<int,mixed>
+     */
+    public function iterateAggregates(string $aggregateType = '', array $options = []): Generator
+    {
+        return $this->iterate($aggregateType, null, $options);
+    }
+
     public function get(string $aggregateType, string $aggregateId): array
     {
-        return $this->callJson(
-            'dbx_get_aggregate',
+        return $this->callBuf(
+            'dbx_get_aggregate_v2',
+            $aggregateType,
+            $aggregateId,
+        );
+    }
+
+    /**
+     * `get()` without decoding the reply up front: fields are decoded when
+     * read from the returned view, e.g. `->get('aggregate.state.status')`.
+     */
+    public function getLazy(string $aggregateType, string $aggregateId): ResultView
+    {
+        return $this->callView(
+            'dbx_get_aggregate_view',
             $aggregateType,
             $aggregateId,
         );
     }
 
+    /**
+     * Fetches many aggregates of one type concurrently in a single native
+     * call. Items are keyed by id; each is `{found, aggregate}` or `{error}`.
+     *
+     * @param list<string> $aggregateIds
+     */
+    public function getMany(string $aggregateType, array $aggregateIds): array
+    {
+        return $this->callJson(
+            'dbx_get_aggregates',
+            $aggregateType,
+            $this->encode(array_values($aggregateIds)),
+        );
+    }
+
+    /**
+     * Mixed-type form of `getMany()`. Items come back as a list in `$refs`
+     * order, each tagged with `aggregateType` and `aggregateId`.
+     *
+     * @param list<array{aggregateType:string,aggregateId:string}> $refs
+     */
+    public function getRefs(array $refs): array
+    {
+        return $this->callJson(
+            'dbx_get_aggregates',
+            '',
+            $this->encode(array_values($refs)),
+        );
+    }
+
     /**
      * @param list<string> $fields
      */
     public function select(string $aggregateType, string $aggregateId, array $fields): array
     {
-        return $this->callJson(
-            'dbx_select_aggregate',
+        return $this->callBuf(
+            'dbx_select_aggregate_v2',
             $aggregateType,
             $aggregateId,
             $this->encode($fields),
         );
     }
 
+    /**
+     * Projects the same `$fields` from many aggregates of one type. Items are
+     * keyed by id; each is `{found, selection}` or `{error}`.
+     *
+     * @param list<string> $aggregateIds
+     * @param list<string> $fields
+     */
+    public function selectMany(string $aggregateType, array $aggregateIds, array $fields): array
+    {
+        return $this->callJson(
+            'dbx_select_aggregates',
+            $aggregateType,
+            $this->encode(array_values($aggregateIds)),
+            $this->encode($fields),
+        );
+    }
+
     /**
      * @param array<string,mixed> $options
      */
     public function events(string $aggregateType, string $aggregateId, array $options = []): array
     {
-        return $this->callJson(
-            'dbx_list_events',
+        return $this->callBuf(
+            'dbx_list_events_v2',
+            $aggregateType,
+            $aggregateId,
+            $this->encode($options),
+        );
+    }
+
+    /**
+     * `events()` without decoding the page up front, for large pages of
+     * which only a few fields are read: `->get('items.3.payload.status')`,
+     * `->count('items')` or `->iterate('items')`.
+     *
+     * @param array<string,mixed> $options
+     */
+    public function eventsLazy(string $aggregateType, string $aggregateId, array $options = []): ResultView
+    {
+        return $this->callView(
+            'dbx_list_events_view',
             $aggregateType,
             $aggregateId,
             $this->encode($options),
         );
     }
 
+    /**
+     * Yields every event of an aggregate across all pages, with the same
+     * read-ahead as `iterateAggregates()`.
+     *
+     * @param array<string,mixed> $options
+     * @return Generator<int,mixed>
+     */
+    public function iterateEvents(string $aggregateType, string $aggregateId, array $options = []): Generator
+    {
+        return $this->iterate($aggregateType, $aggregateId, $options);
+    }
+
     /**
      * @param array<string,mixed> $options
      */
     public function apply(string $aggregateType, string $aggregateId, string $eventType, array $options = []): array
+    {
+        return $this->callBuf(
+            'dbx_append_event_v2',
+            $aggregateType,
+            $aggregateId,
+            $eventType,
+            $this->encode($options),
+        );
+    }
+
+    /**
+     * `apply()` with a payload that is already JSON text. The string is
+     * handed to the native library as pointer and length, without a
+     * `json_decode()`/`json_encode()` round trip; `payload` in `$options` is
+     * ignored.
+     *
+     * @param array<string,mixed> $options
+     */
+    public function applyRaw(string $aggregateType, string $aggregateId, string $eventType, string $payloadJson, array $options = []): array
+    {
+        return $this->callJson(
+            'dbx_append_event_raw',
+            $aggregateType,
+            $aggregateId,
+            $eventType,
+            $payloadJson,
+            strlen($payloadJson),
+            $this->encode($options),
+        );
+    }
+
+    /**
+     * `create()` with a payload that is already JSON text; see `applyRaw()`.
+     *
+     * @param array<string,mixed> $options
+     */
+    public function createRaw(string $aggregateType, string $aggregateId, string $eventType, string $payloadJson, array $options = []): array
     {
         return $this->callJson(
-            'dbx_append_event',
+            'dbx_create_aggregate_raw',
             $aggregateType,
             $aggregateId,
             $eventType,
+            $payloadJson,
+            strlen($payloadJson),
+            $this->encode($options),
+        );
+    }
+
+    /**
+     * Parses `$options` once in the native library for repeated `list`,
+     * `events` or `apply` calls on `$aggregateType` (`apply` also needs
+     * `eventType` in `$options`). Executing the statement only passes the
+     * aggregate id, cursor and payload.
+     *
+     * @param 'list'|'events'|'apply' $operation
+     * @param array<string,mixed> $options
+     */
+    public function prepare(string $operation, string $aggregateType = '', array $options = []): PreparedStatement
+    {
+        $error = $this->ffi->new('char*');
+        $id = $this->ffi->dbx_prepare(
+            $this->handle,
+            $operation,
+            $aggregateType,
             $this->encode($options),
+            FFI::addr($error),
+        );
+        $this->throwIfError($error);
+
+        return new PreparedStatement($this, $id);
+    }
+
+    /**
+     * @internal use PreparedStatement::execute()
+     */
+    public function executeStatement(int $statement, ?string $aggregateId, ?string $cursor, mixed $payload): array
+    {
+        return $this->callJson(
+            'dbx_execute',
+            $statement,
+            $aggregateId,
+            $cursor,
+            $payload === null ? null : $this->encode($payload),
+        );
+    }
+
+    /**
+     * @internal called when a PreparedStatement is destroyed
+     */
+    public function closeStatement(int $statement): void
+    {
+        $this->ffi->dbx_statement_free($this->handle, $statement);
+    }
+
+    /**
+     * Queues an append on the native write queue and returns its sequence
+     * number without waiting for the server. When the queue is full the
+     * `writeQueue` policy applies: `block` waits for room, `drop` returns
+     * null, `fail` throws. Collect the results with `flush()`: freeing the
+     * handle only waits `writeQueue.closeTimeoutMs` for the rest.
+     *
+     * @param array<string,mixed> $options
+     */
+    public function enqueueApply(string $aggregateType, string $aggregateId, string $eventType, array $options = []): ?int
+    {
+        $error = $this->ffi->new('char*');
+        $seq = $this->ffi->dbx_enqueue_append(
+            $this->handle,
+            $aggregateType,
+            $aggregateId,
+            $eventType,
+            $this->encode($options),
+            FFI::addr($error),
+        );
+        $this->throwIfError($error);
+
+        return $seq === 0 ? null : $seq;
+    }
+
+    /**
+     * Waits up to `$timeoutMs` (null waits until every queued append is
+     * acknowledged, 0 only collects) and returns
+     * `{items: [{seq, aggregateType, aggregateId, event|error}], failed, pending}`
+     * for the appends acknowledged since the previous flush.
+     */
+    public function flush(?int $timeoutMs = null): array
+    {
+        return $this->callJson('dbx_flush', $timeoutMs ?? -1);
+    }
+
+    /**
+     * Appends many events in one native call. Each entry carries
+     * `aggregateType`, `aggregateId`, `eventType` plus the same keys accepted
+     * by `apply()` options; `token`/`publishTargets` in `$options` are used
+     * for entries that omit them. Results are returned per item, in order.
+     *
+     * @param list<array<string,mixed>> $events
+     * @param array<string,mixed> $options
+     */
+    public function applyMany(array $events, array $options = []): array
+    {
+        return $this->callJson(
+            'dbx_append_events',
+            $this->encode(array_values($events)),
+            $this->encode($options),
+        );
+    }
+
+    /**
+     * Streams every event of every matching aggregate to `$target` (a file
+     * path, or an open file descriptor number) entirely inside the native
+     * library and returns a `{aggregates, events, bytes, failed, errors}`
+     * summary. Accepts the `list()` options plus `format` (`ndjson` or
+     * `msgpack`), `concurrency`, `eventsTake`, `adaptiveTake` (as for
+     * `iterateEvents()`) and `compression` (`zstd`, or `{algorithm, level}`).
+     *
+     * @param array<string,mixed> $options
+     */
+    public function exportEvents(string $aggregateType, string|int $target, array $options = []): array
+    {
+        return $this->callJson(
+            'dbx_export_events',
+            $aggregateType,
+            $this->encode($options),
+            is_string($target) ? $target : null,
+            is_int($target) ? $target : -1,
+        );
+    }
+
+    /**
+     * Filters and aggregates events inside the native library, returning
+     * only the result: `{aggregates, events, matched, failed, errors}` plus
+     * `values`, or `groups` keyed by the `groupBy` value. With a null
+     * `$aggregateId` every aggregate matching the `list()` options in
+     * `$spec` is reduced, `concurrency` at a time. The spec takes
+     * `eventTypes`, `where` (`[{path, op, value}]` with `eq`, `ne`, `gt`,
+     * `gte`, `lt`, `lte`, `in` or `exists`), `groupBy` and `metrics`
+     * (`name => {op: count|sum|avg|min|max|latest, path, by?}`).
+     *
+     * @param array<string,mixed> $spec
+     */
+    public function reduceEvents(string $aggregateType, ?string $aggregateId, array $spec = []): array
+    {
+        return $this->callJson(
+            'dbx_reduce_events',
+            $aggregateType,
+            $aggregateId,
+            $this->encode($spec),
         );
     }
 
@@ -193,6 +645,34 @@ final class Client
         );
     }
 
+    /**
+     * Verifies many aggregates concurrently inside the native library: every
+     * id in `$ids`, or every aggregate of `$aggregateType` matched by the
+     * `list()` options when `$ids` is null. Returns `{verified, mismatched,
+     * failed, items}` with one `{aggregateId, merkleRoot}` (or `error`) item
+     * per aggregate. With `expected` (id => root) only mismatches and failures
+     * are listed; with `target` (a file path or descriptor number) they are
+     * written there as NDJSON instead of returned. `concurrency` caps the
+     * verifications in flight (default 8).
+     *
+     * @param list<string>|null $ids
+     * @param array<string,mixed> $options
+     */
+    public function verifyMany(string $aggregateType, ?array $ids = null, array $options = []): array
+    {
+        $target = $options['target'] ?? null;
+        unset($options['target']);
+
+        return $this->callJson(
+            'dbx_verify_aggregates',
+            $aggregateType,
+            $ids === null ? null : $this->encode(array_values($ids)),
+            $this->encode($options),
+            is_string($target) ? $target : null,
+            is_int($target) ? $target : -1,
+        );
+    }
+
     /**
      * @param array<string,mixed> $options
      */
@@ -229,12 +709,334 @@ final class Client
         );
     }
 
+    /**
+     * The latest snapshot of an aggregate plus only the events recorded after
+     * it, in one call. With `snapshotAfter` set, a tail of at least that many
+     * events also takes a new snapshot for the next load.
+     *
+     * @param array{token?:string,eventsTake?:int,snapshotAfter?:int,snapshotComment?:string} $options
+     * @return array{snapshot:mixed,tailEvents:list<mixed>,createdSnapshot?:mixed,snapshotError?:string}
+     */
+    public function loadState(string $aggregateType, string $aggregateId, array $options = []): array
+    {
+        return $this->callJson(
+            'dbx_load_state',
+            $aggregateType,
+            $aggregateId,
+            $this->encode($options),
+        );
+    }
+
+    public function submitGet(string $aggregateType, string $aggregateId): PendingResult
+    {
+        return $this->submit(
+            'dbx_submit_get_aggregate',
+            $aggregateType,
+            $aggregateId,
+        );
+    }
+
+    /**
+     * @param list<string> $fields
+     */
+    public function submitSelect(string $aggregateType, string $aggregateId, array $fields): PendingResult
+    {
+        return $this->submit(
+            'dbx_submit_select_aggregate',
+            $aggregateType,
+            $aggregateId,
+            $this->encode($fields),
+        );
+    }
+
+    /**
+     * @param array<string,mixed> $options
+     */
+    public function submitEvents(string $aggregateType, string $aggregateId, array $options = []): PendingResult
+    {
+        return $this->submit(
+            'dbx_submit_list_events',
+            $aggregateType,
+            $aggregateId,
+            $this->encode($options),
+        );
+    }
+
+    /**
+     * @param array<string,mixed> $options
+     */
+    public function submitApply(string $aggregateType, string $aggregateId, string $eventType, array $options = []): PendingResult
+    {
+        return $this->submit(
+            'dbx_submit_append_event',
+            $aggregateType,
+            $aggregateId,
+            $eventType,
+            $this->encode($options),
+        );
+    }
+
+    /**
+     * Drops every entry of the read cache configured with the `cache` option.
+     */
+    public function clearCache(): void
+    {
+        $this->ffi->dbx_cache_clear($this->handle);
+    }
+
+    /**
+     * Per-export call counts, errors, response bytes and latency percentiles
+     * recorded by the native handle, along with pool queue wait and server
+     * time, plus the PHP-side encode/decode time and request/response bytes
+     * of this client under `php`.
+     */
+    public function metrics(): array
+    {
+        $error = $this->ffi->new('char*');
+        $ptr = $this->ffi->dbx_metrics_snapshot($this->handle, FFI::addr($error));
+        $this->throwIfError($error);
+        if ($ptr === null || FFI::isNull($ptr)) {
+            throw new EventDbxException('dbx_metrics_snapshot returned no data');
+        }
+
+        $metrics = $this->decodeNative($ptr);
+        $metrics['php'] = $this->phpMetrics;
+        return $metrics;
+    }
+
+    /**
+     * The same metrics in Prometheus text exposition format.
+     */
+    public function metricsPrometheus(): string
+    {
+        $ptr = $this->ffi->dbx_metrics_prometheus($this->handle);
+        if ($ptr === null || FFI::isNull($ptr)) {
+            throw new EventDbxException('dbx_metrics_prometheus returned no data');
+        }
+        $text = FFI::string($ptr);
+        $this->ffi->dbx_string_free($ptr);
+
+        $text .= "# TYPE eventdbx_php_encode_seconds_total counter\n";
+        $text .= sprintf("eventdbx_php_encode_seconds_total %.9F\n", $this->phpMetrics['encodeNs'] / 1e9);
+        $text .= "# TYPE eventdbx_php_decode_seconds_total counter\n";
+        $text .= sprintf("eventdbx_php_decode_seconds_total %.9F\n", $this->phpMetrics['decodeNs'] / 1e9);
+        $text .= "# TYPE eventdbx_php_request_bytes_total counter\n";
+        $text .= "eventdbx_php_request_bytes_total {$this->phpMetrics['bytesIn']}\n";
+        $text .= "# TYPE eventdbx_php_response_bytes_total counter\n";
+        $text .= "eventdbx_php_response_bytes_total {$this->phpMetrics['bytesOut']}\n";
+        return $text;
+    }
+
+    /**
+     * Returns the decoded response of a submitted operation once it has
+     * finished (consuming the ticket), or null while it is still running.
+     */
+    public function poll(int $ticket): ?array
+    {
+        $error = $this->ffi->new('char*');
+        $jsonPtr = $this->ffi->dbx_poll($this->handle, $ticket, FFI::addr($error));
+        $this->throwIfError($error);
+
+        if ($jsonPtr === null || FFI::isNull($jsonPtr)) {
+            return null;
+        }
+        return $this->decodeResponse($jsonPtr);
+    }
+
+    /**
+     * Blocks until one of `$pending` has finished and returns it, or null
+     * once `$timeoutMs` elapses (null waits indefinitely, 0 only checks).
+     *
+     * @param list<PendingResult> $pending
+     */
+    public function waitAny(array $pending, ?int $timeoutMs = null): ?PendingResult
+    {
+        $count = count($pending);
+        if ($count === 0) {
+            return null;
+        }
+
+        $tickets = $this->ffi->new("uint64_t[{$count}]");
+        $byTicket = [];
+        foreach (array_values($pending) as $i => $result) {
+            $tickets[$i] = $result->ticket();
+            $byTicket[$result->ticket()] = $result;
+        }
+
+        $ready = $this->ffi->dbx_wait_any($this->handle, $tickets, $count, $timeoutMs ?? -1);
+        return $byTicket[$ready] ?? null;
+    }
+
+    public function cancel(int $ticket): void
+    {
+        $this->ffi->dbx_cancel($this->handle, $ticket);
+    }
+
+    /**
+     * File descriptor that turns readable when a submitted operation
+     * finishes, e.g. `fopen("php://fd/{$fd}", 'r')` for `stream_select()` or an
+     * event loop. Call `drainNotifications()` when it fires, then poll the
+     * pending results. Throws on a current_thread runtime or a platform
+     * without pipes.
+     */
+    public function notifyFd(): int
+    {
+        $fd = $this->ffi->dbx_notify_fd($this->handle);
+        if ($fd < 0) {
+            throw new EventDbxException('notifyFd() needs a multi_thread or shared runtime on a platform with pipes');
+        }
+        return $fd;
+    }
+
+    public function drainNotifications(): void
+    {
+        $this->ffi->dbx_notify_drain($this->handle);
+    }
+
+    /**
+     * Follows the events of the given aggregates without polling from PHP.
+     * `$filter` takes `aggregates` (a list of `['aggregateType',
+     * 'aggregateId', 'fromVersion'?]`; without `fromVersion` only events
+     * after the current version are delivered), `intervalMs` (default 250),
+     * `buffer` (default 1024), `eventsTake` and `token`.
+     *
+     * @param array<string,mixed> $filter
+     */
+    public function subscribe(array $filter): Subscription
+    {
+        $error = $this->ffi->new('char*');
+        $feed = $this->ffi->dbx_subscribe($this->handle, $this->encode($filter), FFI::addr($error));
+        $this->throwIfError($error);
+        if ($feed === null || FFI::isNull($feed)) {
+            throw new EventDbxException('dbx_subscribe returned no subscription');
+        }
+
+        return new Subscription($this, $feed);
+    }
+
+    /**
+     * @internal use Subscription::next()
+     */
+    public function subscriptionNext(CData $feed, int $max, ?int $timeoutMs): array
+    {
+        return $this->callJson('dbx_subscription_next_batch', $feed, $max, $timeoutMs ?? -1);
+    }
+
+    /**
+     * @internal use Subscription::fd()
+     */
+    public function subscriptionFd(CData $feed): int
+    {
+        return $this->ffi->dbx_subscription_fd($feed);
+    }
+
+    /**
+     * @internal called when a Subscription is closed
+     */
+    public function closeSubscription(CData $feed): void
+    {
+        $this->ffi->dbx_subscription_close($feed);
+    }
+
+    /**
+     * @internal use ResultView::get()
+     */
+    public function viewGet(CData $view, string $path, mixed $default): mixed
+    {
+        $error = $this->ffi->new('char*');
+        $buf = $this->ffi->dbx_view_get($this->handle, $view, $path, strlen($path), FFI::addr($error));
+        $this->throwIfError($error);
+        if (FFI::isNull($buf->ptr)) {
+            return $default;
+        }
+        return $this->decodeBufValue($buf);
+    }
+
+    /**
+     * @internal use ResultView::keys()
+     * @return list<int|string>
+     */
+    public function viewKeys(CData $view, string $path): array
+    {
+        $error = $this->ffi->new('char*');
+        $buf = $this->ffi->dbx_view_keys($this->handle, $view, $path, strlen($path), FFI::addr($error));
+        $this->throwIfError($error);
+        return FFI::isNull($buf->ptr) ? [] : $this->decodeBuf($buf);
+    }
+
+    /**
+     * @internal use ResultView::count()
+     */
+    public function viewLen(CData $view, string $path): int
+    {
+        return $this->ffi->dbx_view_len($view, $path, strlen($path));
+    }
+
+    /**
+     * @internal called when a ResultView is closed
+     */
+    public function closeView(CData $view): void
+    {
+        $this->ffi->dbx_view_free($view);
+    }
+
+    /**
+     * @param mixed ...$args
+     */
+    private function submit(string $function, ...$args): PendingResult
+    {
+        $error = $this->ffi->new('char*');
+        $callArgs = array_merge([$this->handle], $args, [FFI::addr($error)]);
+        $ticket = $this->ffi->{$function}(...$callArgs);
+        $this->throwIfError($error);
+
+        return new PendingResult($this, $ticket);
+    }
+
+    /**
+     * @param array<string,mixed> $options
+     * @return Generator<int,mixed>
+     */
+    private function iterate(string $aggregateType, ?string $aggregateId, array $options): Generator
+    {
+        $error = $this->ffi->new('char*');
+        $cursor = $this->ffi->dbx_cursor_open(
+            $this->handle,
+            $aggregateType,
+            $aggregateId,
+            $this->encode($options),
+            FFI::addr($error),
+        );
+        $this->throwIfError($error);
+        if ($cursor === null || FFI::isNull($cursor)) {
+            throw new EventDbxException('dbx_cursor_open returned no cursor');
+        }
+
+        try {
+            while (true) {
+                $page = $this->ffi->dbx_cursor_next_v2($this->handle, $cursor, FFI::addr($error));
+                $this->throwIfError($error);
+                if (FFI::isNull($page->ptr)) {
+                    return;
+                }
+                foreach ($this->decodeBuf($page)['items'] ?? [] as $item) {
+                    yield $item;
+                }
+            }
+        } finally {
+            $this->ffi->dbx_cursor_close($cursor);
+        }
+    }
+
     private function encode(mixed $value): string
     {
+        $started = hrtime(true);
         $json = json_encode($value);
         if ($json === false) {
             throw new EventDbxException('Failed to encode request payload to JSON');
         }
+        $this->phpMetrics['encodeNs'] += hrtime(true) - $started;
+        $this->phpMetrics['bytesIn'] += strlen($json);
         return $json;
     }
 
@@ -253,10 +1055,122 @@ final class Client
             throw new EventDbxException("{$function} returned no data");
         }
 
+        return $this->decodeResponse($jsonPtr);
+    }
+
+    /**
+     * Calls a `_v2` export: every argument is a string passed as pointer and
+     * length, and the reply comes back as a sized `DbxBuf`.
+     */
+    private function callBuf(string $function, string ...$args): array
+    {
+        $error = $this->ffi->new('char*');
+        $callArgs = [$this->handle];
+        foreach ($args as $arg) {
+            $callArgs[] = $arg;
+            $callArgs[] = strlen($arg);
+        }
+        $callArgs[] = FFI::addr($error);
+        $buf = $this->ffi->{$function}(...$callArgs);
+        $this->throwIfError($error);
+
+        if (FFI::isNull($buf->ptr)) {
+            $name = substr($function, 0, -strlen('_v2'));
+            throw new EventDbxException("{$name} returned no data");
+        }
+
+        return $this->decodeBuf($buf);
+    }
+
+    /**
+     * `callBuf()` for the view exports, which keep the reply natively.
+     */
+    private function callView(string $function, string ...$args): ResultView
+    {
+        $error = $this->ffi->new('char*');
+        $callArgs = [$this->handle];
+        foreach ($args as $arg) {
+            $callArgs[] = $arg;
+            $callArgs[] = strlen($arg);
+        }
+        $callArgs[] = FFI::addr($error);
+        $view = $this->ffi->{$function}(...$callArgs);
+        $this->throwIfError($error);
+
+        if ($view === null || FFI::isNull($view)) {
+            throw new EventDbxException("{$function} returned no view");
+        }
+
+        return new ResultView($this, $view);
+    }
+
+    private function decodeBuf(CData $buf): array
+    {
+        $started = hrtime(true);
+        $bytes = FFI::string($buf->ptr, $buf->len);
+        $this->ffi->dbx_buf_release($this->handle, $buf);
+        $decoded = $this->decodeBytes($bytes);
+        $this->phpMetrics['decodeNs'] += hrtime(true) - $started;
+        return $decoded;
+    }
+
+    /**
+     * `decodeBuf()` for a part of a reply, which may be a scalar.
+     */
+    private function decodeBufValue(CData $buf): mixed
+    {
+        $started = hrtime(true);
+        $bytes = FFI::string($buf->ptr, $buf->len);
+        $this->ffi->dbx_buf_release($this->handle, $buf);
+        $this->phpMetrics['bytesOut'] += strlen($bytes);
+        if ($this->msgpack) {
+            $decoded = msgpack_unpack($bytes);
+        } else {
+            $decoded = json_decode($bytes, true);
+            if ($decoded === null && json_last_error() !== JSON_ERROR_NONE) {
+                throw new EventDbxException("Failed to decode response JSON: " . json_last_error_msg());
+            }
+        }
+        $this->phpMetrics['decodeNs'] += hrtime(true) - $started;
+        return $decoded;
+    }
+
+    private function decodeResponse(CData $jsonPtr): array
+    {
+        $started = hrtime(true);
+        $decoded = $this->decodeNative($jsonPtr);
+        $this->phpMetrics['decodeNs'] += hrtime(true) - $started;
+        return $decoded;
+    }
+
+    private function decodeNative(CData $jsonPtr): array
+    {
+        if ($this->msgpack) {
+            // Binary replies carry an 8-byte little-endian length prefix.
+            $length = unpack('P', FFI::string($jsonPtr, 8))[1];
+            $bytes = FFI::string($jsonPtr + 8, $length);
+            $this->ffi->dbx_bytes_free($jsonPtr);
+            return $this->decodeBytes($bytes);
+        }
+
         $json = FFI::string($jsonPtr);
         $this->ffi->dbx_string_free($jsonPtr);
+        return $this->decodeBytes($json);
+    }
+
+    private function decodeBytes(string $bytes): array
+    {
+        $this->phpMetrics['bytesOut'] += strlen($bytes);
+
+        if ($this->msgpack) {
+            $decoded = msgpack_unpack($bytes);
+            if (!is_array($decoded)) {
+                throw new EventDbxException('Failed to decode MessagePack response');
+            }
+            return $decoded;
+        }
 
-        $decoded = json_decode($json, true);
+        $decoded = json_decode($bytes, true);
         if ($decoded === null && json_last_error() !== JSON_ERROR_NONE) {
             throw new EventDbxException("Failed to decode response JSON: " . json_last_error_msg());
         }
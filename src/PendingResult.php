@@ -0,0 +1,81 @@
+<?php
+
+declare(strict_types=1);
+
+namespace EventDbx;
+
+use EventDbx\Exception\EventDbxException;
+
+/**
+ * Handle to an operation started with one of the `Client::submit*()` methods.
+ * The operation runs on the native runtime; this object only holds its ticket.
+ */
+final class PendingResult
+{
+    private bool $settled = false;
+    private ?array $result = null;
+    private ?EventDbxException $error = null;
+
+    public function __construct(private readonly Client $client, private readonly int $ticket)
+    {
+    }
+
+    public function __destruct()
+    {
+        if (!$this->settled) {
+            $this->client->cancel($this->ticket);
+        }
+    }
+
+    public function ticket(): int
+    {
+        return $this->ticket;
+    }
+
+    /**
+     * Checks without blocking whether the operation has finished.
+     */
+    public function isReady(): bool
+    {
+        if ($this->settled) {
+            return true;
+        }
+
+        try {
+            $result = $this->client->poll($this->ticket);
+        } catch (EventDbxException $e) {
+            $this->error = $e;
+            $this->settled = true;
+            return true;
+        }
+        if ($result === null) {
+            return false;
+        }
+
+        $this->result = $result;
+        $this->settled = true;
+        return true;
+    }
+
+    /**
+     * Blocks until the operation finishes and returns its decoded response.
+     * A null timeout waits indefinitely; otherwise `$timeoutMs` bounds the
+     * whole wait, however often `waitAny()` returns early.
+     */
+    public function wait(?int $timeoutMs = null): array
+    {
+        $deadline = $timeoutMs === null ? null : hrtime(true) + max(0, $timeoutMs) * 1_000_000;
+        while (!$this->isReady()) {
+            $remainingMs = $deadline === null ? null : intdiv(max(0, $deadline - hrtime(true)), 1_000_000);
+            $ready = $this->client->waitAny([$this], $remainingMs);
+            if ($ready === null || ($remainingMs === 0 && !$this->isReady())) {
+                throw new EventDbxException("Timed out waiting for ticket {$this->ticket}");
+            }
+        }
+
+        if ($this->error !== null) {
+            throw $this->error;
+        }
+        return $this->result ?? [];
+    }
+}
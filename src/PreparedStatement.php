@@ -0,0 +1,37 @@
+<?php
+
+declare(strict_types=1);
+
+namespace EventDbx;
+
+/**
+ * Options parsed once by `Client::prepare()`. The native handle keeps the
+ * parsed form; this object only holds its id and frees it when destroyed.
+ */
+final class PreparedStatement
+{
+    public function __construct(private readonly Client $client, private readonly int $id)
+    {
+    }
+
+    public function __destruct()
+    {
+        $this->client->closeStatement($this->id);
+    }
+
+    public function id(): int
+    {
+        return $this->id;
+    }
+
+    /**
+     * Runs the statement. `events` and `apply` statements need
+     * `$aggregateId`; `$cursor` pages `list`/`events`; `$payload` replaces
+     * the payload prepared for `apply`. Responses have the same shape as
+     * `list()`, `events()` and `apply()`.
+     */
+    public function execute(?string $aggregateId = null, ?string $cursor = null, mixed $payload = null): array
+    {
+        return $this->client->executeStatement($this->id, $aggregateId, $cursor, $payload);
+    }
+}
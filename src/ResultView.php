@@ -0,0 +1,107 @@
+<?php
+
+declare(strict_types=1);
+
+namespace EventDbx;
+
+use Countable;
+use EventDbx\Exception\EventDbxException;
+use FFI\CData;
+use Generator;
+use IteratorAggregate;
+
+/**
+ * A reply returned by `Client::getLazy()` or `Client::eventsLazy()`. The
+ * reply stays in native memory; only the parts read through `get()` or
+ * `iterate()` are decoded into PHP values. Paths are dot-separated object
+ * keys and list positions, such as `items.3.payload.status`; the empty path
+ * is the whole reply. The native memory is freed when the view is closed or
+ * destroyed.
+ *
+ * @implements IteratorAggregate<int|string,mixed>
+ */
+final class ResultView implements Countable, IteratorAggregate
+{
+    private ?CData $view;
+
+    public function __construct(private readonly Client $client, CData $view)
+    {
+        $this->view = $view;
+    }
+
+    public function __destruct()
+    {
+        $this->close();
+    }
+
+    /**
+     * The decoded value at `$path`, or `$default` when the path does not
+     * resolve.
+     */
+    public function get(string $path = '', mixed $default = null): mixed
+    {
+        return $this->client->viewGet($this->open(), $path, $default);
+    }
+
+    public function has(string $path): bool
+    {
+        return $this->client->viewLen($this->open(), $path) !== -2;
+    }
+
+    /**
+     * Elements of the list or entries of the map at `$path`; 0 for a scalar
+     * or a path that does not resolve.
+     */
+    public function count(string $path = ''): int
+    {
+        return max(0, $this->client->viewLen($this->open(), $path));
+    }
+
+    /**
+     * Keys of the map at `$path`, or the positions of the list there.
+     *
+     * @return list<int|string>
+     */
+    public function keys(string $path = ''): array
+    {
+        return $this->client->viewKeys($this->open(), $path);
+    }
+
+    /**
+     * Yields the entries under `$path` one at a time, decoding each only
+     * when it is reached, e.g. `iterate('items')` for the events of a page.
+     *
+     * @return Generator<int|string,mixed>
+     */
+    public function iterate(string $path = ''): Generator
+    {
+        $prefix = $path === '' ? '' : $path . '.';
+        foreach ($this->keys($path) as $key) {
+            yield $key => $this->get($prefix . $key);
+        }
+    }
+
+    /**
+     * @return Generator<int|string,mixed>
+     */
+    public function getIterator(): Generator
+    {
+        return $this->iterate();
+    }
+
+    public function close(): void
+    {
+        if ($this->view !== null) {
+            $this->client->closeView($this->view);
+            $this->view = null;
+        }
+    }
+
+    private function open(): CData
+    {
+        if ($this->view === null) {
+            throw new EventDbxException('result view is closed');
+        }
+        return $this->view;
+    }
+}
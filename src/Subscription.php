@@ -0,0 +1,62 @@
+<?php
+
+declare(strict_types=1);
+
+namespace EventDbx;
+
+use EventDbx\Exception\EventDbxException;
+use FFI\CData;
+
+/**
+ * A change feed opened by `Client::subscribe()`. The native library polls
+ * the watched aggregates in the background and buffers new events; this
+ * object drains them and closes the feed when destroyed.
+ */
+final class Subscription
+{
+    private ?CData $feed;
+
+    public function __construct(private readonly Client $client, CData $feed)
+    {
+        $this->feed = $feed;
+    }
+
+    public function __destruct()
+    {
+        $this->close();
+    }
+
+    /**
+     * Up to `$max` buffered changes, each `['aggregateType', 'aggregateId',
+     * 'event' => [...]]` (or `'error'` when polling an aggregate failed).
+     * Waits up to `$timeoutMs` for the first one (null waits indefinitely,
+     * 0 returns immediately); an empty list means nothing arrived. Throws
+     * once the feed has stopped and everything it buffered was drained.
+     *
+     * @return list<array<string,mixed>>
+     */
+    public function next(int $max = 100, ?int $timeoutMs = null): array
+    {
+        if ($this->feed === null) {
+            throw new EventDbxException('subscription is closed');
+        }
+        return $this->client->subscriptionNext($this->feed, $max, $timeoutMs)['items'] ?? [];
+    }
+
+    /**
+     * Descriptor that becomes readable when changes are buffered, for
+     * `stream_select()` or an event loop; -1 where unsupported.
+     */
+    public function fd(): int
+    {
+        return $this->feed === null ? -1 : $this->client->subscriptionFd($this->feed);
+    }
+
+    public function close(): void
+    {
+        if ($this->feed !== null) {
+            $this->client->closeSubscription($this->feed);
+            $this->feed = null;
+        }
+    }
+}
@@ -80,6 +80,131 @@ final class ClientTest extends TestCase
         new Client(['mode' => 'config-error'], self::$libraryPath);
     }
 
+    public function testRejectsUnsupportedResponseFormat(): void
+    {
+        $this->expectException(EventDbxException::class);
+        $this->expectExceptionMessage('Unsupported responseFormat');
+
+        $this->createClient(['responseFormat' => 'xml']);
+    }
+
+    public function testIterateEventsYieldsItemsAcrossPages(): void
+    {
+        $client = $this->createClient();
+
+        $items = iterator_to_array($client->iterateEvents('order', '1', ['prefetch' => 4]));
+
+        $this->assertCount(6, $items);
+        $this->assertSame(['kind' => 'events', 'page' => 0, 'index' => 0], $items[0]);
+        $this->assertSame(['kind' => 'events', 'page' => 2, 'index' => 1], $items[5]);
+    }
+
+    public function testIterateAggregatesCanStopEarly(): void
+    {
+        $client = $this->createClient();
+
+        foreach ($client->iterateAggregates('order') as $item) {
+            $this->assertSame('aggregates', $item['kind']);
+            break;
+        }
+    }
+
+    public function testIteratePropagatesOpenError(): void
+    {
+        $client = $this->createClient();
+
+        $this->expectException(EventDbxException::class);
+        $this->expectExceptionMessage('native error from stub library');
+
+        iterator_to_array($client->iterateEvents('order', 'native-error'));
+    }
+
+    public function testExportEventsPassesPathOrFd(): void
+    {
+        $client = $this->createClient();
+
+        $toPath = $client->exportEvents('order', '/tmp/orders.ndjson', ['concurrency' => 8]);
+        $this->assertSame('/tmp/orders.ndjson', $toPath['path']);
+        $this->assertSame(['concurrency' => 8], $toPath['options']);
+
+        $toFd = $client->exportEvents('order', 3);
+        $this->assertSame(3, $toFd['fd']);
+        $this->assertArrayNotHasKey('path', $toFd);
+    }
+
+    public function testReduceEventsPassesSpecAndOptionalId(): void
+    {
+        $client = $this->createClient();
+        $spec = ['eventTypes' => ['paid'], 'groupBy' => 'payload.currency', 'metrics' => ['total' => ['op' => 'sum', 'path' => 'payload.amount']]];
+
+        $one = $client->reduceEvents('order', '42', $spec);
+        $this->assertSame('42', $one['aggregateId']);
+        $this->assertSame($spec, $one['spec']);
+
+        $all = $client->reduceEvents('order', null, ['concurrency' => 8]);
+        $this->assertArrayNotHasKey('aggregateId', $all);
+        $this->assertSame(['concurrency' => 8], $all['spec']);
+    }
+
+    public function testVerifyManyPassesIdsOptionsAndTarget(): void
+    {
+        $client = $this->createClient();
+
+        $listed = $client->verifyMany('order', null, ['concurrency' => 16, 'filter' => 'archived = false']);
+        $this->assertSame('dbx_verify_aggregates', $listed['function']);
+        $this->assertNull($listed['ids']);
+        $this->assertSame(-1, $listed['fd']);
+        $this->assertSame(['concurrency' => 16, 'filter' => 'archived = false'], $listed['options']);
+
+        $checked = $client->verifyMany('order', ['a' => '1', 'b' => '2'], [
+            'expected' => ['1' => 'root-1'],
+            'target' => '/tmp/mismatches.ndjson',
+        ]);
+        $this->assertSame(['1', '2'], $checked['ids']);
+        $this->assertSame('/tmp/mismatches.ndjson', $checked['path']);
+        $this->assertSame(['expected' => ['1' => 'root-1']], $checked['options']);
+    }
+
+    public function testClearCacheIsAvailableWithoutCacheConfig(): void
+    {
+        $client = $this->createClient();
+        $client->clearCache();
+
+        $this->assertSame('dbx_get_aggregate', $client->get('order', '1')['function']);
+    }
+
+    public function testMetricsMergeNativeAndPhpCounters(): void
+    {
+        $client = $this->createClient();
+        $client->events('order', '1', ['take' => 5]);
+        $client->events('order', '2', ['take' => 5]);
+
+        $metrics = $client->metrics();
+        $this->assertSame(2, $metrics['ops']['dbx_list_events']['calls']);
+        $this->assertSame(0, $metrics['ops']['dbx_get_aggregate']['calls']);
+        $this->assertGreaterThan(0, $metrics['php']['bytesIn']);
+        $this->assertGreaterThan(0, $metrics['php']['bytesOut']);
+
+        $text = $client->metricsPrometheus();
+        $this->assertStringContainsString('eventdbx_calls_total{op="dbx_list_events"} 2', $text);
+        $this->assertStringContainsString('eventdbx_php_request_bytes_total', $text);
+    }
+
+    public function testSharedReusesClientForEquivalentConfig(): void
+    {
+        $first = Client::shared(['dsn' => 'shared'], self::$libraryPath);
+        $second = Client::shared(['dsn' => 'shared'], self::$libraryPath);
+        $other = Client::shared(['dsn' => 'shared-other'], self::$libraryPath);
+
+        $this->assertSame($first, $second);
+        $this->assertNotSame($first, $other);
+        $this->assertSame('dbx_get_aggregate', $first->get('order', '1')['function']);
+
+        $first->evict();
+
+        $this->assertNotSame($first, Client::shared(['dsn' => 'shared'], self::$libraryPath));
+    }
+
     public function testGetReturnsDecodedResponse(): void
     {
         $client = $this->createClient();
@@ -91,6 +216,42 @@ final class ClientTest extends TestCase
         $this->assertSame('123', $result['aggregate_id']);
     }
 
+    public function testGetManySendsIdsInOneCall(): void
+    {
+        $client = $this->createClient();
+
+        $result = $client->getMany('order', ['a' => '1', 'b' => '2']);
+
+        $this->assertSame('dbx_get_aggregates', $result['function']);
+        $this->assertSame('order', $result['aggregate_type']);
+        $this->assertSame(['1', '2'], $result['ids']);
+    }
+
+    public function testGetRefsLeavesTypeToEachRef(): void
+    {
+        $client = $this->createClient();
+
+        $refs = [
+            ['aggregateType' => 'order', 'aggregateId' => '1'],
+            ['aggregateType' => 'person', 'aggregateId' => 'p-1'],
+        ];
+        $result = $client->getRefs($refs);
+
+        $this->assertSame('', $result['aggregate_type']);
+        $this->assertSame($refs, $result['ids']);
+    }
+
+    public function testSelectManySharesFields(): void
+    {
+        $client = $this->createClient();
+
+        $result = $client->selectMany('order', ['1', '2'], ['status', 'total']);
+
+        $this->assertSame('dbx_select_aggregates', $result['function']);
+        $this->assertSame(['1', '2'], $result['ids']);
+        $this->assertSame(['status', 'total'], $result['fields']);
+    }
+
     public function testArchiveAndRestoreToggleArchiveFlag(): void
     {
         $client = $this->createClient();
@@ -112,6 +273,13 @@ final class ClientTest extends TestCase
         $client->apply('order', 'native-error', 'created', ['foo' => 'bar']);
     }
 
+    public function testSizedArgumentsAllowEmbeddedNul(): void
+    {
+        $client = $this->createClient();
+
+        $this->assertSame(3, $client->get('order', "a\0b")['aggregate_id_len']);
+    }
+
     public function testNullResponseThrows(): void
     {
         $client = $this->createClient();
@@ -142,6 +310,164 @@ final class ClientTest extends TestCase
         $client->apply('order', '123', 'created', ['infinite' => INF]);
     }
 
+    public function testApplyRawPassesPayloadBytesWithLength(): void
+    {
+        $client = $this->createClient();
+
+        $payload = '{"name":"Ada","tags":["a","b"]}';
+        $result = $client->applyRaw('order', '123', 'updated', $payload, ['note' => 'raw']);
+
+        $this->assertSame('dbx_append_event_raw', $result['function']);
+        $this->assertSame(strlen($payload), $result['payload_len']);
+        $this->assertSame(['name' => 'Ada', 'tags' => ['a', 'b']], $result['payload']);
+        $this->assertSame(['note' => 'raw'], $result['options']);
+
+        $created = $client->createRaw('order', '124', 'created', '{"n":1}');
+        $this->assertSame('dbx_create_aggregate_raw', $created['function']);
+        $this->assertSame(['n' => 1], $created['payload']);
+    }
+
+    public function testApplyManySendsEventsInOneCall(): void
+    {
+        $client = $this->createClient();
+
+        $result = $client->applyMany([
+            ['aggregateType' => 'order', 'aggregateId' => '1', 'eventType' => 'created'],
+            ['aggregateType' => 'order', 'aggregateId' => '2', 'eventType' => 'created', 'payload' => ['total' => 5]],
+        ], ['token' => 'batch']);
+
+        $this->assertSame('dbx_append_events', $result['function']);
+        $this->assertCount(2, $result['events']);
+        $this->assertSame('2', $result['events'][1]['aggregateId']);
+        $this->assertSame(['total' => 5], $result['events'][1]['payload']);
+        $this->assertSame(['token' => 'batch'], $result['options']);
+    }
+
+    public function testApplyManyPropagatesNativeError(): void
+    {
+        $client = $this->createClient();
+
+        $this->expectException(EventDbxException::class);
+        $this->expectExceptionMessage('native error from stub library');
+
+        $client->applyMany([
+            ['aggregateType' => 'order', 'aggregateId' => 'native-error', 'eventType' => 'created'],
+        ]);
+    }
+
+    public function testPreparedStatementPassesOnlyVaryingArguments(): void
+    {
+        $client = $this->createClient();
+
+        $events = $client->prepare('events', 'order', ['take' => 50]);
+        $page = $events->execute('123', 'c-1');
+        $this->assertSame('dbx_execute', $page['function']);
+        $this->assertSame($events->id(), $page['statement']);
+        $this->assertSame('123', $page['aggregate_id']);
+        $this->assertSame('c-1', $page['cursor']);
+        $this->assertNull($page['payload']);
+
+        $apply = $client->prepare('apply', 'order', ['eventType' => 'updated']);
+        $this->assertNotSame($events->id(), $apply->id());
+        $this->assertSame(['n' => 1], $apply->execute('123', null, ['n' => 1])['payload']);
+    }
+
+    public function testPrepareRejectsUnknownOperation(): void
+    {
+        $client = $this->createClient();
+
+        $this->expectException(EventDbxException::class);
+        $this->expectExceptionMessage("unsupported operation 'delete'");
+
+        $client->prepare('delete', 'order');
+    }
+
+    public function testEnqueueApplyReturnsSequenceUntilFlushed(): void
+    {
+        $client = $this->createClient();
+
+        $this->assertSame(1, $client->enqueueApply('order', '1', 'created', ['payload' => ['n' => 1]]));
+        $this->assertSame(2, $client->enqueueApply('order', '1', 'updated'));
+        $this->assertNull($client->enqueueApply('order', 'dropped', 'created'));
+
+        $flushed = $client->flush(250);
+        $this->assertSame(250, $flushed['timeoutMs']);
+        $this->assertSame(2, $flushed['acknowledged']);
+        $this->assertSame(-1, $client->flush()['timeoutMs']);
+    }
+
+    public function testEnqueueApplyThrowsWhenQueueRejects(): void
+    {
+        $client = $this->createClient();
+
+        $this->expectException(EventDbxException::class);
+        $this->expectExceptionMessage('write queue is full');
+
+        $client->enqueueApply('order', 'queue-full', 'created');
+    }
+
+    public function testSubmitGetResolvesThroughPendingResult(): void
+    {
+        $client = $this->createClient();
+
+        $pending = $client->submitGet('order', '123');
+
+        $this->assertTrue($pending->isReady());
+        $result = $pending->wait();
+        $this->assertSame('dbx_get_aggregate', $result['function']);
+        $this->assertSame('123', $result['aggregate_id']);
+    }
+
+    public function testWaitAnyReturnsFirstCompletedResult(): void
+    {
+        $client = $this->createClient();
+
+        $slow = $client->submitEvents('order', 'pending');
+        $fast = $client->submitApply('order', '7', 'created', ['payload' => ['n' => 1]]);
+
+        $this->assertSame($fast, $client->waitAny([$slow, $fast], 0));
+        $this->assertFalse($slow->isReady());
+        $this->assertSame('dbx_append_event', $fast->wait()['function']);
+    }
+
+    public function testPendingResultTimesOut(): void
+    {
+        $client = $this->createClient();
+
+        $this->expectException(EventDbxException::class);
+        $this->expectExceptionMessage('Timed out waiting for ticket');
+
+        $client->submitSelect('order', 'pending', ['status'])->wait(0);
+    }
+
+    public function testPendingResultTimeoutBoundsEarlyWakeUps(): void
+    {
+        $client = $this->createClient();
+        $pending = $client->submitGet('order', 'pending-wakes');
+
+        $started = hrtime(true);
+        try {
+            $pending->wait(30);
+            $this->fail('wait() returned for a ticket that never settles');
+        } catch (EventDbxException $e) {
+            $this->assertStringContainsString('Timed out waiting for ticket', $e->getMessage());
+        }
+        $this->assertLessThan(1000, (hrtime(true) - $started) / 1e6);
+    }
+
+    public function testSubmittedOperationErrorsSurfaceOnWait(): void
+    {
+        $client = $this->createClient();
+
+        $pending = $client->submitApply('order', 'native-error', 'created');
+
+        $this->assertTrue($pending->isReady());
+        $this->expectException(EventDbxException::class);
+        $this->expectExceptionMessage('native error from stub library');
+
+        $pending->wait();
+    }
+
     public function testCreateSnapshotReturnsDecodedResponse(): void
     {
         $client = $this->createClient();
@@ -174,4 +500,69 @@ final class ClientTest extends TestCase
         $this->assertSame(42, $result['snapshot_id']);
         $this->assertSame(['token' => 'demo'], $result['options']);
     }
+
+    public function testLoadStateReturnsSnapshotAndTail(): void
+    {
+        $client = $this->createClient();
+
+        $result = $client->loadState('order', '7', ['snapshotAfter' => 500]);
+
+        $this->assertSame('dbx_load_state', $result['function']);
+        $this->assertSame('7', $result['aggregate_id']);
+        $this->assertSame(['snapshotAfter' => 500], $result['options']);
+        $this->assertSame(['version' => 40], $result['snapshot']);
+        $this->assertSame([], $result['tailEvents']);
+    }
+
+    public function testSubscriptionDrainsBufferedChanges(): void
+    {
+        $client = $this->createClient();
+
+        $subscription = $client->subscribe(['aggregates' => [['aggregateType' => 'order', 'aggregateId' => '1']]]);
+
+        $this->assertSame(
+            [['aggregateType' => 'order', 'aggregateId' => '1', 'event' => ['version' => 8]]],
+            $subscription->next(10, 0),
+        );
+        $this->assertSame([], $subscription->next());
+        $subscription->close();
+
+        $this->expectException(EventDbxException::class);
+        $this->expectExceptionMessage('subscription is closed');
+        $subscription->next();
+    }
+
+    public function testEventsLazyDecodesOnlyRequestedPaths(): void
+    {
+        $client = $this->createClient();
+
+        $view = $client->eventsLazy('order', '42', ['take' => 500]);
+
+        $this->assertSame(
+            ['function' => 'dbx_list_events', 'aggregate_type' => 'order', 'aggregate_id' => '42', 'options' => ['take' => 500]],
+            $view->get(),
+        );
+        $this->assertSame(['path' => 'items.3.payload.status'], $view->get('items.3.payload.status'));
+        $this->assertSame('fallback', $view->get('missing', 'fallback'));
+        $this->assertFalse($view->has('missing'));
+        $this->assertSame(2, $view->count('items'));
+        $this->assertSame(
+            [0 => ['path' => 'items.0'], 1 => ['path' => 'items.1']],
+            iterator_to_array($view->iterate('items')),
+        );
+
+        $view->close();
+        $this->expectException(EventDbxException::class);
+        $this->expectExceptionMessage('result view is closed');
+        $view->get('items');
+    }
+
+    public function testGetLazyPropagatesNativeError(): void
+    {
+        $client = $this->createClient();
+
+        $this->expectException(EventDbxException::class);
+        $this->expectExceptionMessage('native error from stub library');
+        $client->getLazy('native-error', '1');
+    }
 }
@@ -5,8 +5,32 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define STUB_MAX_TICKETS 64
+
+typedef struct StubTicket {
+    uint64_t id;
+    bool pending;
+    bool wakes;
+    char *result;
+    char *error;
+} StubTicket;
+
+/* Per-operation counters for dbx_metrics_snapshot, kept like the real
+ * library: every call, failed or not, under the v1 export's name. */
+typedef struct StubOp {
+    uint64_t calls;
+    uint64_t errors;
+} StubOp;
+
 typedef struct DbxHandle {
     char *config_json;
+    uint64_t next_ticket;
+    StubTicket tickets[STUB_MAX_TICKETS];
+    uint64_t next_seq;
+    int queued;
+    uint64_t next_statement;
+    StubOp get_aggregate;
+    StubOp list_events;
 } DbxHandle;
 
 static char *duplicate_string(const char *value) {
@@ -64,12 +88,25 @@ static bool should_error(const char *first, const char *second, char **error_out
     return false;
 }
 
+static void count_call(StubOp *op, char **error_out) {
+    op->calls++;
+    if (*error_out != NULL) {
+        op->errors++;
+    }
+}
+
 void dbx_string_free(char *ptr) {
     if (ptr != NULL) {
         free(ptr);
     }
 }
 
+void dbx_bytes_free(char *ptr) {
+    if (ptr != NULL) {
+        free(ptr);
+    }
+}
+
 DbxHandle *dbx_client_new(const char *config_json, char **error_out) {
     if (config_json != NULL && strstr(config_json, "config-error") != NULL) {
         *error_out = duplicate_string("config failure from stub library");
@@ -81,17 +118,27 @@ DbxHandle *dbx_client_new(const char *config_json, char **error_out) {
     if (handle == NULL) {
         return NULL;
     }
+    memset(handle, 0, sizeof(DbxHandle));
     handle->config_json = duplicate_string(config_json == NULL ? "" : config_json);
+    handle->next_ticket = 1;
     return handle;
 }
 
 void dbx_client_free(DbxHandle *handle) {
     if (handle != NULL) {
+        for (int i = 0; i < STUB_MAX_TICKETS; i++) {
+            free(handle->tickets[i].result);
+            free(handle->tickets[i].error);
+        }
         free(handle->config_json);
         free(handle);
     }
 }
 
+void dbx_client_evict(DbxHandle *handle) {
+    (void)handle;
+}
+
 char *dbx_list_aggregates(DbxHandle *handle, const char *aggregate_type, const char *options_json, char **error_out) {
     if (should_error(aggregate_type, NULL, error_out)) {
         return NULL;
@@ -110,7 +157,7 @@ char *dbx_list_aggregates(DbxHandle *handle, const char *aggregate_type, const c
     return build_json("{\"function\":\"dbx_list_aggregates\",\"aggregate_type\":\"%s\",\"options\":%s}", aggregate_type, options);
 }
 
-char *dbx_get_aggregate(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, char **error_out) {
+static char *get_aggregate(const char *aggregate_type, const char *aggregate_id, char **error_out) {
     if (should_error(aggregate_type, aggregate_id, error_out)) {
         return NULL;
     }
@@ -127,6 +174,23 @@ char *dbx_get_aggregate(DbxHandle *handle, const char *aggregate_type, const cha
     return build_json("{\"function\":\"dbx_get_aggregate\",\"aggregate_type\":\"%s\",\"aggregate_id\":\"%s\"}", aggregate_type, aggregate_id);
 }
 
+char *dbx_get_aggregate(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, char **error_out) {
+    *error_out = NULL;
+    char *result = get_aggregate(aggregate_type, aggregate_id, error_out);
+    count_call(&handle->get_aggregate, error_out);
+    return result;
+}
+
+char *dbx_get_aggregates(DbxHandle *handle, const char *aggregate_type, const char *ids_json, char **error_out) {
+    if (should_error(aggregate_type, NULL, error_out)) {
+        return NULL;
+    }
+
+    *error_out = NULL;
+    const char *ids = ids_json != NULL ? ids_json : "null";
+    return build_json("{\"function\":\"dbx_get_aggregates\",\"aggregate_type\":\"%s\",\"ids\":%s}", aggregate_type, ids);
+}
+
 char *dbx_select_aggregate(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *fields_json, char **error_out) {
     if (should_error(aggregate_type, aggregate_id, error_out)) {
         return NULL;
@@ -145,7 +209,18 @@ char *dbx_select_aggregate(DbxHandle *handle, const char *aggregate_type, const
     return build_json("{\"function\":\"dbx_select_aggregate\",\"aggregate_type\":\"%s\",\"aggregate_id\":\"%s\",\"fields\":%s}", aggregate_type, aggregate_id, fields);
 }
 
-char *dbx_list_events(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *options_json, char **error_out) {
+char *dbx_select_aggregates(DbxHandle *handle, const char *aggregate_type, const char *ids_json, const char *fields_json, char **error_out) {
+    if (should_error(aggregate_type, NULL, error_out)) {
+        return NULL;
+    }
+
+    *error_out = NULL;
+    const char *ids = ids_json != NULL ? ids_json : "null";
+    const char *fields = fields_json != NULL ? fields_json : "null";
+    return build_json("{\"function\":\"dbx_select_aggregates\",\"aggregate_type\":\"%s\",\"ids\":%s,\"fields\":%s}", aggregate_type, ids, fields);
+}
+
+static char *list_events(const char *aggregate_type, const char *aggregate_id, const char *options_json, char **error_out) {
     if (should_error(aggregate_type, aggregate_id, error_out)) {
         return NULL;
     }
@@ -163,6 +238,13 @@ char *dbx_list_events(DbxHandle *handle, const char *aggregate_type, const char
     return build_json("{\"function\":\"dbx_list_events\",\"aggregate_type\":\"%s\",\"aggregate_id\":\"%s\",\"options\":%s}", aggregate_type, aggregate_id, options);
 }
 
+char *dbx_list_events(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *options_json, char **error_out) {
+    *error_out = NULL;
+    char *result = list_events(aggregate_type, aggregate_id, options_json, error_out);
+    count_call(&handle->list_events, error_out);
+    return result;
+}
+
 char *dbx_append_event(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *event_type, const char *options_json, char **error_out) {
     if (should_error(aggregate_type, aggregate_id, error_out)) {
         return NULL;
@@ -181,6 +263,40 @@ char *dbx_append_event(DbxHandle *handle, const char *aggregate_type, const char
     return build_json("{\"function\":\"dbx_append_event\",\"aggregate_type\":\"%s\",\"aggregate_id\":\"%s\",\"event_type\":\"%s\",\"options\":%s}", aggregate_type, aggregate_id, event_type, options);
 }
 
+/* Echoes exactly payload_len bytes, so callers passing the length (rather
+ * than relying on a NUL terminator) are visible in the response. */
+static char *raw_write(const char *function, const char *aggregate_type, const char *aggregate_id, const char *event_type, const char *payload, size_t payload_len, const char *options_json, char **error_out) {
+    if (should_error(aggregate_type, aggregate_id, error_out)) {
+        return NULL;
+    }
+    *error_out = NULL;
+    const char *options = options_json != NULL ? options_json : "null";
+    return build_json("{\"function\":\"%s\",\"aggregate_type\":\"%s\",\"aggregate_id\":\"%s\",\"event_type\":\"%s\",\"payload_len\":%zu,\"payload\":%.*s,\"options\":%s}",
+        function, aggregate_type, aggregate_id, event_type, payload_len, (int)payload_len, payload, options);
+}
+
+char *dbx_append_event_raw(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *event_type, const char *payload, size_t payload_len, const char *options_json, char **error_out) {
+    (void)handle;
+    return raw_write("dbx_append_event_raw", aggregate_type, aggregate_id, event_type, payload, payload_len, options_json, error_out);
+}
+
+char *dbx_create_aggregate_raw(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *event_type, const char *payload, size_t payload_len, const char *options_json, char **error_out) {
+    (void)handle;
+    return raw_write("dbx_create_aggregate_raw", aggregate_type, aggregate_id, event_type, payload, payload_len, options_json, error_out);
+}
+
+char *dbx_append_events(DbxHandle *handle, const char *events_json, const char *options_json, char **error_out) {
+    if (events_json != NULL && strstr(events_json, "native-error") != NULL) {
+        *error_out = duplicate_string("native error from stub library");
+        return NULL;
+    }
+
+    *error_out = NULL;
+    const char *events = events_json != NULL ? events_json : "null";
+    const char *options = options_json != NULL ? options_json : "null";
+    return build_json("{\"function\":\"dbx_append_events\",\"events\":%s,\"options\":%s}", events, options);
+}
+
 char *dbx_create_aggregate(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *event_type, const char *options_json, char **error_out) {
     if (should_error(aggregate_type, aggregate_id, error_out)) {
         return NULL;
@@ -254,6 +370,21 @@ char *dbx_verify_aggregate(DbxHandle *handle, const char *aggregate_type, const
     return build_json("{\"function\":\"dbx_verify_aggregate\",\"aggregate_type\":\"%s\",\"aggregate_id\":\"%s\"}", aggregate_type, aggregate_id);
 }
 
+char *dbx_verify_aggregates(DbxHandle *handle, const char *aggregate_type, const char *ids_json, const char *options_json, const char *path, int fd, char **error_out) {
+    (void)handle;
+    if (should_error(aggregate_type, path, error_out)) {
+        return NULL;
+    }
+
+    *error_out = NULL;
+    const char *ids = ids_json != NULL ? ids_json : "null";
+    const char *options = options_json != NULL ? options_json : "null";
+    if (path == NULL) {
+        return build_json("{\"function\":\"dbx_verify_aggregates\",\"aggregateType\":\"%s\",\"ids\":%s,\"fd\":%d,\"options\":%s}", aggregate_type, ids, fd, options);
+    }
+    return build_json("{\"function\":\"dbx_verify_aggregates\",\"aggregateType\":\"%s\",\"ids\":%s,\"path\":\"%s\",\"options\":%s}", aggregate_type, ids, path, options);
+}
+
 char *dbx_create_snapshot(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *options_json, char **error_out) {
     if (should_error(aggregate_type, aggregate_id, error_out)) {
         return NULL;
@@ -308,3 +439,489 @@ char *dbx_get_snapshot(DbxHandle *handle, uint64_t snapshot_id, const char *opti
     const char *options = options_json != NULL ? options_json : "null";
     return build_json("{\"function\":\"dbx_get_snapshot\",\"snapshot_id\":%llu,\"options\":%s}", (unsigned long long)snapshot_id, options);
 }
+
+char *dbx_load_state(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *options_json, char **error_out) {
+    (void)handle;
+    if (should_error(aggregate_type, aggregate_id, error_out)) {
+        return NULL;
+    }
+
+    *error_out = NULL;
+    const char *options = options_json != NULL ? options_json : "null";
+    return build_json("{\"function\":\"dbx_load_state\",\"aggregate_type\":\"%s\",\"aggregate_id\":\"%s\",\"options\":%s,\"snapshot\":{\"version\":40},\"tailEvents\":[]}", aggregate_type, aggregate_id, options);
+}
+
+static StubTicket *find_ticket(DbxHandle *handle, uint64_t ticket) {
+    for (int i = 0; i < STUB_MAX_TICKETS; i++) {
+        if (handle->tickets[i].id == ticket && ticket != 0) {
+            return &handle->tickets[i];
+        }
+    }
+    return NULL;
+}
+
+static void release_ticket(StubTicket *slot) {
+    free(slot->result);
+    free(slot->error);
+    memset(slot, 0, sizeof(StubTicket));
+}
+
+/* Runs the blocking stub synchronously and parks its outcome under a ticket.
+ * An identifier of "pending" keeps the ticket in flight forever; one that
+ * also contains "wakes" makes dbx_wait_any report it without settling it. */
+static uint64_t submit_result(DbxHandle *handle, const char *marker, char *result, char *error) {
+    StubTicket *slot = NULL;
+    for (int i = 0; slot == NULL && i < STUB_MAX_TICKETS; i++) {
+        if (handle->tickets[i].id == 0) {
+            slot = &handle->tickets[i];
+        }
+    }
+    if (slot == NULL) {
+        free(result);
+        free(error);
+        return 0;
+    }
+    slot->id = handle->next_ticket++;
+    slot->pending = has_marker(marker, "pending");
+    slot->wakes = has_marker(marker, "wakes");
+    slot->result = result;
+    slot->error = error;
+    return slot->id;
+}
+
+uint64_t dbx_submit_get_aggregate(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, char **error_out) {
+    char *error = NULL;
+    char *result = dbx_get_aggregate(handle, aggregate_type, aggregate_id, &error);
+    *error_out = NULL;
+    return submit_result(handle, aggregate_id, result, error);
+}
+
+uint64_t dbx_submit_select_aggregate(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *fields_json, char **error_out) {
+    char *error = NULL;
+    char *result = dbx_select_aggregate(handle, aggregate_type, aggregate_id, fields_json, &error);
+    *error_out = NULL;
+    return submit_result(handle, aggregate_id, result, error);
+}
+
+uint64_t dbx_submit_list_events(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *options_json, char **error_out) {
+    char *error = NULL;
+    char *result = dbx_list_events(handle, aggregate_type, aggregate_id, options_json, &error);
+    *error_out = NULL;
+    return submit_result(handle, aggregate_id, result, error);
+}
+
+uint64_t dbx_submit_append_event(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *event_type, const char *options_json, char **error_out) {
+    char *error = NULL;
+    char *result = dbx_append_event(handle, aggregate_type, aggregate_id, event_type, options_json, &error);
+    *error_out = NULL;
+    return submit_result(handle, aggregate_id, result, error);
+}
+
+char *dbx_poll(DbxHandle *handle, uint64_t ticket, char **error_out) {
+    *error_out = NULL;
+    StubTicket *slot = find_ticket(handle, ticket);
+    if (slot == NULL) {
+        *error_out = build_json("unknown ticket %llu", (unsigned long long)ticket);
+        return NULL;
+    }
+    if (slot->pending) {
+        return NULL;
+    }
+
+    char *result = slot->result;
+    *error_out = slot->error;
+    slot->result = NULL;
+    slot->error = NULL;
+    release_ticket(slot);
+    return result;
+}
+
+uint64_t dbx_wait_any(DbxHandle *handle, const uint64_t *tickets, size_t count, int64_t timeout_ms) {
+    (void)timeout_ms;
+    for (size_t i = 0; i < count; i++) {
+        StubTicket *slot = find_ticket(handle, tickets[i]);
+        if (slot == NULL || !slot->pending || slot->wakes) {
+            return tickets[i];
+        }
+    }
+    return 0;
+}
+
+void dbx_cancel(DbxHandle *handle, uint64_t ticket) {
+    StubTicket *slot = find_ticket(handle, ticket);
+    if (slot != NULL) {
+        release_ticket(slot);
+    }
+}
+
+int dbx_notify_fd(DbxHandle *handle) {
+    (void)handle;
+    return -1;
+}
+
+void dbx_notify_drain(DbxHandle *handle) {
+    (void)handle;
+}
+
+#define STUB_CURSOR_PAGES 3
+
+typedef struct DbxCursor {
+    char *aggregate_type;
+    char *aggregate_id;
+    int page;
+} DbxCursor;
+
+DbxCursor *dbx_cursor_open(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *options_json, char **error_out) {
+    (void)handle;
+    (void)options_json;
+    if (should_error(aggregate_type, aggregate_id, error_out)) {
+        return NULL;
+    }
+    *error_out = NULL;
+
+    DbxCursor *cursor = (DbxCursor *)calloc(1, sizeof(DbxCursor));
+    if (cursor == NULL) {
+        return NULL;
+    }
+    cursor->aggregate_type = duplicate_string(aggregate_type);
+    cursor->aggregate_id = duplicate_string(aggregate_id);
+    return cursor;
+}
+
+char *dbx_cursor_next(DbxHandle *handle, DbxCursor *cursor, char **error_out) {
+    (void)handle;
+    *error_out = NULL;
+    if (cursor->page >= STUB_CURSOR_PAGES) {
+        return NULL;
+    }
+
+    int page = cursor->page++;
+    const char *kind = cursor->aggregate_id == NULL ? "aggregates" : "events";
+    if (page + 1 < STUB_CURSOR_PAGES) {
+        return build_json(
+            "{\"items\":[{\"kind\":\"%s\",\"page\":%d,\"index\":0},{\"kind\":\"%s\",\"page\":%d,\"index\":1}],\"nextCursor\":\"%d\"}",
+            kind, page, kind, page, page + 1);
+    }
+    return build_json(
+        "{\"items\":[{\"kind\":\"%s\",\"page\":%d,\"index\":0},{\"kind\":\"%s\",\"page\":%d,\"index\":1}],\"nextCursor\":null}",
+        kind, page, kind, page);
+}
+
+void dbx_cursor_close(DbxCursor *cursor) {
+    if (cursor == NULL) {
+        return;
+    }
+    free(cursor->aggregate_type);
+    free(cursor->aggregate_id);
+    free(cursor);
+}
+
+/* Delivers one change on the first batch, then nothing. */
+typedef struct DbxSubscription {
+    int delivered;
+} DbxSubscription;
+
+DbxSubscription *dbx_subscribe(DbxHandle *handle, const char *filter_json, char **error_out) {
+    (void)handle;
+    if (should_error(filter_json, NULL, error_out)) {
+        return NULL;
+    }
+    *error_out = NULL;
+    return (DbxSubscription *)calloc(1, sizeof(DbxSubscription));
+}
+
+char *dbx_subscription_next_batch(DbxHandle *handle, DbxSubscription *subscription, size_t max, int64_t timeout_ms, char **error_out) {
+    (void)handle;
+    *error_out = NULL;
+    const char *items = subscription->delivered
+        ? "[]"
+        : "[{\"aggregateType\":\"order\",\"aggregateId\":\"1\",\"event\":{\"version\":8}}]";
+    subscription->delivered = 1;
+    return build_json("{\"function\":\"dbx_subscription_next_batch\",\"max\":%zu,\"timeoutMs\":%lld,\"items\":%s}", max, (long long)timeout_ms, items);
+}
+
+int dbx_subscription_fd(DbxSubscription *subscription) {
+    (void)subscription;
+    return -1;
+}
+
+void dbx_subscription_close(DbxSubscription *subscription) {
+    free(subscription);
+}
+
+char *dbx_export_events(DbxHandle *handle, const char *aggregate_type, const char *options_json, const char *path, int fd, char **error_out) {
+    (void)handle;
+    if (should_error(aggregate_type, path, error_out)) {
+        return NULL;
+    }
+
+    *error_out = NULL;
+    const char *options = options_json != NULL ? options_json : "null";
+    if (path == NULL) {
+        return build_json("{\"function\":\"dbx_export_events\",\"aggregateType\":\"%s\",\"fd\":%d,\"options\":%s}", aggregate_type, fd, options);
+    }
+    return build_json("{\"function\":\"dbx_export_events\",\"aggregateType\":\"%s\",\"path\":\"%s\",\"options\":%s}", aggregate_type, path, options);
+}
+
+void dbx_cache_clear(DbxHandle *handle) {
+    (void)handle;
+}
+
+char *dbx_metrics_snapshot(DbxHandle *handle, char **error_out) {
+    *error_out = NULL;
+    return build_json(
+        "{\"ops\":{\"dbx_get_aggregate\":{\"calls\":%llu,\"errors\":%llu},\"dbx_list_events\":{\"calls\":%llu,\"errors\":%llu}},\"queueWait\":{\"count\":0},\"server\":{\"count\":0}}",
+        (unsigned long long)handle->get_aggregate.calls, (unsigned long long)handle->get_aggregate.errors,
+        (unsigned long long)handle->list_events.calls, (unsigned long long)handle->list_events.errors);
+}
+
+char *dbx_metrics_prometheus(DbxHandle *handle) {
+    return build_json(
+        "# TYPE eventdbx_calls_total counter\neventdbx_calls_total{op=\"dbx_get_aggregate\"} %llu\neventdbx_calls_total{op=\"dbx_list_events\"} %llu\n",
+        (unsigned long long)handle->get_aggregate.calls, (unsigned long long)handle->list_events.calls);
+}
+
+/* Accepts every append except the "queue-full" (fail policy) and "dropped"
+ * (drop policy) markers; dbx_flush acknowledges whatever was queued. */
+uint64_t dbx_enqueue_append(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *event_type, const char *options_json, char **error_out) {
+    (void)event_type;
+    (void)options_json;
+    if (should_error(aggregate_type, aggregate_id, error_out)) {
+        return 0;
+    }
+    if (has_marker(aggregate_id, "queue-full")) {
+        *error_out = duplicate_string("write queue is full (1 entries)");
+        return 0;
+    }
+    *error_out = NULL;
+    if (has_marker(aggregate_id, "dropped")) {
+        return 0;
+    }
+    handle->queued++;
+    return ++handle->next_seq;
+}
+
+char *dbx_flush(DbxHandle *handle, int64_t timeout_ms, char **error_out) {
+    *error_out = NULL;
+    int acknowledged = handle->queued;
+    handle->queued = 0;
+    return build_json("{\"function\":\"dbx_flush\",\"timeoutMs\":%lld,\"acknowledged\":%d,\"items\":[],\"failed\":0,\"pending\":0}",
+        (long long)timeout_ms, acknowledged);
+}
+
+uint64_t dbx_prepare(DbxHandle *handle, const char *operation, const char *aggregate_type, const char *options_json, char **error_out) {
+    (void)options_json;
+    if (should_error(operation, aggregate_type, error_out)) {
+        return 0;
+    }
+    if (strcmp(operation, "list") != 0 && strcmp(operation, "events") != 0 && strcmp(operation, "apply") != 0) {
+        *error_out = build_json("unsupported operation '%s' (expected list, events or apply)", operation);
+        return 0;
+    }
+    *error_out = NULL;
+    return ++handle->next_statement;
+}
+
+char *dbx_execute(DbxHandle *handle, uint64_t statement, const char *aggregate_id, const char *cursor, const char *payload_json, char **error_out) {
+    if (statement == 0 || statement > handle->next_statement) {
+        *error_out = build_json("unknown statement %llu", (unsigned long long)statement);
+        return NULL;
+    }
+    *error_out = NULL;
+    return build_json(
+        "{\"function\":\"dbx_execute\",\"statement\":%llu,\"aggregate_id\":\"%s\",\"cursor\":\"%s\",\"payload\":%s}",
+        (unsigned long long)statement,
+        aggregate_id != NULL ? aggregate_id : "",
+        cursor != NULL ? cursor : "",
+        payload_json != NULL ? payload_json : "null");
+}
+
+void dbx_statement_free(DbxHandle *handle, uint64_t statement) {
+    (void)handle;
+    (void)statement;
+}
+
+/* v2 ABI: sized inputs and sized DbxBuf replies. The wrappers copy each
+ * argument into a NUL-terminated string and reuse the v1 stubs above. */
+typedef struct DbxBuf {
+    char *ptr;
+    size_t len;
+    size_t cap;
+} DbxBuf;
+
+static char *terminated(const char *ptr, size_t len) {
+    char *copy = (char *)malloc(len + 1);
+    if (copy != NULL) {
+        if (len > 0) {
+            memcpy(copy, ptr, len);
+        }
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+static DbxBuf to_buf(char *result) {
+    DbxBuf buf = {result, 0, 0};
+    if (result != NULL) {
+        buf.len = strlen(result);
+        buf.cap = buf.len + 1;
+    }
+    return buf;
+}
+
+void dbx_buf_free(DbxBuf buf) {
+    free(buf.ptr);
+}
+
+void dbx_buf_release(DbxHandle *handle, DbxBuf buf) {
+    (void)handle;
+    free(buf.ptr);
+}
+
+DbxBuf dbx_list_aggregates_v2(DbxHandle *handle, const char *aggregate_type, size_t aggregate_type_len, const char *options_json, size_t options_json_len, char **error_out) {
+    char *type = terminated(aggregate_type, aggregate_type_len);
+    char *options = terminated(options_json, options_json_len);
+    DbxBuf buf = to_buf(dbx_list_aggregates(handle, type, options, error_out));
+    free(type);
+    free(options);
+    return buf;
+}
+
+DbxBuf dbx_get_aggregate_v2(DbxHandle *handle, const char *aggregate_type, size_t aggregate_type_len, const char *aggregate_id, size_t aggregate_id_len, char **error_out) {
+    if (memchr(aggregate_id, '\0', aggregate_id_len) != NULL) {
+        *error_out = NULL;
+        return to_buf(build_json("{\"function\":\"dbx_get_aggregate\",\"aggregate_id_len\":%zu}", aggregate_id_len));
+    }
+    char *type = terminated(aggregate_type, aggregate_type_len);
+    char *id = terminated(aggregate_id, aggregate_id_len);
+    DbxBuf buf = to_buf(dbx_get_aggregate(handle, type, id, error_out));
+    free(type);
+    free(id);
+    return buf;
+}
+
+DbxBuf dbx_select_aggregate_v2(DbxHandle *handle, const char *aggregate_type, size_t aggregate_type_len, const char *aggregate_id, size_t aggregate_id_len, const char *fields_json, size_t fields_json_len, char **error_out) {
+    char *type = terminated(aggregate_type, aggregate_type_len);
+    char *id = terminated(aggregate_id, aggregate_id_len);
+    char *fields = terminated(fields_json, fields_json_len);
+    DbxBuf buf = to_buf(dbx_select_aggregate(handle, type, id, fields, error_out));
+    free(type);
+    free(id);
+    free(fields);
+    return buf;
+}
+
+DbxBuf dbx_list_events_v2(DbxHandle *handle, const char *aggregate_type, size_t aggregate_type_len, const char *aggregate_id, size_t aggregate_id_len, const char *options_json, size_t options_json_len, char **error_out) {
+    char *type = terminated(aggregate_type, aggregate_type_len);
+    char *id = terminated(aggregate_id, aggregate_id_len);
+    char *options = terminated(options_json, options_json_len);
+    DbxBuf buf = to_buf(dbx_list_events(handle, type, id, options, error_out));
+    free(type);
+    free(id);
+    free(options);
+    return buf;
+}
+
+DbxBuf dbx_append_event_v2(DbxHandle *handle, const char *aggregate_type, size_t aggregate_type_len, const char *aggregate_id, size_t aggregate_id_len, const char *event_type, size_t event_type_len, const char *options_json, size_t options_json_len, char **error_out) {
+    char *type = terminated(aggregate_type, aggregate_type_len);
+    char *id = terminated(aggregate_id, aggregate_id_len);
+    char *event = terminated(event_type, event_type_len);
+    char *options = terminated(options_json, options_json_len);
+    DbxBuf buf = to_buf(dbx_append_event(handle, type, id, event, options, error_out));
+    free(type);
+    free(id);
+    free(event);
+    free(options);
+    return buf;
+}
+
+DbxBuf dbx_cursor_next_v2(DbxHandle *handle, DbxCursor *cursor, char **error_out) {
+    return to_buf(dbx_cursor_next(handle, cursor, error_out));
+}
+
+/* Views keep the v1 reply; the whole reply is returned for the empty path,
+ * {"path": ...} for any other path except "missing", and every container
+ * has two entries. */
+typedef struct DbxView {
+    char *reply;
+} DbxView;
+
+static DbxView *to_view(char *reply) {
+    if (reply == NULL) {
+        return NULL;
+    }
+    DbxView *view = (DbxView *)calloc(1, sizeof(DbxView));
+    view->reply = reply;
+    return view;
+}
+
+DbxView *dbx_get_aggregate_view(DbxHandle *handle, const char *aggregate_type, size_t aggregate_type_len, const char *aggregate_id, size_t aggregate_id_len, char **error_out) {
+    char *type = terminated(aggregate_type, aggregate_type_len);
+    char *id = terminated(aggregate_id, aggregate_id_len);
+    DbxView *view = to_view(dbx_get_aggregate(handle, type, id, error_out));
+    free(type);
+    free(id);
+    return view;
+}
+
+DbxView *dbx_list_events_view(DbxHandle *handle, const char *aggregate_type, size_t aggregate_type_len, const char *aggregate_id, size_t aggregate_id_len, const char *options_json, size_t options_json_len, char **error_out) {
+    char *type = terminated(aggregate_type, aggregate_type_len);
+    char *id = terminated(aggregate_id, aggregate_id_len);
+    char *options = terminated(options_json, options_json_len);
+    DbxView *view = to_view(dbx_list_events(handle, type, id, options, error_out));
+    free(type);
+    free(id);
+    free(options);
+    return view;
+}
+
+DbxBuf dbx_view_get(DbxHandle *handle, DbxView *view, const char *path, size_t path_len, char **error_out) {
+    (void)handle;
+    *error_out = NULL;
+    char *key = terminated(path, path_len);
+    DbxBuf buf = {NULL, 0, 0};
+    if (path_len == 0) {
+        buf = to_buf(duplicate_string(view->reply));
+    } else if (!has_marker(key, "missing")) {
+        buf = to_buf(build_json("{\"path\":\"%s\"}", key));
+    }
+    free(key);
+    return buf;
+}
+
+DbxBuf dbx_view_keys(DbxHandle *handle, DbxView *view, const char *path, size_t path_len, char **error_out) {
+    (void)handle;
+    (void)view;
+    (void)path;
+    (void)path_len;
+    *error_out = NULL;
+    return to_buf(duplicate_string("[0,1]"));
+}
+
+int64_t dbx_view_len(DbxView *view, const char *path, size_t path_len) {
+    (void)view;
+    char *key = terminated(path, path_len);
+    int64_t len = has_marker(key, "missing") ? -2 : 2;
+    free(key);
+    return len;
+}
+
+void dbx_view_free(DbxView *view) {
+    if (view != NULL) {
+        free(view->reply);
+        free(view);
+    }
+}
+
+char *dbx_reduce_events(DbxHandle *handle, const char *aggregate_type, const char *aggregate_id, const char *spec_json, char **error_out) {
+    (void)handle;
+    if (should_error(aggregate_type, aggregate_id, error_out)) {
+        return NULL;
+    }
+    *error_out = NULL;
+    const char *spec = spec_json != NULL ? spec_json : "null";
+    if (aggregate_id == NULL) {
+        return build_json("{\"function\":\"dbx_reduce_events\",\"aggregateType\":\"%s\",\"spec\":%s,\"values\":{\"count\":0}}", aggregate_type, spec);
+    }
+    return build_json("{\"function\":\"dbx_reduce_events\",\"aggregateType\":\"%s\",\"aggregateId\":\"%s\",\"spec\":%s,\"values\":{\"count\":0}}", aggregate_type, aggregate_id, spec);
+}